@@ -0,0 +1,70 @@
+#!/bin/bash
+# Gallery-open latency with and without a generation running.
+# Opening the gallery = one history page plus the full-size images on it. Run it against
+# two builds (e.g. with /outputs proxied to the SD worker and served by the orchestrator)
+# with a model loaded and some images in the library, and compare the p50/p95 columns.
+#
+#   scripts/tests/bench_gallery_latency.sh [base_url] [rounds] [images_per_page]
+
+BASE_URL="${1:-http://127.0.0.1:1234}"
+ROUNDS="${2:-20}"
+PAGE="${3:-24}"
+
+PAGE_JSON=$(curl -s "$BASE_URL/v1/history/images?limit=$PAGE")
+if [ -z "$PAGE_JSON" ]; then
+    echo "[ERROR] No response from $BASE_URL. Is the server running?"
+    exit 1
+fi
+mapfile -t URLS < <(echo "$PAGE_JSON" | grep -o '"file_path":"/outputs/[^"]*"' | cut -d'"' -f4)
+if [ "${#URLS[@]}" -eq 0 ]; then
+    echo "[ERROR] The library has no images to fetch."
+    exit 1
+fi
+echo "Fetching 1 history page + ${#URLS[@]} images per round, $ROUNDS rounds per phase"
+
+# Prints the wall time in ms of one gallery open. curl sends no validators, so every round
+# transfers the files as a first visit would.
+open_gallery() {
+    local start end
+    start=$(date +%s%N)
+    curl -s -o /dev/null "$BASE_URL/v1/history/images?limit=$PAGE"
+    for url in "${URLS[@]}"; do
+        curl -s -o /dev/null "$BASE_URL$url"
+    done
+    end=$(date +%s%N)
+    echo $(( (end - start) / 1000000 ))
+}
+
+# p50 and p95 of the numbers on stdin
+percentiles() {
+    sort -n | awk '{ v[NR] = $1 } END {
+        if (NR == 0) exit
+        i50 = int(NR * 0.50 + 0.5); if (i50 < 1) i50 = 1
+        i95 = int(NR * 0.95 + 0.5); if (i95 > NR) i95 = NR
+        printf "p50 %d ms, p95 %d ms, n=%d\n", v[i50], v[i95], NR
+    }'
+}
+
+run_phase() {
+    for _ in $(seq 1 "$ROUNDS"); do open_gallery; done | percentiles
+}
+
+echo -n "idle:                 "
+run_phase
+
+# A long enough generation to cover the whole phase
+curl -s -o /dev/null -X POST "$BASE_URL/v1/images/generations" \
+    -H "Content-Type: application/json" \
+    -d '{"prompt": "gallery latency benchmark", "width": 1024, "height": 1024, "sample_steps": 40, "n": 4, "save_image": false}' &
+GEN_PID=$!
+sleep 3
+
+echo -n "during generation:    "
+run_phase
+
+if kill -0 "$GEN_PID" 2>/dev/null; then
+    echo "(generation still running at the end of the phase)"
+else
+    echo "[WARN] The generation finished before the phase did; raise sample_steps or n for a fair number."
+fi
+wait "$GEN_PID"
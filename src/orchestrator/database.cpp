@@ -1,11 +1,26 @@
 #include "database.hpp"
 #include <iostream>
 #include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+#include <unordered_map>
+#include <chrono>
+#include <thread>
 
 namespace diffusion_desk {
 
-// Internal helper to parse a generation row from a query (assumes all columns are selected)
-static diffusion_desk::json parse_generation_row(SQLite::Statement& q, SQLite::Database& db) {
+// Columns selected by every gallery listing. Tags are aggregated per row through the
+// image_tags primary key, so a page is one statement instead of one tag query per row.
+static const char* GENERATION_LIST_COLUMNS =
+    "g.*, (SELECT json_group_array(t.name) FROM image_tags it JOIN tags t ON t.id = it.tag_id "
+    "WHERE it.generation_id = g.id) AS tags_json";
+
+// Internal helper to parse a generation row selected with GENERATION_LIST_COLUMNS
+static diffusion_desk::json parse_generation_row(SQLite::Statement& q) {
     diffusion_desk::json gen;
     std::string file_path = q.getColumn("file_path").getText();
     std::string name = file_path;
@@ -38,28 +53,43 @@ static diffusion_desk::json parse_generation_row(SQLite::Statement& q, SQLite::D
     try { gen["rating"] = q.getColumn("rating").getInt(); } catch (...) { gen["rating"] = 0; }
 
     diffusion_desk::json tags_arr = diffusion_desk::json::array();
-    SQLite::Statement tag_query(db, "SELECT t.name FROM tags t JOIN image_tags it ON t.id = it.tag_id WHERE it.generation_id = ?");
-    tag_query.bind(1, q.getColumn("id").getInt());
-    while (tag_query.executeStep()) {
-        tags_arr.push_back(tag_query.getColumn(0).getText());
-    }
-    gen["tags"] = tags_arr;
-
-    // Fetch thumbnail
-    std::string thumb_path;
     try {
-        SQLite::Statement thumb_q(db, "SELECT file_path FROM generation_files WHERE generation_id = ? AND file_type = 'thumbnail' LIMIT 1");
-        thumb_q.bind(1, q.getColumn("id").getInt());
-        if (thumb_q.executeStep()) {
-            thumb_path = thumb_q.getColumn(0).getText();
-        }
+        auto parsed = diffusion_desk::json::parse(q.getColumn("tags_json").getText("[]"));
+        if (parsed.is_array()) tags_arr = std::move(parsed);
     } catch (...) {}
-    gen["thumbnail_path"] = thumb_path;
+    gen["tags"] = tags_arr;
+    gen["thumbnail_path"] = "";
 
     return gen;
 }
 
-Database::Database(const std::string& db_path) 
+// Fills thumbnail_path for a whole page with one lookup keyed by the page's ids
+void Database::attach_thumbnails(ReaderLease& reader, diffusion_desk::json& items) {
+    if (items.empty()) return;
+    try {
+        std::string sql = "SELECT generation_id, file_path FROM generation_files WHERE file_type = 'thumbnail' AND generation_id IN (";
+        for (size_t i = 0; i < items.size(); ++i) sql += (i == 0 ? "?" : ", ?");
+        sql += ") ORDER BY id ASC";
+
+        auto q_lease = reader.statement(sql, __func__);
+        SQLite::Statement& q = *q_lease;
+        int bind_idx = 1;
+        for (const auto& item : items) q.bind(bind_idx++, item["__internal_id"].get<int>());
+
+        std::unordered_map<int, std::string> thumbs;
+        while (q.executeStep()) {
+            thumbs.emplace(q.getColumn(0).getInt(), q.getColumn(1).getText());
+        }
+        for (auto& item : items) {
+            auto it = thumbs.find(item["__internal_id"].get<int>());
+            if (it != thumbs.end()) item["thumbnail_path"] = it->second;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[Database] attach_thumbnails failed: " << e.what() << std::endl;
+    }
+}
+
+Database::Database(const std::string& db_path, int reader_count) 
     : m_db(db_path, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE) 
 {
     try {
@@ -69,9 +99,311 @@ Database::Database(const std::string& db_path)
     } catch (const std::exception& e) {
         std::cerr << "[Database] Error setting pragmas: " << e.what() << std::endl;
     }
+
+    m_write_thread = std::thread(&Database::write_loop, this);
+
+    // Readers need a shared on-disk WAL; in-memory databases stay on the writer
+    if (reader_count < 0 || db_path.empty() || db_path == ":memory:") return;
+    if (reader_count <= 0) {
+        reader_count = std::max(2, std::min(8, (int)std::thread::hardware_concurrency()));
+    }
+    try {
+        for (int i = 0; i < reader_count; ++i) {
+            m_readers.push_back(std::make_unique<ReadConnection>(db_path));
+            m_idle_readers.push_back(m_readers.back().get());
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[Database] Could not open read connections, queries share the writer: " << e.what() << std::endl;
+        m_idle_readers.clear();
+        m_readers.clear();
+    }
 }
 
-Database::~Database() {}
+Database::~Database() {
+    {
+        std::lock_guard<std::mutex> lock(m_write_mutex);
+        m_write_stop = true;
+    }
+    m_write_cv.notify_all();
+    if (m_write_thread.joinable()) m_write_thread.join();
+}
+
+void Database::set_write_batching(std::chrono::microseconds window, size_t max_batch) {
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    m_write_window = window;
+    m_write_max_batch = std::max<size_t>(1, max_batch);
+}
+
+std::future<int64_t> Database::submit_write(const char* name, std::function<int64_t()> op) {
+    PendingWrite write;
+    write.name = name;
+    write.op = std::move(op);
+    std::future<int64_t> result = write.done.get_future();
+    {
+        std::unique_lock<std::mutex> lock(m_write_mutex);
+        // Backpressure: fire-and-forget callers must not outrun the writer indefinitely
+        m_write_done_cv.wait(lock, [this] { return m_write_queue.size() < MAX_PENDING_WRITES || m_write_stop; });
+        write.seq = ++m_write_submitted;
+        m_write_queue.push_back(std::move(write));
+    }
+    m_write_cv.notify_one();
+    return result;
+}
+
+void Database::flush_writes() {
+    std::unique_lock<std::mutex> lock(m_write_mutex);
+    uint64_t target = m_write_submitted;
+    m_write_done_cv.wait(lock, [this, target] { return m_write_completed >= target; });
+}
+
+void Database::write_loop() {
+    size_t batch_size_hint = 0;
+    while (true) {
+        std::vector<PendingWrite> batch;
+        {
+            std::unique_lock<std::mutex> lock(m_write_mutex);
+            m_write_cv.wait(lock, [this] { return m_write_stop || !m_write_queue.empty(); });
+            if (m_write_queue.empty()) break; // Stopping and drained
+
+            // Under load, let writes arriving right behind this one share its transaction.
+            // A write reaching an idle queue commits immediately so lone callers (imports,
+            // the generation insert) do not pay the window.
+            if (batch_size_hint > 1 || m_write_queue.size() > 1) {
+                auto deadline = std::chrono::steady_clock::now() + m_write_window;
+                m_write_cv.wait_until(lock, deadline, [this] {
+                    return m_write_stop || m_write_queue.size() >= m_write_max_batch;
+                });
+            }
+
+            size_t n = std::min(m_write_queue.size(), m_write_max_batch);
+            for (size_t i = 0; i < n; ++i) {
+                batch.push_back(std::move(m_write_queue.front()));
+                m_write_queue.pop_front();
+            }
+        }
+
+        // Every op runs in its own savepoint, so one that fails part-way through several
+        // statements is undone completely while the rest of the batch still commits. Some
+        // errors (FULL, IOERR, NOMEM) make SQLite abort the whole transaction instead: the op
+        // that hit it fails, and the ops before it, rolled back with it, run again in a new
+        // transaction together with those not reached yet (ops only touch the database, so
+        // running one again is safe). Each such round fails at least one op, so this ends.
+        std::vector<int64_t> results(batch.size(), -1);
+        std::vector<size_t> pending(batch.size());
+        std::iota(pending.begin(), pending.end(), size_t(0));
+        {
+            std::lock_guard<std::recursive_mutex> lock(m_mutex);
+            while (!pending.empty()) {
+                std::vector<size_t> applied; // Ran and released in this round's transaction
+                std::vector<size_t> retry;
+                bool aborted = false;
+                try {
+                    SQLite::Transaction transaction(m_db);
+                    for (size_t k = 0; k < pending.size() && !aborted; ++k) {
+                        const size_t i = pending[k];
+                        m_db.exec("SAVEPOINT write_op");
+                        bool ok = false;
+                        try {
+                            results[i] = batch[i].op();
+                            ok = true;
+                        } catch (const std::exception& e) {
+                            std::cerr << "[Database] " << batch[i].name << " failed: " << e.what() << std::endl;
+                        }
+                        try {
+                            m_db.exec(ok ? "RELEASE write_op" : "ROLLBACK TO write_op; RELEASE write_op");
+                        } catch (const std::exception& e) {
+                            // The savepoint went with the transaction
+                            std::cerr << "[Database] " << batch[i].name << " aborted the group transaction: " << e.what() << std::endl;
+                            ok = false;
+                            aborted = true;
+                            retry = applied;
+                            retry.insert(retry.end(), pending.begin() + k + 1, pending.end());
+                            applied.clear();
+                        }
+                        if (ok) applied.push_back(i);
+                        else results[i] = -1;
+                    }
+                    if (!aborted) transaction.commit();
+                } catch (const std::exception& e) {
+                    // BEGIN, SAVEPOINT or COMMIT failed: nothing of this round was written
+                    std::cerr << "[Database] Group commit of " << batch.size() << " writes failed: " << e.what() << std::endl;
+                    retry.clear();
+                    for (size_t i : applied) results[i] = -1;
+                    applied.clear();
+                }
+                for (size_t i : retry) results[i] = -1;
+                pending = std::move(retry);
+            }
+        }
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            batch[i].done.set_value(results[i]);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_write_mutex);
+            m_write_completed = batch.back().seq;
+            m_write_batches++;
+            m_write_largest_batch = std::max(m_write_largest_batch, batch.size());
+        }
+        batch_size_hint = batch.size();
+        m_write_done_cv.notify_all();
+    }
+}
+
+diffusion_desk::json Database::get_write_queue_stats() {
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    return {
+        {"writes", m_write_completed},
+        {"pending", m_write_submitted - m_write_completed},
+        {"transactions", m_write_batches},
+        {"avg_batch", m_write_batches > 0 ? (double)m_write_completed / m_write_batches : 0.0},
+        {"largest_batch", m_write_largest_batch},
+        {"window_us", m_write_window.count()}
+    };
+}
+
+Database::ReadConnection::ReadConnection(const std::string& db_path)
+    : db(db_path, SQLite::OPEN_READONLY, 5000)
+{
+}
+
+Database::CachedStatement::~CachedStatement() {
+    if (!m_stmt) return;
+    try {
+        m_stmt->reset();
+        m_stmt->clearBindings();
+    } catch (...) {}
+    if (m_in_use) *m_in_use = false;
+}
+
+Database::ReaderLease::ReaderLease(Database* owner, ReadConnection* conn)
+    : m_owner(owner), m_conn(conn)
+{
+    if (!m_conn) m_writer_lock = std::unique_lock<std::recursive_mutex>(owner->m_mutex);
+}
+
+Database::ReaderLease::ReaderLease(ReaderLease&& other) noexcept
+    : m_owner(other.m_owner), m_conn(other.m_conn), m_writer_lock(std::move(other.m_writer_lock))
+{
+    other.m_conn = nullptr;
+    other.m_owner = nullptr;
+}
+
+Database::ReaderLease::~ReaderLease() {
+    if (m_owner && m_conn) m_owner->release_reader(m_conn);
+}
+
+Database::CachedStatement Database::ReaderLease::statement(const std::string& sql, const char* caller) {
+    if (!m_conn) return m_owner->statement(sql, caller);
+    return m_owner->statement(m_conn->db, m_conn->cache, sql, caller);
+}
+
+Database::ReaderLease Database::acquire_reader() {
+    if (m_readers.empty()) return ReaderLease(this, nullptr);
+    std::unique_lock<std::mutex> lock(m_readers_mutex);
+    m_readers_cv.wait(lock, [this] { return !m_idle_readers.empty(); });
+    ReadConnection* conn = m_idle_readers.back();
+    m_idle_readers.pop_back();
+    return ReaderLease(this, conn);
+}
+
+void Database::release_reader(ReadConnection* conn) {
+    {
+        std::lock_guard<std::mutex> lock(m_readers_mutex);
+        m_idle_readers.push_back(conn);
+    }
+    m_readers_cv.notify_one();
+}
+
+Database::CachedStatement Database::statement(const std::string& sql, const char* caller) {
+    return statement(m_db, m_stmt_cache, sql, caller);
+}
+
+Database::CachedStatement Database::statement(SQLite::Database& db, StatementCache& cache, const std::string& sql, const char* caller) {
+    ++cache.clock;
+
+    auto it = cache.entries.find(sql);
+    if (it != cache.entries.end() && !it->second.in_use) {
+        {
+            std::lock_guard<std::mutex> lock(m_stats_mutex);
+            m_stmt_stats[caller].reuses++;
+        }
+        it->second.in_use = true;
+        it->second.last_used = cache.clock;
+        return CachedStatement(it->second.stmt.get(), nullptr, &it->second.in_use);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto stmt = std::make_unique<SQLite::Statement>(db, sql);
+    double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    {
+        std::lock_guard<std::mutex> lock(m_stats_mutex);
+        StatementStats& stats = m_stmt_stats[caller];
+        stats.prepares++;
+        stats.prepare_us += elapsed_us;
+        if (m_prepared_sql.size() < MAX_TRACKED_SQL) m_prepared_sql.emplace(sql, caller);
+    }
+
+    // Same SQL already leased further up the call stack: hand out a one-off copy
+    if (it != cache.entries.end()) {
+        SQLite::Statement* raw = stmt.get();
+        return CachedStatement(raw, std::move(stmt), nullptr);
+    }
+
+    if (cache.entries.size() >= STATEMENT_CACHE_CAPACITY) {
+        auto victim = cache.entries.end();
+        for (auto e = cache.entries.begin(); e != cache.entries.end(); ++e) {
+            if (e->second.in_use) continue;
+            if (victim == cache.entries.end() || e->second.last_used < victim->second.last_used) victim = e;
+        }
+        if (victim != cache.entries.end()) {
+            cache.entries.erase(victim);
+            m_cached_statements--;
+        }
+    }
+
+    StatementCacheEntry& entry = cache.entries[sql];
+    entry.stmt = std::move(stmt);
+    entry.in_use = true;
+    entry.last_used = cache.clock;
+    m_cached_statements++;
+    return CachedStatement(entry.stmt.get(), nullptr, &entry.in_use);
+}
+
+std::map<std::string, std::string> Database::get_prepared_statements() {
+    std::lock_guard<std::mutex> lock(m_stats_mutex);
+    return m_prepared_sql;
+}
+
+diffusion_desk::json Database::get_statement_cache_stats() {
+    std::lock_guard<std::mutex> lock(m_stats_mutex);
+    diffusion_desk::json callers = diffusion_desk::json::object();
+    uint64_t total_prepares = 0, total_reuses = 0;
+    double total_saved_us = 0.0;
+    for (const auto& [caller, st] : m_stmt_stats) {
+        // Every reuse skips one prepare, so estimate the saving from the mean prepare cost
+        double avg_prepare_us = st.prepares > 0 ? st.prepare_us / st.prepares : 0.0;
+        double saved_us = avg_prepare_us * st.reuses;
+        callers[caller] = {
+            {"prepares", st.prepares},
+            {"reuses", st.reuses},
+            {"avg_prepare_us", avg_prepare_us},
+            {"saved_ms", saved_us / 1000.0}
+        };
+        total_prepares += st.prepares;
+        total_reuses += st.reuses;
+        total_saved_us += saved_us;
+    }
+    return {
+        {"cached_statements", m_cached_statements.load()},
+        {"capacity_per_connection", STATEMENT_CACHE_CAPACITY},
+        {"read_connections", m_readers.size()},
+        {"prepares", total_prepares},
+        {"reuses", total_reuses},
+        {"saved_ms", total_saved_us / 1000.0},
+        {"callers", callers}
+    };
+}
 
 void Database::init_schema() {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
@@ -121,6 +453,36 @@ void Database::init_schema() {
             std::cout << "[Database] Migrated to version 7 (Image Preset Unconditional Diffusion Path)" << std::endl;
         }
 
+        if (current_version < 8) {
+            migrate_to_v8();
+            set_schema_version(8);
+            std::cout << "[Database] Migrated to version 8 (Maintained Tag Counts)" << std::endl;
+        }
+
+        if (current_version < 9) {
+            migrate_to_v9();
+            set_schema_version(9);
+            std::cout << "[Database] Migrated to version 9 (Gallery and Queue Indexes)" << std::endl;
+        }
+
+        if (current_version < 10) {
+            migrate_to_v10();
+            set_schema_version(10);
+            std::cout << "[Database] Migrated to version 10 (Ranked Search over Prompts and Tags)" << std::endl;
+        }
+
+        if (current_version < 11) {
+            migrate_to_v11();
+            set_schema_version(11);
+            std::cout << "[Database] Migrated to version 11 (Job Leases and Retries)" << std::endl;
+        }
+
+        if (current_version < 12) {
+            migrate_to_v12();
+            set_schema_version(12);
+            std::cout << "[Database] Migrated to version 12 (Thumbnail Pack Index)" << std::endl;
+        }
+
         std::cout << "[Database] Schema initialized successfully." << std::endl;
 
     } catch (const std::exception& e) {
@@ -402,6 +764,181 @@ void Database::migrate_to_v7() {
     transaction.commit();
 }
 
+void Database::migrate_to_v8() {
+    SQLite::Transaction transaction(m_db);
+    try {
+        m_db.exec("ALTER TABLE tags ADD COLUMN usage_count INTEGER NOT NULL DEFAULT 0");
+    } catch (const std::exception& e) {
+        std::cerr << "[Database] migrate_to_v8 warning (column might exist): " << e.what() << std::endl;
+    }
+    m_db.exec("UPDATE tags SET usage_count = (SELECT COUNT(*) FROM image_tags it WHERE it.tag_id = tags.id)");
+    m_db.exec("CREATE INDEX IF NOT EXISTS idx_tags_usage ON tags(usage_count DESC);");
+
+    // Counts follow image_tags, including rows removed by the generations ON DELETE CASCADE.
+    // A tag whose last assignment goes away is dropped on the spot, which replaces the
+    // full-table delete_unused_tags scan after every removal.
+    m_db.exec(R"(
+        CREATE TRIGGER IF NOT EXISTS image_tags_count_ai AFTER INSERT ON image_tags BEGIN
+            UPDATE tags SET usage_count = usage_count + 1 WHERE id = new.tag_id;
+        END;
+    )");
+    m_db.exec(R"(
+        CREATE TRIGGER IF NOT EXISTS image_tags_count_ad AFTER DELETE ON image_tags BEGIN
+            UPDATE tags SET usage_count = usage_count - 1 WHERE id = old.tag_id;
+            DELETE FROM tags WHERE id = old.tag_id AND usage_count <= 0;
+        END;
+    )");
+    m_db.exec(R"(
+        CREATE TRIGGER IF NOT EXISTS image_tags_count_au AFTER UPDATE OF tag_id ON image_tags
+        WHEN old.tag_id IS NOT new.tag_id BEGIN
+            UPDATE tags SET usage_count = usage_count + 1 WHERE id = new.tag_id;
+            UPDATE tags SET usage_count = usage_count - 1 WHERE id = old.tag_id;
+            DELETE FROM tags WHERE id = old.tag_id AND usage_count <= 0;
+        END;
+    )");
+    transaction.commit();
+}
+
+void Database::migrate_to_v9() {
+    SQLite::Transaction transaction(m_db);
+
+    // Gallery pages order by (timestamp DESC, id DESC); walking this index backwards
+    // yields exactly that order, so pages stop with a temp b-tree sort
+    m_db.exec("CREATE INDEX IF NOT EXISTS idx_generations_timeline ON generations(timestamp, id);");
+    m_db.exec("CREATE INDEX IF NOT EXISTS idx_generations_model_timeline ON generations(model_id, timestamp, id);");
+
+    // Import dedup probes by path; parent_uuid is checked whenever a generation is deleted
+    m_db.exec("CREATE INDEX IF NOT EXISTS idx_generations_file_path ON generations(file_path);");
+    m_db.exec("CREATE INDEX IF NOT EXISTS idx_generations_parent ON generations(parent_uuid);");
+
+    // Tagging backlog: only the untagged minority is indexed
+    m_db.exec("CREATE INDEX IF NOT EXISTS idx_generations_untagged ON generations(id) WHERE auto_tagged = 0;");
+
+    // Tag filters start from tag ids; the primary key only covers (generation_id, tag_id)
+    m_db.exec("CREATE INDEX IF NOT EXISTS idx_image_tags_tag ON image_tags(tag_id, generation_id);");
+
+    // Thumbnail lookups and the ON DELETE CASCADE from generations
+    m_db.exec("CREATE INDEX IF NOT EXISTS idx_generation_files_generation ON generation_files(generation_id, file_type, file_path);");
+
+    // Job queue claim order
+    m_db.exec("CREATE INDEX IF NOT EXISTS idx_jobs_queue ON jobs(status, priority DESC, created_at);");
+
+    transaction.commit();
+}
+
+// Tag names of one generation as a single FTS column value
+static std::string generation_tag_text(const std::string& id_expr) {
+    return "(SELECT group_concat(t.name, ' ') FROM image_tags it JOIN tags t ON t.id = it.tag_id WHERE it.generation_id = " + id_expr + ")";
+}
+
+void Database::migrate_to_v10() {
+    SQLite::Transaction transaction(m_db);
+
+    // The index now also carries tags, which generations has no column for, so it keeps
+    // its own copy of the text instead of reading through content='generations'.
+    // Prefix indexes make the type-ahead "cas*" queries index lookups.
+    m_db.exec("DROP TRIGGER IF EXISTS generations_ai;");
+    m_db.exec("DROP TRIGGER IF EXISTS generations_ad;");
+    m_db.exec("DROP TRIGGER IF EXISTS generations_au;");
+    m_db.exec("DROP TABLE IF EXISTS generations_fts;");
+    m_db.exec(R"(
+        CREATE VIRTUAL TABLE generations_fts USING fts5(
+            uuid UNINDEXED,
+            prompt,
+            negative_prompt,
+            tags,
+            prefix = '2 3 4',
+            tokenize = 'unicode61 remove_diacritics 2'
+        );
+    )");
+    m_db.exec("INSERT INTO generations_fts(rowid, uuid, prompt, negative_prompt, tags) "
+              "SELECT g.id, g.uuid, g.prompt, g.negative_prompt, " + generation_tag_text("g.id") + " FROM generations g;");
+
+    m_db.exec(R"(
+        CREATE TRIGGER generations_fts_ai AFTER INSERT ON generations BEGIN
+            INSERT INTO generations_fts(rowid, uuid, prompt, negative_prompt, tags) VALUES (new.id, new.uuid, new.prompt, new.negative_prompt, '');
+        END;
+    )");
+    // save_generation's INSERT OR REPLACE deletes the old row without firing delete
+    // triggers, so drop its index row up front
+    m_db.exec(R"(
+        CREATE TRIGGER generations_fts_bi BEFORE INSERT ON generations BEGIN
+            DELETE FROM generations_fts WHERE rowid = (SELECT id FROM generations WHERE uuid = new.uuid);
+        END;
+    )");
+    m_db.exec(R"(
+        CREATE TRIGGER generations_fts_ad AFTER DELETE ON generations BEGIN
+            DELETE FROM generations_fts WHERE rowid = old.id;
+        END;
+    )");
+    // Rating, favorite and tagging flags change often and are not indexed
+    m_db.exec(R"(
+        CREATE TRIGGER generations_fts_au AFTER UPDATE OF uuid, prompt, negative_prompt ON generations BEGIN
+            UPDATE generations_fts SET uuid = new.uuid, prompt = new.prompt, negative_prompt = new.negative_prompt WHERE rowid = new.id;
+        END;
+    )");
+    m_db.exec(
+        "CREATE TRIGGER image_tags_fts_ai AFTER INSERT ON image_tags BEGIN "
+        "UPDATE generations_fts SET tags = " + generation_tag_text("new.generation_id") + " WHERE rowid = new.generation_id; "
+        "END;");
+    m_db.exec(
+        "CREATE TRIGGER image_tags_fts_ad AFTER DELETE ON image_tags BEGIN "
+        "UPDATE generations_fts SET tags = " + generation_tag_text("old.generation_id") + " WHERE rowid = old.generation_id; "
+        "END;");
+    m_db.exec(
+        "CREATE TRIGGER image_tags_fts_au AFTER UPDATE OF generation_id, tag_id ON image_tags BEGIN "
+        "UPDATE generations_fts SET tags = " + generation_tag_text("old.generation_id") + " WHERE rowid = old.generation_id; "
+        "UPDATE generations_fts SET tags = " + generation_tag_text("new.generation_id") + " WHERE rowid = new.generation_id; "
+        "END;");
+    m_db.exec(
+        "CREATE TRIGGER tags_fts_au AFTER UPDATE OF name ON tags BEGIN "
+        "UPDATE generations_fts SET tags = " + generation_tag_text("generations_fts.rowid") + " "
+        "WHERE rowid IN (SELECT generation_id FROM image_tags WHERE tag_id = new.id); "
+        "END;");
+
+    transaction.commit();
+}
+
+void Database::migrate_to_v11() {
+    SQLite::Transaction transaction(m_db);
+
+    // attempts counts claims; a claimed job holds a lease until lease_expires_at, and a
+    // retried job waits for available_at
+    try { m_db.exec("ALTER TABLE jobs ADD COLUMN attempts INTEGER DEFAULT 0;"); } catch (...) {}
+    try { m_db.exec("ALTER TABLE jobs ADD COLUMN lease_expires_at DATETIME;"); } catch (...) {}
+    try { m_db.exec("ALTER TABLE jobs ADD COLUMN available_at DATETIME;"); } catch (...) {}
+
+    // Jobs left in processing by an earlier version never had a lease and are stuck for
+    // good; nothing is running yet during migration, so requeue them
+    m_db.exec("UPDATE jobs SET status = 'pending' WHERE status = 'processing';");
+
+    // Claims are per job type and only ever look at pending rows
+    m_db.exec("CREATE INDEX IF NOT EXISTS idx_jobs_claim ON jobs(type, priority DESC, created_at, id) WHERE status = 'pending';");
+
+    transaction.commit();
+}
+
+void Database::migrate_to_v12() {
+    SQLite::Transaction transaction(m_db);
+
+    // One row per packed thumbnail. Keyed for the serving lookup; segment is indexed for
+    // compaction, which walks one segment at a time.
+    m_db.exec(R"(
+        CREATE TABLE IF NOT EXISTS thumbnail_pack (
+            generation_id INTEGER NOT NULL,
+            size INTEGER NOT NULL,
+            segment INTEGER NOT NULL,
+            offset INTEGER NOT NULL,
+            length INTEGER NOT NULL,
+            PRIMARY KEY (generation_id, size),
+            FOREIGN KEY(generation_id) REFERENCES generations(id) ON DELETE CASCADE
+        ) WITHOUT ROWID;
+    )");
+    m_db.exec("CREATE INDEX IF NOT EXISTS idx_thumbnail_pack_segment ON thumbnail_pack(segment, offset);");
+
+    transaction.commit();
+}
+
 void Database::save_generation(const diffusion_desk::json& j) {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     try {
@@ -409,13 +946,14 @@ void Database::save_generation(const diffusion_desk::json& j) {
         std::string file_path = j.value("file_path", "");
         if (uuid.empty() || file_path.empty()) return;
 
-        SQLite::Statement query(m_db, R"(
+        auto query_lease = statement(R"(
             INSERT OR REPLACE INTO generations (
                 uuid, file_path, prompt, negative_prompt, seed, 
                 width, height, steps, cfg_scale, model_hash, 
                 generation_time, parent_uuid, params_json, model_id
             ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
-        )");
+        )", __func__);
+        SQLite::Statement& query = *query_lease;
 
         query.bind(1, uuid);
         query.bind(2, file_path);
@@ -447,7 +985,8 @@ void Database::save_generation(const diffusion_desk::json& j) {
 void Database::set_favorite(const std::string& uuid, bool favorite) {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     try {
-        SQLite::Statement query(m_db, "UPDATE generations SET is_favorite = ? WHERE uuid = ?");
+        auto query_lease = statement("UPDATE generations SET is_favorite = ? WHERE uuid = ?", __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, favorite ? 1 : 0);
         query.bind(2, uuid);
         query.exec();
@@ -459,7 +998,8 @@ void Database::set_favorite(const std::string& uuid, bool favorite) {
 void Database::set_rating(const std::string& uuid, int rating) {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     try {
-        SQLite::Statement query(m_db, "UPDATE generations SET rating = ? WHERE uuid = ?");
+        auto query_lease = statement("UPDATE generations SET rating = ? WHERE uuid = ?", __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, std::max(0, std::min(5, rating)));
         query.bind(2, uuid);
         query.exec();
@@ -471,19 +1011,20 @@ void Database::set_rating(const std::string& uuid, int rating) {
 void Database::remove_generation(const std::string& uuid) {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     try {
-        SQLite::Statement query(m_db, "DELETE FROM generations WHERE uuid = ?");
+        auto query_lease = statement("DELETE FROM generations WHERE uuid = ?", __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, uuid);
-        query.exec();
-        delete_unused_tags(); 
+        query.exec(); // Tag counts and orphaned tags are handled by the image_tags triggers
     } catch (const std::exception& e) {
         std::cerr << "[Database] remove_generation failed: " << e.what() << std::endl;
     }
 }
 
 std::string Database::get_generation_filepath(const std::string& uuid) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto reader = acquire_reader();
     try {
-        SQLite::Statement query(m_db, "SELECT file_path FROM generations WHERE uuid = ?");
+        auto query_lease = reader.statement("SELECT file_path FROM generations WHERE uuid = ?", __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, uuid);
         if (query.executeStep()) {
             return query.getColumn(0).getText();
@@ -494,65 +1035,77 @@ std::string Database::get_generation_filepath(const std::string& uuid) {
     return "";
 }
 
-diffusion_desk::json Database::get_generations(int limit, const std::string& cursor, const std::vector<std::string>& tags, const std::string& model, int min_rating) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    diffusion_desk::json response;
-    diffusion_desk::json items = diffusion_desk::json::array();
-    
-    try {
-        std::string sql = "SELECT g.* FROM generations g WHERE 1=1 ";
-        
-        // Cursor logic: "timestamp|id"
-        if (!cursor.empty()) {
-            sql += "AND (g.timestamp < ? OR (g.timestamp = ? AND g.id < ?)) ";
-        }
+// WHERE/ORDER BY/LIMIT shared by the gallery listings, bound by bind_gallery_filters
+static std::string gallery_filter_sql(bool has_cursor, size_t tag_count, bool has_model, bool has_rating) {
+    std::string sql = "WHERE 1=1 ";
 
-        if (!tags.empty()) {
-            sql += "AND g.id IN (SELECT it.generation_id FROM image_tags it JOIN tags t ON it.tag_id = t.id WHERE t.name IN (";
-            for (size_t i = 0; i < tags.size(); ++i) {
-                sql += (i == 0 ? "?" : ", ?");
-            }
-            sql += ") GROUP BY it.generation_id HAVING COUNT(DISTINCT t.id) = ?) ";
+    // Cursor logic: "timestamp|id"
+    if (has_cursor) {
+        sql += "AND (g.timestamp < ? OR (g.timestamp = ? AND g.id < ?)) ";
+    }
+
+    if (tag_count > 0) {
+        sql += "AND g.id IN (SELECT it.generation_id FROM image_tags it JOIN tags t ON it.tag_id = t.id WHERE t.name IN (";
+        for (size_t i = 0; i < tag_count; ++i) {
+            sql += (i == 0 ? "?" : ", ?");
         }
-        if (!model.empty()) sql += "AND g.model_id = ? ";
-        if (min_rating > 0) sql += "AND g.rating >= ? ";
-        
-        // Stable sort
-        sql += "ORDER BY g.timestamp DESC, g.id DESC LIMIT ?";
+        sql += ") GROUP BY it.generation_id HAVING COUNT(DISTINCT t.id) = ?) ";
+    }
+    if (has_model) sql += "AND g.model_id = ? ";
+    if (has_rating) sql += "AND g.rating >= ? ";
 
-        SQLite::Statement query(m_db, sql);
-        int bind_idx = 1;
+    // Stable sort
+    sql += "ORDER BY g.timestamp DESC, g.id DESC LIMIT ?";
+    return sql;
+}
 
-        if (!cursor.empty()) {
-            size_t pipe_pos = cursor.find('|');
-            if (pipe_pos != std::string::npos) {
-                std::string ts = cursor.substr(0, pipe_pos);
-                int id = std::stoi(cursor.substr(pipe_pos + 1));
-                query.bind(bind_idx++, ts);
-                query.bind(bind_idx++, ts);
-                query.bind(bind_idx++, id);
-            } else {
-                // Fallback or invalid cursor, maybe just ignore or throw
-                // For safety, just bind something that returns nothing or everything?
-                // Actually, if invalid, we might just proceed without cursor logic effectively (or error).
-                // Let's assume empty result if invalid cursor to prompt reset.
-                query.bind(bind_idx++, "9999-99-99 99:99:99");
-                query.bind(bind_idx++, "9999-99-99 99:99:99");
-                query.bind(bind_idx++, 0);
-            }
+static void bind_gallery_filters(SQLite::Statement& query, int limit, const std::string& cursor, const std::vector<std::string>& tags,
+                                 const std::string& model, int min_rating) {
+    int bind_idx = 1;
+
+    if (!cursor.empty()) {
+        size_t pipe_pos = cursor.find('|');
+        if (pipe_pos != std::string::npos) {
+            std::string ts = cursor.substr(0, pipe_pos);
+            int id = std::stoi(cursor.substr(pipe_pos + 1));
+            query.bind(bind_idx++, ts);
+            query.bind(bind_idx++, ts);
+            query.bind(bind_idx++, id);
+        } else {
+            // Invalid cursor: bind a position before every row so the client gets an
+            // empty page and resets
+            query.bind(bind_idx++, "9999-99-99 99:99:99");
+            query.bind(bind_idx++, "9999-99-99 99:99:99");
+            query.bind(bind_idx++, 0);
         }
+    }
 
-        if (!tags.empty()) {
-            for (const auto& tag : tags) query.bind(bind_idx++, tag);
-            query.bind(bind_idx++, (int)tags.size());
-        }
-        if (!model.empty()) query.bind(bind_idx++, model);
-        if (min_rating > 0) query.bind(bind_idx++, min_rating);
-        query.bind(bind_idx++, limit);
+    if (!tags.empty()) {
+        for (const auto& tag : tags) query.bind(bind_idx++, tag);
+        query.bind(bind_idx++, (int)tags.size());
+    }
+    if (!model.empty()) query.bind(bind_idx++, model);
+    if (min_rating > 0) query.bind(bind_idx++, min_rating);
+    query.bind(bind_idx++, limit);
+}
+
+diffusion_desk::json Database::get_generations(int limit, const std::string& cursor, const std::vector<std::string>& tags, const std::string& model, int min_rating) {
+    auto reader = acquire_reader();
+    diffusion_desk::json response;
+    diffusion_desk::json items = diffusion_desk::json::array();
+    
+    try {
+        std::string sql = std::string("SELECT ") + GENERATION_LIST_COLUMNS + " FROM generations g " +
+                          gallery_filter_sql(!cursor.empty(), tags.size(), !model.empty(), min_rating > 0);
+
+        auto query_lease = reader.statement(sql, __func__);
+        SQLite::Statement& query = *query_lease;
+        bind_gallery_filters(query, limit, cursor, tags, model, min_rating);
 
         while (query.executeStep()) {
-            items.push_back(parse_generation_row(query, m_db));
+            items.push_back(parse_generation_row(query));
         }
+        attach_thumbnails(reader, items);
     } catch (const std::exception& e) {
         std::cerr << "[Database] get_generations failed: " << e.what() << std::endl;
     }
@@ -569,41 +1122,422 @@ diffusion_desk::json Database::get_generations(int limit, const std::string& cur
     return response;
 }
 
-diffusion_desk::json Database::search_generations(const std::string& query, int limit) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    diffusion_desk::json results = diffusion_desk::json::array();
+std::string thumbnail_file_type(int size) {
+    if (size == DEFAULT_THUMBNAIL_SIZE) return "thumbnail";
+    return "thumbnail_" + std::to_string(size);
+}
+
+int snap_thumbnail_size(int requested) {
+    for (int size : THUMBNAIL_SIZES) {
+        if (size >= requested) return size;
+    }
+    return THUMBNAIL_SIZES[std::size(THUMBNAIL_SIZES) - 1];
+}
+
+bool GenerationFields::parse(const std::string& list, GenerationFields& out, std::string& error) {
+    GenerationFields fields;
+    fields.id = fields.internal_id = fields.name = fields.file_path = fields.timestamp = false;
+    fields.params = fields.is_favorite = fields.rating = fields.tags = fields.thumbnail_path = false;
+
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string field = list.substr(start, end - start);
+        start = end + 1;
+        if (field.empty()) continue;
+
+        if (field == "id") fields.id = true;
+        else if (field == "__internal_id") fields.internal_id = true;
+        else if (field == "name") fields.name = true;
+        else if (field == "file_path") fields.file_path = true;
+        else if (field == "timestamp") fields.timestamp = true;
+        else if (field == "params") fields.params = true;
+        else if (field == "is_favorite") fields.is_favorite = true;
+        else if (field == "rating") fields.rating = true;
+        else if (field == "tags") fields.tags = true;
+        else if (field == "thumbnail_path") fields.thumbnail_path = true;
+        else {
+            error = "unknown field: " + field;
+            return false;
+        }
+    }
+    out = fields;
+    return true;
+}
+
+// Appends `value` as a JSON string literal. Bytes >= 0x80 pass through, so UTF-8 text
+// is copied as is.
+static void append_json_string(std::string& out, const char* value) {
+    static const char* HEX = "0123456789abcdef";
+    out += '"';
+    for (const char* p = value; *p; ++p) {
+        unsigned char c = static_cast<unsigned char>(*p);
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            default:
+                if (c < 0x20) {
+                    out += "\\u00";
+                    out += HEX[c >> 4];
+                    out += HEX[c & 0xf];
+                } else {
+                    out += static_cast<char>(c);
+                }
+        }
+    }
+    out += '"';
+}
+
+static void append_json_double(std::string& out, double value) {
+    // Whole numbers keep the "7.0" form nlohmann writes for REAL columns
+    if (std::isfinite(value) && value == std::floor(value) && std::fabs(value) < 1e15) {
+        out += std::to_string((long long)value);
+        out += ".0";
+    } else {
+        out += diffusion_desk::json(value).dump();
+    }
+}
+
+// Copies the top-level members of the JSON object `src` into `out` without parsing the
+// values, dropping keys in `skip`. Returns false with `out` unchanged when `src` is not
+// an object, so the caller can treat the blob as empty.
+static bool splice_object_members(std::string& out, const std::string& src, const std::vector<const char*>& skip, bool& wrote_any) {
+    const size_t out_start = out.size();
+    const bool wrote_any_start = wrote_any;
+    auto fail = [&] {
+        out.resize(out_start);
+        wrote_any = wrote_any_start;
+        return false;
+    };
+    auto skip_ws = [&](size_t i) {
+        while (i < src.size() && (src[i] == ' ' || src[i] == '\n' || src[i] == '\r' || src[i] == '\t')) ++i;
+        return i;
+    };
+    // Index just past the string literal starting at src[i] == '"'
+    auto string_end = [&](size_t i) {
+        for (++i; i < src.size(); ++i) {
+            if (src[i] == '\\') ++i;
+            else if (src[i] == '"') return i + 1;
+        }
+        return std::string::npos;
+    };
+
+    size_t i = skip_ws(0);
+    if (i >= src.size() || src[i] != '{') return fail();
+    i = skip_ws(i + 1);
+    if (i < src.size() && src[i] == '}') return skip_ws(i + 1) == src.size() || fail();
+
+    while (i < src.size()) {
+        if (src[i] != '"') return fail();
+        size_t key_end = string_end(i);
+        if (key_end == std::string::npos) return fail();
+        const size_t key_start = i;
+        i = skip_ws(key_end);
+        if (i >= src.size() || src[i] != ':') return fail();
+
+        const size_t value_start = skip_ws(i + 1);
+        int depth = 0;
+        for (i = value_start; i < src.size(); ++i) {
+            char c = src[i];
+            if (c == '"') {
+                i = string_end(i);
+                if (i == std::string::npos) return fail();
+                --i;
+            } else if (c == '{' || c == '[') {
+                ++depth;
+            } else if (c == '}' || c == ']') {
+                if (depth == 0) break;
+                --depth;
+            } else if (c == ',' && depth == 0) {
+                break;
+            }
+        }
+        if (i >= src.size()) return fail();
+        size_t value_end = i;
+        while (value_end > value_start && (src[value_end - 1] == ' ' || src[value_end - 1] == '\n' ||
+                                           src[value_end - 1] == '\r' || src[value_end - 1] == '\t')) {
+            --value_end;
+        }
+        if (value_end == value_start) return fail();
+
+        const size_t key_len = key_end - key_start - 2;
+        bool skipped = false;
+        for (const char* name : skip) {
+            if (std::strlen(name) == key_len && src.compare(key_start + 1, key_len, name) == 0) {
+                skipped = true;
+                break;
+            }
+        }
+        if (!skipped) {
+            if (wrote_any) out += ',';
+            out.append(src, key_start, key_end - key_start);
+            out += ':';
+            out.append(src, value_start, value_end - value_start);
+            wrote_any = true;
+        }
+
+        if (src[i] == '}') return skip_ws(i + 1) == src.size() || fail();
+        i = skip_ws(i + 1); // Past ','
+    }
+    return fail();
+}
+
+void Database::write_generations_json(std::string& out, int limit, const std::string& cursor, const std::vector<std::string>& tags,
+                                      const std::string& model, int min_rating, const GenerationFields& fields) {
+    // Column values win over params_json for these keys, as in parse_generation_row
+    static const std::vector<const char*> COLUMN_PARAMS = {
+        "prompt", "negative_prompt", "seed", "width", "height", "steps", "cfg_scale", "model_id"};
+
+    auto reader = acquire_reader();
+    const size_t out_start = out.size();
     try {
-        SQLite::Statement q(m_db, R"(
-            SELECT g.* 
-            FROM generations g
-            WHERE g.id IN (SELECT rowid FROM generations_fts WHERE generations_fts MATCH ?)
-            ORDER BY g.timestamp DESC LIMIT ?
-        )");
-        q.bind(1, query);
-        q.bind(2, limit);
-        while (q.executeStep()) {
-            results.push_back(parse_generation_row(q, m_db));
+        // Only the columns the projection needs; id and timestamp always, for the cursor
+        std::string sql = "SELECT g.id, g.timestamp";
+        if (fields.id) sql += ", g.uuid";
+        if (fields.name || fields.file_path) sql += ", g.file_path";
+        if (fields.params) sql += ", g.params_json, g.prompt, g.negative_prompt, g.seed, g.width, g.height, g.steps, g.cfg_scale, g.model_id";
+        if (fields.is_favorite) sql += ", g.is_favorite";
+        if (fields.rating) sql += ", g.rating";
+        if (fields.tags) {
+            sql += ", (SELECT json_group_array(t.name) FROM image_tags it JOIN tags t ON t.id = it.tag_id "
+                   "WHERE it.generation_id = g.id) AS tags_json";
+        }
+        if (fields.thumbnail_path && fields.thumbnail_size != DEFAULT_THUMBNAIL_SIZE) {
+            // Other levels fall back to the default one for images from before the pyramid
+            const std::string type = thumbnail_file_type(snap_thumbnail_size(fields.thumbnail_size));
+            sql += ", (SELECT gf.file_path FROM generation_files gf WHERE gf.generation_id = g.id "
+                   "AND gf.file_type IN ('" + type + "', 'thumbnail') "
+                   "ORDER BY gf.file_type = 'thumbnail' ASC, gf.id ASC LIMIT 1) AS thumbnail_path";
+        } else if (fields.thumbnail_path) {
+            sql += ", (SELECT gf.file_path FROM generation_files gf WHERE gf.generation_id = g.id "
+                   "AND gf.file_type = 'thumbnail' ORDER BY gf.id ASC LIMIT 1) AS thumbnail_path";
+        }
+        sql += " FROM generations g " + gallery_filter_sql(!cursor.empty(), tags.size(), !model.empty(), min_rating > 0);
+
+        auto query_lease = reader.statement(sql, __func__);
+        SQLite::Statement& query = *query_lease;
+        bind_gallery_filters(query, limit, cursor, tags, model, min_rating);
+
+        out += "{\"data\":[";
+        int rows = 0;
+        int last_id = 0;
+        std::string last_timestamp;
+        std::string params_json;
+        while (query.executeStep()) {
+            if (rows++ > 0) out += ',';
+            last_id = query.getColumn("id").getInt();
+            last_timestamp = query.getColumn("timestamp").getText();
+
+            char sep = '{';
+            auto key = [&](const char* name) {
+                out += sep;
+                out += '"';
+                out += name;
+                out += "\":";
+                sep = ',';
+            };
+            if (fields.id) { key("id"); append_json_string(out, query.getColumn("uuid").getText()); }
+            if (fields.internal_id) { key("__internal_id"); out += std::to_string(last_id); }
+            if (fields.name || fields.file_path) {
+                const char* file_path = query.getColumn("file_path").getText();
+                if (fields.name) {
+                    const char* name = file_path;
+                    for (const char* p = file_path; *p; ++p) {
+                        if (*p == '/' || *p == '\\') name = p + 1;
+                    }
+                    key("name");
+                    append_json_string(out, name);
+                }
+                if (fields.file_path) { key("file_path"); append_json_string(out, file_path); }
+            }
+            if (fields.timestamp) { key("timestamp"); append_json_string(out, last_timestamp.c_str()); }
+            if (fields.params) {
+                key("params");
+                out += '{';
+                bool wrote_any = false;
+                params_json = query.getColumn("params_json").getText();
+                if (!params_json.empty()) splice_object_members(out, params_json, COLUMN_PARAMS, wrote_any);
+                out += wrote_any ? ",\"prompt\":" : "\"prompt\":";
+                append_json_string(out, query.getColumn("prompt").getText());
+                out += ",\"negative_prompt\":";
+                append_json_string(out, query.getColumn("negative_prompt").getText());
+                out += ",\"seed\":" + std::to_string((long long)query.getColumn("seed").getInt64());
+                out += ",\"width\":" + std::to_string(query.getColumn("width").getInt());
+                out += ",\"height\":" + std::to_string(query.getColumn("height").getInt());
+                out += ",\"steps\":" + std::to_string(query.getColumn("steps").getInt());
+                out += ",\"cfg_scale\":";
+                append_json_double(out, query.getColumn("cfg_scale").getDouble());
+                out += ",\"model_id\":";
+                append_json_string(out, query.getColumn("model_id").getText());
+                out += '}';
+            }
+            if (fields.is_favorite) { key("is_favorite"); out += query.getColumn("is_favorite").getInt() != 0 ? "true" : "false"; }
+            if (fields.rating) { key("rating"); out += std::to_string(query.getColumn("rating").getInt()); }
+            if (fields.tags) {
+                // json_group_array already produced JSON text
+                key("tags");
+                const char* tags_json = query.getColumn("tags_json").getText();
+                out += *tags_json ? tags_json : "[]";
+            }
+            if (fields.thumbnail_path) { key("thumbnail_path"); append_json_string(out, query.getColumn("thumbnail_path").getText()); }
+            out += sep == '{' ? "{}" : "}";
         }
+        out += "],\"next_cursor\":";
+        if (rows > 0 && rows == limit) append_json_string(out, (last_timestamp + "|" + std::to_string(last_id)).c_str());
+        else out += "null";
+        out += '}';
     } catch (const std::exception& e) {
-        std::cerr << "[Database] search_generations FTS failed, falling back to LIKE: " << e.what() << std::endl;
+        std::cerr << "[Database] write_generations_json failed: " << e.what() << std::endl;
+        out.resize(out_start);
+        out += "{\"data\":[],\"next_cursor\":null}";
+    }
+}
+
+// Turns free text into an FTS5 query that cannot be a syntax error: every term is a
+// quoted string, so operators, column filters and quotes in the input are literal text.
+// Terms are ANDed; the last term (or one written as "cas*") is prefix matched for
+// type-ahead. Returns "" when nothing searchable is left.
+static std::string build_fts_query(const std::string& input) {
+    std::vector<std::string> terms;
+    std::string current;
+    for (size_t i = 0; i <= input.size(); ++i) {
+        unsigned char c = i < input.size() ? static_cast<unsigned char>(input[i]) : ' ';
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            if (!current.empty()) terms.push_back(std::move(current));
+            current.clear();
+        } else {
+            current += static_cast<char>(c);
+        }
+    }
+    const bool typing_last_term = !input.empty() && input.back() != ' ';
+
+    std::string fts;
+    for (size_t i = 0; i < terms.size(); ++i) {
+        std::string term = terms[i];
+        bool prefix = typing_last_term && i + 1 == terms.size();
+        while (!term.empty() && term.back() == '*') {
+            term.pop_back();
+            prefix = true;
+        }
+        // Terms without a single word character would tokenize to nothing
+        bool searchable = false;
+        for (unsigned char c : term) {
+            if (std::isalnum(c) || c >= 0x80) { searchable = true; break; }
+        }
+        if (!searchable) continue;
+
+        if (!fts.empty()) fts += ' ';
+        fts += '"';
+        for (char c : term) {
+            if (c == '"') fts += '"';
+            fts += c;
+        }
+        fts += '"';
+        if (prefix) fts += '*';
+    }
+    return fts;
+}
+
+diffusion_desk::json Database::search_generations(const std::string& query, int limit, const std::string& cursor) {
+    auto reader = acquire_reader();
+    diffusion_desk::json response;
+    diffusion_desk::json items = diffusion_desk::json::array();
+    response["next_cursor"] = nullptr;
+
+    const std::string fts_query = build_fts_query(query);
+    if (fts_query.empty() || limit <= 0) {
+        response["data"] = items;
+        return response;
+    }
+
+    // Cursor logic: "score|id", ascending like bm25 itself (more negative is better)
+    double cursor_score = 0.0;
+    int cursor_id = 0;
+    bool has_cursor = false;
+    size_t pipe_pos = cursor.find('|');
+    if (!cursor.empty() && pipe_pos != std::string::npos) {
         try {
-            SQLite::Statement q(m_db, "SELECT * FROM generations WHERE prompt LIKE ? OR negative_prompt LIKE ? ORDER BY timestamp DESC LIMIT ?");
-            q.bind(1, "%" + query + "%");
-            q.bind(2, "%" + query + "%");
-            q.bind(3, limit);
-            while (q.executeStep()) {
-                results.push_back(parse_generation_row(q, m_db));
-            }
+            cursor_score = std::stod(cursor.substr(0, pipe_pos));
+            cursor_id = std::stoi(cursor.substr(pipe_pos + 1));
+            has_cursor = true;
         } catch (...) {}
     }
-    return results;
+    if (!cursor.empty() && !has_cursor) {
+        // Invalid cursor: empty page so the client resets, as in get_generations
+        response["data"] = items;
+        return response;
+    }
+
+    try {
+        // Column weights: prompt, tags, then negative prompt (uuid is not indexed).
+        // Ranks every match, then joins only the requested page back to generations.
+        std::string sql = R"(
+            WITH hits AS (
+                SELECT rowid AS id, bm25(generations_fts, 0.0, 4.0, 0.5, 2.0) AS score
+                FROM generations_fts WHERE generations_fts MATCH ?
+            ), page AS (
+                SELECT id, score FROM hits
+        )";
+        if (has_cursor) sql += " WHERE score > ? OR (score = ? AND id > ?)";
+        sql += std::string(R"(
+                ORDER BY score, id LIMIT ?
+            )
+            SELECT )") + GENERATION_LIST_COLUMNS + R"(, page.id AS search_id, page.score AS search_score
+            FROM page LEFT JOIN generations g ON g.id = page.id
+            ORDER BY page.score, page.id
+        )";
+
+        auto q_lease = reader.statement(sql, __func__);
+        SQLite::Statement& q = *q_lease;
+        int bind_idx = 1;
+        q.bind(bind_idx++, fts_query);
+        if (has_cursor) {
+            q.bind(bind_idx++, cursor_score);
+            q.bind(bind_idx++, cursor_score);
+            q.bind(bind_idx++, cursor_id);
+        }
+        q.bind(bind_idx++, limit);
+
+        int rows = 0;
+        int last_id = 0;
+        double last_score = 0.0;
+        while (q.executeStep()) {
+            rows++;
+            last_id = q.getColumn("search_id").getInt();
+            last_score = q.getColumn("search_score").getDouble();
+            // An index row without its generation still advances the cursor
+            if (q.getColumn("uuid").isNull()) continue;
+            items.push_back(parse_generation_row(q));
+        }
+        attach_thumbnails(reader, items);
+
+        if (rows == limit) {
+            // %.17g round-trips the double, so the next page resumes exactly after this row
+            char score_buf[32];
+            std::snprintf(score_buf, sizeof(score_buf), "%.17g", last_score);
+            response["next_cursor"] = std::string(score_buf) + "|" + std::to_string(last_id);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[Database] search_generations failed: " << e.what() << std::endl;
+        items = diffusion_desk::json::array();
+    }
+
+    response["data"] = items;
+    return response;
 }
 
 diffusion_desk::json Database::get_tags() {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto reader = acquire_reader();
     diffusion_desk::json results = diffusion_desk::json::array();
     try {
-        SQLite::Statement query(m_db, "SELECT name, category, COUNT(it.tag_id) as count FROM tags t LEFT JOIN image_tags it ON t.id = it.tag_id GROUP BY t.id ORDER BY count DESC");
+        auto query_lease = reader.statement("SELECT name, category, usage_count FROM tags ORDER BY usage_count DESC", __func__);
+        SQLite::Statement& query = *query_lease;
         while (query.executeStep()) {
             diffusion_desk::json tag;
             tag["name"] = query.getColumn(0).getText();
@@ -620,7 +1554,8 @@ diffusion_desk::json Database::get_tags() {
 void Database::save_style(const Style& style) {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     try {
-        SQLite::Statement query(m_db, "INSERT OR REPLACE INTO styles (name, prompt, negative_prompt, preview_path) VALUES (?, ?, ?, ?)");
+        auto query_lease = statement("INSERT OR REPLACE INTO styles (name, prompt, negative_prompt, preview_path) VALUES (?, ?, ?, ?)", __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, style.name);
         query.bind(2, style.prompt);
         query.bind(3, style.negative_prompt);
@@ -632,10 +1567,11 @@ void Database::save_style(const Style& style) {
 }
 
 diffusion_desk::json Database::get_styles() {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto reader = acquire_reader();
     diffusion_desk::json results = diffusion_desk::json::array();
     try {
-        SQLite::Statement query(m_db, "SELECT name, prompt, negative_prompt, preview_path FROM styles ORDER BY name ASC");
+        auto query_lease = reader.statement("SELECT name, prompt, negative_prompt, preview_path FROM styles ORDER BY name ASC", __func__);
+        SQLite::Statement& query = *query_lease;
         while (query.executeStep()) {
             diffusion_desk::json s;
             s["name"] = query.getColumn(0).getText();
@@ -653,7 +1589,8 @@ diffusion_desk::json Database::get_styles() {
 void Database::delete_style(const std::string& name) {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     try {
-        SQLite::Statement query(m_db, "DELETE FROM styles WHERE name = ?");
+        auto query_lease = statement("DELETE FROM styles WHERE name = ?", __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, name);
         query.exec();
     } catch (const std::exception& e) {
@@ -664,7 +1601,8 @@ void Database::delete_style(const std::string& name) {
 void Database::add_library_item(const LibraryItem& item) {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     try {
-        SQLite::Statement query(m_db, "INSERT INTO prompt_library (label, content, category, preview_path) VALUES (?, ?, ?, ?)");
+        auto query_lease = statement("INSERT INTO prompt_library (label, content, category, preview_path) VALUES (?, ?, ?, ?)", __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, item.label);
         query.bind(2, item.content);
         query.bind(3, item.category);
@@ -676,13 +1614,14 @@ void Database::add_library_item(const LibraryItem& item) {
 }
 
 diffusion_desk::json Database::get_library_items(const std::string& category) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto reader = acquire_reader();
     diffusion_desk::json results = diffusion_desk::json::array();
     try {
         std::string sql = "SELECT id, label, content, category, preview_path, usage_count FROM prompt_library ";
         if (!category.empty()) sql += "WHERE category = ? ";
         sql += "ORDER BY label ASC";
-        SQLite::Statement query(m_db, sql);
+        auto query_lease = reader.statement(sql, __func__);
+        SQLite::Statement& query = *query_lease;
         if (!category.empty()) query.bind(1, category);
         while (query.executeStep()) {
             diffusion_desk::json item;
@@ -715,21 +1654,155 @@ void Database::increment_library_usage(int id) {
 }
 
 int Database::add_job(const std::string& type, const diffusion_desk::json& payload, int priority) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    try {
-        SQLite::Statement query(m_db, "INSERT INTO jobs (type, payload, priority) VALUES (?, ?, ?)");
+    auto id = submit_write("add_job", [this, type, payload = payload.dump(), priority]() -> int64_t {
+        auto query_lease = statement("INSERT INTO jobs (type, payload, priority) VALUES (?, ?, ?)", "add_job");
+        SQLite::Statement& query = *query_lease;
         query.bind(1, type);
-        query.bind(2, payload.dump());
+        query.bind(2, payload);
         query.bind(3, priority);
         query.exec();
-        return (int)m_db.getLastInsertRowid();
-    } catch (...) { return -1; }
+        return m_db.getLastInsertRowid();
+    });
+    int job_id = (int)id.get();
+
+    // Committed, so a woken worker will find it
+    std::function<void(const std::string&)> callback;
+    {
+        std::lock_guard<std::mutex> lock(m_job_callback_mutex);
+        callback = m_job_added_callback;
+    }
+    if (job_id > 0 && callback) callback(type);
+    return job_id;
+}
+
+void Database::set_job_added_callback(std::function<void(const std::string&)> callback) {
+    std::lock_guard<std::mutex> lock(m_job_callback_mutex);
+    m_job_added_callback = std::move(callback);
+}
+
+std::vector<Job> Database::claim_jobs(const std::string& type, int max_count, int lease_seconds) {
+    // Retries and completions of earlier claims may still be queued
+    flush_writes();
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    std::vector<Job> jobs;
+    try {
+        // One statement, so two workers can never claim the same row
+        auto query_lease = statement(R"(
+            UPDATE jobs SET status = 'processing', attempts = attempts + 1,
+                            lease_expires_at = datetime('now', ?), updated_at = CURRENT_TIMESTAMP
+            WHERE id IN (
+                SELECT id FROM jobs
+                WHERE status = 'pending' AND type = ? AND (available_at IS NULL OR available_at <= datetime('now'))
+                ORDER BY priority DESC, created_at ASC, id ASC LIMIT ?
+            )
+            RETURNING id, type, payload, status, error, priority, created_at, attempts
+        )", __func__);
+        SQLite::Statement& query = *query_lease;
+        query.bind(1, "+" + std::to_string(std::max(1, lease_seconds)) + " seconds");
+        query.bind(2, type);
+        query.bind(3, std::max(1, max_count));
+        while (query.executeStep()) {
+            Job job;
+            job.id = query.getColumn(0).getInt();
+            job.type = query.getColumn(1).getText();
+            try { job.payload = diffusion_desk::json::parse(query.getColumn(2).getText()); } catch (...) {}
+            job.status = query.getColumn(3).getText();
+            job.error = query.getColumn(4).getText();
+            job.priority = query.getColumn(5).getInt();
+            job.created_at = query.getColumn(6).getText();
+            job.attempts = query.getColumn(7).getInt();
+            jobs.push_back(std::move(job));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[Database] claim_jobs failed: " << e.what() << std::endl;
+    }
+    // RETURNING order is unspecified
+    std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) {
+        if (a.priority != b.priority) return a.priority > b.priority;
+        if (a.created_at != b.created_at) return a.created_at < b.created_at;
+        return a.id < b.id;
+    });
+    return jobs;
+}
+
+void Database::retry_job(int id, const std::string& error, int delay_seconds) {
+    submit_write("retry_job", [this, id, error, delay_seconds]() -> int64_t {
+        auto query_lease = statement(R"(
+            UPDATE jobs SET status = 'pending', error = ?, lease_expires_at = NULL,
+                            available_at = datetime('now', ?), updated_at = CURRENT_TIMESTAMP
+            WHERE id = ?
+        )", "retry_job");
+        SQLite::Statement& query = *query_lease;
+        query.bind(1, error);
+        query.bind(2, "+" + std::to_string(std::max(0, delay_seconds)) + " seconds");
+        query.bind(3, id);
+        return query.exec();
+    });
+}
+
+int Database::recover_expired_jobs(const std::string& type, int max_attempts) {
+    flush_writes();
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    try {
+        auto query_lease = statement(R"(
+            UPDATE jobs SET status = CASE WHEN attempts >= ? THEN 'failed' ELSE 'pending' END,
+                            error = 'Lease expired', lease_expires_at = NULL, updated_at = CURRENT_TIMESTAMP
+            WHERE status = 'processing' AND type = ? AND lease_expires_at <= datetime('now')
+        )", __func__);
+        SQLite::Statement& query = *query_lease;
+        query.bind(1, max_attempts);
+        query.bind(2, type);
+        return query.exec();
+    } catch (const std::exception& e) {
+        std::cerr << "[Database] recover_expired_jobs failed: " << e.what() << std::endl;
+    }
+    return 0;
+}
+
+int Database::fail_unhandled_jobs(const std::vector<std::string>& handled_types) {
+    flush_writes();
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    try {
+        std::vector<std::string> unhandled;
+        {
+            auto types_lease = statement(R"(
+                SELECT type FROM jobs WHERE status = 'pending'
+                UNION
+                SELECT type FROM jobs WHERE status = 'processing' AND lease_expires_at <= datetime('now')
+            )", __func__);
+            SQLite::Statement& types = *types_lease;
+            while (types.executeStep()) {
+                std::string type = types.getColumn(0).getText();
+                if (std::find(handled_types.begin(), handled_types.end(), type) == handled_types.end()) {
+                    unhandled.push_back(std::move(type));
+                }
+            }
+        }
+        int failed = 0;
+        for (const auto& type : unhandled) {
+            auto query_lease = statement(R"(
+                UPDATE jobs SET status = 'failed', error = 'No handler for job type: ' || type,
+                                lease_expires_at = NULL, updated_at = CURRENT_TIMESTAMP
+                WHERE type = ? AND (status = 'pending' OR (status = 'processing' AND lease_expires_at <= datetime('now')))
+            )", __func__);
+            SQLite::Statement& query = *query_lease;
+            query.bind(1, type);
+            failed += query.exec();
+        }
+        return failed;
+    } catch (const std::exception& e) {
+        std::cerr << "[Database] fail_unhandled_jobs failed: " << e.what() << std::endl;
+    }
+    return 0;
 }
 
 std::optional<Job> Database::get_next_job() {
+    // The previous job's status updates may still be queued; they must land first
+    flush_writes();
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     try {
-        SQLite::Statement query(m_db, "SELECT id, type, payload, status, error, priority, created_at FROM jobs WHERE status = 'pending' ORDER BY priority DESC, created_at ASC LIMIT 1");
+        auto query_lease = statement("SELECT id, type, payload, status, error, priority, created_at FROM jobs WHERE status = 'pending' ORDER BY priority DESC, created_at ASC LIMIT 1", __func__);
+        SQLite::Statement& query = *query_lease;
         if (query.executeStep()) {
             Job job;
             job.id = query.getColumn(0).getInt();
@@ -746,39 +1819,41 @@ std::optional<Job> Database::get_next_job() {
 }
 
 void Database::update_job_status(int id, const std::string& status, const std::string& error) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    try {
+    submit_write("update_job_status", [this, id, status, error]() -> int64_t {
         std::string sql = "UPDATE jobs SET status = ?, updated_at = CURRENT_TIMESTAMP ";
         if (status == "completed") sql += ", completed_at = CURRENT_TIMESTAMP ";
         if (!error.empty()) sql += ", error = ? ";
         sql += "WHERE id = ?";
-        SQLite::Statement query(m_db, sql);
+        auto query_lease = statement(sql, "update_job_status");
+        SQLite::Statement& query = *query_lease;
         query.bind(1, status);
         if (!error.empty()) { query.bind(2, error); query.bind(3, id); } 
         else query.bind(2, id);
-        query.exec();
-    } catch (...) {}
+        return query.exec();
+    });
 }
 
 void Database::add_generation_file(int generation_id, const std::string& type, const std::string& path) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    try {
-        SQLite::Statement query(m_db, "INSERT INTO generation_files (generation_id, file_type, file_path) VALUES (?, ?, ?)");
+    submit_write("add_generation_file", [this, generation_id, type, path]() -> int64_t {
+        auto query_lease = statement("INSERT INTO generation_files (generation_id, file_type, file_path) VALUES (?, ?, ?)", "add_generation_file");
+        SQLite::Statement& query = *query_lease;
         query.bind(1, generation_id);
         query.bind(2, type);
         query.bind(3, path);
         query.exec();
-    } catch (...) {}
+        return m_db.getLastInsertRowid();
+    });
 }
 
 std::vector<std::string> Database::get_generation_files(int generation_id, const std::string& type) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto reader = acquire_reader();
     std::vector<std::string> results;
     try {
         std::string sql = "SELECT file_path FROM generation_files WHERE generation_id = ? ";
         if (!type.empty()) sql += "AND file_type = ? ";
         sql += "ORDER BY created_at ASC";
-        SQLite::Statement query(m_db, sql);
+        auto query_lease = reader.statement(sql, __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, generation_id);
         if (!type.empty()) query.bind(2, type);
         while (query.executeStep()) results.push_back(query.getColumn(0).getText());
@@ -786,6 +1861,145 @@ std::vector<std::string> Database::get_generation_files(int generation_id, const
     return results;
 }
 
+void Database::set_generation_file_path(int file_id, const std::string& path) {
+    submit_write("set_generation_file_path", [this, file_id, path]() -> int64_t {
+        auto query_lease = statement("UPDATE generation_files SET file_path = ? WHERE id = ?", "set_generation_file_path");
+        SQLite::Statement& query = *query_lease;
+        query.bind(1, path);
+        query.bind(2, file_id);
+        return query.exec();
+    });
+}
+
+std::vector<std::tuple<int, int, std::string, std::string>> Database::get_loose_thumbnails(int after_id, int limit) {
+    flush_writes();
+    auto reader = acquire_reader();
+    std::vector<std::tuple<int, int, std::string, std::string>> results;
+    try {
+        auto query_lease = reader.statement(R"(
+            SELECT id, generation_id, file_type, file_path FROM generation_files
+            WHERE id > ? AND file_type LIKE 'thumbnail%' AND file_path LIKE '/outputs/previews/%'
+            ORDER BY id LIMIT ?
+        )", __func__);
+        SQLite::Statement& query = *query_lease;
+        query.bind(1, after_id);
+        query.bind(2, limit);
+        while (query.executeStep()) {
+            results.emplace_back(query.getColumn(0).getInt(), query.getColumn(1).getInt(),
+                                 query.getColumn(2).getText(), query.getColumn(3).getText());
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[Database] get_loose_thumbnails failed: " << e.what() << std::endl;
+    }
+    return results;
+}
+
+bool Database::put_thumbnail_location(const ThumbnailLocation& location) {
+    auto done = submit_write("put_thumbnail_location", [this, location]() -> int64_t {
+        auto query_lease = statement(R"(
+            INSERT OR REPLACE INTO thumbnail_pack (generation_id, size, segment, offset, length)
+            VALUES (?, ?, ?, ?, ?)
+        )", "put_thumbnail_location");
+        SQLite::Statement& query = *query_lease;
+        query.bind(1, location.generation_id);
+        query.bind(2, location.size);
+        query.bind(3, location.segment);
+        query.bind(4, location.offset);
+        query.bind(5, location.length);
+        return query.exec();
+    });
+    return done.get() > 0;
+}
+
+static ThumbnailLocation read_thumbnail_location(SQLite::Statement& query) {
+    ThumbnailLocation location;
+    location.generation_id = query.getColumn(0).getInt();
+    location.size = query.getColumn(1).getInt();
+    location.segment = query.getColumn(2).getInt();
+    location.offset = query.getColumn(3).getInt64();
+    location.length = query.getColumn(4).getInt64();
+    return location;
+}
+
+std::vector<ThumbnailLocation> Database::get_thumbnail_locations(const std::vector<int>& generation_ids, int size) {
+    std::vector<ThumbnailLocation> results;
+    if (generation_ids.empty()) return results;
+    auto reader = acquire_reader();
+    try {
+        std::string sql = "SELECT generation_id, size, segment, offset, length FROM thumbnail_pack WHERE size = ? AND generation_id IN (";
+        for (size_t i = 0; i < generation_ids.size(); ++i) sql += (i == 0 ? "?" : ", ?");
+        sql += ")";
+        auto query_lease = reader.statement(sql, __func__);
+        SQLite::Statement& query = *query_lease;
+        query.bind(1, size);
+        int bind_idx = 2;
+        for (int id : generation_ids) query.bind(bind_idx++, id);
+        while (query.executeStep()) results.push_back(read_thumbnail_location(query));
+    } catch (const std::exception& e) {
+        std::cerr << "[Database] get_thumbnail_locations failed: " << e.what() << std::endl;
+    }
+    return results;
+}
+
+std::vector<ThumbnailLocation> Database::get_segment_thumbnails(int segment) {
+    flush_writes();
+    auto reader = acquire_reader();
+    std::vector<ThumbnailLocation> results;
+    try {
+        auto query_lease = reader.statement(
+            "SELECT generation_id, size, segment, offset, length FROM thumbnail_pack WHERE segment = ? ORDER BY offset", __func__);
+        SQLite::Statement& query = *query_lease;
+        query.bind(1, segment);
+        while (query.executeStep()) results.push_back(read_thumbnail_location(query));
+    } catch (const std::exception& e) {
+        std::cerr << "[Database] get_segment_thumbnails failed: " << e.what() << std::endl;
+    }
+    return results;
+}
+
+std::map<int, int64_t> Database::get_thumbnail_segment_usage() {
+    flush_writes();
+    auto reader = acquire_reader();
+    std::map<int, int64_t> usage;
+    try {
+        auto query_lease = reader.statement("SELECT segment, SUM(length) FROM thumbnail_pack GROUP BY segment", __func__);
+        SQLite::Statement& query = *query_lease;
+        while (query.executeStep()) usage[query.getColumn(0).getInt()] = query.getColumn(1).getInt64();
+    } catch (const std::exception& e) {
+        std::cerr << "[Database] get_thumbnail_segment_usage failed: " << e.what() << std::endl;
+    }
+    return usage;
+}
+
+int Database::relocate_thumbnails(const std::vector<std::pair<ThumbnailLocation, ThumbnailLocation>>& moves) {
+    flush_writes();
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    int moved = 0;
+    try {
+        SQLite::Transaction transaction(m_db);
+        auto query_lease = statement(R"(
+            UPDATE thumbnail_pack SET segment = ?, offset = ?
+            WHERE generation_id = ? AND size = ? AND segment = ? AND offset = ?
+        )", __func__);
+        SQLite::Statement& query = *query_lease;
+        for (const auto& [from, to] : moves) {
+            query.bind(1, to.segment);
+            query.bind(2, to.offset);
+            query.bind(3, from.generation_id);
+            query.bind(4, from.size);
+            query.bind(5, from.segment);
+            query.bind(6, from.offset);
+            moved += query.exec();
+            query.reset();
+        }
+        transaction.commit();
+    } catch (const std::exception& e) {
+        std::cerr << "[Database] relocate_thumbnails failed: " << e.what() << std::endl;
+        return 0;
+    }
+    return moved;
+}
+
 void Database::save_image_preset(const ImagePreset& p_in) {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     ImagePreset p = p_in;
@@ -798,12 +2012,13 @@ void Database::save_image_preset(const ImagePreset& p_in) {
         mem["stream_layers"] = p.memory_settings.stream_layers;
         p.preferred_params["memory"] = mem;
 
-        SQLite::Statement query(m_db, R"(
+        auto query_lease = statement(R"(
             INSERT OR REPLACE INTO image_presets (
                 id, name, unet_path, vae_path, clip_l_path, clip_g_path, t5xxl_path, llm_path, uncond_path,
                 vram_weights_mb_estimate, vram_weights_mb_measured, default_params, preferred_params
             ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
-        )");
+        )", __func__);
+        SQLite::Statement& query = *query_lease;
         if (p.id > 0) query.bind(1, p.id); else query.bind(1);
         query.bind(2, p.name);
         query.bind(3, p.unet_path);
@@ -822,10 +2037,11 @@ void Database::save_image_preset(const ImagePreset& p_in) {
 }
 
 diffusion_desk::json Database::get_image_presets() {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto reader = acquire_reader();
     diffusion_desk::json results = diffusion_desk::json::array();
     try {
-        SQLite::Statement query(m_db, "SELECT id, name, unet_path, vae_path, clip_l_path, clip_g_path, t5xxl_path, llm_path, uncond_path, vram_weights_mb_estimate, vram_weights_mb_measured, default_params, preferred_params FROM image_presets ORDER BY name ASC");
+        auto query_lease = reader.statement("SELECT id, name, unet_path, vae_path, clip_l_path, clip_g_path, t5xxl_path, llm_path, uncond_path, vram_weights_mb_estimate, vram_weights_mb_measured, default_params, preferred_params FROM image_presets ORDER BY name ASC", __func__);
+        SQLite::Statement& query = *query_lease;
         while (query.executeStep()) {
             diffusion_desk::json p_json;
             p_json["id"] = query.getColumn(0).getInt();
@@ -855,12 +2071,13 @@ void Database::delete_image_preset(int id) {
 void Database::save_llm_preset(const LlmPreset& p) {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     try {
-        SQLite::Statement query(m_db, R"(
+        auto query_lease = statement(R"(
             INSERT OR REPLACE INTO llm_presets (
                 id, name, model_path, mmproj_path, n_ctx, capabilities, role,
                 system_prompt_assistant, system_prompt_tagging, system_prompt_style
             ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
-        )");
+        )", __func__);
+        SQLite::Statement& query = *query_lease;
         if (p.id > 0) query.bind(1, p.id); else query.bind(1);
         query.bind(2, p.name);
         query.bind(3, p.model_path);
@@ -876,10 +2093,11 @@ void Database::save_llm_preset(const LlmPreset& p) {
 }
 
 diffusion_desk::json Database::get_llm_presets() {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto reader = acquire_reader();
     diffusion_desk::json results = diffusion_desk::json::array();
     try {
-        SQLite::Statement query(m_db, "SELECT id, name, model_path, mmproj_path, n_ctx, capabilities, role, system_prompt_assistant, system_prompt_tagging, system_prompt_style FROM llm_presets ORDER BY name ASC");
+        auto query_lease = reader.statement("SELECT id, name, model_path, mmproj_path, n_ctx, capabilities, role, system_prompt_assistant, system_prompt_tagging, system_prompt_style FROM llm_presets ORDER BY name ASC", __func__);
+        SQLite::Statement& query = *query_lease;
         while (query.executeStep()) {
             diffusion_desk::json p;
             p["id"] = query.getColumn(0).getInt();
@@ -906,7 +2124,8 @@ void Database::delete_llm_preset(int id) {
 void Database::save_model_metadata(const std::string& model_id, const diffusion_desk::json& metadata) {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     try {
-        SQLite::Statement query(m_db, "INSERT OR REPLACE INTO models (id, metadata, updated_at) VALUES (?, ?, CURRENT_TIMESTAMP)");
+        auto query_lease = statement("INSERT OR REPLACE INTO models (id, metadata, updated_at) VALUES (?, ?, CURRENT_TIMESTAMP)", __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, model_id);
         query.bind(2, metadata.dump());
         query.exec();
@@ -914,13 +2133,15 @@ void Database::save_model_metadata(const std::string& model_id, const diffusion_
 }
 
 diffusion_desk::json Database::get_model_metadata(const std::string& model_id) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto reader = acquire_reader();
     try {
-        SQLite::Statement query(m_db, "SELECT metadata FROM models WHERE id = ?");
+        auto query_lease = reader.statement("SELECT metadata FROM models WHERE id = ?", __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, model_id);
         if (query.executeStep()) return diffusion_desk::json::parse(query.getColumn(0).getText());
 
-        SQLite::Statement all_ids(m_db, "SELECT id, metadata FROM models");
+        auto all_ids_lease = reader.statement("SELECT id, metadata FROM models", __func__);
+        SQLite::Statement& all_ids = *all_ids_lease;
         std::string normalized_id = model_id;
         std::replace(normalized_id.begin(), normalized_id.end(), '\\', '/');
         while (all_ids.executeStep()) {
@@ -938,10 +2159,11 @@ diffusion_desk::json Database::get_model_metadata(const std::string& model_id) {
 }
 
 diffusion_desk::json Database::get_all_models_metadata() {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto reader = acquire_reader();
     diffusion_desk::json results = diffusion_desk::json::array();
     try {
-        SQLite::Statement query(m_db, "SELECT id, metadata FROM models ORDER BY id ASC");
+        auto query_lease = reader.statement("SELECT id, metadata FROM models ORDER BY id ASC", __func__);
+        SQLite::Statement& query = *query_lease;
         while (query.executeStep()) {
             diffusion_desk::json m;
             m["id"] = query.getColumn(0).getText();
@@ -953,18 +2175,19 @@ diffusion_desk::json Database::get_all_models_metadata() {
 }
 
 bool Database::generation_exists(const std::string& file_path) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto reader = acquire_reader();
     try {
-        SQLite::Statement check(m_db, "SELECT id FROM generations WHERE file_path = ?");
+        auto check_lease = reader.statement("SELECT id FROM generations WHERE file_path = ?", __func__);
+        SQLite::Statement& check = *check_lease;
         check.bind(1, file_path);
         return check.executeStep();
     } catch (...) { return false; }
 }
 
 int Database::insert_generation(const Generation& gen) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    try {
-        SQLite::Statement ins(m_db, "INSERT INTO generations (uuid, file_path, prompt, negative_prompt, seed, width, height, steps, cfg_scale, generation_time, model_hash, is_favorite, auto_tagged, rating, model_id, params_json) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    auto id = submit_write("insert_generation", [this, gen]() -> int64_t {
+        auto ins_lease = statement("INSERT INTO generations (uuid, file_path, prompt, negative_prompt, seed, width, height, steps, cfg_scale, generation_time, model_hash, is_favorite, auto_tagged, rating, model_id, params_json) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)", "insert_generation");
+        SQLite::Statement& ins = *ins_lease;
         ins.bind(1, gen.uuid);
         ins.bind(2, gen.file_path);
         ins.bind(3, gen.prompt);
@@ -982,8 +2205,9 @@ int Database::insert_generation(const Generation& gen) {
         ins.bind(15, gen.model_id);
         ins.bind(16, gen.params_json);
         ins.exec();
-        return (int)m_db.getLastInsertRowid();
-    } catch (...) { return -1; }
+        return m_db.getLastInsertRowid();
+    });
+    return (int)id.get();
 }
 
 void Database::insert_generation_with_tags(const Generation& gen, const std::vector<std::string>& tags) {
@@ -991,7 +2215,8 @@ void Database::insert_generation_with_tags(const Generation& gen, const std::vec
     try {
         SQLite::Transaction transaction(m_db);
         // Inlining insert_generation logic here to avoid double locking
-        SQLite::Statement ins(m_db, "INSERT INTO generations (uuid, file_path, prompt, negative_prompt, seed, width, height, steps, cfg_scale, generation_time, model_hash, is_favorite, auto_tagged, rating, model_id, params_json) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+        auto ins_lease = statement("INSERT INTO generations (uuid, file_path, prompt, negative_prompt, seed, width, height, steps, cfg_scale, generation_time, model_hash, is_favorite, auto_tagged, rating, model_id, params_json) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)", __func__);
+        SQLite::Statement& ins = *ins_lease;
         ins.bind(1, gen.uuid);
         ins.bind(2, gen.file_path);
         ins.bind(3, gen.prompt);
@@ -1012,13 +2237,16 @@ void Database::insert_generation_with_tags(const Generation& gen, const std::vec
 
         int64_t gen_id = m_db.getLastInsertRowid();
         for (const auto& tag : tags) {
-            SQLite::Statement ins_tag(m_db, "INSERT OR IGNORE INTO tags (name) VALUES (?)");
+            auto ins_tag_lease = statement("INSERT OR IGNORE INTO tags (name) VALUES (?)", __func__);
+            SQLite::Statement& ins_tag = *ins_tag_lease;
             ins_tag.bind(1, tag); ins_tag.exec();
-            SQLite::Statement get_tag_id(m_db, "SELECT id FROM tags WHERE name = ?");
+            auto get_tag_id_lease = statement("SELECT id FROM tags WHERE name = ?", __func__);
+            SQLite::Statement& get_tag_id = *get_tag_id_lease;
             get_tag_id.bind(1, tag);
             if (get_tag_id.executeStep()) {
                 int tag_id = get_tag_id.getColumn(0);
-                SQLite::Statement link(m_db, "INSERT OR IGNORE INTO image_tags (generation_id, tag_id, source) VALUES (?, ?, ?)");
+                auto link_lease = statement("INSERT OR IGNORE INTO image_tags (generation_id, tag_id, source) VALUES (?, ?, ?)", __func__);
+                SQLite::Statement& link = *link_lease;
                 link.bind(1, (int)gen_id); link.bind(2, tag_id); link.bind(3, "user"); link.exec();
             }
         }
@@ -1027,53 +2255,67 @@ void Database::insert_generation_with_tags(const Generation& gen, const std::vec
 }
 
 void Database::add_tag(const std::string& uuid, const std::string& tag, const std::string& source) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    try {
-        SQLite::Statement get_id(m_db, "SELECT id FROM generations WHERE uuid = ?");
-        get_id.bind(1, uuid);
-        if (!get_id.executeStep()) return;
-        int gen_id = get_id.getColumn(0);
-        add_tag_by_id(gen_id, tag, source); // This will re-lock if add_tag_by_id locks
-    } catch (...) {}
+    int gen_id = 0;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_mutex);
+        try {
+            auto get_id_lease = statement("SELECT id FROM generations WHERE uuid = ?", __func__);
+            SQLite::Statement& get_id = *get_id_lease;
+            get_id.bind(1, uuid);
+            if (!get_id.executeStep()) return;
+            gen_id = get_id.getColumn(0);
+        } catch (...) { return; }
+    }
+    add_tag_by_id(gen_id, tag, source);
+    flush_writes(); // User edits are read back right away
 }
 
 void Database::add_tag_by_id(int generation_id, const std::string& tag, const std::string& source) {
-    // This function is called by add_tag, which already holds the lock. 
-    // To avoid double locking, this function should not lock again.
-    // However, for simplicity and safety, it's made to handle its own lock if called directly.
-    // If add_tag calls this, it will attempt to double-lock.
-    // A better approach would be to have an internal non-locking version.
-    // For now, assuming add_tag is the primary caller and it holds the lock.
-    try {
-        SQLite::Statement ins_tag(m_db, "INSERT OR IGNORE INTO tags (name) VALUES (?)");
+    submit_write("add_tag_by_id", [this, generation_id, tag, source]() -> int64_t {
+        auto ins_tag_lease = statement("INSERT OR IGNORE INTO tags (name) VALUES (?)", "add_tag_by_id");
+        SQLite::Statement& ins_tag = *ins_tag_lease;
         ins_tag.bind(1, tag); ins_tag.exec();
-        SQLite::Statement get_tag_id(m_db, "SELECT id FROM tags WHERE name = ?");
+        auto get_tag_id_lease = statement("SELECT id FROM tags WHERE name = ?", "add_tag_by_id");
+        SQLite::Statement& get_tag_id = *get_tag_id_lease;
         get_tag_id.bind(1, tag);
         if (get_tag_id.executeStep()) {
             int tag_id = get_tag_id.getColumn(0);
-            SQLite::Statement link(m_db, "INSERT OR IGNORE INTO image_tags (generation_id, tag_id, source) VALUES (?, ?, ?)");
+            auto link_lease = statement("INSERT OR IGNORE INTO image_tags (generation_id, tag_id, source) VALUES (?, ?, ?)", "add_tag_by_id");
+            SQLite::Statement& link = *link_lease;
             link.bind(1, generation_id); link.bind(2, tag_id); link.bind(3, source); link.exec();
         }
-    } catch (...) {}
+        return 0;
+    });
 }
 
 void Database::remove_tag(const std::string& uuid, const std::string& tag) {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     try {
-        m_db.exec("DELETE FROM image_tags WHERE generation_id = (SELECT id FROM generations WHERE uuid = '" + uuid + "') AND tag_id = (SELECT id FROM tags WHERE name = '" + tag + "')");
+        auto query_lease = statement("DELETE FROM image_tags WHERE generation_id = (SELECT id FROM generations WHERE uuid = ?) AND tag_id = (SELECT id FROM tags WHERE name = ?)", __func__);
+        SQLite::Statement& query = *query_lease;
+        query.bind(1, uuid);
+        query.bind(2, tag);
+        query.exec();
     } catch (...) {}
 }
 
 void Database::delete_unused_tags() {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    try { m_db.exec("DELETE FROM tags WHERE id NOT IN (SELECT DISTINCT tag_id FROM image_tags)"); } catch (...) {}
+    // Triggers keep this empty in normal operation; it only catches tags created without
+    // ever being assigned. Served by idx_tags_usage rather than an image_tags scan.
+    try {
+        auto query_lease = statement("DELETE FROM tags WHERE usage_count <= 0", __func__);
+        query_lease->exec();
+    } catch (...) {}
 }
 
 std::vector<std::tuple<int, std::string, std::string, std::string>> Database::get_untagged_generations(int limit) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    flush_writes(); // Otherwise the last batch's mark_as_tagged may not be visible yet
+    auto reader = acquire_reader();
     std::vector<std::tuple<int, std::string, std::string, std::string>> results;
     try {
-        SQLite::Statement query(m_db, "SELECT id, uuid, prompt, file_path FROM generations WHERE auto_tagged = 0 AND prompt IS NOT NULL AND prompt != '' LIMIT ?");
+        auto query_lease = reader.statement("SELECT id, uuid, prompt, file_path FROM generations WHERE auto_tagged = 0 AND prompt IS NOT NULL AND prompt != '' LIMIT ?", __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, limit);
         while (query.executeStep()) results.emplace_back(query.getColumn(0).getInt(), query.getColumn(1).getText(), query.getColumn(2).getText(), query.getColumn(3).getText());
     } catch (...) {}
@@ -1081,14 +2323,19 @@ std::vector<std::tuple<int, std::string, std::string, std::string>> Database::ge
 }
 
 void Database::mark_as_tagged(int id) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    try { m_db.exec("UPDATE generations SET auto_tagged = 1 WHERE id = " + std::to_string(id)); } catch (...) {}
+    submit_write("mark_as_tagged", [this, id]() -> int64_t {
+        auto query_lease = statement("UPDATE generations SET auto_tagged = 1 WHERE id = ?", "mark_as_tagged");
+        SQLite::Statement& query = *query_lease;
+        query.bind(1, id);
+        return query.exec();
+    });
 }
 
 void Database::set_config(const std::string& key, const std::string& value) {
     std::lock_guard<std::recursive_mutex> lock(m_mutex);
     try {
-        SQLite::Statement query(m_db, "INSERT OR REPLACE INTO app_config (key, value) VALUES (?, ?)");
+        auto query_lease = statement("INSERT OR REPLACE INTO app_config (key, value) VALUES (?, ?)", __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, key);
         query.bind(2, value);
         query.exec();
@@ -1098,9 +2345,10 @@ void Database::set_config(const std::string& key, const std::string& value) {
 }
 
 std::string Database::get_config(const std::string& key) {
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto reader = acquire_reader();
     try {
-        SQLite::Statement query(m_db, "SELECT value FROM app_config WHERE key = ?");
+        auto query_lease = reader.statement("SELECT value FROM app_config WHERE key = ?", __func__);
+        SQLite::Statement& query = *query_lease;
         query.bind(1, key);
         if (query.executeStep()) {
             return query.getColumn(0).getText();
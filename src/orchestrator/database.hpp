@@ -1,12 +1,23 @@
 #pragma once
 
 #include "utils/common.hpp"
+#include "utils/image_resample.hpp"
 #include <SQLiteCpp/SQLiteCpp.h>
 #include <string>
 #include <memory>
 #include <vector>
 #include <optional>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <thread>
+#include <chrono>
+#include <map>
+#include <tuple>
+#include <unordered_map>
 
 namespace diffusion_desk {
 
@@ -29,6 +40,41 @@ struct Generation {
     std::string params_json;
 };
 
+// generation_files.file_type of a pyramid level. The default level keeps the original
+// "thumbnail" type, which is also what images thumbnailed before the pyramid have.
+std::string thumbnail_file_type(int size);
+// The level to serve for a requested display size: the smallest one at least that big
+int snap_thumbnail_size(int requested);
+
+// Where one thumbnail lives in the pack files (see ThumbnailPack)
+struct ThumbnailLocation {
+    int generation_id = 0;
+    int size = 0;       // Pyramid level
+    int segment = 0;    // Pack file number
+    int64_t offset = 0; // Of the encoded image within the segment
+    int64_t length = 0;
+};
+
+// Keys written per gallery item by write_generations_json, selected with the fields=
+// parameter of /v1/history/images. Unselected keys also skip their columns/subqueries.
+struct GenerationFields {
+    bool id = true;
+    bool internal_id = true; // "__internal_id"
+    bool name = true;
+    bool file_path = true;
+    bool timestamp = true;
+    bool params = true;
+    bool is_favorite = true;
+    bool rating = true;
+    bool tags = true;
+    bool thumbnail_path = true;
+    int thumbnail_size = DEFAULT_THUMBNAIL_SIZE; // Pyramid level thumbnail_path points at
+
+    // Parses a comma separated list such as "id,name,thumbnail_path". Returns false and
+    // names the offending entry in `error` for unknown fields.
+    static bool parse(const std::string& list, GenerationFields& out, std::string& error);
+};
+
 struct TagInfo {
     std::string name;
     std::string category;
@@ -59,6 +105,7 @@ struct Job {
     std::string error;
     int priority = 0;
     std::string created_at;
+    int attempts = 0; // Claims so far, including the current one
 };
 
 struct ImagePreset {
@@ -99,7 +146,9 @@ struct LlmPreset {
 
 class Database {
 public:
-    explicit Database(const std::string& db_path);
+    // reader_count: read-only WAL connections for queries; 0 picks one per core (2..8),
+    // a negative value keeps every query on the writer connection
+    explicit Database(const std::string& db_path, int reader_count = 0);
     ~Database();
 
     // Prevent copying
@@ -116,7 +165,13 @@ public:
     void remove_generation(const std::string& uuid);
     std::string get_generation_filepath(const std::string& uuid);
     diffusion_desk::json get_generations(int limit = 50, const std::string& cursor = "", const std::vector<std::string>& tags = {}, const std::string& model = "", int min_rating = 0);
-    diffusion_desk::json search_generations(const std::string& query, int limit = 50);
+    // Same page as get_generations(...).dump(), appended to `out` straight from the row
+    // cursor. The stored params_json is spliced in as text rather than parsed.
+    void write_generations_json(std::string& out, int limit, const std::string& cursor, const std::vector<std::string>& tags,
+                                const std::string& model, int min_rating, const GenerationFields& fields = {});
+    // Relevance-ranked (bm25) search over prompt, negative prompt and tags. Same page shape
+    // as get_generations; the cursor is "score|id" from the previous page's next_cursor.
+    diffusion_desk::json search_generations(const std::string& query, int limit = 50, const std::string& cursor = "");
     diffusion_desk::json get_tags();
     
     // Styles
@@ -133,11 +188,40 @@ public:
     // Job Queue
     int add_job(const std::string& type, const diffusion_desk::json& payload, int priority = 0);
     std::optional<Job> get_next_job();
+    // Atomically moves up to max_count runnable pending jobs of `type` to processing with a
+    // lease of lease_seconds, highest priority then oldest first
+    std::vector<Job> claim_jobs(const std::string& type, int max_count, int lease_seconds);
     void update_job_status(int id, const std::string& status, const std::string& error = "");
+    // Back to pending after a failed attempt; claimable again after delay_seconds
+    void retry_job(int id, const std::string& error, int delay_seconds);
+    // Requeues processing jobs of `type` whose lease ran out (the worker died or was killed).
+    // Jobs that already had max_attempts are failed instead. Returns how many were touched.
+    int recover_expired_jobs(const std::string& type, int max_attempts);
+    // Fails pending jobs, and processing ones whose lease ran out, of any type not in
+    // handled_types: nothing would ever claim them. Returns how many were failed.
+    int fail_unhandled_jobs(const std::vector<std::string>& handled_types);
+    // Invoked with the job type after add_job commits, so workers can wake immediately
+    void set_job_added_callback(std::function<void(const std::string&)> callback);
 
     // Asset Management
     void add_generation_file(int generation_id, const std::string& type, const std::string& path);
     std::vector<std::string> get_generation_files(int generation_id, const std::string& type = "");
+    void set_generation_file_path(int file_id, const std::string& path);
+    // Thumbnails still stored as loose files under /outputs/previews, in id order from after_id:
+    // (generation_files id, generation id, file_type, file_path)
+    std::vector<std::tuple<int, int, std::string, std::string>> get_loose_thumbnails(int after_id, int limit);
+
+    // Thumbnail pack index. Rows go away with their generation (ON DELETE CASCADE); the
+    // bytes they pointed at stay in the segment until compaction.
+    // Records a newly appended thumbnail, replacing any earlier copy. Waits for the commit.
+    bool put_thumbnail_location(const ThumbnailLocation& location);
+    std::vector<ThumbnailLocation> get_thumbnail_locations(const std::vector<int>& generation_ids, int size);
+    std::vector<ThumbnailLocation> get_segment_thumbnails(int segment);
+    // Referenced bytes per segment
+    std::map<int, int64_t> get_thumbnail_segment_usage();
+    // Points each moved thumbnail (first) at its new copy (second), skipping any whose row
+    // changed since it was read. Returns how many moved.
+    int relocate_thumbnails(const std::vector<std::pair<ThumbnailLocation, ThumbnailLocation>>& moves);
 
     // Presets
     void save_image_preset(const ImagePreset& preset);
@@ -177,10 +261,111 @@ public:
     void set_config(const std::string& key, const std::string& value);
     std::string get_config(const std::string& key);
 
+    // Group commit: insert_generation, add_job, update_job_status, add_generation_file,
+    // add_tag_by_id and mark_as_tagged go through a write queue, and writes arriving
+    // within `window` share one transaction. The id-returning calls wait for their
+    // commit; the others return immediately.
+    void set_write_batching(std::chrono::microseconds window, size_t max_batch);
+    // Blocks until every write queued so far is committed. Never call with m_mutex held.
+    void flush_writes();
+
+    // Diagnostics: prepare/reuse counts and prepare time per Database method
+    diffusion_desk::json get_statement_cache_stats();
+    diffusion_desk::json get_write_queue_stats();
+    // Every distinct SQL text prepared so far with the method that issued it (sql -> caller),
+    // so tooling can EXPLAIN exactly what the methods run
+    std::map<std::string, std::string> get_prepared_statements();
+
     // Accessor
     SQLite::Database& get_db() { return m_db; }
 
 private:
+    // Lease on a prepared statement owned by the cache. The statement is reset on
+    // release so a cached SELECT never pins a WAL read snapshot between calls.
+    class CachedStatement {
+    public:
+        CachedStatement(SQLite::Statement* stmt, std::unique_ptr<SQLite::Statement> owned, bool* in_use)
+            : m_stmt(stmt), m_owned(std::move(owned)), m_in_use(in_use) {}
+        CachedStatement(CachedStatement&& other) noexcept
+            : m_stmt(other.m_stmt), m_owned(std::move(other.m_owned)), m_in_use(other.m_in_use) {
+            other.m_stmt = nullptr;
+            other.m_in_use = nullptr;
+        }
+        CachedStatement(const CachedStatement&) = delete;
+        CachedStatement& operator=(const CachedStatement&) = delete;
+        ~CachedStatement();
+
+        SQLite::Statement& operator*() { return *m_stmt; }
+        SQLite::Statement* operator->() { return m_stmt; }
+
+    private:
+        SQLite::Statement* m_stmt;
+        std::unique_ptr<SQLite::Statement> m_owned; // Set when the cached copy was busy
+        bool* m_in_use;
+    };
+
+    struct StatementCacheEntry {
+        std::unique_ptr<SQLite::Statement> stmt;
+        uint64_t last_used = 0;
+        bool in_use = false;
+    };
+
+    // Statements belong to one connection, so every connection carries its own cache
+    struct StatementCache {
+        std::unordered_map<std::string, StatementCacheEntry> entries;
+        uint64_t clock = 0;
+    };
+
+    struct StatementStats {
+        uint64_t prepares = 0;
+        uint64_t reuses = 0;
+        double prepare_us = 0.0;
+    };
+
+    struct ReadConnection {
+        explicit ReadConnection(const std::string& db_path);
+        SQLite::Database db;
+        StatementCache cache; // Declared after db so statements are finalized first
+    };
+
+    // Exclusive use of one read-only connection. Queries run against a WAL snapshot,
+    // so they never wait for m_mutex. Falls back to the writer when no pool exists.
+    class ReaderLease {
+    public:
+        ReaderLease(Database* owner, ReadConnection* conn);
+        ReaderLease(ReaderLease&& other) noexcept;
+        ReaderLease(const ReaderLease&) = delete;
+        ReaderLease& operator=(const ReaderLease&) = delete;
+        ~ReaderLease();
+
+        CachedStatement statement(const std::string& sql, const char* caller);
+
+    private:
+        Database* m_owner;
+        ReadConnection* m_conn;
+        std::unique_lock<std::recursive_mutex> m_writer_lock; // Only held in fallback mode
+    };
+
+    // Returns the cached writer statement for `sql` (keyed by SQL text, so dynamically
+    // built queries are cached per shape), preparing it on first use.
+    // Must be called with m_mutex held, and the lease must not outlive the lock.
+    CachedStatement statement(const std::string& sql, const char* caller);
+    CachedStatement statement(SQLite::Database& db, StatementCache& cache, const std::string& sql, const char* caller);
+
+    struct PendingWrite {
+        const char* name;
+        std::function<int64_t()> op; // Runs on the write thread with m_mutex held
+        std::promise<int64_t> done;
+        uint64_t seq = 0;
+    };
+
+    std::future<int64_t> submit_write(const char* name, std::function<int64_t()> op);
+    void write_loop();
+
+    ReaderLease acquire_reader();
+    void release_reader(ReadConnection* conn);
+    void attach_thumbnails(ReaderLease& reader, diffusion_desk::json& items);
+
     int get_schema_version();
     void set_schema_version(int version);
 
@@ -192,9 +377,45 @@ private:
     void migrate_to_v5();
     void migrate_to_v6();
     void migrate_to_v7();
+    void migrate_to_v8();
+    void migrate_to_v9();
+    void migrate_to_v10();
+    void migrate_to_v11();
+    void migrate_to_v12();
 
-    SQLite::Database m_db;
+    SQLite::Database m_db;        // Single writer connection
     std::recursive_mutex m_mutex; // Protects access to m_db, recursive to allow nested calls
+
+    // Declared after m_db so cached statements are finalized before the connection closes
+    StatementCache m_stmt_cache;
+    std::map<std::string, StatementStats> m_stmt_stats;
+    std::map<std::string, std::string> m_prepared_sql; // Bounded by MAX_TRACKED_SQL
+    static constexpr size_t MAX_TRACKED_SQL = 1024;
+    std::mutex m_stats_mutex;
+    std::atomic<size_t> m_cached_statements{0};
+    static constexpr size_t STATEMENT_CACHE_CAPACITY = 128;
+
+    std::function<void(const std::string&)> m_job_added_callback;
+    std::mutex m_job_callback_mutex;
+
+    std::vector<std::unique_ptr<ReadConnection>> m_readers;
+    std::vector<ReadConnection*> m_idle_readers;
+    std::mutex m_readers_mutex;
+    std::condition_variable m_readers_cv;
+
+    std::deque<PendingWrite> m_write_queue;
+    std::mutex m_write_mutex;
+    std::condition_variable m_write_cv;      // New work or shutdown
+    std::condition_variable m_write_done_cv; // A batch was committed
+    uint64_t m_write_submitted = 0;
+    uint64_t m_write_completed = 0;
+    uint64_t m_write_batches = 0;
+    size_t m_write_largest_batch = 0;
+    std::chrono::microseconds m_write_window{2000};
+    size_t m_write_max_batch = 256;
+    static constexpr size_t MAX_PENDING_WRITES = 4096;
+    bool m_write_stop = false;
+    std::thread m_write_thread; // Started last in the constructor, joined in the destructor
 };
 
 } // namespace diffusion_desk
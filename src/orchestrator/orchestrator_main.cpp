@@ -19,6 +19,7 @@
 #include "proxy.hpp"
 #include "ws_manager.hpp"
 #include "database.hpp"
+#include "thumbnail_pack.hpp"
 #include "httplib.h"
 #include "services/health_service.hpp"
 #include "services/resource_manager.hpp"
@@ -42,6 +43,7 @@ static std::unique_ptr<diffusion_desk::TaggingService> g_tagging_svc;
 static std::unique_ptr<diffusion_desk::HealthService> g_health_svc;
 static std::unique_ptr<diffusion_desk::ImportService> g_import_svc;
 static std::shared_ptr<diffusion_desk::JobService> g_job_svc;
+static std::shared_ptr<diffusion_desk::ThumbnailPack> g_thumb_pack;
 static std::unique_ptr<diffusion_desk::ThumbnailService> g_thumb_svc;
 static std::string g_internal_token;
 static std::atomic<bool> is_shutting_down{false};
@@ -100,6 +102,8 @@ int run_orchestrator(int argc, const char** argv, SDSvrParams& svr_params) {
         g_ws_mgr = std::make_shared<diffusion_desk::WsManager>(svr_params.listen_port + WS_PORT_OFFSET, "127.0.0.1");
         g_tool_svc = std::make_shared<diffusion_desk::ToolService>(g_db, sd_port, llm_port, g_internal_token);
         g_controller = std::make_shared<diffusion_desk::ServiceController>(g_db, g_res_mgr, g_ws_mgr, g_tool_svc, svr_params, sd_port, llm_port, g_internal_token);
+        g_thumb_pack = std::make_shared<diffusion_desk::ThumbnailPack>(g_db, fs::path(svr_params.output_dir) / "previews");
+        g_controller->set_thumbnail_pack(g_thumb_pack);
         g_import_svc = std::make_unique<diffusion_desk::ImportService>(g_db);
         g_import_svc->auto_import_outputs(svr_params.output_dir);
     } catch (const std::exception& e) {
@@ -141,6 +145,16 @@ int run_orchestrator(int argc, const char** argv, SDSvrParams& svr_params) {
     sd_args.push_back("--listen-ip"); sd_args.push_back("127.0.0.1");
     // Ensure worker knows the correct model directory loaded from config
     sd_args.push_back("--model-dir"); sd_args.push_back(svr_params.model_dir);
+    sd_args.push_back("--encode-threads"); sd_args.push_back(std::to_string(svr_params.encode_threads));
+    sd_args.push_back("--image-cache-mb"); sd_args.push_back(std::to_string(svr_params.image_cache_mb));
+    sd_args.push_back("--context-cache-host-mb"); sd_args.push_back(std::to_string(svr_params.context_cache_host_mb));
+    sd_args.push_back("--context-cache-vram-mb"); sd_args.push_back(std::to_string(svr_params.context_cache_vram_mb));
+    sd_args.push_back("--generation-batch-images"); sd_args.push_back(std::to_string(svr_params.generation_batch_images));
+    sd_args.push_back("--generation-batch-window-ms"); sd_args.push_back(std::to_string(svr_params.generation_batch_window_ms));
+    sd_args.push_back("--generation-aging-s"); sd_args.push_back(std::to_string(svr_params.generation_aging_s));
+    sd_args.push_back("--generation-job-retention"); sd_args.push_back(std::to_string(svr_params.generation_job_retention_count));
+    sd_args.push_back("--generation-job-retention-s"); sd_args.push_back(std::to_string(svr_params.generation_job_retention_s));
+    sd_args.push_back("--fsync"); sd_args.push_back(svr_params.fsync_policy);
     
     if (!passed_sd_model_arg.empty()) {
         sd_args.push_back("--diffusion-model");
@@ -165,7 +179,8 @@ int run_orchestrator(int argc, const char** argv, SDSvrParams& svr_params) {
     g_health_svc->set_model_state_callbacks([]() { return g_controller->get_last_sd_model_req(); }, []() { return g_controller->get_last_llm_model_req(); });
     g_health_svc->start();
     g_job_svc = std::make_shared<diffusion_desk::JobService>(g_db);
-    g_thumb_svc = std::make_unique<diffusion_desk::ThumbnailService>(g_job_svc, g_db);
+    g_thumb_svc = std::make_unique<diffusion_desk::ThumbnailService>(g_job_svc, g_db, g_thumb_pack);
+    for (const auto& [type, workers] : svr_params.job_workers) g_job_svc->set_workers(type, workers);
     g_job_svc->start();
     g_tagging_svc = std::make_unique<diffusion_desk::TaggingService>(g_db, llm_port, svr_params.listen_port, g_internal_token, svr_params.tagger_system_prompt);
     g_tagging_svc->set_model_provider([]() { return g_controller->get_last_llm_model_req(); });
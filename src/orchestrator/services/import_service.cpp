@@ -1,5 +1,7 @@
 #include "import_service.hpp"
 #include "utils/common.hpp"
+#include "utils/png_text.hpp"
+#include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
@@ -42,22 +44,46 @@ void ImportService::auto_import_outputs(const std::string& output_dir) {
                         double gen_time = 0.0;
                         std::string params_json = "";
 
+                        auto from_json = [&](const std::string& raw_json) {
+                            auto j = diffusion_desk::json::parse(raw_json);
+                            prompt = j.value("prompt", "");
+                            neg_prompt = j.value("negative_prompt", "");
+                            seed = j.value("seed", 0LL);
+                            width = j.value("width", 512);
+                            height = j.value("height", 512);
+                            steps = j.value("steps", 20);
+                            cfg = j.value("cfg_scale", 7.0f);
+                            gen_time = j.value("generation_time", 0.0);
+                            params_json = raw_json;
+                        };
+
+                        // Parameters embedded in the PNG come first: reading them touches
+                        // only the chunks ahead of the pixel data
+                        std::map<std::string, std::string> png_text;
+                        if (ext == ".png") png_text = png_read_text_file(path);
+                        auto embedded_json = png_text.find(PNG_PARAMS_JSON_KEY);
+                        auto parameters = png_text.find(PNG_PARAMETERS_KEY);
+
                         auto json_path = path;
                         json_path.replace_extension(".json");
-                        if (fs::exists(json_path)) {
+                        if (embedded_json != png_text.end()) {
+                            try { from_json(embedded_json->second); } catch(...) {}
+                        } else if (parameters != png_text.end()) {
+                            // Written by another tool (A1111 and compatible)
+                            try {
+                                auto p = parse_image_params(parameters->second);
+                                prompt = p.value("prompt", "");
+                                neg_prompt = p.value("negative_prompt", "");
+                                if (p.contains("Seed")) seed = std::stoll(p["Seed"].get<std::string>());
+                                if (p.contains("Steps")) steps = std::stoi(p["Steps"].get<std::string>());
+                                if (p.contains("CFG scale")) cfg = std::stof(p["CFG scale"].get<std::string>());
+                                if (p.contains("Time")) gen_time = std::stod(p["Time"].get<std::string>());
+                                if (p.contains("Size")) std::sscanf(p["Size"].get<std::string>().c_str(), "%dx%d", &width, &height);
+                            } catch(...) {}
+                        } else if (fs::exists(json_path)) {
                             try {
                                 std::ifstream f(json_path);
-                                std::string raw_json((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
-                                auto j = diffusion_desk::json::parse(raw_json);
-                                prompt = j.value("prompt", "");
-                                neg_prompt = j.value("negative_prompt", "");
-                                seed = j.value("seed", 0LL);
-                                width = j.value("width", 512);
-                                height = j.value("height", 512);
-                                steps = j.value("steps", 20);
-                                cfg = j.value("cfg_scale", 7.0f);
-                                gen_time = j.value("generation_time", 0.0);
-                                params_json = raw_json;
+                                from_json(std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>()));
                             } catch(...) {}
                         } else {
                             auto txt_path = path;
@@ -1,10 +1,13 @@
 #include "job_service.hpp"
 #include "../utils/common.hpp" // For logging macros if available, or use iostream
 #include <iostream>
+#include <algorithm>
 #include <chrono>
 
 namespace diffusion_desk {
 
+constexpr std::chrono::seconds JobService::RECOVERY_INTERVAL;
+
 JobService::JobService(std::shared_ptr<Database> db) : m_db(db) {}
 
 JobService::~JobService() {
@@ -14,75 +17,182 @@ JobService::~JobService() {
 void JobService::start() {
     if (m_running) return;
     m_running = true;
-    m_thread = std::thread(&JobService::loop, this);
-    std::cout << "[JobService] Started background worker thread." << std::endl;
+
+    // Jobs orphaned by a crash are claimable again before the first worker looks
+    recover_expired();
+    m_db->set_job_added_callback([this](const std::string& type) { notify(type); });
+
+    std::lock_guard<std::mutex> lock(m_handlers_mutex);
+    for (auto& [type, queue] : m_queues) {
+        auto it = m_worker_overrides.find(type);
+        if (it != m_worker_overrides.end()) queue->options.workers = it->second;
+        start_workers(*queue);
+    }
+    std::cout << "[JobService] Started workers for " << m_queues.size() << " job type(s)." << std::endl;
 }
 
 void JobService::stop() {
     if (!m_running) return;
     m_running = false;
-    if (m_thread.joinable()) {
-        m_thread.join();
+    m_db->set_job_added_callback(nullptr);
+
+    // Joined without m_handlers_mutex held; workers take it to broadcast recoveries
+    std::vector<JobQueue*> queues;
+    {
+        std::lock_guard<std::mutex> lock(m_handlers_mutex);
+        for (auto& [type, queue] : m_queues) queues.push_back(queue.get());
+    }
+    for (JobQueue* queue : queues) {
+        {
+            std::lock_guard<std::mutex> queue_lock(queue->mutex);
+            queue->signaled = true;
+        }
+        queue->cv.notify_all();
+        for (auto& worker : queue->workers) {
+            if (worker.joinable()) worker.join();
+        }
+        queue->workers.clear();
     }
     std::cout << "[JobService] Stopped." << std::endl;
 }
 
-void JobService::register_handler(const std::string& job_type, JobHandler handler) {
+void JobService::register_handler(const std::string& job_type, JobHandler handler, JobTypeOptions options) {
     std::lock_guard<std::mutex> lock(m_handlers_mutex);
-    m_handlers[job_type] = handler;
-    std::cout << "[JobService] Registered handler for job type: " << job_type << std::endl;
+    auto& queue = m_queues[job_type];
+    if (queue) {
+        // Replacing a handler keeps the running workers; they pick it up per job
+        std::lock_guard<std::mutex> queue_lock(queue->mutex);
+        queue->handler = handler;
+    } else {
+        queue = std::make_unique<JobQueue>();
+        queue->type = job_type;
+        queue->handler = handler;
+        queue->options = options;
+        if (m_running) start_workers(*queue);
+    }
+    std::cout << "[JobService] Registered handler for job type: " << job_type
+              << " (" << queue->options.workers << " worker(s))" << std::endl;
+}
+
+void JobService::set_workers(const std::string& job_type, int workers) {
+    std::lock_guard<std::mutex> lock(m_handlers_mutex);
+    m_worker_overrides[job_type] = std::max(1, workers);
+}
+
+void JobService::notify(const std::string& job_type) {
+    JobQueue* queue = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_handlers_mutex);
+        auto it = m_queues.find(job_type);
+        if (it == m_queues.end()) return;
+        queue = it->second.get();
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->signaled = true;
+    }
+    queue->cv.notify_all();
+}
+
+void JobService::start_workers(JobQueue& queue) {
+    int count = std::max(1, queue.options.workers);
+    for (int i = 0; i < count; ++i) {
+        queue.workers.emplace_back(&JobService::worker_loop, this, std::ref(queue));
+    }
+}
+
+void JobService::recover_expired() {
+    {
+        std::lock_guard<std::mutex> lock(m_recovery_mutex);
+        auto now = std::chrono::steady_clock::now();
+        if (m_last_recovery.time_since_epoch().count() != 0 && now - m_last_recovery < RECOVERY_INTERVAL) return;
+        m_last_recovery = now;
+    }
+    // Each type against its own attempt limit; nothing claims a type without a handler, so
+    // its jobs are failed here as process_job used to
+    std::vector<std::pair<std::string, int>> types;
+    {
+        std::lock_guard<std::mutex> lock(m_handlers_mutex);
+        for (const auto& [type, queue] : m_queues) types.emplace_back(type, queue->options.max_attempts);
+    }
+    std::vector<std::string> handled;
+    for (const auto& [type, max_attempts] : types) {
+        handled.push_back(type);
+        int recovered = m_db->recover_expired_jobs(type, max_attempts);
+        if (recovered > 0) {
+            std::cout << "[JobService] Recovered " << recovered << " " << type << " job(s) with expired leases." << std::endl;
+            notify(type);
+        }
+    }
+    int unhandled = m_db->fail_unhandled_jobs(handled);
+    if (unhandled > 0) {
+        std::cerr << "[JobService] Failed " << unhandled << " job(s) with no handler for their type." << std::endl;
+    }
 }
 
-void JobService::loop() {
+void JobService::worker_loop(JobQueue& queue) {
     while (m_running) {
         try {
-            auto job_opt = m_db->get_next_job();
-            if (job_opt) {
-                process_job(*job_opt);
-            } else {
-                // No jobs, sleep for a bit
-                // We can make this adaptive or event-driven later if needed
-                std::this_thread::sleep_for(std::chrono::seconds(2));
+            auto jobs = m_db->claim_jobs(queue.type, queue.options.batch_size, queue.options.lease_seconds);
+            if (!jobs.empty()) {
+                // A claimed batch is finished even when stopping; leases would hold it otherwise
+                for (const auto& job : jobs) process_job(queue, job);
+                continue;
             }
+
+            // Idle: sleep until add_job signals, a retry comes due, or the next lease sweep
+            {
+                std::unique_lock<std::mutex> lock(queue.mutex);
+                auto wake = std::chrono::steady_clock::now() + RECOVERY_INTERVAL;
+                if (!queue.retries_due.empty()) wake = std::min(wake, queue.retries_due.top());
+                queue.cv.wait_until(lock, wake, [&] { return !m_running || queue.signaled; });
+                queue.signaled = false;
+                auto now = std::chrono::steady_clock::now();
+                while (!queue.retries_due.empty() && queue.retries_due.top() <= now) queue.retries_due.pop();
+            }
+            recover_expired();
         } catch (const std::exception& e) {
-            std::cerr << "[JobService] Error in job loop: " << e.what() << std::endl;
+            std::cerr << "[JobService] Error in " << queue.type << " worker: " << e.what() << std::endl;
             std::this_thread::sleep_for(std::chrono::seconds(5));
         }
     }
 }
 
-void JobService::process_job(const Job& job) {
-    std::cout << "[JobService] Processing Job ID " << job.id << " (Type: " << job.type << ")" << std::endl;
-    
-    // Mark as processing
-    m_db->update_job_status(job.id, "processing");
+void JobService::process_job(JobQueue& queue, const Job& job) {
+    std::cout << "[JobService] Processing Job ID " << job.id << " (Type: " << job.type
+              << ", attempt " << job.attempts << ")" << std::endl;
 
-    JobHandler handler = nullptr;
+    JobHandler handler;
     {
-        std::lock_guard<std::mutex> lock(m_handlers_mutex);
-        auto it = m_handlers.find(job.type);
-        if (it != m_handlers.end()) {
-            handler = it->second;
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        handler = queue.handler;
+    }
+
+    std::string error;
+    try {
+        if (handler(job.payload)) {
+            m_db->update_job_status(job.id, "completed");
+            std::cout << "[JobService] Job ID " << job.id << " completed successfully." << std::endl;
+            return;
         }
+        error = "Handler returned false";
+    } catch (const std::exception& e) {
+        error = e.what();
     }
 
-    if (handler) {
-        try {
-            bool success = handler(job.payload);
-            if (success) {
-                m_db->update_job_status(job.id, "completed");
-                std::cout << "[JobService] Job ID " << job.id << " completed successfully." << std::endl;
-            } else {
-                m_db->update_job_status(job.id, "failed", "Handler returned false");
-                std::cerr << "[JobService] Job ID " << job.id << " failed." << std::endl;
-            }
-        } catch (const std::exception& e) {
-            m_db->update_job_status(job.id, "failed", e.what());
-            std::cerr << "[JobService] Job ID " << job.id << " threw exception: " << e.what() << std::endl;
+    if (job.attempts < queue.options.max_attempts) {
+        int shift = std::min(job.attempts - 1, 16);
+        int delay = std::min(queue.options.retry_max_seconds, queue.options.retry_base_seconds << std::max(0, shift));
+        m_db->retry_job(job.id, error, delay);
+        {
+            // available_at has one-second resolution, so look again a second later
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.retries_due.push(std::chrono::steady_clock::now() + std::chrono::seconds(delay + 1));
         }
+        std::cerr << "[JobService] Job ID " << job.id << " failed (" << error << "), retrying in " << delay << "s." << std::endl;
     } else {
-        m_db->update_job_status(job.id, "failed", "No handler for job type: " + job.type);
-        std::cerr << "[JobService] No handler for job type: " << job.type << std::endl;
+        m_db->update_job_status(job.id, "failed", error);
+        std::cerr << "[JobService] Job ID " << job.id << " failed after " << job.attempts << " attempt(s): " << error << std::endl;
     }
 }
 
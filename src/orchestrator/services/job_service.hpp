@@ -3,13 +3,26 @@
 #include "../database.hpp"
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <queue>
+#include <vector>
 
 namespace diffusion_desk {
 
+struct JobTypeOptions {
+    int workers = 1;             // Threads running jobs of this type
+    int batch_size = 4;          // Jobs claimed per database round trip (1 for slow handlers: a claimed batch runs serially on one worker)
+    int lease_seconds = 300;     // A claimed job not finished by then counts as abandoned
+    int max_attempts = 3;
+    int retry_base_seconds = 2;  // Backoff doubles with every failed attempt...
+    int retry_max_seconds = 300; // ...up to this
+};
+
 class JobService {
 public:
     using JobHandler = std::function<bool(const diffusion_desk::json&)>;
@@ -20,17 +33,42 @@ public:
     void start();
     void stop();
 
-    void register_handler(const std::string& job_type, JobHandler handler);
+    void register_handler(const std::string& job_type, JobHandler handler, JobTypeOptions options = {});
+    // Overrides the worker count of a job type (from config); takes effect on start()
+    void set_workers(const std::string& job_type, int workers);
+
+    // Wakes the workers of a job type; Database calls this after add_job commits
+    void notify(const std::string& job_type);
 
 private:
-    void loop();
-    void process_job(const Job& job);
+    struct JobQueue {
+        std::string type;
+        JobHandler handler;
+        JobTypeOptions options;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool signaled = false; // A job arrived since the workers last looked
+        // When retried jobs become claimable, soonest first
+        std::priority_queue<std::chrono::steady_clock::time_point, std::vector<std::chrono::steady_clock::time_point>,
+                            std::greater<std::chrono::steady_clock::time_point>> retries_due;
+        std::vector<std::thread> workers;
+    };
+
+    void start_workers(JobQueue& queue);
+    void worker_loop(JobQueue& queue);
+    void process_job(JobQueue& queue, const Job& job);
+    void recover_expired();
 
     std::shared_ptr<Database> m_db;
     std::atomic<bool> m_running{false};
-    std::thread m_thread;
-    std::map<std::string, JobHandler> m_handlers;
+    std::map<std::string, std::unique_ptr<JobQueue>> m_queues;
+    std::map<std::string, int> m_worker_overrides;
     std::mutex m_handlers_mutex;
+
+    // Expired leases are swept at start and then at most this often by an idle worker
+    static constexpr std::chrono::seconds RECOVERY_INTERVAL{30};
+    std::mutex m_recovery_mutex;
+    std::chrono::steady_clock::time_point m_last_recovery;
 };
 
 } // namespace diffusion_desk
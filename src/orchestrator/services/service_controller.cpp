@@ -1,11 +1,15 @@
 #include "service_controller.hpp"
 #include "proxy.hpp"
 #include "sd/api_utils.hpp"
+#include "utils/file_server.hpp"
 #include <algorithm>
 #include <cctype>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <regex>
+#include <sstream>
+#include <thread>
 
 namespace diffusion_desk {
 
@@ -54,6 +58,80 @@ bool is_ideogram4_sd_request(const std::string& model_id, const diffusion_desk::
     return false;
 }
 
+// Upper bound on ids per /v1/thumbnails request; a gallery page is far smaller
+constexpr size_t MAX_THUMBNAIL_BATCH = 500;
+
+// Streams packed thumbnails as multipart/form-data straight from their mappings. The part
+// headers are built up front so the total length is known and httplib can send a
+// Content-Length instead of chunking.
+void write_multipart_thumbnails(httplib::Response& res, std::vector<ThumbnailPack::Record> records) {
+    struct Body {
+        std::vector<ThumbnailPack::Record> records;
+        std::vector<std::string> heads; // Headers before each record; one more closes the body
+        std::vector<size_t> starts;     // Offset of every piece, heads and records interleaved
+        size_t length = 0;
+    };
+    auto body = std::make_shared<Body>();
+    body->records = std::move(records);
+    const std::string boundary = "dd-thumbs-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    for (const auto& record : body->records) {
+        const std::string id = std::to_string(record.location.generation_id);
+        body->heads.push_back((body->heads.empty() ? "" : "\r\n") + std::string("--") + boundary + "\r\n"
+            "Content-Disposition: form-data; name=\"" + id + "\"; filename=\"" + id + ".jpg\"\r\n"
+            "Content-Type: image/jpeg\r\n\r\n");
+    }
+    body->heads.push_back((body->heads.empty() ? "" : "\r\n") + std::string("--") + boundary + "--\r\n");
+    for (size_t i = 0; i < body->heads.size(); ++i) {
+        body->starts.push_back(body->length);
+        body->length += body->heads[i].size();
+        if (i < body->records.size()) {
+            body->starts.push_back(body->length);
+            body->length += body->records[i].size();
+        }
+    }
+
+    res.set_content_provider(body->length, "multipart/form-data; boundary=" + boundary,
+        [body](size_t offset, size_t count, httplib::DataSink& sink) {
+            // Piece 2k is heads[k], piece 2k+1 is records[k]
+            size_t piece = size_t(std::upper_bound(body->starts.begin(), body->starts.end(), offset) - body->starts.begin()) - 1;
+            const size_t end = std::min(body->length, offset + count);
+            while (offset < end) {
+                const char* data = piece % 2 == 0 ? body->heads[piece / 2].data() : body->records[piece / 2].data();
+                const size_t piece_end = piece + 1 < body->starts.size() ? body->starts[piece + 1] : body->length;
+                const size_t n = std::min(end, piece_end) - offset;
+                if (!sink.write(data + (offset - body->starts[piece]), n)) return false;
+                offset += n;
+                piece++;
+            }
+            return true;
+        });
+}
+
+// Runs a preview render as a background job on the SD worker, so it waits for the user's own
+// requests (and is preempted by them) instead of competing for the model. Returns the
+// generation response, or null if the job failed, was cancelled or took too long.
+diffusion_desk::json run_background_generation(httplib::Client& cli, const httplib::Headers& headers, diffusion_desk::json req) {
+    req["priority"] = "background";
+    auto submitted = cli.Post("/v1/generation-jobs", headers, req.dump(), "application/json");
+    if (!submitted || submitted->status != 202) return nullptr;
+    const std::string job_id = diffusion_desk::json::parse(submitted->body).value("id", "");
+    if (job_id.empty()) return nullptr;
+
+    // Polled rather than streamed: the job may sit in the queue for a long time
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::minutes(30);
+    while (std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        auto status = cli.Get("/v1/generation-jobs/" + job_id, headers);
+        if (!status || status->status != 200) return nullptr;
+        auto job = diffusion_desk::json::parse(status->body);
+        const std::string state = job.value("status", "");
+        if (state == "completed") return job["result"];
+        if (state == "failed" || state == "cancelled") return nullptr;
+    }
+    cli.Post("/v1/generation-jobs/" + job_id + "/cancel", headers, "", "application/json");
+    return nullptr;
+}
+
 }
 
 ServiceController::ServiceController(std::shared_ptr<Database> db,
@@ -108,9 +186,8 @@ void ServiceController::generate_style_preview(Style style, std::string output_d
         req["n"] = 1;
         req["save_image"] = false; 
 
-        auto res = cli.Post("/v1/images/generations", h, req.dump(), "application/json");
-        if (res && res->status == 200) {
-            auto j = diffusion_desk::json::parse(res->body);
+        auto j = run_background_generation(cli, h, req);
+        if (j.is_object()) {
             if (j.contains("data") && !j["data"].empty()) {
                 std::string url = j["data"][0].value("url", "");
                 if (!url.empty()) {
@@ -128,9 +205,8 @@ void ServiceController::generate_style_preview(Style style, std::string output_d
                     }
                     fs::path source_path = fs::path(output_dir) / rel_path;
 
-                    if (fs::exists(source_path)) {
-                        fs::copy_file(source_path, filepath, fs::copy_options::overwrite_existing);
-
+                    // Replaced by rename: the old preview may be mid-download
+                    if (materialize_image(source_path.string()) && copy_file_replacing(source_path, filepath)) {
                         style.preview_path = "/outputs/previews/" + filepath.filename().string();
                         if (m_db) m_db->save_style(style);
                     }
@@ -175,9 +251,8 @@ void ServiceController::generate_model_preview(std::string model_id, std::string
         req["n"] = 1;
         req["save_image"] = false;
 
-        auto res = cli.Post("/v1/images/generations", h, req.dump(), "application/json");
-        if (res && res->status == 200) {
-            auto j = diffusion_desk::json::parse(res->body);
+        auto j = run_background_generation(cli, h, req);
+        if (j.is_object()) {
             if (j.contains("data") && !j["data"].empty()) {
                 std::string url = j["data"][0].value("url", "");
                 if (!url.empty()) {
@@ -200,9 +275,8 @@ void ServiceController::generate_model_preview(std::string model_id, std::string
                     }
                     fs::path source_path = fs::path(output_dir) / rel_path;
 
-                    if (fs::exists(source_path)) {
-                        fs::copy_file(source_path, filepath, fs::copy_options::overwrite_existing);
-
+                    // Replaced by rename: the old preview may be mid-download
+                    if (materialize_image(source_path.string()) && copy_file_replacing(source_path, filepath)) {
                         meta["preview_path"] = "/outputs/previews/" + filepath.filename().string();
                         m_db->save_model_metadata(model_id, meta);
                     }
@@ -627,7 +701,11 @@ void ServiceController::register_routes(httplib::Server& svr) {
         GenActiveGuard gen_guard(m_generation_active_cb);
 
         DD_LOG_INFO("Request: POST /v1/images/generations");
-        std::string modified_body = req.body;
+        // Multipart requests carry the JSON in a "params" field next to the image files, which
+        // are forwarded untouched
+        const bool multipart = req.is_multipart_form_data();
+        const std::string params_body = multipart ? (req.form.has_field("params") ? req.form.get_field("params") : "{}") : req.body;
+        std::string modified_body = params_body;
         
         // 1. Ensure Model is Loaded (Lazy Load)
         diffusion_desk::json requested_config;
@@ -636,7 +714,7 @@ void ServiceController::register_routes(httplib::Server& svr) {
 
         // Check if request body overrides model
         try {
-            auto j_req = diffusion_desk::json::parse(req.body);
+            auto j_req = diffusion_desk::json::parse(params_body);
             if (j_req.contains("model_id")) {
                 requested_model_id = j_req["model_id"];
                 requested_config["model_id"] = requested_model_id;
@@ -678,7 +756,7 @@ void ServiceController::register_routes(httplib::Server& svr) {
         bool req_hires = false;
         float req_hires_factor = 2.0f;
         try {
-            auto j = diffusion_desk::json::parse(req.body);
+            auto j = diffusion_desk::json::parse(params_body);
             req_width = j.value("width", 512);
             req_height = j.value("height", 512);
             req_batch = j.value("n", 1);
@@ -740,8 +818,22 @@ void ServiceController::register_routes(httplib::Server& svr) {
             modified_body = j.dump();
         } catch(...) {}
 
+        // Every result of this route is recorded below, so the worker writes its thumbnails.
+        // Only the forwarded copy carries the flag; modified_body is stored with the image.
+        std::string forwarded_body = modified_body;
+        try {
+            auto j = diffusion_desk::json::parse(modified_body);
+            j["write_thumbnails"] = true;
+            forwarded_body = j.dump();
+        } catch(...) {}
+
         httplib::Request mod_req = req;
-        mod_req.body = modified_body;
+        if (multipart) {
+            auto params_field = mod_req.form.fields.find("params");
+            if (params_field != mod_req.form.fields.end()) params_field->second.content = forwarded_body;
+        } else {
+            mod_req.body = forwarded_body;
+        }
         Proxy::forward_request(mod_req, res, "127.0.0.1", m_sd_port, "", m_token);
         
         // 4. Uncommit VRAM
@@ -790,7 +882,16 @@ void ServiceController::register_routes(httplib::Server& svr) {
                                 }
                             }
                             int gen_id = m_db->insert_generation(gen);
-                            if (gen_id > 0) {
+                            const auto thumbnails = item.value("thumbnails", diffusion_desk::json::object());
+                            if (gen_id > 0 && thumbnails.is_object() && !thumbnails.empty()) {
+                                // The worker already wrote the pyramid from the in-memory image
+                                for (const auto& [size, url] : thumbnails.items()) {
+                                    if (url.is_string()) m_db->add_generation_file(gen_id, thumbnail_file_type(std::stoi(size)), url.get<std::string>());
+                                }
+                                if (m_thumb_pack && m_thumb_pack->request_packing()) {
+                                    m_db->add_job("pack_thumbnails", {{"after_id", 0}}, 1);
+                                }
+                            } else if (gen_id > 0) {
                                 diffusion_desk::json job_payload;
                                 job_payload["generation_id"] = gen_id;
                                 job_payload["image_path"] = gen.file_path;
@@ -923,18 +1024,30 @@ void ServiceController::register_routes(httplib::Server& svr) {
         auto count = req.get_param_value_count("tag");
         for (size_t i = 0; i < count; ++i) tags.push_back(req.get_param_value("tag", i));
         std::string model = req.has_param("model") ? req.get_param_value("model") : "";
-        res.set_content(m_db->get_generations(limit, cursor, tags, model, min_rating).dump(), "application/json");
+        GenerationFields fields;
+        if (req.has_param("fields")) {
+            std::string error;
+            if (!GenerationFields::parse(req.get_param_value("fields"), fields, error)) {
+                res.status = 400;
+                res.set_content(diffusion_desk::json({{"error", error}}).dump(), "application/json");
+                return;
+            }
+        }
+        // Display size of a grid cell in device pixels; picks the thumbnail pyramid level
+        if (req.has_param("thumb_size")) fields.thumbnail_size = snap_thumbnail_size(std::stoi(req.get_param_value("thumb_size")));
+        // Serialized straight from the query; moved into the response without a copy
+        std::string body;
+        m_db->write_generations_json(body, limit, cursor, tags, model, min_rating, fields);
+        res.set_content(std::move(body), "application/json");
     });
 
     svr.Get("/v1/history/search", [this](const httplib::Request& req, httplib::Response& res) {
-        if (!m_db) { res.set_content("[]", "application/json"); return; }
+        // Same page shape as /v1/history/images, ranked by relevance; pass next_cursor back as cursor
+        if (!m_db) { res.set_content(R"({"data":[],"next_cursor":null})", "application/json"); return; }
         std::string query = req.get_param_value("q");
         int limit = req.has_param("limit") ? std::stoi(req.get_param_value("limit")) : 50;
-        if (query.empty()) {
-            res.set_content("[]", "application/json");
-            return;
-        }
-        res.set_content(m_db->search_generations(query, limit).dump(), "application/json");
+        std::string cursor = req.has_param("cursor") ? req.get_param_value("cursor") : "";
+        res.set_content(m_db->search_generations(query, limit, cursor).dump(), "application/json");
     });
 
     svr.Get("/v1/history/tags", [this](const httplib::Request&, httplib::Response& res) {
@@ -1150,7 +1263,6 @@ void ServiceController::register_routes(httplib::Server& svr) {
             std::string tag = j.value("tag", "");
             if (uuid.empty() || tag.empty()) { res.status = 400; return; }
             m_db->remove_tag(uuid, tag);
-            m_db->delete_unused_tags();
             res.set_content(R"({\"status\":\"success\"})", "application/json");
         } catch(...) { res.status = 400; }
     });
@@ -1203,10 +1315,15 @@ void ServiceController::register_routes(httplib::Server& svr) {
                         auto json_p = p; json_p.replace_extension(".json");
                         if (fs::exists(json_p)) fs::remove(json_p);
                     }
+                    // Temporary results that were never fetched are still QOI
+                    auto qoi_p = p; qoi_p.replace_extension(".qoi");
+                    if (fs::exists(qoi_p)) fs::remove(qoi_p);
                 } catch(...) {}
             }
         }
         m_db->remove_generation(uuid);
+        // The index rows went with the generation; the packed bytes wait for compaction
+        if (m_thumb_pack && m_thumb_pack->note_deleted()) m_db->add_job("compact_thumbnails", diffusion_desk::json::object(), 1);
         res.set_content(R"({\"status\":\"success\"})", "application/json");
     });
 
@@ -1215,21 +1332,75 @@ void ServiceController::register_routes(httplib::Server& svr) {
     svr.Get("/v1/stream/progress", proxy_sd); 
     
     svr.Get("/outputs/previews/([^/]+)", [this](const httplib::Request& req, httplib::Response& res) {
-        fs::path p = fs::path(m_params.output_dir) / "previews" / std::string(req.matches[1]);
-        if (fs::exists(p) && fs::is_regular_file(p)) {
-            std::ifstream ifs(p.string(), std::ios::binary);
-            std::string content((std::istreambuf_iterator<char>(ifs)), (std::istreambuf_iterator<char>()));
-            std::string mime = (p.extension() == ".jpg" || p.extension() == ".jpeg") ? "image/jpeg" : "image/png";
-            res.set_content(content, mime);
-        } else res.status = 404;
+        auto p = resolve_served_path(fs::path(m_params.output_dir) / "previews", req.matches[1]);
+        // Thumbnails and style/model previews can be regenerated under the same name
+        if (!p || !serve_file(req, res, *p, CACHE_REVALIDATE)) res.status = 404;
+    });
+
+    // Packed thumbnails (ThumbnailPack::url). The ETag is the record's place in the pack, which
+    // changes whenever the thumbnail is rewritten or moved by compaction.
+    svr.Get(R"(/thumbs/(\d+)_(\d+)\.jpg)", [this](const httplib::Request& req, httplib::Response& res) {
+        auto record = m_thumb_pack ? m_thumb_pack->get(std::stoi(req.matches[1]), std::stoi(req.matches[2])) : std::nullopt;
+        if (!record) {
+            res.status = 404;
+            return;
+        }
+        const auto& loc = record->location;
+        const std::string etag = "\"p" + std::to_string(loc.segment) + "-" + std::to_string(loc.offset) + "-" + std::to_string(loc.length) + "\"";
+        serve_mapped(req, res, record->file, (size_t)loc.offset, record->size(), "image/jpeg", etag, CACHE_REVALIDATE);
+    });
+
+    // A page of thumbnails in one response: GET /v1/thumbnails?ids=1,2,3&size=256. The body is
+    // multipart/form-data with one part per packed thumbnail, named by generation id, so the
+    // browser can split it with Response.formData(). Ids without a packed thumbnail are left
+    // out; the client falls back to their thumbnail_path.
+    svr.Get("/v1/thumbnails", [this](const httplib::Request& req, httplib::Response& res) {
+        if (!m_thumb_pack) {
+            res.status = 404;
+            return;
+        }
+        std::vector<int> ids;
+        try {
+            std::stringstream ss(req.get_param_value("ids"));
+            std::string id;
+            while (std::getline(ss, id, ',') && ids.size() < MAX_THUMBNAIL_BATCH) {
+                if (!id.empty()) ids.push_back(std::stoi(id));
+            }
+        } catch (...) {
+            res.status = 400;
+            return;
+        }
+        const int size = req.has_param("size") ? snap_thumbnail_size(std::atoi(req.get_param_value("size").c_str())) : DEFAULT_THUMBNAIL_SIZE;
+        write_multipart_thumbnails(res, m_thumb_pack->get_many(ids, size));
     });
 
-    svr.Get("/outputs/(.*)", proxy_sd);
+    // Served here rather than proxied: the SD worker has a handful of request threads and
+    // is busiest exactly when the gallery fills with new images
+    svr.Get("/outputs/(.*)", [this](const httplib::Request& req, httplib::Response& res) {
+        std::string rel_path = req.matches[1];
+        auto p = resolve_served_path(m_params.output_dir, rel_path);
+        if (!p) {
+            res.status = 404;
+            return;
+        }
+        // Temporary results exist as QOI until first fetched
+        if (!fs::exists(*p)) materialize_image(p->string());
+        // Generated files get unique names and are never rewritten; previews are
+        const char* cache_control = rel_path.rfind("previews/", 0) == 0 ? CACHE_REVALIDATE : CACHE_IMMUTABLE;
+        if (!serve_file(req, res, *p, cache_control)) res.status = 404;
+    });
     svr.Get("/v1/llm/models", proxy_llm);
     
     svr.Get("/health", [this](const httplib::Request&, httplib::Response& res) {
         auto status = m_res_mgr->get_vram_status();
         status["status"] = "ok";
+        if (m_db) {
+            status["database"] = {
+                {"statement_cache", m_db->get_statement_cache_stats()},
+                {"write_queue", m_db->get_write_queue_stats()}
+            };
+            if (m_thumb_pack) status["database"]["thumbnail_pack"] = m_thumb_pack->stats();
+        }
         res.set_content(status.dump(), "application/json");
     });
 
@@ -2,6 +2,7 @@
 
 #include "httplib.h"
 #include "database.hpp"
+#include "thumbnail_pack.hpp"
 #include "resource_manager.hpp"
 #include "ws_manager.hpp"
 #include "tool_service.hpp"
@@ -33,6 +34,8 @@ public:
 
     void set_on_generation_callback(std::function<void()> cb) { m_on_generation = cb; }
     void set_generation_active_callback(std::function<void(bool)> cb) { m_generation_active_cb = cb; }
+    // Serves /thumbs and /v1/thumbnails from the pack and moves worker-written thumbnails into it
+    void set_thumbnail_pack(std::shared_ptr<ThumbnailPack> pack) { m_thumb_pack = pack; }
 
     // Smart Queue: Notify from external metrics if needed
     void notify_model_loaded(const std::string& type, const std::string& model_id);
@@ -47,6 +50,7 @@ private:
     std::shared_ptr<ResourceManager> m_res_mgr;
     std::shared_ptr<WsManager> m_ws_mgr;
     std::shared_ptr<ToolService> m_tool_svc;
+    std::shared_ptr<ThumbnailPack> m_thumb_pack;
     SDSvrParams m_params;
     int m_sd_port;
     int m_llm_port;
@@ -1,6 +1,7 @@
 #include "tagging_service.hpp"
 #include "httplib.h"
 #include "utils/common.hpp"
+#include "utils/base64.hpp"
 #include <iostream>
 #include <fstream>
 #include <chrono>
@@ -370,14 +371,14 @@ void TaggingService::loop() {
                  continue;
             }
             
-            // Base64 Encode
-            std::string b64 = base64_encode(buffer.data(), (unsigned int)buffer.size());
             // Determine Mime Type (simple check)
             std::string mime_type = "image/png";
             if (str_ends_with(file_path, ".jpg") || str_ends_with(file_path, ".jpeg")) mime_type = "image/jpeg";
             else if (str_ends_with(file_path, ".webp")) mime_type = "image/webp";
 
-            std::string data_uri = "data:" + mime_type + ";base64," + b64;
+            // Encoded straight onto the prefix
+            std::string data_uri = "data:" + mime_type + ";base64,";
+            base64_encode(buffer.data(), buffer.size(), data_uri);
             
             // Resolve System Prompt
             std::string active_prompt = m_system_prompt;
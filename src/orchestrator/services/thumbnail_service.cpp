@@ -1,9 +1,16 @@
 #include "thumbnail_service.hpp"
 #include "../utils/common.hpp"
+#include "../utils/file_server.hpp"
+#include "../utils/image_resample.hpp"
+#include "../utils/qoi.hpp"
 #include <iostream>
 #include <filesystem>
 #include <vector>
 #include <algorithm>
+#include <iterator>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
 
 // STB includes are handled carefully to avoid multiple definitions
 #include "stb_image.h"
@@ -13,15 +20,40 @@ namespace fs = std::filesystem;
 
 namespace diffusion_desk {
 
-ThumbnailService::ThumbnailService(std::shared_ptr<JobService> job_svc, std::shared_ptr<Database> db)
-    : m_job_svc(job_svc), m_db(db) {
+ThumbnailService::ThumbnailService(std::shared_ptr<JobService> job_svc, std::shared_ptr<Database> db,
+                                   std::shared_ptr<ThumbnailPack> pack)
+    : m_job_svc(job_svc), m_db(db), m_pack(pack) {
     
     ensure_preview_dir();
     
     if (m_job_svc) {
+        // Decode + resize + encode is CPU bound and independent per image, so a batch of
+        // generations is thumbnailed in parallel: each worker claims one job at a time, which
+        // leaves the rest of a burst to the other worker and starts each lease when work does
+        JobTypeOptions options;
+        options.workers = 2;
+        options.batch_size = 1;
+        options.lease_seconds = 120;
         m_job_svc->register_handler("generate_thumbnail", [this](const diffusion_desk::json& payload) {
             return this->handle_job(payload);
-        });
+        }, options);
+
+        if (m_pack) {
+            // Both walk the pack under its write lock; one worker each is all they can use
+            JobTypeOptions pack_options;
+            pack_options.workers = 1;
+            pack_options.batch_size = 1;
+            pack_options.lease_seconds = 600;
+            m_job_svc->register_handler("pack_thumbnails", [this](const diffusion_desk::json& payload) {
+                return this->handle_pack_job(payload);
+            }, pack_options);
+            m_job_svc->register_handler("compact_thumbnails", [this](const diffusion_desk::json& payload) {
+                return this->handle_compact_job(payload);
+            }, pack_options);
+
+            // Libraries from before the pack still have one file per thumbnail
+            if (m_pack->request_packing()) m_db->add_job("pack_thumbnails", {{"after_id", 0}}, 1);
+        }
     }
 }
 
@@ -52,7 +84,12 @@ bool ThumbnailService::handle_job(const diffusion_desk::json& payload) {
         // Try as relative to CWD first (most likely for /outputs/...)
         fs::path img_path = fs::absolute(fs::current_path() / clean_path);
         
-        if (!fs::exists(img_path)) {
+        fs::path qoi_path = img_path;
+        qoi_path.replace_extension(".qoi");
+        if (!fs::exists(img_path) && fs::exists(qoi_path)) {
+            // Temporary result not fetched yet; read the QOI file instead of converting it
+            img_path = qoi_path;
+        } else if (!fs::exists(img_path)) {
             // Fallback: Check if original path was actually absolute and valid
             fs::path raw_path = fs::path(rel_path);
             if (fs::exists(raw_path)) {
@@ -63,68 +100,65 @@ bool ThumbnailService::handle_job(const diffusion_desk::json& payload) {
             }
         }
 
+        // One decode feeds every level of the pyramid
         int width, height, channels;
-        unsigned char* img = stbi_load(img_path.string().c_str(), &width, &height, &channels, 3); // Force 3 channels (RGB)
+        unsigned char* img = is_qoi_file(img_path.string().c_str())
+            ? qoi_load(img_path.string().c_str(), &width, &height, &channels, 3)
+            : stbi_load(img_path.string().c_str(), &width, &height, &channels, 3); // Force 3 channels (RGB)
         if (!img) {
             DD_LOG_ERROR("Failed to load image for thumbnail: %s", img_path.string().c_str());
             return false;
         }
+        std::vector<int> sizes(std::begin(THUMBNAIL_SIZES), std::end(THUMBNAIL_SIZES));
+        std::vector<ImageLevel> levels = build_pyramid(img, width, height, 3, sizes);
+        stbi_image_free(img);
 
-        // Target size (max dimension 256)
-        int target_w = width;
-        int target_h = height;
-        float scale = 1.0f;
-        
-        if (width > 256 || height > 256) {
-            if (width > height) {
-                scale = 256.0f / width;
-            } else {
-                scale = 256.0f / height;
+        // Write every level before recording any, so a failed job leaves no partial set
+        std::vector<std::pair<std::string, std::string>> files; // file_type, db path
+        std::vector<std::vector<unsigned char>> encoded;
+        for (const auto& level : levels) {
+            std::vector<unsigned char> jpg;
+            auto append = [](void* ctx, void* data, int size) {
+                auto* out = static_cast<std::vector<unsigned char>*>(ctx);
+                out->insert(out->end(), static_cast<unsigned char*>(data), static_cast<unsigned char*>(data) + size);
+            };
+            if (!stbi_write_jpg_to_func(append, &jpg, level.width, level.height, 3, level.pixels.data(), 85)) {
+                DD_LOG_ERROR("Failed to encode thumbnail %d for ID %d", level.max_dim, id);
+                return false;
             }
+            encoded.push_back(std::move(jpg));
         }
-        
-        target_w = static_cast<int>(width * scale);
-        target_h = static_cast<int>(height * scale);
-
-        // Simple Nearest Neighbor / Boxish downsampling
-        std::vector<unsigned char> thumb(target_w * target_h * 3);
-        
-        for (int y = 0; y < target_h; ++y) {
-            for (int x = 0; x < target_w; ++x) {
-                // Map target pixel (x,y) to source pixel (sx, sy)
-                int sx = static_cast<int>(x / scale);
-                int sy = static_cast<int>(y / scale);
-                
-                // Clamp
-                sx = std::min(sx, width - 1);
-                sy = std::min(sy, height - 1);
-                
-                int src_idx = (sy * width + sx) * 3;
-                int dst_idx = (y * target_w + x) * 3;
-                
-                thumb[dst_idx] = img[src_idx];
-                thumb[dst_idx + 1] = img[src_idx + 1];
-                thumb[dst_idx + 2] = img[src_idx + 2];
+        if (m_pack) {
+            for (size_t i = 0; i < levels.size(); ++i) {
+                if (!m_pack->put(id, levels[i].max_dim, encoded[i].data(), encoded[i].size())) {
+                    DD_LOG_ERROR("Failed to pack thumbnail %d for ID %d", levels[i].max_dim, id);
+                    return false;
+                }
+                files.emplace_back(thumbnail_file_type(levels[i].max_dim), ThumbnailPack::url(id, levels[i].max_dim));
+            }
+        } else {
+            for (size_t i = 0; i < levels.size(); ++i) {
+                const auto& level = levels[i];
+                std::string thumb_filename = "thumb_" + std::to_string(id) +
+                    (level.max_dim == DEFAULT_THUMBNAIL_SIZE ? "" : "_" + std::to_string(level.max_dim)) + ".jpg";
+                fs::path thumb_path = fs::path("outputs") / "previews" / thumb_filename;
+
+                // Regenerating replaces by rename; the old thumbnail may be mid-download
+                if (!replace_file(thumb_path, encoded[i].data(), encoded[i].size())) {
+                    DD_LOG_ERROR("Failed to write thumbnail: %s", thumb_path.string().c_str());
+                    return false;
+                }
+                // Use relative path for DB consistency
+                files.emplace_back(thumbnail_file_type(level.max_dim), "/outputs/previews/" + thumb_filename);
             }
         }
 
-        stbi_image_free(img);
-
-        // Save
-        std::string thumb_filename = "thumb_" + std::to_string(id) + ".jpg";
-        fs::path thumb_path = fs::path("outputs") / "previews" / thumb_filename;
-        
-        if (!stbi_write_jpg(thumb_path.string().c_str(), target_w, target_h, 3, thumb.data(), 85)) {
-             DD_LOG_ERROR("Failed to write thumbnail: %s", thumb_path.string().c_str());
-             return false;
+        // Update DB
+        for (const auto& [type, db_path] : files) {
+            m_db->add_generation_file(id, type, db_path);
         }
 
-        // Update DB
-        // Use relative path for DB consistency
-        std::string db_path = "/outputs/previews/" + thumb_filename;
-        m_db->add_generation_file(id, "thumbnail", db_path);
-        
-        DD_LOG_INFO("Generated thumbnail for ID %d", id);
+        DD_LOG_INFO("Generated %zu thumbnails for ID %d", files.size(), id);
         return true;
 
     } catch (const std::exception& e) {
@@ -133,4 +167,45 @@ bool ThumbnailService::handle_job(const diffusion_desk::json& payload) {
     }
 }
 
+bool ThumbnailService::handle_pack_job(const diffusion_desk::json& payload) {
+    constexpr int BATCH = 256;
+    const int after_id = payload.value("after_id", 0);
+    if (after_id == 0) m_pack->packing_started();
+
+    // One batch per job so the lease never runs out on a large library; the job re-enqueues
+    // itself from where it stopped
+    const auto rows = m_db->get_loose_thumbnails(after_id, BATCH);
+    std::vector<fs::path> moved;
+    for (const auto& [file_id, generation_id, file_type, file_path] : rows) {
+        const int size = file_type == "thumbnail" ? DEFAULT_THUMBNAIL_SIZE : std::atoi(file_type.c_str() + std::strlen("thumbnail_"));
+        const fs::path path = m_pack->dir() / fs::path(file_path).filename();
+        std::ifstream file(path, std::ios::binary);
+        if (!file) continue; // Missing files stay as they are; the gallery already shows them broken
+        std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        file.close();
+        if (!m_pack->put(generation_id, size, bytes.data(), bytes.size())) {
+            DD_LOG_ERROR("Failed to pack thumbnail %s", path.string().c_str());
+            return false;
+        }
+        m_db->set_generation_file_path(file_id, ThumbnailPack::url(generation_id, size));
+        moved.push_back(path);
+    }
+    // Only delete the files once no row points at them any more
+    m_db->flush_writes();
+    for (const auto& path : moved) {
+        std::error_code ec;
+        fs::remove(path, ec);
+    }
+    if (!moved.empty()) DD_LOG_INFO("Moved %zu thumbnail files into the pack", moved.size());
+    if ((int)rows.size() == BATCH) {
+        m_db->add_job("pack_thumbnails", {{"after_id", std::get<0>(rows.back())}}, 1);
+    }
+    return true;
+}
+
+bool ThumbnailService::handle_compact_job(const diffusion_desk::json&) {
+    m_pack->compact();
+    return true;
+}
+
 } // namespace diffusion_desk
@@ -2,6 +2,7 @@
 
 #include "job_service.hpp"
 #include "../database.hpp"
+#include "../thumbnail_pack.hpp"
 #include <memory>
 #include <string>
 
@@ -9,15 +10,21 @@ namespace diffusion_desk {
 
 class ThumbnailService {
 public:
-    ThumbnailService(std::shared_ptr<JobService> job_svc, std::shared_ptr<Database> db);
+    // With a pack, new thumbnails go into it and loose thumbnail files are migrated by the
+    // "pack_thumbnails" job; without one they are written as files as before
+    ThumbnailService(std::shared_ptr<JobService> job_svc, std::shared_ptr<Database> db,
+                     std::shared_ptr<ThumbnailPack> pack = nullptr);
     ~ThumbnailService() = default;
 
 private:
     bool handle_job(const diffusion_desk::json& payload);
+    bool handle_pack_job(const diffusion_desk::json& payload);
+    bool handle_compact_job(const diffusion_desk::json& payload);
     void ensure_preview_dir();
 
     std::shared_ptr<JobService> m_job_svc;
     std::shared_ptr<Database> m_db;
+    std::shared_ptr<ThumbnailPack> m_pack;
 };
 
 } // namespace diffusion_desk
@@ -28,7 +28,8 @@ diffusion_desk::json ToolService::get_library_items(const std::string& category)
 
 diffusion_desk::json ToolService::search_history(const std::string& query) {
     if (!m_db) return diffusion_desk::json::array();
-    return m_db->search_generations(query, 10);
+    // The tool result stays a plain list of the best matches
+    return m_db->search_generations(query, 10)["data"];
 }
 
 diffusion_desk::json ToolService::get_vram_status() {
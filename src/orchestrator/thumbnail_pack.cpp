@@ -0,0 +1,246 @@
+#include "thumbnail_pack.hpp"
+#include "utils/common.hpp"
+#include <algorithm>
+#include <cstring>
+#include <regex>
+#include <set>
+
+namespace fs = std::filesystem;
+
+namespace diffusion_desk {
+
+namespace {
+
+constexpr char RECORD_MAGIC[4] = {'D', 'D', 'T', 'P'};
+
+void put_u32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+uint32_t get_u32(const unsigned char* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+void encode_header(unsigned char* header, int generation_id, int size, size_t length) {
+    std::memcpy(header, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+    put_u32(header + 4, (uint32_t)generation_id);
+    put_u32(header + 8, (uint32_t)size);
+    put_u32(header + 12, (uint32_t)length);
+}
+
+bool header_matches(const char* header, const ThumbnailLocation& location) {
+    const auto* p = reinterpret_cast<const unsigned char*>(header);
+    return std::memcmp(p, RECORD_MAGIC, sizeof(RECORD_MAGIC)) == 0 &&
+           get_u32(p + 4) == (uint32_t)location.generation_id &&
+           get_u32(p + 8) == (uint32_t)location.size &&
+           get_u32(p + 12) == (uint32_t)location.length;
+}
+
+} // namespace
+
+ThumbnailPack::ThumbnailPack(std::shared_ptr<Database> db, const fs::path& dir, uint64_t segment_limit)
+    : m_db(db), m_dir(dir), m_segment_limit(segment_limit) {
+    std::error_code ec;
+    fs::create_directories(m_dir, ec);
+
+    // Continue appending to the newest segment
+    int newest = 0;
+    const std::regex name_re(R"(thumbs-(\d+)\.pack)");
+    for (const auto& entry : fs::directory_iterator(m_dir, ec)) {
+        std::smatch m;
+        const std::string name = entry.path().filename().string();
+        if (std::regex_match(name, m, name_re)) newest = std::max(newest, std::stoi(m[1].str()));
+    }
+    if (!open_active(std::max(newest, 1))) {
+        DD_LOG_ERROR("Failed to open thumbnail pack in %s", m_dir.string().c_str());
+    }
+}
+
+ThumbnailPack::~ThumbnailPack() {
+    if (m_active) std::fclose(m_active);
+}
+
+std::string ThumbnailPack::url(int generation_id, int size) {
+    return "/thumbs/" + std::to_string(generation_id) + "_" + std::to_string(size) + ".jpg";
+}
+
+fs::path ThumbnailPack::segment_path(int segment) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "thumbs-%06d.pack", segment);
+    return m_dir / name;
+}
+
+bool ThumbnailPack::open_active(int segment) {
+    if (m_active) std::fclose(m_active);
+    m_active = std::fopen(segment_path(segment).string().c_str(), "ab");
+    m_active_segment = segment;
+    std::error_code ec;
+    auto size = fs::file_size(segment_path(segment), ec);
+    m_active_size = ec ? 0 : (int64_t)size;
+    return m_active != nullptr;
+}
+
+std::optional<ThumbnailLocation> ThumbnailPack::append(int generation_id, int size, const void* data, size_t length) {
+    if (m_active_size > 0 && (uint64_t)m_active_size + RECORD_HEADER_SIZE + length > m_segment_limit) {
+        open_active(m_active_segment + 1);
+    }
+    if (!m_active) return std::nullopt;
+
+    unsigned char header[RECORD_HEADER_SIZE];
+    encode_header(header, generation_id, size, length);
+    if (std::fwrite(header, 1, sizeof(header), m_active) != sizeof(header) ||
+        std::fwrite(data, 1, length, m_active) != length || std::fflush(m_active) != 0) {
+        // A torn record is never indexed, so it only wastes space until compaction; reopening
+        // resyncs m_active_size with what actually reached the file
+        open_active(m_active_segment);
+        return std::nullopt;
+    }
+
+    ThumbnailLocation location;
+    location.generation_id = generation_id;
+    location.size = size;
+    location.segment = m_active_segment;
+    location.offset = m_active_size + (int64_t)RECORD_HEADER_SIZE;
+    location.length = (int64_t)length;
+    m_active_size += (int64_t)(RECORD_HEADER_SIZE + length);
+    return location;
+}
+
+bool ThumbnailPack::put(int generation_id, int size, const void* data, size_t length) {
+    std::optional<ThumbnailLocation> location;
+    {
+        std::lock_guard<std::mutex> lock(m_write_mutex);
+        location = append(generation_id, size, data, length);
+    }
+    return location && m_db->put_thumbnail_location(*location);
+}
+
+std::shared_ptr<const MappedFile> ThumbnailPack::mapping(int segment, int64_t end) {
+    std::lock_guard<std::mutex> lock(m_map_mutex);
+    auto& cached = m_mappings[segment];
+    if (!cached || (int64_t)cached->size() < end) {
+        // The active segment grows under us; a new mapping sees the appended records
+        cached = MappedFile::open(segment_path(segment));
+    }
+    return cached && (int64_t)cached->size() >= end ? cached : nullptr;
+}
+
+void ThumbnailPack::drop_mapping(int segment) {
+    std::lock_guard<std::mutex> lock(m_map_mutex);
+    m_mappings.erase(segment);
+}
+
+std::optional<ThumbnailPack::Record> ThumbnailPack::read(const ThumbnailLocation& location) {
+    if (location.offset < (int64_t)RECORD_HEADER_SIZE) return std::nullopt;
+    auto file = mapping(location.segment, location.offset + location.length);
+    if (!file || !header_matches(file->data() + location.offset - RECORD_HEADER_SIZE, location)) return std::nullopt;
+    return Record{location, file};
+}
+
+std::optional<ThumbnailPack::Record> ThumbnailPack::get(int generation_id, int size) {
+    auto records = get_many({generation_id}, size);
+    if (records.empty()) return std::nullopt;
+    return records.front();
+}
+
+std::vector<ThumbnailPack::Record> ThumbnailPack::get_many(const std::vector<int>& generation_ids, int size) {
+    std::vector<Record> records;
+    std::vector<int> retry;
+    for (const auto& location : m_db->get_thumbnail_locations(generation_ids, size)) {
+        if (auto record = read(location)) records.push_back(std::move(*record));
+        else retry.push_back(location.generation_id);
+    }
+    // A compaction may have moved these between the index read and the mapping; the index
+    // already points at the new copy
+    if (!retry.empty()) {
+        for (const auto& location : m_db->get_thumbnail_locations(retry, size)) {
+            if (auto record = read(location)) records.push_back(std::move(*record));
+        }
+    }
+    return records;
+}
+
+int64_t ThumbnailPack::compact(double dead_ratio) {
+    m_compaction_requested = false;
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+
+    std::set<int> segments;
+    std::error_code ec;
+    const std::regex name_re(R"(thumbs-(\d+)\.pack)");
+    for (const auto& entry : fs::directory_iterator(m_dir, ec)) {
+        std::smatch m;
+        const std::string name = entry.path().filename().string();
+        if (std::regex_match(name, m, name_re)) segments.insert(std::stoi(m[1].str()));
+    }
+
+    const auto usage = m_db->get_thumbnail_segment_usage();
+    int64_t freed = 0;
+    for (int segment : segments) {
+        if (segment >= m_active_segment) continue;
+        const fs::path path = segment_path(segment);
+        const auto file_size = fs::file_size(path, ec);
+        if (ec) continue;
+        const auto it = usage.find(segment);
+        const int64_t live = it == usage.end() ? 0 : it->second;
+        if (live > 0 && (double)(file_size - live) < dead_ratio * (double)file_size) continue;
+
+        // Copy what is still referenced, then repoint the index in one transaction. A
+        // thumbnail replaced in the meantime keeps its newer location (relocate_thumbnails
+        // only moves rows still pointing here), and its copy is garbage for the next round.
+        std::vector<std::pair<ThumbnailLocation, ThumbnailLocation>> moves;
+        bool copied = true;
+        for (const auto& from : m_db->get_segment_thumbnails(segment)) {
+            auto record = read(from);
+            if (!record) continue; // Unreadable; nothing to save
+            auto to = append(from.generation_id, from.size, record->data(), record->size());
+            if (!to) {
+                copied = false;
+                break;
+            }
+            moves.emplace_back(from, *to);
+        }
+        if (!copied) {
+            DD_LOG_ERROR("Thumbnail pack compaction stopped: cannot append to segment %d", m_active_segment);
+            break;
+        }
+        if (!moves.empty() && m_db->relocate_thumbnails(moves) == 0) continue;
+
+        drop_mapping(segment);
+        // Fails on Windows while a response still maps the file; the segment then has no
+        // live records and goes on the next run
+        if (fs::remove(path, ec)) {
+            freed += (int64_t)file_size;
+            DD_LOG_INFO("Compacted thumbnail segment %d: moved %zu thumbnails, freed %llu bytes",
+                        segment, moves.size(), (unsigned long long)file_size);
+        }
+    }
+    m_bytes_reclaimed += freed;
+    return freed;
+}
+
+diffusion_desk::json ThumbnailPack::stats() {
+    const auto usage = m_db->get_thumbnail_segment_usage();
+    int64_t total = 0, live = 0;
+    int segment_count = 0;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(m_dir, ec)) {
+        if (entry.path().extension() != ".pack") continue;
+        total += (int64_t)entry.file_size(ec);
+        segment_count++;
+    }
+    for (const auto& [segment, bytes] : usage) live += bytes;
+
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    return {
+        {"segments", segment_count},
+        {"active_segment", m_active_segment},
+        {"bytes", total},
+        {"live_bytes", live},
+        {"reclaimed_bytes", m_bytes_reclaimed.load()}
+    };
+}
+
+} // namespace diffusion_desk
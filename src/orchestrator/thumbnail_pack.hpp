@@ -0,0 +1,98 @@
+#pragma once
+
+#include "database.hpp"
+#include "utils/file_server.hpp"
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace diffusion_desk {
+
+// Thumbnails packed into a few large append-only files instead of one small file each, so a
+// library of tens of thousands of images costs a handful of inodes and a gallery page is
+// served from one or two memory mappings. The location of every thumbnail is indexed in
+// the thumbnail_pack table.
+//
+// Segments are <dir>/thumbs-000001.pack, ... Each record is a 16-byte header ("DDTP",
+// generation id, size, length; little endian) followed by the JPEG. The index points at the
+// JPEG; reads check the header in front of it, so a stale index entry is caught instead of
+// served. New records always go to the highest-numbered segment, which rolls over once it
+// passes segment_limit. Space of replaced or deleted thumbnails is reclaimed by compact().
+class ThumbnailPack {
+public:
+    struct Record {
+        ThumbnailLocation location;
+        std::shared_ptr<const MappedFile> file; // Keeps data alive
+        const char* data() const { return file->data() + location.offset; }
+        size_t size() const { return (size_t)location.length; }
+    };
+
+    static constexpr size_t RECORD_HEADER_SIZE = 16;
+
+    ThumbnailPack(std::shared_ptr<Database> db, const std::filesystem::path& dir,
+                  uint64_t segment_limit = 256ull * 1024 * 1024);
+    ~ThumbnailPack();
+
+    ThumbnailPack(const ThumbnailPack&) = delete;
+    ThumbnailPack& operator=(const ThumbnailPack&) = delete;
+
+    // Appends an encoded thumbnail and indexes it, replacing any earlier one for the same
+    // generation and size. Returns false if the append or the index write fails.
+    bool put(int generation_id, int size, const void* data, size_t length);
+
+    std::optional<Record> get(int generation_id, int size);
+    // One index query for the whole set; ids without a packed thumbnail are left out
+    std::vector<Record> get_many(const std::vector<int>& generation_ids, int size);
+
+    // Rewrites the live records of every closed segment that is at least dead_ratio garbage
+    // (or entirely garbage) into the active segment, then deletes it. Returns the bytes freed.
+    int64_t compact(double dead_ratio = 0.5);
+
+    // Deleting generations leaves garbage behind. Returns true for the first call since the
+    // last compact() started, so callers enqueue a single compaction job for a burst of deletes.
+    bool note_deleted() { return !m_compaction_requested.exchange(true); }
+    // Same for migrating loose thumbnail files; cleared by the job through packing_started()
+    bool request_packing() { return !m_packing_requested.exchange(true); }
+    void packing_started() { m_packing_requested = false; }
+
+    diffusion_desk::json stats();
+
+    const std::filesystem::path& dir() const { return m_dir; }
+
+    // URL a packed thumbnail is served under; stored in generation_files like a file path
+    static std::string url(int generation_id, int size);
+
+private:
+    std::filesystem::path segment_path(int segment) const;
+    bool open_active(int segment);
+    // Appends one record to the active segment. Call with m_write_mutex held.
+    std::optional<ThumbnailLocation> append(int generation_id, int size, const void* data, size_t length);
+    // Mapping of a segment covering at least end bytes, remapped if the cached one is short
+    std::shared_ptr<const MappedFile> mapping(int segment, int64_t end);
+    void drop_mapping(int segment);
+    std::optional<Record> read(const ThumbnailLocation& location);
+
+    std::shared_ptr<Database> m_db;
+    std::filesystem::path m_dir;
+    uint64_t m_segment_limit;
+
+    std::mutex m_write_mutex; // Appends, rollover and compaction
+    std::FILE* m_active = nullptr;
+    int m_active_segment = 0;
+    int64_t m_active_size = 0;
+
+    std::mutex m_map_mutex;
+    std::map<int, std::shared_ptr<const MappedFile>> m_mappings;
+
+    std::atomic<bool> m_compaction_requested{false};
+    std::atomic<bool> m_packing_requested{false};
+    std::atomic<int64_t> m_bytes_reclaimed{0};
+};
+
+} // namespace diffusion_desk
@@ -2,15 +2,23 @@
 #include "api_utils.hpp"
 #include "server_state.hpp"
 #include "model_loader.hpp"
+#include "image_cache.hpp"
+#include "utils/base64.hpp"
+#include "utils/file_server.hpp"
+#include "utils/png_text.hpp"
+#include "utils/thread_pool.hpp"
+#include <array>
 #include <atomic>
 #include <condition_variable>
 #include <deque>
 #include <sstream>
 #include <iomanip>
 #include <fstream>
+#include <future>
 #include <thread>
 #include <unordered_map>
 #include <regex>
+#include <random>
 #include <cctype>
 #include <algorithm>
 
@@ -39,6 +47,35 @@ const char* generation_job_status_name(GenerationJobStatus status) {
     }
 }
 
+// Scheduling class of a generation job. Lower runs first; waiting raises a job one class per
+// aging interval, so background work is never starved outright.
+enum class GenerationJobPriority {
+    Interactive,
+    Batch,
+    Background,
+};
+
+constexpr size_t GENERATION_JOB_PRIORITY_COUNT = 3;
+
+const char* generation_job_priority_name(GenerationJobPriority priority) {
+    switch (priority) {
+        case GenerationJobPriority::Interactive: return "interactive";
+        case GenerationJobPriority::Batch: return "batch";
+        case GenerationJobPriority::Background: return "background";
+        default: return "interactive";
+    }
+}
+
+bool parse_generation_job_priority(const std::string& name, GenerationJobPriority& priority) {
+    for (size_t i = 0; i < GENERATION_JOB_PRIORITY_COUNT; ++i) {
+        if (name == generation_job_priority_name((GenerationJobPriority)i)) {
+            priority = (GenerationJobPriority)i;
+            return true;
+        }
+    }
+    return false;
+}
+
 bool generation_job_status_terminal(GenerationJobStatus status) {
     return status == GenerationJobStatus::Completed ||
            status == GenerationJobStatus::Failed ||
@@ -50,6 +87,87 @@ int64_t unix_ms_now() {
         std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
+// An image as it arrived: encoded bytes, or base64 text still to be decoded
+struct RequestImage {
+    const char* data = nullptr;
+    size_t size = 0;
+    bool base64 = false;
+    bool empty() const { return size == 0; }
+};
+
+// Image endpoints take their parameters as a JSON body, or as multipart/form-data with the
+// JSON in a "params" field and images as file parts, which skips base64 entirely
+std::string request_params_body(const httplib::Request& req) {
+    if (req.is_multipart_form_data()) {
+        return req.form.has_field("params") ? req.form.get_field("params") : "{}";
+    }
+    return req.body;
+}
+
+// A body that is the image itself (Content-Type image/* or application/octet-stream)
+bool is_raw_image_body(const httplib::Request& req) {
+    const std::string type = req.get_header_value("Content-Type");
+    return !req.body.empty() && (type.rfind("image/", 0) == 0 || type.rfind("application/octet-stream", 0) == 0);
+}
+
+// The image named `name`: a multipart file part, else a JSON string of base64 or a base64
+// data URI. Empty if the request has neither.
+RequestImage request_image(const httplib::Request& req, const diffusion_desk::json& params, const std::string& name) {
+    RequestImage image;
+    if (req.is_multipart_form_data()) {
+        auto it = req.form.files.find(name);
+        if (it != req.form.files.end()) {
+            image.data = it->second.content.data();
+            image.size = it->second.content.size();
+            return image;
+        }
+    }
+    auto field = params.find(name);
+    if (field == params.end() || !field->is_string()) return image;
+    const std::string& text = field->get_ref<const std::string&>();
+    const size_t offset = diffusion_desk::base64_payload_offset(text);
+    image.data = text.data() + offset;
+    image.size = text.size() - offset;
+    image.base64 = true;
+    return image;
+}
+
+// Decoded init, mask and reference images; sized once from --image-cache-mb
+DecodedImageCache& image_cache(const SDSvrParams& params) {
+    static DecodedImageCache cache((size_t)std::max(0, params.image_cache_mb) * 1024 * 1024);
+    return cache;
+}
+
+// load_image_from_memory for a request image, through cache if given. The cache is keyed on
+// the bytes as received, so a hit skips the base64 decode as well.
+uint8_t* load_request_image(const RequestImage& image, int& width, int& height,
+                            int expected_width, int expected_height, int expected_channel,
+                            DecodedImageCache* cache = nullptr) {
+    auto decode = [&](int& w, int& h) -> uint8_t* {
+        if (!image.base64) return load_image_from_memory(image.data, (int)image.size, w, h, expected_width, expected_height, expected_channel);
+        std::vector<uint8_t> bytes = diffusion_desk::base64_decode(image.data, image.size);
+        return load_image_from_memory(reinterpret_cast<const char*>(bytes.data()), (int)bytes.size(), w, h,
+                                      expected_width, expected_height, expected_channel);
+    };
+    if (!cache) return decode(width, height);
+    return cache->load(image.data, image.size, width, height, expected_width, expected_height, expected_channel, decode);
+}
+
+// fsync for --fsync async, kept off the result pool so it never delays the next batch
+diffusion_desk::ThreadPool& flush_pool() {
+    static diffusion_desk::ThreadPool pool(1);
+    return pool;
+}
+
+// Encodes and writes generated images; sized once from --encode-threads
+diffusion_desk::ThreadPool& result_pool(const SDSvrParams& params) {
+    flush_pool(); // Constructed first so it outlives tasks this pool drains at exit
+    static diffusion_desk::ThreadPool pool(params.encode_threads > 0
+        ? (size_t)params.encode_threads
+        : std::min<size_t>(8, std::max(1u, std::thread::hardware_concurrency())));
+    return pool;
+}
+
 fs::path resolve_model_path_case_insensitive(const std::string& path, const std::string& model_dir);
 
 std::string resolve_model_path(const std::string& path, const std::string& model_dir) {
@@ -228,9 +346,34 @@ struct GenerationJob {
     diffusion_desk::json result;
     std::string error_code;
     std::string error_message;
+    // Lifecycle events (queued, started, requeued and the terminal one) are all kept. Progress
+    // arrives every 250 ms, so only the most recent is kept while the job runs, and just the
+    // latest once it has finished. Event ids are shared, so the two merge back in order.
     std::vector<GenerationJobEvent> events;
+    std::deque<GenerationJobEvent> progress;
+    GenerationJobEvent latest_progress; // id 0 until the first progress event
     uint64_t next_event_id = 1;
     std::atomic<bool> cancel_requested{false};
+
+    GenerationJobPriority priority = GenerationJobPriority::Interactive;
+    int64_t queued_at = created_at; // Last time it entered the queue
+    int preemptions = 0;
+    std::atomic<bool> preempt_requested{false}; // Stop the pass and requeue, see preempt_background_jobs_locked
+
+    // Auto-batching: jobs with the same key differ only in seed and image count.
+    // batch_key 0 means the request cannot share a pass.
+    uint64_t batch_key = 0;
+    int64_t batch_seed = -1; // First seed; negative for random
+    int batch_images = 1;
+    size_t batch_size = 1;   // Jobs in the pass this job runs in
+};
+
+// One handle_generate_image call made for queued jobs. Only the worker thread running it sees
+// it (t_generation_pass), so a synchronous request never reads its cancel flag.
+struct GenerationPass {
+    std::vector<std::shared_ptr<GenerationJob>> jobs;
+    std::atomic<bool> cancel{false};   // Set through stop_running_generation_pass_locked
+    sd_ctx_t* sampling_ctx = nullptr;  // Context it is sampling on; under g_generation_jobs.mutex
 };
 
 struct GenerationJobManager {
@@ -243,15 +386,132 @@ struct GenerationJobManager {
     bool stop = false;
     bool started = false;
     size_t max_pending_jobs = 64;
+    size_t pending = 0;               // Queued or processing jobs
+    std::deque<std::string> finished; // Jobs in a terminal state still kept, oldest first
+    size_t retention_count = 256;     // Finished jobs kept at most...
+    int64_t retention_ms = 3600000;   // ...and for at most this long (0: no time limit)
+    uint64_t batches = 0;      // Passes that ran more than one job
+    uint64_t batched_jobs = 0; // Jobs that ran in those passes
+    uint64_t preemptions = 0;
+    int64_t aging_ms = 60000;  // Queue wait that raises a job by one priority class
+    GenerationPass* running = nullptr; // Pass holding sd_ctx_mutex, see GenerationPassLock
+    // Jobs the worker took off the queue and holds for the batch window; still Queued
+    const std::vector<std::shared_ptr<GenerationJob>>* collecting = nullptr;
+    int interactive_requests = 0; // Synchronous generation requests in flight, see InteractiveGenerationScope
+    // Recent queue waits in ms per priority class, oldest first
+    std::array<std::deque<int64_t>, GENERATION_JOB_PRIORITY_COUNT> waits;
 };
 
+// A background job is preempted at most this often, so a steady stream of interactive
+// requests cannot keep restarting it forever
+constexpr int MAX_GENERATION_JOB_PREEMPTIONS = 3;
+constexpr size_t GENERATION_WAIT_SAMPLES = 512;
+constexpr size_t GENERATION_PROGRESS_EVENTS = 16;
+
 GenerationJobManager g_generation_jobs;
-std::atomic<sd_ctx_t*> g_active_generation_ctx{nullptr};
-std::atomic<std::atomic<bool>*> g_active_generation_cancel_flag{nullptr};
+thread_local GenerationPass* t_generation_pass = nullptr; // Set by execute_generation_batch
+
+// Class a queued job is scheduled in now: its own, raised one step per aging interval waited
+int64_t generation_job_effective_class(const GenerationJob& job, int64_t now) {
+    const int64_t raised = g_generation_jobs.aging_ms > 0 ? (now - job.created_at) / g_generation_jobs.aging_ms : 0;
+    return std::max<int64_t>(0, (int64_t)job.priority - raised);
+}
+
+// Scheduling order of queued jobs: by effective class, then oldest first
+bool generation_job_runs_before(const GenerationJob& a, const GenerationJob& b, int64_t now) {
+    const int64_t class_a = generation_job_effective_class(a, now);
+    const int64_t class_b = generation_job_effective_class(b, now);
+    if (class_a != class_b) {
+        return class_a < class_b;
+    }
+    return a.created_at < b.created_at;
+}
+
+// The queued job to run next, or queue.end() if the queue holds only stale ids
+std::deque<std::string>::iterator next_generation_job_locked(int64_t now) {
+    auto best = g_generation_jobs.queue.end();
+    const GenerationJob* best_job = nullptr;
+    for (auto id = g_generation_jobs.queue.begin(); id != g_generation_jobs.queue.end(); ++id) {
+        auto it = g_generation_jobs.jobs.find(*id);
+        if (it == g_generation_jobs.jobs.end() || it->second->status != GenerationJobStatus::Queued) {
+            continue;
+        }
+        if (!best_job || generation_job_runs_before(*it->second, *best_job, now)) {
+            best = id;
+            best_job = it->second.get();
+        }
+    }
+    return best;
+}
+
+void record_generation_wait_locked(const GenerationJob& job, int64_t now) {
+    auto& samples = g_generation_jobs.waits[(size_t)job.priority];
+    samples.push_back(now - job.queued_at);
+    if (samples.size() > GENERATION_WAIT_SAMPLES) {
+        samples.pop_front();
+    }
+}
+
+diffusion_desk::json generation_queue_stats_locked() {
+    diffusion_desk::json out;
+    out["aging_ms"] = g_generation_jobs.aging_ms;
+    out["pending"] = g_generation_jobs.pending;
+    out["finished_retained"] = g_generation_jobs.finished.size();
+    out["preemptions"] = g_generation_jobs.preemptions;
+    for (size_t i = 0; i < GENERATION_JOB_PRIORITY_COUNT; ++i) {
+        std::vector<int64_t> sorted(g_generation_jobs.waits[i].begin(), g_generation_jobs.waits[i].end());
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&](double p) -> diffusion_desk::json {
+            if (sorted.empty()) return nullptr;
+            const size_t rank = (size_t)std::ceil(p * (double)sorted.size());
+            return sorted[std::max<size_t>(rank, 1) - 1];
+        };
+        size_t queued = 0;
+        for (const auto& id : g_generation_jobs.queue) {
+            auto it = g_generation_jobs.jobs.find(id);
+            if (it != g_generation_jobs.jobs.end() && it->second->priority == (GenerationJobPriority)i &&
+                it->second->status == GenerationJobStatus::Queued) {
+                ++queued;
+            }
+        }
+        out[generation_job_priority_name((GenerationJobPriority)i)] = {
+            {"queued", queued},
+            {"wait_samples", sorted.size()},
+            {"wait_p50_ms", percentile(0.50)},
+            {"wait_p90_ms", percentile(0.90)},
+            {"wait_p99_ms", percentile(0.99)}
+        };
+    }
+    return out;
+}
 
+// Fills the auto-batching fields of a job from its request. Anything besides the seed and
+// image count that differs (prompt, size, sampler, steps, input images, save options, ...)
+// gives a different key, so only requests that can run as one batch_count pass share one.
+void assign_generation_batch_key(GenerationJob& job, const diffusion_desk::json& body, int64_t default_seed) {
+    diffusion_desk::json key_body = body;
+    int images = 1;
+    int64_t seed = default_seed;
+    try {
+        images = std::max(1, key_body.value("n", 1));
+        if (key_body.contains("batch_count")) images = key_body["batch_count"].get<int>();
+        if (key_body.contains("seed")) seed = key_body["seed"].get<int64_t>();
+    } catch (...) {
+        return; // Malformed; handle_generate_image rejects it on its own
+    }
+    if (images < 1) return;
+    for (const char* key : {"seed", "n", "batch_count", "priority"}) {
+        key_body.erase(key);
+    }
+    const std::string text = key_body.dump();
+    job.batch_key = content_hash(text.data(), text.size()) | 1;
+    job.batch_seed = seed;
+    job.batch_images = images;
+}
+
+// Whether the pass this thread runs was cancelled or preempted; never for a synchronous request
 bool active_generation_cancel_requested() {
-    auto* cancel_flag = g_active_generation_cancel_flag.load(std::memory_order_acquire);
-    return cancel_flag != nullptr && cancel_flag->load(std::memory_order_relaxed);
+    return t_generation_pass != nullptr && t_generation_pass->cancel.load(std::memory_order_relaxed);
 }
 
 sd_image_t* generate_image_with_cancel_context(sd_ctx_t* sd_ctx, const sd_img_gen_params_t* img_gen_params) {
@@ -259,27 +519,49 @@ sd_image_t* generate_image_with_cancel_context(sd_ctx_t* sd_ctx, const sd_img_ge
         sd_cancel_generation(sd_ctx, SD_CANCEL_RESET);
     }
 
-    sd_ctx_t* previous = g_active_generation_ctx.exchange(sd_ctx, std::memory_order_acq_rel);
+    GenerationPass* pass = t_generation_pass;
+    if (pass == nullptr) {
+        return generate_image(sd_ctx, img_gen_params);
+    }
+    {
+        // Under the jobs mutex a stop either finds the context or set the flag before;
+        // stopped before the library could be interrupted, callers check the flag on nullptr
+        std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
+        if (pass->cancel.load(std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        pass->sampling_ctx = sd_ctx;
+    }
     sd_image_t* result = nullptr;
     try {
         result = generate_image(sd_ctx, img_gen_params);
     } catch (...) {
-        g_active_generation_ctx.store(previous, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
+        pass->sampling_ctx = nullptr;
         throw;
     }
-    g_active_generation_ctx.store(previous, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
+    pass->sampling_ctx = nullptr;
     return result;
 }
 
-size_t count_pending_generation_jobs_locked() {
-    size_t count = 0;
-    for (const auto& entry : g_generation_jobs.jobs) {
-        if (entry.second->status == GenerationJobStatus::Queued ||
-            entry.second->status == GenerationJobStatus::Processing) {
-            ++count;
-        }
+// Forgets finished jobs beyond the retention count or age, oldest first. Event streams hold
+// their job, so one still being read is only dropped from the lookup.
+void prune_finished_generation_jobs_locked(int64_t now) {
+    auto& finished = g_generation_jobs.finished;
+    while (!finished.empty()) {
+        auto it = g_generation_jobs.jobs.find(finished.front());
+        const bool expired = it == g_generation_jobs.jobs.end() ||
+                             finished.size() > std::max<size_t>(1, g_generation_jobs.retention_count) ||
+                             (g_generation_jobs.retention_ms > 0 && now - it->second->completed_at > g_generation_jobs.retention_ms);
+        if (!expired) {
+            break;
+        }
+        if (it != g_generation_jobs.jobs.end()) {
+            g_generation_jobs.jobs.erase(it);
+        }
+        finished.pop_front();
     }
-    return count;
 }
 
 std::string make_generation_job_id_locked() {
@@ -289,12 +571,50 @@ std::string make_generation_job_id_locked() {
     return oss.str();
 }
 
+// Records a lifecycle event. Called right after a job enters a terminal state, it also takes
+// the job off the pending count and hands it to retention.
 void append_generation_job_event_locked(GenerationJob& job, const std::string& name, diffusion_desk::json data) {
     data["job_id"] = job.id;
     job.events.push_back({job.next_event_id++, name, std::move(data)});
+    if (generation_job_status_terminal(job.status)) {
+        g_generation_jobs.pending--;
+        std::deque<GenerationJobEvent>().swap(job.progress);
+        g_generation_jobs.finished.push_back(job.id);
+        prune_finished_generation_jobs_locked(unix_ms_now());
+    }
+    g_generation_jobs.cv.notify_all();
+}
+
+void append_generation_job_progress_locked(GenerationJob& job, diffusion_desk::json data) {
+    data["job_id"] = job.id;
+    job.latest_progress = {job.next_event_id++, "progress", std::move(data)};
+    job.progress.push_back(job.latest_progress);
+    if (job.progress.size() > GENERATION_PROGRESS_EVENTS) {
+        job.progress.pop_front();
+    }
     g_generation_jobs.cv.notify_all();
 }
 
+// Events with ids above last_id, in order. A reader that fell further behind than the progress
+// kept skips the progress it missed; it still gets every lifecycle event and the latest progress.
+std::vector<GenerationJobEvent> generation_job_events_after_locked(const GenerationJob& job, uint64_t last_id) {
+    std::vector<GenerationJobEvent> out;
+    for (const auto& event : job.events) {
+        if (event.id > last_id) out.push_back(event);
+    }
+    if (!job.progress.empty()) {
+        for (const auto& event : job.progress) {
+            if (event.id > last_id) out.push_back(event);
+        }
+    } else if (job.latest_progress.id > last_id) {
+        out.push_back(job.latest_progress);
+    }
+    std::sort(out.begin(), out.end(), [](const GenerationJobEvent& a, const GenerationJobEvent& b) {
+        return a.id < b.id;
+    });
+    return out;
+}
+
 diffusion_desk::json make_generation_job_json_locked(const GenerationJob& job) {
     diffusion_desk::json j;
     j["id"] = job.id;
@@ -302,17 +622,23 @@ diffusion_desk::json make_generation_job_json_locked(const GenerationJob& job) {
     j["created_at"] = job.created_at;
     j["started_at"] = job.started_at == 0 ? diffusion_desk::json(nullptr) : diffusion_desk::json(job.started_at);
     j["completed_at"] = job.completed_at == 0 ? diffusion_desk::json(nullptr) : diffusion_desk::json(job.completed_at);
+    j["priority"] = generation_job_priority_name(job.priority);
+    j["preemptions"] = job.preemptions;
     j["queue_position"] = 0;
 
     if (job.status == GenerationJobStatus::Queued) {
+        // One more than the queued jobs that run before it as things stand now
+        const int64_t now = unix_ms_now();
         size_t position = 1;
         for (const auto& queued_id : g_generation_jobs.queue) {
-            if (queued_id == job.id) {
-                j["queue_position"] = position;
-                break;
+            auto it = g_generation_jobs.jobs.find(queued_id);
+            if (it != g_generation_jobs.jobs.end() && it->second.get() != &job &&
+                it->second->status == GenerationJobStatus::Queued &&
+                generation_job_runs_before(*it->second, job, now)) {
+                ++position;
             }
-            ++position;
         }
+        j["queue_position"] = position;
     }
 
     if (job.status == GenerationJobStatus::Completed) {
@@ -339,7 +665,7 @@ bool write_sse_event(httplib::DataSink& sink, const GenerationJobEvent& event) {
     return sink.write(payload.c_str(), payload.size());
 }
 
-void publish_progress_events_until_done(const std::shared_ptr<GenerationJob>& job, std::atomic<bool>& done) {
+void publish_progress_events_until_done(const std::vector<std::shared_ptr<GenerationJob>>& batch, std::atomic<bool>& done) {
     uint64_t last_version = 0;
     while (!done.load()) {
         int step = 0;
@@ -371,47 +697,172 @@ void publish_progress_events_until_done(const std::shared_ptr<GenerationJob>& jo
         data["phase"] = phase;
         data["message"] = message;
 
+        // Jobs sharing a pass share its progress
         std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
-        if (job->status == GenerationJobStatus::Processing) {
-            append_generation_job_event_locked(*job, "progress", std::move(data));
+        for (const auto& job : batch) {
+            if (job->status == GenerationJobStatus::Processing) {
+                append_generation_job_progress_locked(*job, data);
+            }
         }
     }
 }
 
-void execute_generation_job(const std::shared_ptr<GenerationJob>& job, ServerContext& ctx) {
-    {
-        std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
-        job->status = GenerationJobStatus::Processing;
-        job->started_at = unix_ms_now();
-        append_generation_job_event_locked(*job, "started", make_generation_job_json_locked(*job));
+// Ends the pass holding sd_ctx_mutex at its next sampling step. Its cancel flag is set before
+// the library is interrupted, so handle_generate_image sees a cancelled pass rather than a
+// failed one and does not retry it. Call once every job in the pass is cancelled, or to
+// preempt it. Only that pass's own sampling is interrupted: a synchronous request holding the
+// context is never touched, and a pass still waiting for it checks on entry (GenerationPassLock).
+void stop_running_generation_pass_locked() {
+    GenerationPass* pass = g_generation_jobs.running;
+    if (pass == nullptr) {
+        return;
+    }
+    pass->cancel.store(true, std::memory_order_relaxed);
+    if (pass->sampling_ctx != nullptr) {
+        sd_cancel_generation(pass->sampling_ctx, SD_CANCEL_ALL);
     }
+}
 
-    std::atomic<bool> progress_done{false};
-    std::thread progress_thread([job, &progress_done]() {
-        publish_progress_events_until_done(job, progress_done);
-    });
+// Stops a running background pass when work of a higher class arrives: a job, or a
+// synchronous request (described by arrival). The pass ends at its next sampling step
+// through the cancel plumbing, and its jobs go back to the queue.
+void preempt_background_jobs_locked(GenerationJobPriority arriving, const std::string& arrival) {
+    if (arriving == GenerationJobPriority::Background || g_generation_jobs.running == nullptr) {
+        return;
+    }
+    const auto& running = g_generation_jobs.running->jobs;
+    // Jobs in a pass share their class, so the pass stops for all of them or for none
+    for (const auto& job : running) {
+        if (job->priority != GenerationJobPriority::Background || job->preemptions >= MAX_GENERATION_JOB_PREEMPTIONS ||
+            job->preempt_requested.load(std::memory_order_relaxed)) {
+            return;
+        }
+    }
+    DD_LOG_INFO("Preempting background generation job %s for %s",
+                running.front()->id.c_str(), arrival.c_str());
+    for (const auto& job : running) {
+        job->preempt_requested.store(true, std::memory_order_relaxed);
+    }
+    g_generation_jobs.preemptions++;
+    stop_running_generation_pass_locked();
+}
 
-    std::atomic<bool> generation_done{false};
-    std::thread cancel_thread([job, &generation_done]() {
-        while (!generation_done.load(std::memory_order_relaxed)) {
-            if (job->cancel_requested.load(std::memory_order_relaxed)) {
-                if (sd_ctx_t* active_ctx = g_active_generation_ctx.load(std::memory_order_acquire)) {
-                    sd_cancel_generation(active_ctx, SD_CANCEL_ALL);
-                }
+// Publishes the pass this thread runs as g_generation_jobs.running while it holds sd_ctx_mutex:
+// handle_generate_image declares one right after taking the mutex, so it is gone again before
+// the mutex is released. Cancels and arrivals that came while the pass waited are applied here.
+// Does nothing for a synchronous request.
+struct GenerationPassLock {
+    GenerationPass* pass = t_generation_pass;
+
+    GenerationPassLock() {
+        if (pass == nullptr) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
+        g_generation_jobs.running = pass;
+        if (std::all_of(pass->jobs.begin(), pass->jobs.end(), [](const auto& job) {
+                return job->cancel_requested.load(std::memory_order_relaxed);
+            })) {
+            stop_running_generation_pass_locked();
+            return;
+        }
+        if (g_generation_jobs.interactive_requests > 0) {
+            preempt_background_jobs_locked(GenerationJobPriority::Interactive, "a synchronous generation request");
+            return;
+        }
+        for (const auto& queued_id : g_generation_jobs.queue) {
+            auto it = g_generation_jobs.jobs.find(queued_id);
+            if (it != g_generation_jobs.jobs.end() && it->second->status == GenerationJobStatus::Queued &&
+                it->second->priority != GenerationJobPriority::Background) {
+                preempt_background_jobs_locked(it->second->priority,
+                                               std::string(generation_job_priority_name(it->second->priority)) + " job " + queued_id);
+                return;
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
         }
+    }
+
+    ~GenerationPassLock() {
+        if (pass == nullptr) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
+        g_generation_jobs.running = nullptr;
+    }
+
+    GenerationPassLock(const GenerationPassLock&) = delete;
+    GenerationPassLock& operator=(const GenerationPassLock&) = delete;
+};
+
+void fail_generation_job_locked(GenerationJob& job, const std::string& code, const std::string& message) {
+    job.status = GenerationJobStatus::Failed;
+    job.error_code = code;
+    job.error_message = message;
+    append_generation_job_event_locked(job, "failed", make_generation_job_json_locked(job));
+}
+
+// Runs one or more jobs as a single handle_generate_image call. A batch of several jobs runs
+// the first job's request with all their images and one consecutive seed range, and each
+// job gets back the images with its own seeds.
+void execute_generation_batch(const std::vector<std::shared_ptr<GenerationJob>>& batch, ServerContext& ctx) {
+    const std::shared_ptr<GenerationJob>& first = batch.front();
+    int64_t base_seed = first->batch_seed;
+    int total_images = 0;
+    for (const auto& job : batch) {
+        total_images += job->batch_images;
+    }
+
+    std::string request_body = first->request_body;
+    if (batch.size() > 1) {
+        if (base_seed < 0) {
+            std::random_device rd;
+            base_seed = std::uniform_int_distribution<int64_t>(0, INT32_MAX - total_images)(rd);
+        }
+        diffusion_desk::json body = diffusion_desk::json::parse(request_body);
+        body.erase("batch_count");
+        body["n"] = total_images;
+        body["seed"] = base_seed;
+        request_body = body.dump();
+    }
+
+    // One cancel flag for the whole pass, single job or not. It is set only through
+    // stop_running_generation_pass_locked: once every job in the pass is cancelled, or when the
+    // pass is preempted. Jobs cancelled before the pass got sd_ctx_mutex stop it right away.
+    GenerationPass pass;
+    pass.jobs = batch;
+    {
+        std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
+        const int64_t now = unix_ms_now();
+        for (const auto& job : batch) {
+            job->status = GenerationJobStatus::Processing;
+            job->started_at = now;
+            job->batch_size = batch.size();
+            record_generation_wait_locked(*job, now);
+            append_generation_job_event_locked(*job, "started", make_generation_job_json_locked(*job));
+        }
+        if (batch.size() > 1) {
+            g_generation_jobs.batches++;
+            g_generation_jobs.batched_jobs += batch.size();
+        }
+    }
+    if (batch.size() > 1) {
+        DD_LOG_INFO("Running %zu generation jobs as one batch of %d image(s), seeds %lld-%lld",
+                    batch.size(), total_images, (long long)base_seed, (long long)(base_seed + total_images - 1));
+    }
+
+    std::atomic<bool> progress_done{false};
+    std::thread progress_thread([&batch, &progress_done]() {
+        publish_progress_events_until_done(batch, progress_done);
     });
 
     httplib::Request generation_req;
-    generation_req.body = job->request_body;
+    generation_req.body = request_body;
     httplib::Response generation_res;
 
-    auto* previous_cancel_flag = g_active_generation_cancel_flag.exchange(&job->cancel_requested, std::memory_order_acq_rel);
+    t_generation_pass = &pass;
     try {
-        DD_LOG_INFO("Executing generation job %s: body_bytes=%zu", job->id.c_str(), job->request_body.size());
+        DD_LOG_INFO("Executing generation job %s: body_bytes=%zu", first->id.c_str(), request_body.size());
         handle_generate_image(generation_req, generation_res, ctx);
-        DD_LOG_INFO("Generation job %s returned HTTP %d", job->id.c_str(), generation_res.status);
+        DD_LOG_INFO("Generation job %s returned HTTP %d", first->id.c_str(), generation_res.status);
     } catch (const std::exception& e) {
         generation_res.status = 500;
         generation_res.set_content(make_error_json("server_error", e.what()), "application/json");
@@ -419,12 +870,7 @@ void execute_generation_job(const std::shared_ptr<GenerationJob>& job, ServerCon
         generation_res.status = 500;
         generation_res.set_content(make_error_json("server_error", "generation job failed"), "application/json");
     }
-    g_active_generation_cancel_flag.store(previous_cancel_flag, std::memory_order_release);
-
-    generation_done = true;
-    if (cancel_thread.joinable()) {
-        cancel_thread.join();
-    }
+    t_generation_pass = nullptr;
 
     progress_done = true;
     progress_state.cv.notify_all();
@@ -432,37 +878,109 @@ void execute_generation_job(const std::shared_ptr<GenerationJob>& job, ServerCon
         progress_thread.join();
     }
 
-    std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
-    job->completed_at = unix_ms_now();
-    if (job->cancel_requested.load(std::memory_order_relaxed)) {
-        job->status = GenerationJobStatus::Cancelled;
-        job->error_code = "cancelled";
-        job->error_message = "generation job cancelled by client";
-        append_generation_job_event_locked(*job, "cancelled", make_generation_job_json_locked(*job));
-    } else if (generation_res.status >= 200 && generation_res.status < 300) {
+    const bool succeeded = generation_res.status >= 200 && generation_res.status < 300;
+    diffusion_desk::json response;
+    std::string parse_error;
+    if (succeeded) {
         try {
-            job->result = diffusion_desk::json::parse(generation_res.body);
+            response = diffusion_desk::json::parse(generation_res.body);
+        } catch (const std::exception& e) {
+            parse_error = e.what();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
+    int64_t next_seed = base_seed;
+    for (const auto& job : batch) {
+        const int64_t first_seed = next_seed;
+        next_seed += job->batch_images;
+        job->completed_at = unix_ms_now();
+        if (job->cancel_requested.load(std::memory_order_relaxed)) {
+            job->status = GenerationJobStatus::Cancelled;
+            job->error_code = "cancelled";
+            job->error_message = "generation job cancelled by client";
+            append_generation_job_event_locked(*job, "cancelled", make_generation_job_json_locked(*job));
+        } else if (job->preempt_requested.load(std::memory_order_relaxed) && !succeeded) {
+            // Stopped for a higher class; it starts over when it is picked again. Its class and
+            // creation time are kept, so it keeps aging.
+            job->preempt_requested.store(false, std::memory_order_relaxed);
+            job->preemptions++;
+            job->status = GenerationJobStatus::Queued;
+            job->started_at = 0;
+            job->completed_at = 0;
+            job->batch_size = 1;
+            job->queued_at = unix_ms_now();
+            g_generation_jobs.queue.push_back(job->id);
+            append_generation_job_event_locked(*job, "requeued", make_generation_job_json_locked(*job));
+        } else if (!succeeded) {
+            fail_generation_job_locked(*job, "generation_failed", generation_res.body.empty()
+                ? ("generation failed with status " + std::to_string(generation_res.status))
+                : generation_res.body);
+        } else if (!parse_error.empty()) {
+            fail_generation_job_locked(*job, "invalid_generation_response", parse_error);
+        } else if (batch.size() == 1) {
+            job->result = std::move(response);
+            job->status = GenerationJobStatus::Completed;
+            append_generation_job_event_locked(*job, "completed", make_generation_job_json_locked(*job));
+        } else {
+            // Every image carries its seed, which says whose it is even if some came back empty
+            diffusion_desk::json result = response;
+            result["data"] = diffusion_desk::json::array();
+            for (const auto& item : response.value("data", diffusion_desk::json::array())) {
+                const int64_t seed = item.value("seed", (int64_t)-1);
+                if (seed >= first_seed && seed < first_seed + job->batch_images) {
+                    result["data"].push_back(item);
+                }
+            }
+            result["batch"] = {{"jobs", batch.size()}, {"images", total_images}};
+            if (result["data"].empty()) {
+                fail_generation_job_locked(*job, "generation_failed", "no images were generated for this job");
+                continue;
+            }
+            job->result = std::move(result);
             job->status = GenerationJobStatus::Completed;
             append_generation_job_event_locked(*job, "completed", make_generation_job_json_locked(*job));
-        } catch (const std::exception& e) {
-            job->status = GenerationJobStatus::Failed;
-            job->error_code = "invalid_generation_response";
-            job->error_message = e.what();
-            append_generation_job_event_locked(*job, "failed", make_generation_job_json_locked(*job));
         }
-    } else {
-        job->status = GenerationJobStatus::Failed;
-        job->error_code = "generation_failed";
-        job->error_message = generation_res.body.empty()
-            ? ("generation failed with status " + std::to_string(generation_res.status))
-            : generation_res.body;
-        append_generation_job_event_locked(*job, "failed", make_generation_job_json_locked(*job));
+    }
+}
+
+// Moves queued jobs that can share the pass of batch's first job into batch: the same key,
+// seeds continuing where the batch ends so far (or all random), at most max_images images
+void collect_generation_batch_locked(std::vector<std::shared_ptr<GenerationJob>>& batch, int& images, int max_images) {
+    const GenerationJob& first = *batch.front();
+    if (first.batch_key == 0) {
+        return;
+    }
+    bool added = true;
+    while (added && images < max_images) {
+        added = false;
+        for (auto id = g_generation_jobs.queue.begin(); id != g_generation_jobs.queue.end(); ++id) {
+            auto it = g_generation_jobs.jobs.find(*id);
+            if (it == g_generation_jobs.jobs.end()) {
+                continue;
+            }
+            const GenerationJob& candidate = *it->second;
+            const bool seed_follows = first.batch_seed < 0 ? candidate.batch_seed < 0
+                                                            : candidate.batch_seed == first.batch_seed + images;
+            if (candidate.status != GenerationJobStatus::Queued || candidate.batch_key != first.batch_key ||
+                candidate.priority != first.priority || !seed_follows || images + candidate.batch_images > max_images) {
+                continue;
+            }
+            batch.push_back(it->second);
+            images += candidate.batch_images;
+            g_generation_jobs.queue.erase(id);
+            added = true;
+            break;
+        }
     }
 }
 
 void generation_job_worker(ServerContext* ctx) {
+    // handle_generate_image makes at most MAX_GENERATION_IMAGES, whatever the merged n
+    const int max_images = std::clamp(ctx->svr_params.generation_batch_images, 1, MAX_GENERATION_IMAGES);
+    const auto batch_window = std::chrono::milliseconds(std::max(0, ctx->svr_params.generation_batch_window_ms));
     while (true) {
-        std::shared_ptr<GenerationJob> job;
+        std::vector<std::shared_ptr<GenerationJob>> batch;
         {
             std::unique_lock<std::mutex> lock(g_generation_jobs.mutex);
             g_generation_jobs.cv.wait(lock, [] {
@@ -471,15 +989,62 @@ void generation_job_worker(ServerContext* ctx) {
             if (g_generation_jobs.stop && g_generation_jobs.queue.empty()) {
                 return;
             }
-            const std::string job_id = g_generation_jobs.queue.front();
-            g_generation_jobs.queue.pop_front();
-            auto it = g_generation_jobs.jobs.find(job_id);
-            if (it == g_generation_jobs.jobs.end() || it->second->status != GenerationJobStatus::Queued) {
+            const int64_t now = unix_ms_now();
+            auto next = next_generation_job_locked(now);
+            if (next == g_generation_jobs.queue.end()) {
+                g_generation_jobs.queue.clear();
+                continue;
+            }
+            auto next_job = g_generation_jobs.jobs.find(*next);
+            if (g_generation_jobs.interactive_requests > 0 && next_job != g_generation_jobs.jobs.end() &&
+                generation_job_effective_class(*next_job->second, now) == (int64_t)GenerationJobPriority::Background) {
+                // Nothing but background work is queued; it would only race the synchronous
+                // request for sd_ctx_mutex. Aging is rechecked every so often.
+                g_generation_jobs.cv.wait_for(lock, std::chrono::seconds(1), [] {
+                    return g_generation_jobs.stop || g_generation_jobs.interactive_requests == 0;
+                });
                 continue;
             }
-            job = it->second;
+            auto it = g_generation_jobs.jobs.find(*next);
+            g_generation_jobs.queue.erase(next);
+            batch.push_back(it->second);
+
+            int images = it->second->batch_images;
+            collect_generation_batch_locked(batch, images, max_images);
+            if (batch_window.count() > 0 && it->second->batch_key != 0 && images < max_images) {
+                // Hold the pass briefly for compatible jobs that are still being submitted.
+                // Cancelling a held job marks it like one in a running pass.
+                g_generation_jobs.collecting = &batch;
+                const auto deadline = std::chrono::steady_clock::now() + batch_window;
+                while (images < max_images && !g_generation_jobs.stop &&
+                       g_generation_jobs.cv.wait_until(lock, deadline) == std::cv_status::no_timeout) {
+                    collect_generation_batch_locked(batch, images, max_images);
+                }
+                collect_generation_batch_locked(batch, images, max_images);
+                g_generation_jobs.collecting = nullptr;
+                if (g_generation_jobs.stop) {
+                    // Shutdown came while waiting; these are out of the queue it cancels
+                    for (const auto& job : batch) {
+                        job->cancel_requested.store(true, std::memory_order_relaxed);
+                    }
+                }
+                if (std::all_of(batch.begin(), batch.end(), [](const auto& job) {
+                        return job->cancel_requested.load(std::memory_order_relaxed);
+                    })) {
+                    // Nothing left to run the pass for
+                    for (const auto& job : batch) {
+                        job->status = GenerationJobStatus::Cancelled;
+                        job->completed_at = unix_ms_now();
+                        job->error_code = "cancelled";
+                        job->error_message = g_generation_jobs.stop ? "generation job cancelled by worker shutdown"
+                                                                    : "generation job cancelled by client";
+                        append_generation_job_event_locked(*job, "cancelled", make_generation_job_json_locked(*job));
+                    }
+                    continue;
+                }
+            }
         }
-        execute_generation_job(job, *ctx);
+        execute_generation_batch(batch, *ctx);
     }
 }
 
@@ -489,6 +1054,9 @@ void ensure_generation_job_worker_started(ServerContext& ctx) {
     }
     g_generation_jobs.stop = false;
     g_generation_jobs.started = true;
+    g_generation_jobs.aging_ms = (int64_t)std::max(0, ctx.svr_params.generation_aging_s) * 1000;
+    g_generation_jobs.retention_count = (size_t)std::max(1, ctx.svr_params.generation_job_retention_count);
+    g_generation_jobs.retention_ms = (int64_t)std::max(0, ctx.svr_params.generation_job_retention_s) * 1000;
     ServerContext* ctx_ptr = &ctx;
     g_generation_jobs.worker_thread = std::thread([ctx_ptr]() {
         generation_job_worker(ctx_ptr);
@@ -497,6 +1065,33 @@ void ensure_generation_job_worker_started(ServerContext& ctx) {
 
 } // namespace
 
+InteractiveGenerationScope::InteractiveGenerationScope() {
+    std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
+    g_generation_jobs.interactive_requests++;
+    preempt_background_jobs_locked(GenerationJobPriority::Interactive, "a synchronous generation request");
+}
+
+InteractiveGenerationScope::~InteractiveGenerationScope() {
+    std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
+    g_generation_jobs.interactive_requests--;
+    g_generation_jobs.cv.notify_all();
+}
+
+bool activate_sd_context(ServerContext& ctx, bool vae_decode_only, bool fresh) {
+    SDContextParams& params = ctx.ctx_params;
+    const bool ok = ctx.context_cache->activate(
+        ctx.sd_ctx,
+        SdContextCache::signature(params, vae_decode_only, params.stream_layers),
+        SdContextCache::estimate_cost(params),
+        [&]() {
+            sd_ctx_params_t sd_ctx_p = make_sd_ctx_params(params, vae_decode_only);
+            return SdCtxPtr(new_sd_ctx(&sd_ctx_p));
+        },
+        fresh);
+    if (ok) ctx.sd_ctx_vae_decode_only = vae_decode_only;
+    return ok;
+}
+
 void log_vram_status(const std::string& phase) {
     float proc = get_current_process_vram_usage_gb();
     float free = get_free_vram_gb();
@@ -517,6 +1112,18 @@ void handle_health(const httplib::Request&, httplib::Response& res, ServerContex
     j["model_path"] = mp;
     j["vram_allocated_mb"] = (int)(get_current_process_vram_usage_gb() * 1024.0f);
     j["vram_free_mb"] = (int)(get_free_vram_gb() * 1024.0f);
+    j["image_cache"] = image_cache(ctx.svr_params).stats();
+    j["context_cache"] = ctx.context_cache->stats();
+    {
+        std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
+        j["generation_batching"] = {
+            {"max_images", std::max(1, ctx.svr_params.generation_batch_images)},
+            {"window_ms", std::max(0, ctx.svr_params.generation_batch_window_ms)},
+            {"batches", g_generation_jobs.batches},
+            {"batched_jobs", g_generation_jobs.batched_jobs}
+        };
+        j["generation_queue"] = generation_queue_stats_locked();
+    }
     res.set_content(j.dump(), "application/json");
 }
 
@@ -664,6 +1271,13 @@ void handle_submit_generation_job(const httplib::Request& req, httplib::Response
     const size_t prompt_bytes = body.contains("prompt") && body["prompt"].is_string()
         ? body["prompt"].get<std::string>().size()
         : 0;
+    GenerationJobPriority priority = GenerationJobPriority::Interactive;
+    if (body.contains("priority") &&
+        (!body["priority"].is_string() || !parse_generation_job_priority(body["priority"].get<std::string>(), priority))) {
+        res.status = 400;
+        res.set_content(make_error_json("invalid_request", "priority must be interactive, batch or background"), "application/json");
+        return;
+    }
     std::string request_body = sanitize_generation_job_body_for_context(body, ctx);
 
     std::shared_ptr<GenerationJob> job = std::make_shared<GenerationJob>();
@@ -671,7 +1285,8 @@ void handle_submit_generation_job(const httplib::Request& req, httplib::Response
 
     {
         std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
-        if (count_pending_generation_jobs_locked() >= g_generation_jobs.max_pending_jobs) {
+        prune_finished_generation_jobs_locked(unix_ms_now());
+        if (g_generation_jobs.pending >= g_generation_jobs.max_pending_jobs) {
             res.status = 429;
             res.set_content(make_error_json("queue_full", "generation job queue is full"), "application/json");
             return;
@@ -680,11 +1295,17 @@ void handle_submit_generation_job(const httplib::Request& req, httplib::Response
         ensure_generation_job_worker_started(ctx);
         job->id = make_generation_job_id_locked();
         job->request_body = request_body;
+        job->priority = priority;
+        assign_generation_batch_key(*job, body, ctx.default_gen_params.seed);
         g_generation_jobs.jobs[job->id] = job;
         g_generation_jobs.queue.push_back(job->id);
+        g_generation_jobs.pending++;
         append_generation_job_event_locked(*job, "queued", make_generation_job_json_locked(*job));
-        DD_LOG_INFO("Queued generation job %s: ideogram4=%s, structured_json_prompt=%s, prompt_bytes=%zu",
+        preempt_background_jobs_locked(job->priority,
+                                       std::string(generation_job_priority_name(job->priority)) + " job " + job->id);
+        DD_LOG_INFO("Queued generation job %s: priority=%s, ideogram4=%s, structured_json_prompt=%s, prompt_bytes=%zu",
                     job->id.c_str(),
+                    generation_job_priority_name(priority),
                     ideogram4_context ? "true" : "false",
                     structured_prompt ? "true" : "false",
                     prompt_bytes);
@@ -717,13 +1338,25 @@ void handle_get_generation_job(const httplib::Request& req, httplib::Response& r
 
 void handle_stream_generation_job_events(const httplib::Request& req, httplib::Response& res) {
     const std::string job_id = req.matches[1];
+    std::shared_ptr<GenerationJob> job_ptr;
     {
         std::lock_guard<std::mutex> lock(g_generation_jobs.mutex);
-        if (g_generation_jobs.jobs.find(job_id) == g_generation_jobs.jobs.end()) {
+        auto it = g_generation_jobs.jobs.find(job_id);
+        if (it == g_generation_jobs.jobs.end()) {
             res.status = 404;
             res.set_content(make_error_json("not_found", "generation job not found"), "application/json");
             return;
         }
+        job_ptr = it->second;
+    }
+
+    // A reconnecting EventSource resumes after the last event it saw
+    uint64_t resume_after = 0;
+    if (req.has_header("Last-Event-ID")) {
+        try {
+            resume_after = std::stoull(req.get_header_value("Last-Event-ID"));
+        } catch (...) {
+        }
     }
 
     DD_LOG_INFO("New generation job event stream subscription for %s", job_id.c_str());
@@ -731,38 +1364,25 @@ void handle_stream_generation_job_events(const httplib::Request& req, httplib::R
     res.set_header("Connection", "keep-alive");
     res.set_header("X-Accel-Buffering", "no");
 
-    res.set_chunked_content_provider("text/event-stream", [job_id](size_t, httplib::DataSink& sink) {
-        size_t next_event_index = 0;
+    // The stream keeps its own reference, so retention may drop the job from the table while
+    // it is still being read
+    res.set_chunked_content_provider("text/event-stream", [job_ptr, resume_after](size_t, httplib::DataSink& sink) {
+        uint64_t last_event_id = resume_after;
 
         while (true) {
             std::vector<GenerationJobEvent> events;
             bool terminal = false;
             {
                 std::unique_lock<std::mutex> lock(g_generation_jobs.mutex);
-                auto it = g_generation_jobs.jobs.find(job_id);
-                if (it == g_generation_jobs.jobs.end()) {
-                    sink.done();
-                    return false;
-                }
-
+                const GenerationJob& job = *job_ptr;
                 g_generation_jobs.cv.wait_for(lock, std::chrono::seconds(15), [&] {
-                    auto current = g_generation_jobs.jobs.find(job_id);
-                    return current == g_generation_jobs.jobs.end() ||
-                           current->second->events.size() > next_event_index ||
-                           generation_job_status_terminal(current->second->status);
+                    return job.next_event_id - 1 > last_event_id || generation_job_status_terminal(job.status);
                 });
 
-                it = g_generation_jobs.jobs.find(job_id);
-                if (it == g_generation_jobs.jobs.end()) {
-                    sink.done();
-                    return false;
-                }
-
-                auto& job = *it->second;
                 terminal = generation_job_status_terminal(job.status);
-                if (job.events.size() > next_event_index) {
-                    events.assign(job.events.begin() + static_cast<std::ptrdiff_t>(next_event_index), job.events.end());
-                    next_event_index = job.events.size();
+                events = generation_job_events_after_locked(job, last_event_id);
+                if (!events.empty()) {
+                    last_event_id = events.back().id;
                 }
             }
 
@@ -803,6 +1423,16 @@ void handle_cancel_generation_job(const httplib::Request& req, httplib::Response
     }
 
     GenerationJob& job = *it->second;
+    const auto* collecting = g_generation_jobs.collecting;
+    if (job.status == GenerationJobStatus::Queued && collecting != nullptr &&
+        std::find(collecting->begin(), collecting->end(), it->second) != collecting->end()) {
+        // Held for the batch window: its seeds are part of the pass, so it stays in it and
+        // ends up cancelled like a job of a running pass
+        job.cancel_requested.store(true, std::memory_order_relaxed);
+        res.status = 202;
+        res.set_content(make_generation_job_json_locked(job).dump(), "application/json");
+        return;
+    }
     if (job.status == GenerationJobStatus::Queued) {
         auto new_end = std::remove(g_generation_jobs.queue.begin(), g_generation_jobs.queue.end(), job.id);
         if (new_end == g_generation_jobs.queue.end()) {
@@ -823,8 +1453,14 @@ void handle_cancel_generation_job(const httplib::Request& req, httplib::Response
 
     if (job.status == GenerationJobStatus::Processing) {
         job.cancel_requested.store(true, std::memory_order_relaxed);
-        if (sd_ctx_t* active_ctx = g_active_generation_ctx.load(std::memory_order_acquire)) {
-            sd_cancel_generation(active_ctx, SD_CANCEL_ALL);
+        // A pass shared with other jobs keeps running for them; this job's images are dropped.
+        // A pass not holding the context yet checks on entry, one past it only encodes.
+        const GenerationPass* running = g_generation_jobs.running;
+        const bool all_cancelled = running != nullptr && std::all_of(running->jobs.begin(), running->jobs.end(), [](const auto& other) {
+            return other->cancel_requested.load(std::memory_order_relaxed);
+        });
+        if (all_cancelled) {
+            stop_running_generation_pass_locked();
         }
         res.status = 202;
         res.set_content(make_generation_job_json_locked(job).dump(), "application/json");
@@ -856,9 +1492,7 @@ void shutdown_generation_jobs() {
                 entry.second->cancel_requested.store(true, std::memory_order_relaxed);
             }
         }
-        if (sd_ctx_t* active_ctx = g_active_generation_ctx.load(std::memory_order_acquire)) {
-            sd_cancel_generation(active_ctx, SD_CANCEL_ALL);
-        }
+        stop_running_generation_pass_locked();
         g_generation_jobs.cv.notify_all();
     }
     if (g_generation_jobs.worker_thread.joinable()) {
@@ -873,20 +1507,22 @@ void shutdown_generation_jobs() {
 // We will move other handlers implementation in next steps to keep this manageable
 void handle_get_outputs(const httplib::Request& req, httplib::Response& res, ServerContext& ctx) {
     std::string file_name = req.matches[1];
-    fs::path file_path = fs::path(ctx.svr_params.output_dir) / file_name;
+    auto resolved = diffusion_desk::resolve_served_path(ctx.svr_params.output_dir, file_name);
+    if (!resolved) {
+        res.status = 404;
+        return;
+    }
+    fs::path file_path = *resolved;
 
-    if (fs::exists(file_path) && fs::is_regular_file(file_path)) {
-        std::ifstream ifs(file_path, std::ios::binary);
-        std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-        
-        std::string ext = file_path.extension().string();
-        std::string mime = "application/octet-stream";
-        if (ext == ".png") mime = "image/png";
-        else if (ext == ".jpg" || ext == ".jpeg") mime = "image/jpeg";
-        else if (ext == ".json") mime = "application/json";
-        
-        res.set_content(content, mime.c_str());
-    } else {
+    // Temporary results exist as QOI until first fetched
+    if (!fs::exists(file_path)) {
+        materialize_image(file_path.string());
+    }
+
+    // Generated files get unique names and are never rewritten; previews are
+    const char* cache_control = file_name.rfind("previews/", 0) == 0 ? diffusion_desk::CACHE_REVALIDATE
+                                                                     : diffusion_desk::CACHE_IMMUTABLE;
+    if (!diffusion_desk::serve_file(req, res, file_path, cache_control)) {
         res.status = 404;
     }
 }
@@ -999,8 +1635,8 @@ void handle_load_model(const httplib::Request& req, httplib::Response& res, Serv
         {
             std::lock_guard<std::mutex> lock(ctx.sd_ctx_mutex);
             
-            // Smart pointer reset handles freeing old context
-            ctx.sd_ctx.reset();
+            // The old context stays parked, so switching back to this model is cheap
+            ctx.context_cache->park(ctx.sd_ctx);
 
             // Update params based on where it was found
             std::string rel_s = lowercase_copy(model_id);
@@ -1076,11 +1712,7 @@ void handle_load_model(const httplib::Request& req, httplib::Response& res, Serv
                     if (!validate_component_path("uncond_diffusion_model", ctx.ctx_params.uncond_diffusion_model_path)) return;
             }
 
-            sd_ctx_params_t sd_ctx_p = make_sd_ctx_params(ctx.ctx_params, true);
-            ctx.sd_ctx.reset(new_sd_ctx(&sd_ctx_p));
-            ctx.sd_ctx_vae_decode_only = true;
-
-            if (!ctx.sd_ctx) {
+            if (!activate_sd_context(ctx, true)) {
                 throw std::runtime_error("failed to create new context with selected model");
             }
         }
@@ -1105,7 +1737,8 @@ void handle_unload_model(httplib::Response& res, ServerContext& ctx) {
     DD_LOG_INFO("Unloading Image model to free VRAM.");
     try {
         std::lock_guard<std::mutex> lock(ctx.sd_ctx_mutex);
-        ctx.sd_ctx.reset();
+        ctx.context_cache->release_active(ctx.sd_ctx);
+        ctx.context_cache->clear();
         
         // Reset path state so it's clearly empty
         ctx.ctx_params.diffusion_model_path = "";
@@ -1132,19 +1765,20 @@ void handle_offload_model(httplib::Response& res, ServerContext& ctx) {
             return;
         }
 
-        // We reload the current model with offload_params_to_cpu = true
-        auto params = ctx.ctx_params;
-        params.offload_params_to_cpu = true;
-        sanitize_context_params_for_backend(params);
+        // We reload the current model with offload_params_to_cpu = true. The point is to free
+        // VRAM, so neither the current context nor parked GPU-resident variants are kept.
+        auto previous_params = ctx.ctx_params;
+        ctx.ctx_params.offload_params_to_cpu = true;
+        sanitize_context_params_for_backend(ctx.ctx_params);
 
         DD_LOG_INFO("Re-initializing SD context with CPU offloading...");
-        auto sd_params = make_sd_ctx_params(params, ctx.sd_ctx_vae_decode_only);
-        ctx.sd_ctx.reset(new_sd_ctx(&sd_params));
+        ctx.context_cache->release_active(ctx.sd_ctx);
+        ctx.context_cache->clear_vram();
 
-        if (ctx.sd_ctx) {
-            ctx.ctx_params = params;
+        if (activate_sd_context(ctx, ctx.sd_ctx_vae_decode_only)) {
             res.set_content(R"({\"status\":\"success\",\"message\":\"Model offloaded to CPU\"})", "application/json");
         } else {
+            ctx.ctx_params = previous_params;
             res.status = 500;
             res.set_content(R"({\"error\":\"Failed to re-initialize model for offloading\"})", "application/json");
         }
@@ -1199,17 +1833,25 @@ void handle_load_upscale_model(const httplib::Request& req, httplib::Response& r
 
 void handle_upscale_image(const httplib::Request& req, httplib::Response& res, ServerContext& ctx) {
     try {
-        diffusion_desk::json body = diffusion_desk::json::parse(req.body);
-        std::string image_data;
-        std::string image_name;
-
-        if (body.contains("image")) {
-            image_data = body["image"];
-            if (image_data.find("base64,") != std::string::npos) {
-                image_data = image_data.substr(image_data.find("base64,") + 7);
-            }
-        } else if (body.contains("image_name")) {
-            image_name = body["image_name"];
+        // The image comes as the raw body (parameters in the query string), a multipart file
+        // part "image", base64 in the JSON field "image", or by name from the output dir
+        const bool raw_body = is_raw_image_body(req);
+        diffusion_desk::json body = raw_body ? diffusion_desk::json::object() : diffusion_desk::json::parse(request_params_body(req));
+        if (raw_body) {
+            if (req.has_param("upscale_factor")) body["upscale_factor"] = std::stoi(req.get_param_value("upscale_factor"));
+            if (req.has_param("save_image")) body["save_image"] = req.get_param_value("save_image") != "false";
+        }
+
+        RequestImage image;
+        std::string file_bytes;
+        if (raw_body) {
+            image.data = req.body.data();
+            image.size = req.body.size();
+        } else {
+            image = request_image(req, body, "image");
+        }
+        if (image.empty() && body.contains("image_name")) {
+            std::string image_name = body["image_name"];
             fs::path img_path = fs::path(ctx.svr_params.output_dir) / image_name;
             if (!fs::exists(img_path)) {
                 res.status = 404;
@@ -1217,30 +1859,23 @@ void handle_upscale_image(const httplib::Request& req, httplib::Response& res, S
                 return;
             }
             std::ifstream ifs(img_path, std::ios::binary);
-            image_data = std::string((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-        } else {
+            file_bytes = std::string((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+            image.data = file_bytes.data();
+            image.size = file_bytes.size();
+        }
+        if (image.empty()) {
             res.status = 400;
-            res.set_content(make_error_json("invalid_request", "image (base64) or image_name required"), "application/json");
+            res.set_content(make_error_json("invalid_request", "image (raw body, multipart file or base64) or image_name required"), "application/json");
             return;
         }
 
         uint32_t upscale_factor = body.value("upscale_factor", 0);
 
         sd_image_t input_image = {0, 0, 3, nullptr};
-        std::vector<uint8_t> decoded_bytes;
-        
-        if (!image_name.empty()) {
-            int w, h;
-            input_image.data = load_image_from_memory(image_data.data(), (int)image_data.size(), w, h, 0, 0, 3);
-            input_image.width = (uint32_t)w;
-            input_image.height = (uint32_t)h;
-        } else {
-            decoded_bytes = base64_decode(image_data);
-            int w, h;
-            input_image.data = load_image_from_memory((const char*)decoded_bytes.data(), (int)decoded_bytes.size(), w, h, 0, 0, 3);
-            input_image.width = (uint32_t)w;
-            input_image.height = (uint32_t)h;
-        }
+        int w, h;
+        input_image.data = load_request_image(image, w, h, 0, 0, 3);
+        input_image.width = (uint32_t)w;
+        input_image.height = (uint32_t)h;
 
         if (!input_image.data) {
             res.status = 400;
@@ -1274,7 +1909,9 @@ void handle_upscale_image(const httplib::Request& req, httplib::Response& res, S
             return;
         }
 
-        auto image_bytes = write_image_to_vector(ImageFormat::PNG,
+        bool save_image = body.value("save_image", true);
+
+        auto image_bytes = write_image_to_vector(save_image ? ImageFormat::PNG : ImageFormat::QOI,
                                                     upscaled_image.data,
                                                     (int)upscaled_image.width,
                                                     (int)upscaled_image.height,
@@ -1291,8 +1928,6 @@ void handle_upscale_image(const httplib::Request& req, httplib::Response& res, S
         diffusion_desk::json out;
         out["width"] = upscaled_image.width;
         out["height"] = upscaled_image.height;
-
-        bool save_image = body.value("save_image", true);
         
         // Always save to disk now (either persistent or temp) to serve via URL
         std::string final_output_dir = ctx.svr_params.output_dir;
@@ -1309,6 +1944,7 @@ void handle_upscale_image(const httplib::Request& req, httplib::Response& res, S
         auto timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
         std::string out_name = "upscale-" + std::to_string(timestamp) + ".png";
         fs::path out_path = fs::path(final_output_dir) / out_name;
+        if (!save_image) out_path.replace_extension(".qoi"); // Served as out_name, see materialize_image
         
         std::ofstream ofs(out_path, std::ios::binary);
         ofs.write((const char*)image_bytes.data(), image_bytes.size());
@@ -1348,14 +1984,20 @@ void handle_get_history(const httplib::Request&, httplib::Response& res, ServerC
                 diffusion_desk::json item;
                 item["name"] = img_path.filename().string();
                 
+                // Parameters embedded in the PNG first; only its header chunks are read
+                auto png_text = img_path.extension() == ".png" ? diffusion_desk::png_read_text_file(img_path)
+                                                              : std::map<std::string, std::string>{};
+                auto parameters = png_text.find(diffusion_desk::PNG_PARAMETERS_KEY);
                 auto txt_path = img_path;
                 txt_path.replace_extension(".txt");
-                if (fs::exists(txt_path)) {
+                if (parameters != png_text.end()) {
+                    item["params"] = diffusion_desk::parse_image_params(parameters->second);
+                } else if (fs::exists(txt_path)) {
                     try {
                         std::ifstream txt_file(txt_path);
                         std::string content((std::istreambuf_iterator<char>(txt_file)),
                                             (std::istreambuf_iterator<char>()));
-                        item["params"] = parse_image_params(content);
+                        item["params"] = diffusion_desk::parse_image_params(content);
                     } catch (...) {
                         DD_LOG_WARN("failed to parse txt metadata: %s", txt_path.string().c_str());
                     }
@@ -1387,13 +2029,13 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
     reset_progress();
     DD_LOG_INFO("New generation request received");
     try {
-        if (req.body.empty()) {
+        if (req.body.empty() && !req.is_multipart_form_data()) {
             res.status = 400;
             res.set_content(make_error_json("empty_body"), "application/json");
             return;
         }
 
-        diffusion_desk::json j             = diffusion_desk::json::parse(req.body);
+        diffusion_desk::json j             = diffusion_desk::json::parse(request_params_body(req));
         const bool ideogram4_context = context_is_ideogram4(ctx.ctx_params);
         if (ideogram4_context) {
             strip_generation_placement_fields(j);
@@ -1436,8 +2078,8 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
         }
         if (n <= 0)
             n = 1;
-        if (n > 8)
-            n = 8;  // safety
+        if (n > MAX_GENERATION_IMAGES)
+            n = MAX_GENERATION_IMAGES;  // safety
         if (output_compression > 100) {
             output_compression = 100;
         }
@@ -1470,15 +2112,11 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
             DD_LOG_INFO("Switching VAE load mode to %s for this generation...",
                         request_vae_decode_only ? "decode-only" : "full encode/decode");
             std::lock_guard<std::mutex> lock(ctx.sd_ctx_mutex);
-            ctx.sd_ctx.reset();
-            sd_ctx_params_t sd_ctx_p = make_sd_ctx_params(ctx.ctx_params, request_vae_decode_only);
-            ctx.sd_ctx.reset(new_sd_ctx(&sd_ctx_p));
-            if (!ctx.sd_ctx) {
+            if (!activate_sd_context(ctx, request_vae_decode_only)) {
                 res.status = 500;
                 res.set_content(make_error_json("model_reload_failed", "failed to reload model after VAE load-mode change"), "application/json");
                 return;
             }
-            ctx.sd_ctx_vae_decode_only = request_vae_decode_only;
         }
 
         const bool reload_ideogram4_context =
@@ -1487,10 +2125,8 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
         if (ctx.sd_ctx && reload_ideogram4_context) {
             DD_LOG_INFO("Reloading Ideogram4 context before generation to reset CPU-offloaded runtime backend state...");
             std::lock_guard<std::mutex> lock(ctx.sd_ctx_mutex);
-            ctx.sd_ctx.reset();
-            sd_ctx_params_t sd_ctx_p = make_sd_ctx_params(ctx.ctx_params, ctx.sd_ctx_vae_decode_only);
-            ctx.sd_ctx.reset(new_sd_ctx(&sd_ctx_p));
-            if (!ctx.sd_ctx) {
+            // Always a new context: reusing a parked one would bring back the stale state
+            if (!activate_sd_context(ctx, ctx.sd_ctx_vae_decode_only, true)) {
                 res.status = 500;
                 res.set_content(make_error_json("model_reload_failed", "failed to reload Ideogram4 context before generation"), "application/json");
                 return;
@@ -1506,12 +2142,9 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
         if (request_clip_on_cpu != ctx.ctx_params.clip_on_cpu) {
             DD_LOG_INFO("Switching CLIP to %s for this generation...", request_clip_on_cpu ? "CPU" : "GPU");
             std::lock_guard<std::mutex> lock(ctx.sd_ctx_mutex);
-            ctx.sd_ctx.reset();
             ctx.ctx_params.clip_on_cpu = request_clip_on_cpu;
             sanitize_context_params_for_backend(ctx.ctx_params);
-            sd_ctx_params_t sd_ctx_p = make_sd_ctx_params(ctx.ctx_params, ctx.sd_ctx_vae_decode_only);
-            ctx.sd_ctx.reset(new_sd_ctx(&sd_ctx_p));
-            if (!ctx.sd_ctx) {
+            if (!activate_sd_context(ctx, ctx.sd_ctx_vae_decode_only)) {
                 res.status = 500;
                 res.set_content(make_error_json("model_reload_failed", "failed to reload model after CLIP placement change"), "application/json");
                 return;
@@ -1540,13 +2173,10 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
         if (request_vae_on_cpu != ctx.ctx_params.vae_on_cpu || request_offload != ctx.ctx_params.offload_params_to_cpu) {
             DD_LOG_INFO("Context update required: VAE on CPU: %s, Offload: %s", request_vae_on_cpu ? "Yes" : "No", request_offload ? "Yes" : "No");
             std::lock_guard<std::mutex> lock(ctx.sd_ctx_mutex);
-            ctx.sd_ctx.reset();
             ctx.ctx_params.vae_on_cpu = request_vae_on_cpu;
             ctx.ctx_params.offload_params_to_cpu = request_offload;
             sanitize_context_params_for_backend(ctx.ctx_params);
-            sd_ctx_params_t sd_ctx_p = make_sd_ctx_params(ctx.ctx_params, ctx.sd_ctx_vae_decode_only);
-            ctx.sd_ctx.reset(new_sd_ctx(&sd_ctx_p));
-            if (!ctx.sd_ctx) {
+            if (!activate_sd_context(ctx, ctx.sd_ctx_vae_decode_only)) {
                 res.status = 500;
                 res.set_content(make_error_json("model_reload_failed", "failed to reload model after placement change"), "application/json");
                 return;
@@ -1554,6 +2184,9 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
         }
 
         bool save_image = j.value("save_image", false);
+        // Set by the orchestrator, which records these results; nothing would ever clean up
+        // thumbnails of other callers (style and model previews, direct job clients)
+        const bool make_thumbnails = j.value("write_thumbnails", false);
 
         std::string lora_dir = ctx.ctx_params.lora_model_dir;
         if (lora_dir.empty()) {
@@ -1594,24 +2227,18 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
 
         sd_image_t init_image    = {(uint32_t)gen_params.width, (uint32_t)gen_params.height, 3, nullptr};
         
-        if (j.contains("init_image") && j["init_image"].is_string()) {
-            std::string b64_init = j["init_image"];
-            if (b64_init.find("base64,") != std::string::npos) {
-                b64_init = b64_init.substr(b64_init.find("base64,") + 7);
-            }
-            auto init_bytes = base64_decode(b64_init);
+        {
+            RequestImage init_bytes = request_image(req, j, "init_image");
             if (!init_bytes.empty()) {
                 int img_w = gen_params.width;
                 int img_h = gen_params.height;
-                init_image.data = load_image_from_memory(
-                    reinterpret_cast<const char*>(init_bytes.data()),
-                    (int)init_bytes.size(),
-                    img_w, img_h,
-                    gen_params.width, gen_params.height, 3);
+                init_image.data = load_request_image(init_bytes, img_w, img_h,
+                                                     gen_params.width, gen_params.height, 3,
+                                                     &image_cache(ctx.svr_params));
                 init_image.width = (uint32_t)img_w;
                 init_image.height = (uint32_t)img_h;
                 if (!init_image.data) {
-                    DD_LOG_ERROR("failed to load init_image from base64");
+                    DD_LOG_ERROR("failed to load init_image");
                 } else {
                     DD_LOG_INFO("loaded init_image for img2img: %dx%d", img_w, img_h);
                 }
@@ -1621,24 +2248,18 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
         sd_image_t control_image = {(uint32_t)gen_params.width, (uint32_t)gen_params.height, 3, nullptr};
         sd_image_t mask_image    = {(uint32_t)gen_params.width, (uint32_t)gen_params.height, 1, nullptr};
 
-        if (j.contains("mask_image") && j["mask_image"].is_string()) {
-            std::string b64_mask = j["mask_image"];
-            if (b64_mask.find("base64,") != std::string::npos) {
-                b64_mask = b64_mask.substr(b64_mask.find("base64,") + 7);
-            }
-            auto mask_bytes_v = base64_decode(b64_mask);
-            if (!mask_bytes_v.empty()) {
+        {
+            RequestImage mask_bytes = request_image(req, j, "mask_image");
+            if (!mask_bytes.empty()) {
                 int mask_w = gen_params.width;
                 int mask_h = gen_params.height;
-                mask_image.data = load_image_from_memory(
-                    reinterpret_cast<const char*>(mask_bytes_v.data()),
-                    (int)mask_bytes_v.size(),
-                    mask_w, mask_h,
-                    gen_params.width, gen_params.height, 1);
+                mask_image.data = load_request_image(mask_bytes, mask_w, mask_h,
+                                                     gen_params.width, gen_params.height, 1,
+                                                     &image_cache(ctx.svr_params));
                 mask_image.width = (uint32_t)mask_w;
                 mask_image.height = (uint32_t)mask_h;
                 if (!mask_image.data) {
-                    DD_LOG_ERROR("failed to load mask_image from base64");
+                    DD_LOG_ERROR("failed to load mask_image");
                 } else {
                     DD_LOG_INFO("loaded mask_image for inpainting: %dx%d", mask_w, mask_h);
                 }
@@ -1688,6 +2309,7 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
         {
             auto start_time = std::chrono::high_resolution_clock::now();
             std::lock_guard<std::mutex> lock(ctx.sd_ctx_mutex);
+            GenerationPassLock pass_lock;
             if (ctx.sd_ctx == nullptr) {
                 res.status = 400;
                 res.set_content(make_error_json("no_model", "no model loaded"), "application/json");
@@ -1833,7 +2455,6 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
                 DD_LOG_INFO("Performing NVIDIA PiD highres upscale for %d images...", num_results);
                 set_progress_phase("Highres PiD Upscale...");
 
-                SDContextParams base_ctx_params = ctx.ctx_params;
                 const bool base_vae_decode_only = ctx.sd_ctx_vae_decode_only;
                 SDContextParams pid_ctx_params = ctx.ctx_params;
                 pid_ctx_params.model_path = "";
@@ -1858,14 +2479,19 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
                     pid_ctx_params.vae_tiling_params.tile_size_y = 32;
                 }
 
-                ctx.sd_ctx.reset();
-                sd_ctx_params_t pid_ctx_raw = pid_ctx_params.to_sd_ctx_params_t(false, false, false);
-                SdCtxPtr pid_ctx(new_sd_ctx(&pid_ctx_raw));
-                if (!pid_ctx) {
+                // The PiD context takes the place of the base one; both stay in the context
+                // cache, so repeated PiD runs swap instead of reloading each time
+                const bool pid_ctx_ready = ctx.context_cache->activate(
+                    ctx.sd_ctx,
+                    SdContextCache::signature(pid_ctx_params, false, false),
+                    SdContextCache::estimate_cost(pid_ctx_params),
+                    [&]() {
+                        sd_ctx_params_t pid_ctx_raw = pid_ctx_params.to_sd_ctx_params_t(false, false, false);
+                        return SdCtxPtr(new_sd_ctx(&pid_ctx_raw));
+                    });
+                if (!pid_ctx_ready) {
                     DD_LOG_ERROR("Failed to create PiD context.");
-                    sd_ctx_params_t base_ctx_raw = make_sd_ctx_params(base_ctx_params, base_vae_decode_only);
-                    ctx.sd_ctx.reset(new_sd_ctx(&base_ctx_raw));
-                    ctx.sd_ctx_vae_decode_only = base_vae_decode_only;
+                    activate_sd_context(ctx, base_vae_decode_only);
                     res.status = 500;
                     res.set_content(make_error_json("generation_failed", "Failed to load NVIDIA PiD upscale context."), "application/json");
                     free_sd_images(results, num_results);
@@ -1913,7 +2539,7 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
                         progress_state.sampling_steps = 4;
                     }
 
-                    sd_image_t* pid_pass = generate_image_with_cancel_context(pid_ctx.get(), &pid_params);
+                    sd_image_t* pid_pass = generate_image_with_cancel_context(ctx.sd_ctx.get(), &pid_params);
                     if (pid_pass && pid_pass[0].data && is_image_valid(pid_pass[0])) {
                         pid_results[i] = pid_pass[0];
                         free(pid_pass);
@@ -1929,11 +2555,7 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
                     }
                 }
 
-                pid_ctx.reset();
-                sd_ctx_params_t base_ctx_raw = make_sd_ctx_params(base_ctx_params, base_vae_decode_only);
-                ctx.sd_ctx.reset(new_sd_ctx(&base_ctx_raw));
-                ctx.sd_ctx_vae_decode_only = base_vae_decode_only;
-                if (!ctx.sd_ctx) {
+                if (!activate_sd_context(ctx, base_vae_decode_only)) {
                     DD_LOG_WARN("Failed to restore base SD context after PiD stage. The next request may need to reload the preset.");
                 }
 
@@ -2066,6 +2688,18 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
                 free(results);
                 results = hires_results;
             }
+
+            // The highres stages fall back to the base images when interrupted; a cancelled or
+            // preempted job must not complete with those
+            if (active_generation_cancel_requested()) {
+                res.status = 499;
+                res.set_content(make_error_json("cancelled", "generation job cancelled by client"), "application/json");
+                free_sd_images(results, num_results);
+                if (init_image.data) stbi_image_free(init_image.data);
+                if (mask_image.data) stbi_image_free(mask_image.data);
+                if (control_image.data) stbi_image_free(control_image.data);
+                return;
+            }
             auto end_time = std::chrono::high_resolution_clock::now();
             total_generation_time = std::chrono::duration<double>(end_time - start_time).count();
             
@@ -2079,70 +2713,151 @@ void handle_generate_image(const httplib::Request& req, httplib::Response& res,
         // If batch > 1, force JSON to keep it simple unless we implement multipart
         // Note: We now always return JSON with URLs as primary method.
 
+        // Always save to disk (temp or permanent) to serve via URL
+        std::string final_output_dir = ctx.svr_params.output_dir;
+        std::string url_prefix = "/outputs/";
+        if (!save_image) {
+            final_output_dir = (fs::path(ctx.svr_params.output_dir) / "temp").string();
+            url_prefix = "/outputs/temp/";
+        }
+        try {
+            if (!fs::exists(final_output_dir)) {
+                fs::create_directories(final_output_dir);
+            }
+        } catch (const std::exception& e) {
+            DD_LOG_ERROR("failed to create output directory: %s", e.what());
+        }
+
+        // Each image is thumbnailed, encoded and written on the result pool, so a batch
+        // costs about as long as its slowest image instead of the sum of all of them
+        const std::string fsync_policy = ctx.svr_params.fsync_policy;
+        diffusion_desk::ThreadPool& pool = result_pool(ctx.svr_params);
+
+        // Full parameters for the PNG text chunk: the request without inline images, plus
+        // the values it was actually generated with. Each image adds its own seed.
+        diffusion_desk::json embedded_params = j;
+        for (const char* key : {"init_image", "mask_image", "image", "end_image", "ref_images", "control_image"}) {
+            embedded_params.erase(key);
+        }
+        embedded_params["prompt"]          = gen_params.prompt;
+        embedded_params["negative_prompt"] = gen_params.negative_prompt;
+        embedded_params["width"]           = gen_params.width;
+        embedded_params["height"]          = gen_params.height;
+        embedded_params["steps"]           = gen_params.sample_params.sample_steps;
+        embedded_params["cfg_scale"]       = gen_params.sample_params.guidance.txt_cfg;
+        embedded_params["sampler"]         = sd_sample_method_name(gen_params.sample_params.sample_method);
+        embedded_params["model"]           = fs::path(ctx.ctx_params.diffusion_model_path.empty() ? ctx.ctx_params.model_path
+                                                                                                  : ctx.ctx_params.diffusion_model_path).filename().string();
+        embedded_params["generation_time"] = total_generation_time;
+        auto encode_start = std::chrono::steady_clock::now();
+        std::vector<std::future<diffusion_desk::json>> encoded;
         int successful_generations = 0;
         for (int i = 0; i < num_results; i++) {
             if (results[i].data == nullptr) {
                 continue;
             }
             successful_generations++;
-            auto image_bytes = write_image_to_vector(output_format == "jpeg" ? ImageFormat::JPEG : ImageFormat::PNG,
-                                                        results[i].data,
-                                                        (int)results[i].width,
-                                                        (int)results[i].height,
-                                                        (int)results[i].channel,
-                                                        output_compression);
-            if (image_bytes.empty()) {
-                DD_LOG_ERROR("write image to mem failed");
-                continue;
-            }
-
             int64_t current_seed = gen_params.seed + i;
-            diffusion_desk::json item;
-            item["seed"] = current_seed;
+            auto timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            std::string base_filename = "img-" + std::to_string(timestamp) + "-" + std::to_string(current_seed);
+
+            encoded.push_back(pool.submit([&, i, current_seed, base_filename]() -> diffusion_desk::json {
+                const sd_image_t& image = results[i];
+                auto elapsed_ms = [](std::chrono::steady_clock::time_point since) {
+                    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+                };
+
+                // Thumbnails from the pixels still in memory; the orchestrator records them
+                // instead of decoding the encoded file again
+                auto step_start = std::chrono::steady_clock::now();
+                diffusion_desk::json thumbnails = make_thumbnails
+                    ? write_thumbnails(image, ctx.svr_params.output_dir, base_filename)
+                    : diffusion_desk::json::object();
+                double thumbnails_ms = elapsed_ms(step_start);
+
+                // Temporary results are usually discarded: store them as QOI and convert
+                // only if they are fetched or kept (materialize_image)
+                const ImageFormat file_format = !save_image ? ImageFormat::QOI
+                                              : output_format == "jpeg" ? ImageFormat::JPEG : ImageFormat::PNG;
+                step_start = std::chrono::steady_clock::now();
+                auto image_bytes = write_image_to_vector(file_format,
+                                                            image.data,
+                                                            (int)image.width,
+                                                            (int)image.height,
+                                                            (int)image.channel,
+                                                            output_compression);
+                // Kept PNGs carry their parameters; JPEG has no text chunks and keeps a .txt sidecar
+                std::string params_txt;
+                if (save_image) params_txt = get_image_params(ctx.ctx_params, gen_params, current_seed, total_generation_time);
+                if (file_format == ImageFormat::PNG && !image_bytes.empty()) {
+                    diffusion_desk::json params = embedded_params;
+                    params["seed"] = current_seed;
+                    diffusion_desk::png_add_text(image_bytes, {
+                        {diffusion_desk::PNG_PARAMETERS_KEY, params_txt},
+                        {diffusion_desk::PNG_PARAMS_JSON_KEY, params.dump(-1, ' ', false, diffusion_desk::json::error_handler_t::replace)}});
+                }
+                double encode_ms = elapsed_ms(step_start);
+                if (image_bytes.empty()) {
+                    DD_LOG_ERROR("write image to mem failed");
+                    return nullptr;
+                }
 
-            // Always save to disk (temp or permanent) to serve via URL
-            try {
-                std::string final_output_dir = ctx.svr_params.output_dir;
-                std::string url_prefix = "/outputs/";
-
-                if (!save_image) {
-                    final_output_dir = (fs::path(ctx.svr_params.output_dir) / "temp").string();
-                    url_prefix = "/outputs/temp/";
-                    if (!fs::exists(final_output_dir)) {
-                        fs::create_directories(final_output_dir);
+                diffusion_desk::json item;
+                item["seed"] = current_seed;
+
+                step_start = std::chrono::steady_clock::now();
+                try {
+                    std::string img_filename = (fs::path(final_output_dir) / (base_filename + (save_image ? ".png" : ".qoi"))).string();
+                    if (!write_file(img_filename, image_bytes.data(), image_bytes.size(), fsync_policy == "always")) {
+                        DD_LOG_ERROR("failed to write %s", img_filename.c_str());
+                    } else {
+                        DD_LOG_INFO("saved image to %s", img_filename.c_str());
                     }
-                } else {
-                    if (!fs::exists(final_output_dir)) {
-                        fs::create_directories(final_output_dir);
+
+                    // Only save metadata txt if saving permanently
+                    std::string txt_filename;
+                    if (save_image && file_format != ImageFormat::PNG) {
+                        txt_filename = (fs::path(final_output_dir) / (base_filename + ".txt")).string();
+                        write_file(txt_filename, reinterpret_cast<const uint8_t*>(params_txt.data()), params_txt.size(), fsync_policy == "always");
                     }
-                }
 
-                auto timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-                std::string base_filename = "img-" + std::to_string(timestamp) + "-" + std::to_string(current_seed);
-                std::string img_filename = (fs::path(final_output_dir) / (base_filename + ".png")).string();
-                
-                std::ofstream file(img_filename, std::ios::binary);
-                file.write(reinterpret_cast<const char*>(image_bytes.data()), image_bytes.size());
-                DD_LOG_INFO("saved image to %s", img_filename.c_str());
-
-                // Only save metadata txt if saving permanently
-                if (save_image) {
-                    std::string txt_filename = (fs::path(final_output_dir) / (base_filename + ".txt")).string();
-                    std::string params_txt = get_image_params(ctx.ctx_params, gen_params, current_seed, total_generation_time);
-                    std::ofstream txt_file(txt_filename);
-                    txt_file << params_txt;
+                    if (fsync_policy == "async") {
+                        // Flushed behind the response; the page cache already serves the file
+                        flush_pool().submit([img_filename, txt_filename] {
+                            sync_file(img_filename);
+                            if (!txt_filename.empty()) sync_file(txt_filename);
+                        });
+                    }
+
+                    // Add file info to response
+                    item["url"] = url_prefix + base_filename + ".png";
+                    item["name"] = base_filename + ".png";
+                    if (!thumbnails.empty()) item["thumbnails"] = thumbnails;
+
+                } catch (const std::exception& e) {
+                    DD_LOG_ERROR("failed to save image or metadata: %s", e.what());
                 }
+                double write_ms = elapsed_ms(step_start);
 
-                // Add file info to response
-                item["url"] = url_prefix + base_filename + ".png";
-                item["name"] = base_filename + ".png";
+                item["timings"] = {{"thumbnails_ms", thumbnails_ms}, {"encode_ms", encode_ms}, {"write_ms", write_ms}};
+                DD_LOG_INFO("image %d: thumbnails %.1f ms, encode %.1f ms, write %.1f ms", i + 1, thumbnails_ms, encode_ms, write_ms);
+                return item;
+            }));
+        }
 
+        // Every task references this frame, so all of them finish before anything can throw.
+        // Results keep batch order regardless of which image finished first.
+        for (auto& pending : encoded) pending.wait();
+        for (auto& pending : encoded) {
+            try {
+                diffusion_desk::json item = pending.get();
+                if (!item.is_null()) out["data"].push_back(item);
             } catch (const std::exception& e) {
-                DD_LOG_ERROR("failed to save image or metadata: %s", e.what());
+                DD_LOG_ERROR("failed to encode image: %s", e.what());
             }
-
-            out["data"].push_back(item);
         }
+        out["encode_time_ms"] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encode_start).count();
+        DD_LOG_INFO("Encoded %zu image(s) on %zu thread(s) in %.1f ms", encoded.size(), pool.size(), out["encode_time_ms"].get<double>());
 
         if (successful_generations == 0) {
             DD_LOG_ERROR("All generated images were null (VAE decoding pass).");
@@ -2209,16 +2924,17 @@ void handle_edit_image(const httplib::Request& req, httplib::Response& res, Serv
             return;
         }
 
-        std::vector<std::vector<uint8_t>> images_bytes;
-        for (size_t i = 0; i < image_count; i++) {
-            auto file = req.form.get_file("image[]", i);
-            images_bytes.emplace_back(file.content.begin(), file.content.end());
+        // Views into the request's parts; they stay valid for the whole handler
+        std::vector<RequestImage> images_bytes;
+        auto image_parts = req.form.files.equal_range("image[]");
+        for (auto it = image_parts.first; it != image_parts.second; ++it) {
+            images_bytes.push_back({it->second.content.data(), it->second.content.size()});
         }
 
-        std::vector<uint8_t> mask_bytes;
-        if (req.form.has_field("mask")) {
-            auto file = req.form.get_file("mask");
-            mask_bytes.assign(file.content.begin(), file.content.end());
+        RequestImage mask_bytes;
+        auto mask_part = req.form.files.find("mask");
+        if (mask_part != req.form.files.end()) {
+            mask_bytes = {mask_part->second.content.data(), mask_part->second.content.size()};
         }
 
         int n = 1;
@@ -2228,7 +2944,7 @@ void handle_edit_image(const httplib::Request& req, httplib::Response& res, Serv
             } catch (...) {
             }
         }
-        n = std::clamp(n, 1, 8);
+        n = std::clamp(n, 1, MAX_GENERATION_IMAGES);
 
         std::string size = req.form.get_field("size");
         int width = 512, height = 512;
@@ -2301,11 +3017,7 @@ void handle_edit_image(const httplib::Request& req, httplib::Response& res, Serv
         for (auto& bytes : images_bytes) {
             int img_w           = width;
             int img_h           = height;
-            uint8_t* raw_pixels = load_image_from_memory(
-                reinterpret_cast<const char*>(bytes.data()),
-                (int)bytes.size(),
-                img_w, img_h,
-                width, height, 3);
+            uint8_t* raw_pixels = load_request_image(bytes, img_w, img_h, width, height, 3, &image_cache(ctx.svr_params));
 
             if (!raw_pixels) {
                 continue;
@@ -2319,11 +3031,7 @@ void handle_edit_image(const httplib::Request& req, httplib::Response& res, Serv
         if (!mask_bytes.empty()) {
             int mask_w        = width;
             int mask_h        = height;
-            uint8_t* mask_raw = load_image_from_memory(
-                reinterpret_cast<const char*>(mask_bytes.data()),
-                (int)mask_bytes.size(),
-                mask_w, mask_h,
-                width, height, 1);
+            uint8_t* mask_raw = load_request_image(mask_bytes, mask_w, mask_h, width, height, 1, &image_cache(ctx.svr_params));
             mask_image = {(uint32_t)mask_w, (uint32_t)mask_h, 1, mask_raw};
         } else {
             mask_image.width   = (uint32_t)width;
@@ -2477,7 +3185,10 @@ void handle_edit_image(const httplib::Request& req, httplib::Response& res, Serv
         if (results[i].data == nullptr)
             continue;
         successful_generations++;
-        auto image_bytes = write_image_to_vector(output_format == "jpeg" ? ImageFormat::JPEG : ImageFormat::PNG,
+        // Stored as QOI and converted when first fetched (materialize_image), which
+        // only yields PNG; JPEG is written directly so the requested format is honoured
+        const ImageFormat file_format = output_format == "jpeg" ? ImageFormat::JPEG : ImageFormat::QOI;
+        auto image_bytes = write_image_to_vector(file_format,
                                                     results[i].data,
                                                     (int)results[i].width,
                                                     (int)results[i].height,
@@ -2497,7 +3208,7 @@ void handle_edit_image(const httplib::Request& req, httplib::Response& res, Serv
 
             auto timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
             std::string base_filename = "edit-" + std::to_string(timestamp) + "-" + std::to_string(current_seed);
-            std::string img_filename = (fs::path(temp_dir) / (base_filename + ".png")).string();
+            std::string img_filename = (fs::path(temp_dir) / (base_filename + (file_format == ImageFormat::QOI ? ".qoi" : ".png"))).string();
             
             std::ofstream file(img_filename, std::ios::binary);
             file.write(reinterpret_cast<const char*>(image_bytes.data()), image_bytes.size());
@@ -5,6 +5,7 @@
 #include "utils/common.hpp"
 #include "utils/sd_common.hpp"
 #include "server_state.hpp"
+#include "context_cache.hpp"
 #include <mutex>
 
 // Forward declaration if needed, but workers usually handle their own types
@@ -23,12 +24,29 @@ struct ServerContext {
     bool active_llm_model_loaded = false;
     bool was_using_loras = false; // Workaround for stable-diffusion.cpp LoRA persistence bug
     bool sd_ctx_vae_decode_only = true;
+    // Context variants parked across placement changes; set up by the worker
+    std::shared_ptr<SdContextCache> context_cache;
     
     // B2.5: Idle timeout tracking
     std::chrono::steady_clock::time_point last_access = std::chrono::steady_clock::now();
     void update_last_access() { last_access = std::chrono::steady_clock::now(); }
 };
 
+// Makes ctx.sd_ctx the context for ctx.ctx_params, from the context cache when this variant
+// was used before. Call with sd_ctx_mutex held. fresh always builds a new one.
+bool activate_sd_context(ServerContext& ctx, bool vae_decode_only, bool fresh = false);
+
+// Held by the synchronous /v1/images/generations and /v1/images/edits routes, which are what
+// the web UI uses for the user's own renders. A running background pass (style and model
+// previews) is preempted as for an interactive job, and background jobs do not start until
+// the request is done, instead of racing it for sd_ctx_mutex.
+struct InteractiveGenerationScope {
+    InteractiveGenerationScope();
+    ~InteractiveGenerationScope();
+    InteractiveGenerationScope(const InteractiveGenerationScope&) = delete;
+    InteractiveGenerationScope& operator=(const InteractiveGenerationScope&) = delete;
+};
+
 // Endpoint handlers
 void handle_get_outputs(const httplib::Request& req, httplib::Response& res, ServerContext& ctx);
 void handle_health(const httplib::Request& req, httplib::Response& res, ServerContext& ctx);
@@ -1,4 +1,5 @@
 #include "api_utils.hpp"
+#include <algorithm>
 #include <ctime>
 #include <iomanip>
 #include <sstream>
@@ -7,59 +8,21 @@
 #include <cctype> // For isalnum
 #include "sd/api_endpoints.hpp" // For SDSvrParams definition
 #include "stb_image_write.h"
+#include "utils/file_server.hpp"
+#include "utils/image_resample.hpp"
+#include "utils/qoi.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <mutex>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 
 
-// Base64 utilities
-static const std::string base64_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-bool is_base64(unsigned char c) {
-    return (isalnum(c) || (c == '+') || (c == '/'));
-}
-
-std::vector<uint8_t> base64_decode(const std::string& encoded_string) {
-    int in_len = (int)encoded_string.size();
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::vector<uint8_t> ret;
-
-    while (in_len-- && (encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-        char_array_4[i++] = encoded_string[in_];
-        in_++;
-        if (i == 4) {
-            for (i = 0; i < 4; i++)
-                char_array_4[i] = (unsigned char)base64_chars.find(char_array_4[i]);
-
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-            for (i = 0; i < 3; i++)
-                ret.push_back(char_array_3[i]);
-            i = 0;
-        }
-    }
-
-    if (i) {
-        for (j = i; j < 4; j++)
-            char_array_4[j] = 0;
-
-        for (j = 0; j < 4; j++)
-            char_array_4[j] = (unsigned char)base64_chars.find(char_array_4[j]);
-
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-        for (j = 0; j < i - 1; j++)
-            ret.push_back(char_array_3[j]);
-    }
-
-    return ret;
-}
-
 // JSON utilities
 diffusion_desk::json redact_json_impl(const diffusion_desk::json& j, int depth) {
     if (depth > 10) return "[MAX DEPTH]"; // Safety break
@@ -104,47 +67,6 @@ diffusion_desk::json redact_json(const diffusion_desk::json& j) {
 
 // Image params
 
-diffusion_desk::json parse_image_params(const std::string& txt) {
-    diffusion_desk::json j;
-    std::regex param_re(R"(([^:]+):\s*(.*))");
-    std::stringstream ss(txt);
-    std::string line;
-    bool in_params = false;
-    std::string prompt = "";
-    std::string neg_prompt = "";
-    
-    while(std::getline(ss, line)) {
-        if (line.find("Negative prompt:") == 0) {
-            neg_prompt = line.substr(16);
-            in_params = false;
-            continue;
-        }
-        if (line.find("Steps:") == 0) {
-            in_params = true;
-            std::regex kv_re(R"(([^:,]+):\s*([^,]+))");
-            std::sregex_iterator begin(line.begin(), line.end(), kv_re);
-            std::sregex_iterator end;
-            for (std::sregex_iterator i = begin; i != end; ++i) {
-                std::smatch match = *i;
-                std::string key = match[1];
-                std::string val = match[2];
-                // Trim leading/trailing whitespace
-                key = std::regex_replace(key, std::regex("^\\s+|\\s+$"), "");
-                val = std::regex_replace(val, std::regex("^\\s+|\\s+$"), "");
-                j[key] = val;
-            }
-            continue;
-        }
-        if (!in_params) {
-            if (!prompt.empty()) prompt += "\n";
-            prompt += line;
-        }
-    }
-    j["prompt"] = prompt;
-    j["negative_prompt"] = neg_prompt;
-    return j;
-}
-
 std::string get_image_params(const SDContextParams& ctx_params, const SDGenerationParams& gen_params, int64_t seed, double generation_time) {
     std::stringstream ss;
     ss << (gen_params.prompt_with_lora.empty() ? gen_params.prompt : gen_params.prompt_with_lora) << "\n";
@@ -171,7 +93,9 @@ void write_func(void *context, void *data, int size) {
 std::vector<uint8_t> write_image_to_vector(ImageFormat format, const uint8_t* image, int width, int height, int channels, int quality) {
     std::vector<uint8_t> buffer;
     int res = 0;
-    if (format == ImageFormat::PNG) {
+    if (format == ImageFormat::QOI) {
+        return diffusion_desk::qoi_encode(image, width, height, channels);
+    } else if (format == ImageFormat::PNG) {
         res = stbi_write_png_to_func(write_func, &buffer, width, height, channels, image, width * channels);
     } else {
         res = stbi_write_jpg_to_func(write_func, &buffer, width, height, channels, image, quality);
@@ -180,6 +104,92 @@ std::vector<uint8_t> write_image_to_vector(ImageFormat format, const uint8_t* im
     return buffer;
 }
 
+bool materialize_image(const std::string& path) {
+    // One conversion per file even when the page and the gallery ask at the same time
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    try {
+        fs::path target(path);
+        if (fs::exists(target)) return true;
+        fs::path source = target;
+        source.replace_extension(".qoi");
+        if (!fs::exists(source)) return false;
+
+        int width = 0, height = 0, channels = 0;
+        uint8_t* pixels = diffusion_desk::qoi_load(source.string().c_str(), &width, &height, &channels, 0);
+        if (!pixels) {
+            DD_LOG_ERROR("failed to decode %s", source.string().c_str());
+            return false;
+        }
+        std::string ext = target.extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        auto bytes = write_image_to_vector((ext == ".jpg" || ext == ".jpeg") ? ImageFormat::JPEG : ImageFormat::PNG,
+                                           pixels, width, height, channels);
+        free(pixels);
+        if (bytes.empty()) return false;
+
+        // Written aside and renamed so a reader never sees a partial file
+        if (!diffusion_desk::replace_file(target, bytes.data(), bytes.size())) return false;
+        fs::remove(source);
+        return true;
+    } catch (const std::exception& e) {
+        DD_LOG_ERROR("failed to convert %s: %s", path.c_str(), e.what());
+        return false;
+    }
+}
+
+static bool flush_to_disk(FILE* file) {
+    if (fflush(file) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+bool write_file(const std::string& path, const uint8_t* data, size_t size, bool sync) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    bool ok = fwrite(data, 1, size, file) == size;
+    if (ok && sync) ok = flush_to_disk(file);
+    return fclose(file) == 0 && ok;
+}
+
+bool sync_file(const std::string& path) {
+    // Append mode: writable (needed for _commit) without truncating
+    FILE* file = fopen(path.c_str(), "ab");
+    if (!file) return false;
+    bool ok = flush_to_disk(file);
+    return fclose(file) == 0 && ok;
+}
+
+diffusion_desk::json write_thumbnails(const sd_image_t& image, const std::string& output_dir, const std::string& base_filename) {
+    diffusion_desk::json thumbnails = diffusion_desk::json::object();
+    if (!image.data || image.width == 0 || image.height == 0) return thumbnails;
+    try {
+        fs::path preview_dir = fs::path(output_dir) / "previews";
+        if (!fs::exists(preview_dir)) {
+            fs::create_directories(preview_dir);
+        }
+        std::vector<int> sizes(std::begin(diffusion_desk::THUMBNAIL_SIZES), std::end(diffusion_desk::THUMBNAIL_SIZES));
+        auto levels = diffusion_desk::build_pyramid(image.data, (int)image.width, (int)image.height, (int)image.channel, sizes);
+        for (const auto& level : levels) {
+            std::string filename = "thumb_" + base_filename + "_" + std::to_string(level.max_dim) + ".jpg";
+            auto jpg = write_image_to_vector(ImageFormat::JPEG, level.pixels.data(), level.width, level.height,
+                                             (int)image.channel, 85);
+            if (jpg.empty() || !diffusion_desk::replace_file(preview_dir / filename, jpg.data(), jpg.size())) {
+                DD_LOG_ERROR("failed to write thumbnail %s", filename.c_str());
+                return diffusion_desk::json::object();
+            }
+            thumbnails[std::to_string(level.max_dim)] = "/outputs/previews/" + filename;
+        }
+    } catch (const std::exception& e) {
+        DD_LOG_ERROR("failed to write thumbnails: %s", e.what());
+        return diffusion_desk::json::object();
+    }
+    return thumbnails;
+}
+
 bool is_image_valid(const sd_image_t& img) {
     if (!img.data || img.width == 0 || img.height == 0) return false;
     
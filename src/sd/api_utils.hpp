@@ -9,12 +9,7 @@
 // Time utilities
 std::string iso_timestamp_now();
 
-// Base64 utilities
-std::vector<uint8_t> base64_decode(const std::string& encoded_string);
-bool is_base64(unsigned char c);
-
 // Image parameter handling
-diffusion_desk::json parse_image_params(const std::string& txt);
 std::string get_image_params(const SDContextParams& ctx_params, const SDGenerationParams& gen_params, int64_t seed, double generation_time = 0.0);
 
 // JSON utilities
@@ -23,7 +18,8 @@ diffusion_desk::json redact_json(const diffusion_desk::json& j);
 // Image processing
 enum class ImageFormat { 
     JPEG,
-    PNG 
+    PNG,
+    QOI // Lossless and fast to encode; for temporary outputs, see materialize_image
 };
 
 std::vector<uint8_t> write_image_to_vector(
@@ -35,6 +31,22 @@ std::vector<uint8_t> write_image_to_vector(
     int quality = 90
 );
 
+// Temporary results are written as <base>.qoi but published under the URL of the file they
+// become once kept, <base>.png. If `path` does not exist yet, converts the QOI file next
+// to it into path's format (JPEG for .jpg/.jpeg, PNG otherwise) and removes the QOI file.
+// Returns whether `path` exists afterwards.
+bool materialize_image(const std::string& path);
+
+// Writes `size` bytes to `path`. With sync the data is flushed to stable storage (fsync)
+// before returning; sync_file does the same for a file written earlier.
+bool write_file(const std::string& path, const uint8_t* data, size_t size, bool sync = false);
+bool sync_file(const std::string& path);
+
+// Downscales a generated image into the thumbnail pyramid and writes each level as a JPEG
+// into <output_dir>/previews, straight from the pixel buffer. Returns {"<size>": url} with
+// urls under /outputs/previews/, or an empty object if any level could not be written.
+diffusion_desk::json write_thumbnails(const sd_image_t& image, const std::string& output_dir, const std::string& base_filename);
+
 void sd_log_cb(enum sd_log_level_t level, const char* log, void* data);
 
 // Validation
@@ -0,0 +1,202 @@
+#include "context_cache.hpp"
+#include <vector>
+
+namespace {
+
+uint64_t file_bytes(const std::string& path) {
+    if (path.empty()) return 0;
+    std::error_code ec;
+    auto size = fs::file_size(path, ec);
+    return ec ? 0 : (uint64_t)size;
+}
+
+} // namespace
+
+SdContextCache::SdContextCache(uint64_t host_budget_bytes, uint64_t vram_budget_bytes)
+    : m_host_budget(host_budget_bytes), m_vram_budget(vram_budget_bytes) {}
+
+std::string SdContextCache::signature(const SDContextParams& p, bool vae_decode_only, bool free_params_immediately) {
+    std::ostringstream ss;
+    ss << "model=" << p.model_path << "\ndiffusion=" << p.diffusion_model_path
+       << "\nhigh_noise=" << p.high_noise_diffusion_model_path << "\nuncond=" << p.uncond_diffusion_model_path
+       << "\nclip_l=" << p.clip_l_path << "\nclip_g=" << p.clip_g_path << "\nclip_vision=" << p.clip_vision_path
+       << "\nt5xxl=" << p.t5xxl_path << "\nllm=" << p.llm_path << "\nllm_vision=" << p.llm_vision_path
+       << "\nvae=" << p.vae_path << "\ntaesd=" << p.taesd_path << "\ncontrol_net=" << p.control_net_path
+       << "\nphoto_maker=" << p.photo_maker_path << "\ntensor_type_rules=" << p.tensor_type_rules;
+    for (const auto& [name, path] : p.embedding_map) ss << "\nembedding:" << name << "=" << path;
+    ss << "\nthreads=" << p.n_threads << " wtype=" << (int)p.wtype << " rng=" << (int)p.rng_type
+       << " sampler_rng=" << (int)p.sampler_rng_type << " prediction=" << (int)p.prediction
+       << " lora_apply=" << (int)p.lora_apply_mode << " vae_format=" << (int)p.vae_format
+       << "\noffload=" << p.offload_params_to_cpu << " mmap=" << p.enable_mmap
+       << " control_net_cpu=" << p.control_net_cpu << " clip_on_cpu=" << p.clip_on_cpu
+       << " vae_on_cpu=" << p.vae_on_cpu << " flash_attn=" << p.diffusion_flash_attn
+       << " conv_direct=" << p.diffusion_conv_direct << "/" << p.vae_conv_direct
+       << " sdxl_vae_conv_scale=" << p.force_sdxl_vae_conv_scale
+       << "\nchroma=" << p.chroma_use_dit_mask << "/" << p.chroma_use_t5_mask << "/" << p.chroma_t5_mask_pad
+       << " qwen_zero_cond_t=" << p.qwen_image_zero_cond_t
+       << "\nmax_vram=" << p.max_vram << " stream_layers=" << p.stream_layers
+       << "\nvae_decode_only=" << vae_decode_only << " free_params=" << free_params_immediately;
+    return ss.str();
+}
+
+SdContextCost SdContextCache::estimate_cost(const SDContextParams& p) {
+    SdContextCost cost;
+    auto add = [&](const std::string& path, bool on_cpu) {
+        const uint64_t bytes = file_bytes(path);
+        if (p.offload_params_to_cpu || on_cpu) cost.host_bytes += bytes;
+        else cost.vram_bytes += bytes;
+    };
+    // A full checkpoint carries its text encoders and VAE; it is counted with the diffusion model
+    for (const std::string* path : {&p.model_path, &p.diffusion_model_path, &p.high_noise_diffusion_model_path,
+                                    &p.uncond_diffusion_model_path, &p.photo_maker_path}) {
+        add(*path, false);
+    }
+    for (const std::string* path : {&p.clip_l_path, &p.clip_g_path, &p.clip_vision_path, &p.t5xxl_path,
+                                    &p.llm_path, &p.llm_vision_path}) {
+        add(*path, p.clip_on_cpu);
+    }
+    add(p.vae_path, p.vae_on_cpu);
+    add(p.taesd_path, p.vae_on_cpu);
+    add(p.control_net_path, p.control_net_cpu);
+    return cost;
+}
+
+bool SdContextCache::activate(SdCtxPtr& active, const std::string& signature, const SdContextCost& cost,
+                              const Builder& build, bool fresh) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (active && !fresh && signature == m_active_signature) return true;
+    }
+
+    SdCtxPtr taken;
+    SdCtxPtr discarded; // Freed outside the lock
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (fresh && signature == m_active_signature) {
+            // Rebuilding the active variant itself; the old one must not be parked
+            discarded = std::move(active);
+            m_active_signature.clear();
+            m_active_cost = {};
+        }
+        for (auto it = m_parked.begin(); it != m_parked.end(); ++it) {
+            if (it->signature != signature) continue;
+            (fresh ? discarded : taken) = std::move(it->ctx);
+            m_host_bytes -= it->cost.host_bytes;
+            m_vram_bytes -= it->cost.vram_bytes;
+            m_parked.erase(it);
+            break;
+        }
+        if (taken) m_hits++;
+        else m_misses++;
+    }
+    discarded.reset();
+    // Parked after the lookup so the entry being taken out never counts against the budget
+    park(active);
+
+    if (!taken) {
+        auto start = std::chrono::steady_clock::now();
+        taken = build();
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_rebuilds++;
+        m_rebuild_ms_total += ms;
+        m_rebuild_ms_last = ms;
+        DD_LOG_INFO("SD context built in %.0f ms (%llu build(s), %llu reuse(s) so far)",
+                    ms, (unsigned long long)m_rebuilds, (unsigned long long)m_hits);
+    } else {
+        DD_LOG_INFO("SD context variant reused from cache");
+    }
+    if (!taken) return false;
+
+    active = std::move(taken);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_active_signature = signature;
+    m_active_cost = cost;
+    return true;
+}
+
+void SdContextCache::park(SdCtxPtr& active) {
+    std::vector<SdCtxPtr> evicted;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // A context built outside the cache has no signature to find it by again
+        if (active && !m_active_signature.empty() &&
+            m_active_cost.host_bytes <= m_host_budget && m_active_cost.vram_bytes <= m_vram_budget) {
+            m_parked.push_front(Entry{m_active_signature, m_active_cost, std::move(active), std::chrono::steady_clock::now()});
+            m_host_bytes += m_active_cost.host_bytes;
+            m_vram_bytes += m_active_cost.vram_bytes;
+            trim_locked(evicted);
+        }
+        m_active_signature.clear();
+        m_active_cost = {};
+    }
+    active.reset(); // Did not fit
+}
+
+void SdContextCache::release_active(SdCtxPtr& active) {
+    active.reset();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_active_signature.clear();
+    m_active_cost = {};
+}
+
+void SdContextCache::trim_locked(std::vector<SdCtxPtr>& evicted) {
+    while ((m_host_bytes > m_host_budget || m_vram_bytes > m_vram_budget) && !m_parked.empty()) {
+        Entry& oldest = m_parked.back();
+        m_host_bytes -= oldest.cost.host_bytes;
+        m_vram_bytes -= oldest.cost.vram_bytes;
+        evicted.push_back(std::move(oldest.ctx));
+        m_parked.pop_back();
+        m_evictions++;
+    }
+}
+
+void SdContextCache::clear() {
+    std::list<Entry> freed;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    freed.swap(m_parked);
+    m_host_bytes = 0;
+    m_vram_bytes = 0;
+}
+
+void SdContextCache::clear_vram() {
+    std::list<Entry> freed;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_parked.begin(); it != m_parked.end();) {
+        if (it->cost.vram_bytes == 0) {
+            ++it;
+            continue;
+        }
+        m_host_bytes -= it->cost.host_bytes;
+        m_vram_bytes -= it->cost.vram_bytes;
+        auto next = std::next(it);
+        freed.splice(freed.end(), m_parked, it);
+        it = next;
+    }
+}
+
+diffusion_desk::json SdContextCache::stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto now = std::chrono::steady_clock::now();
+    diffusion_desk::json parked = diffusion_desk::json::array();
+    for (const auto& entry : m_parked) {
+        parked.push_back({
+            {"host_mb", entry.cost.host_bytes / (1024 * 1024)},
+            {"vram_mb", entry.cost.vram_bytes / (1024 * 1024)},
+            {"parked_s", std::chrono::duration_cast<std::chrono::seconds>(now - entry.parked_at).count()}
+        });
+    }
+    return {
+        {"hits", m_hits},
+        {"misses", m_misses},
+        {"evictions", m_evictions},
+        {"rebuilds", m_rebuilds},
+        {"rebuild_ms_total", m_rebuild_ms_total},
+        {"rebuild_ms_last", m_rebuild_ms_last},
+        {"parked", parked},
+        {"host_bytes", m_host_bytes},
+        {"vram_bytes", m_vram_bytes},
+        {"host_budget_bytes", m_host_budget},
+        {"vram_budget_bytes", m_vram_budget}
+    };
+}
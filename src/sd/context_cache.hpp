@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "utils/common.hpp"
+#include "utils/sd_common.hpp"
+
+// Where the weights of a context live, estimated from the component file sizes and the
+// placement flags (offload_params_to_cpu, clip_on_cpu, vae_on_cpu, control_net_cpu)
+struct SdContextCost {
+    uint64_t host_bytes = 0;
+    uint64_t vram_bytes = 0;
+};
+
+// Recently used SD context variants of the worker. Placement changes (VAE decode-only vs
+// full, CLIP/VAE on CPU, weight offload, the automatic >=3 MP and >=4 MP switches) and the
+// PiD highres stage each need a context built with different parameters. Instead of freeing
+// the current context and loading all weights again on every toggle, the current one is
+// parked here under its signature, and a variant seen before is taken back out.
+//
+// Parked contexts stay fully loaded, so they are bounded by separate host and VRAM budgets;
+// the least recently used go first. The active context is not counted against either.
+// All calls except stats() happen with the worker's sd_ctx_mutex held.
+class SdContextCache {
+public:
+    using Builder = std::function<SdCtxPtr()>;
+
+    SdContextCache(uint64_t host_budget_bytes, uint64_t vram_budget_bytes);
+
+    // Everything new_sd_ctx receives from params, in a comparable string
+    static std::string signature(const SDContextParams& params, bool vae_decode_only, bool free_params_immediately);
+    static SdContextCost estimate_cost(const SDContextParams& params);
+
+    // Makes `active` the context with this signature. If it already is and fresh is false,
+    // nothing happens. Otherwise the current one is parked (or freed if it does not fit the
+    // budgets) and the requested one is taken from the cache or, failing that, built; a
+    // missing variant is only built once the current one is out of the way. fresh discards a
+    // parked copy and always builds. Returns false, leaving active empty, if building fails.
+    bool activate(SdCtxPtr& active, const std::string& signature, const SdContextCost& cost,
+                  const Builder& build, bool fresh = false);
+
+    // Moves the active context into the cache if it fits, else frees it
+    void park(SdCtxPtr& active);
+    // Frees the active context without parking it (model unload, offload, idle timeout)
+    void release_active(SdCtxPtr& active);
+    // Frees parked contexts: all of them, or only those holding VRAM
+    void clear();
+    void clear_vram();
+
+    diffusion_desk::json stats() const;
+
+private:
+    struct Entry {
+        std::string signature;
+        SdContextCost cost;
+        SdCtxPtr ctx;
+        std::chrono::steady_clock::time_point parked_at;
+    };
+
+    // Evicts least recently parked entries until both totals fit, handing them to evicted so
+    // they are freed after the lock is released. Call with m_mutex held.
+    void trim_locked(std::vector<SdCtxPtr>& evicted);
+
+    const uint64_t m_host_budget;
+    const uint64_t m_vram_budget;
+
+    mutable std::mutex m_mutex; // Guards everything below
+    std::list<Entry> m_parked;  // Most recently parked first
+    uint64_t m_host_bytes = 0;
+    uint64_t m_vram_bytes = 0;
+    std::string m_active_signature; // Empty if unknown (built outside the cache)
+    SdContextCost m_active_cost;
+
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    uint64_t m_evictions = 0;
+    uint64_t m_rebuilds = 0;
+    double m_rebuild_ms_total = 0.0;
+    double m_rebuild_ms_last = 0.0;
+};
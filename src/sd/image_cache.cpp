@@ -0,0 +1,104 @@
+#include "image_cache.hpp"
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t PRIME_1 = 0x9e3779b185ebca87ull;
+constexpr uint64_t PRIME_2 = 0xc2b2ae3d27d4eb4full;
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read_u64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t mix(uint64_t acc, uint64_t word) {
+    return rotl(acc + word * PRIME_2, 31) * PRIME_1;
+}
+
+} // namespace
+
+uint64_t content_hash(const void* data, size_t length) {
+    // Four independent lanes over 32-byte blocks (the xxHash64 structure), so the multiplies
+    // pipeline instead of waiting on each other
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + length;
+    uint64_t h;
+    if (length >= 32) {
+        uint64_t lanes[4] = {PRIME_1 + PRIME_2, PRIME_2, 0, 0 - PRIME_1};
+        for (; end - p >= 32; p += 32) {
+            lanes[0] = mix(lanes[0], read_u64(p));
+            lanes[1] = mix(lanes[1], read_u64(p + 8));
+            lanes[2] = mix(lanes[2], read_u64(p + 16));
+            lanes[3] = mix(lanes[3], read_u64(p + 24));
+        }
+        h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+        for (uint64_t lane : lanes) h = (h ^ mix(0, lane)) * PRIME_1 + PRIME_2;
+    } else {
+        h = PRIME_2 * 5;
+    }
+    h += (uint64_t)length;
+    for (; end - p >= 8; p += 8) h = rotl(h ^ mix(0, read_u64(p)), 27) * PRIME_1 + PRIME_2;
+    for (; p < end; ++p) h = rotl(h ^ (*p * PRIME_2), 11) * PRIME_1;
+    // Final avalanche
+    h ^= h >> 33;
+    h *= PRIME_2;
+    h ^= h >> 29;
+    h *= PRIME_1;
+    h ^= h >> 32;
+    return h;
+}
+
+DecodedImageCache::DecodedImageCache(size_t budget_bytes) : m_cache(budget_bytes) {}
+
+uint8_t* DecodedImageCache::load(const char* source, size_t length, int& width, int& height,
+                                 int expected_width, int expected_height, int expected_channel, const Decoder& decode) {
+    // Without a fixed channel count the buffer size is not known up front; not worth caching
+    if (expected_channel <= 0 || length == 0) return decode(width, height);
+
+    Key key;
+    key.hash = content_hash(source, length);
+    key.length = length;
+    key.width = expected_width;
+    key.height = expected_height;
+    key.channels = expected_channel;
+
+    if (auto image = m_cache.get(key)) {
+        auto* pixels = static_cast<uint8_t*>(std::malloc(image->pixels.size()));
+        if (!pixels) return nullptr;
+        std::memcpy(pixels, image->pixels.data(), image->pixels.size());
+        width = image->width;
+        height = image->height;
+        return pixels;
+    }
+
+    uint8_t* pixels = decode(width, height);
+    if (pixels) {
+        auto image = std::make_shared<Image>();
+        image->pixels.assign(pixels, pixels + (size_t)width * height * expected_channel);
+        image->width = width;
+        image->height = height;
+        const size_t cost = image->pixels.size();
+        m_cache.put(key, std::move(image), cost);
+    }
+    return pixels;
+}
+
+diffusion_desk::json DecodedImageCache::stats() const {
+    const auto s = m_cache.stats();
+    const uint64_t lookups = s.hits + s.misses;
+    return {
+        {"hits", s.hits},
+        {"misses", s.misses},
+        {"hit_rate", lookups > 0 ? (double)s.hits / (double)lookups : 0.0},
+        {"evictions", s.evictions},
+        {"entries", s.entries},
+        {"bytes", s.cost},
+        {"budget_bytes", s.budget}
+    };
+}
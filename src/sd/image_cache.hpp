@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "utils/common.hpp"
+#include "utils/lru_cache.hpp"
+
+// Decoded request images (init, mask and reference images) by content. Iterative img2img
+// and inpainting send the same picture with every request; the cache is keyed on a hash of
+// the bytes as they arrive (base64 text or a multipart part), so a repeat skips base64,
+// image decoding and the resize to the target size.
+class DecodedImageCache {
+public:
+    struct Key {
+        uint64_t hash = 0;
+        size_t length = 0;
+        int width = 0; // Requested size and channels, as passed to load_image_from_memory
+        int height = 0;
+        int channels = 0;
+        bool operator==(const Key& other) const {
+            return hash == other.hash && length == other.length && width == other.width &&
+                   height == other.height && channels == other.channels;
+        }
+    };
+
+    // Produces pixels on a miss, with load_image_from_memory's contract: a buffer freed
+    // with stbi_image_free, its size in width/height, nullptr on failure
+    using Decoder = std::function<uint8_t*(int& width, int& height)>;
+
+    explicit DecodedImageCache(size_t budget_bytes);
+
+    // The decoded image for source, from the cache or through decode. Returns a buffer of its
+    // own that the caller frees with stbi_image_free, exactly like load_image_from_memory;
+    // generation may keep or modify it without touching the cached copy.
+    uint8_t* load(const char* source, size_t length, int& width, int& height,
+                  int expected_width, int expected_height, int expected_channel, const Decoder& decode);
+
+    diffusion_desk::json stats() const;
+    void clear() { m_cache.clear(); }
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key& key) const { return (size_t)key.hash; }
+    };
+    struct Image {
+        std::vector<uint8_t> pixels;
+        int width = 0;
+        int height = 0;
+    };
+
+    diffusion_desk::LruCache<Key, const Image, KeyHash> m_cache;
+};
+
+// 64-bit hash of a byte range, several GB/s; not cryptographic
+uint64_t content_hash(const void* data, size_t length);
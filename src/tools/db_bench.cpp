@@ -0,0 +1,552 @@
+// Standalone benchmark for the orchestrator Database layer.
+// Populates a throwaway library of configurable size and times every public Database
+// method, then prints one JSON report. Build it with cmake/db-bench; it only needs
+// SQLiteCpp, so it runs on machines without a GPU.
+
+#include "orchestrator/database.hpp"
+#include "synthetic_library.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using diffusion_desk::json;
+
+namespace {
+
+struct BenchOptions {
+    std::string db_path;
+    int generations = 100000;
+    int tags = 2000;
+    int tags_per_image = 10;
+    int models = 5;
+    int files_per_generation = 3;
+    int jobs = 20000;
+    int presets = 20;
+    int page_size = 50;
+    int iterations = 20;
+    int readers = 0;
+    bool keep_db = false;
+    std::string filter;      // Only run cases whose name contains this
+    std::string output_path; // Also write the report here
+};
+
+json time_it(const std::string& name, int iterations, const std::function<void()>& fn) {
+    fn(); // warm-up
+    std::vector<double> samples;
+    samples.reserve(iterations);
+    for (int i = 0; i < iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        samples.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (double s : samples) total += s;
+
+    json r;
+    r["name"] = name;
+    r["iterations"] = iterations;
+    r["mean_ms"] = total / samples.size();
+    r["p50_ms"] = samples[samples.size() / 2];
+    r["p95_ms"] = samples[std::min(samples.size() - 1, (samples.size() * 95) / 100)];
+    r["max_ms"] = samples.back();
+    std::cerr << "[db_bench] " << name << ": p50 " << r["p50_ms"].get<double>() << " ms" << std::endl;
+    return r;
+}
+
+json latency_summary(std::vector<double> samples) {
+    json r;
+    if (samples.empty()) return r;
+    std::sort(samples.begin(), samples.end());
+    r["count"] = samples.size();
+    r["p50_ms"] = samples[samples.size() / 2];
+    r["p95_ms"] = samples[std::min(samples.size() - 1, (samples.size() * 95) / 100)];
+    r["max_ms"] = samples.back();
+    return r;
+}
+
+// Gallery page and search latency from `threads` concurrent readers while a paced
+// tagging burst keeps the writer busy, which is what background auto-tagging does to
+// scrolling. Write latency is reported too, since slow reads used to block the writer.
+json concurrent_reads(diffusion_desk::Database& db, const BenchOptions& opt, int threads, double seconds) {
+    std::atomic<bool> stop{false};
+    std::vector<double> write_ms;
+    std::vector<std::vector<double>> read_ms(threads);
+
+    std::thread writer([&] {
+        int i = 0;
+        while (!stop) {
+            auto start = std::chrono::steady_clock::now();
+            db.add_tag_by_id(1 + (i % opt.generations), "burst_" + std::to_string(i % 50), "llm_vision");
+            db.mark_as_tagged(1 + (i % opt.generations));
+            write_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            ++i;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    });
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < threads; ++t) {
+        readers.emplace_back([&, t] {
+            int n = 0;
+            while (!stop) {
+                auto start = std::chrono::steady_clock::now();
+                if ((t + n) % 4 == 3) db.search_generations("castle", opt.page_size);
+                else db.get_generations(opt.page_size, "", {}, (t + n) % 2 ? "model_1.safetensors" : "");
+                read_ms[t].push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+                ++n;
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto& r : readers) r.join();
+    writer.join();
+
+    std::vector<double> all_reads;
+    for (const auto& v : read_ms) all_reads.insert(all_reads.end(), v.begin(), v.end());
+
+    json r;
+    r["name"] = "concurrent/gallery_during_tagging";
+    r["reader_threads"] = threads;
+    r["reads_per_sec"] = all_reads.size() / seconds;
+    r["reads"] = latency_summary(all_reads);
+    r["writes"] = latency_summary(write_ms);
+    std::cerr << "[db_bench] " << r["name"].get<std::string>() << " x" << threads << ": "
+              << r["reads_per_sec"].get<double>() << " reads/s, read p95 "
+              << r["reads"].value("p95_ms", 0.0) << " ms, write p95 "
+              << r["writes"].value("p95_ms", 0.0) << " ms" << std::endl;
+    return r;
+}
+
+// Write throughput with the generation, thumbnail and tagging services all writing at
+// once, using the same calls they make per image.
+json service_writes(diffusion_desk::Database& db, const BenchOptions& opt, const std::string& label, double seconds) {
+    std::atomic<bool> stop{false};
+    std::atomic<long> writes{0};
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread generation([&] {
+        int i = 0;
+        while (!stop) {
+            diffusion_desk::Generation gen;
+            gen.uuid = "write-" + label + "-" + std::to_string(i);
+            gen.file_path = "/outputs/write-" + label + "-" + std::to_string(i) + ".png";
+            gen.prompt = "a castle at sunset";
+            int id = db.insert_generation(gen);
+            db.add_job("generate_thumbnail", {{"generation_id", id}}, 10);
+            writes += 2;
+            ++i;
+        }
+    });
+    std::thread thumbnails([&] {
+        int i = 0;
+        while (!stop) {
+            int id = 1 + (i % opt.generations);
+            db.update_job_status(id, "processing");
+            db.add_generation_file(id, "thumbnail", "/outputs/previews/thumb_" + std::to_string(id) + ".jpg");
+            db.update_job_status(id, "completed");
+            writes += 3;
+            ++i;
+        }
+    });
+    std::thread tagging([&] {
+        int i = 0;
+        while (!stop) {
+            int id = 1 + (i % opt.generations);
+            for (int t = 0; t < 5; ++t) db.add_tag_by_id(id, "tag_" + std::to_string(1 + (i * 5 + t) % opt.tags), "llm_vision");
+            db.mark_as_tagged(id);
+            writes += 6;
+            ++i;
+            if (i % 20 == 0) db.flush_writes(); // The service re-reads its backlog between batches
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    generation.join();
+    thumbnails.join();
+    tagging.join();
+    db.flush_writes();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    json r;
+    r["name"] = "writes/services_" + label;
+    r["writes_per_sec"] = writes / elapsed;
+    r["write_queue"] = db.get_write_queue_stats();
+    std::cerr << "[db_bench] " << r["name"].get<std::string>() << ": "
+              << r["writes_per_sec"].get<double>() << " writes/s" << std::endl;
+    return r;
+}
+
+// Collects results, skipping cases that do not match --filter
+class BenchRun {
+public:
+    explicit BenchRun(const BenchOptions& opt) : m_opt(opt) {}
+
+    bool wants(const std::string& name) const {
+        return m_opt.filter.empty() || name.find(m_opt.filter) != std::string::npos;
+    }
+    void time(const std::string& name, const std::function<void()>& fn) {
+        if (wants(name)) m_results.push_back(time_it(name, m_opt.iterations, fn));
+    }
+    void add(json result) { m_results.push_back(std::move(result)); }
+    const json& results() const { return m_results; }
+
+private:
+    const BenchOptions& m_opt;
+    json m_results = json::array();
+};
+
+// Every combination the gallery can send: cursor, 0/1/3 tags, model and min rating
+void bench_gallery(diffusion_desk::Database& db, const BenchOptions& opt, BenchRun& run) {
+    const int limit = opt.page_size;
+
+    // Walk a few pages deep with the returned cursor, as infinite scroll does
+    std::string deep_cursor;
+    {
+        json page = db.get_generations(limit);
+        for (int p = 0; p < 20 && page["next_cursor"].is_string(); ++p) {
+            deep_cursor = page["next_cursor"].get<std::string>();
+            page = db.get_generations(limit, deep_cursor);
+        }
+    }
+
+    for (bool with_cursor : {false, true}) {
+        for (const std::vector<std::string>& tags : {std::vector<std::string>{}, {"tag_7"}, {"tag_7", "tag_9", "tag_11"}}) {
+            for (const std::string& model : {std::string(), std::string("model_1.safetensors")}) {
+                for (int min_rating : {0, 4}) {
+                    std::string name = "get_generations/";
+                    name += with_cursor ? "cursor_page_20" : "first_page";
+                    if (!tags.empty()) name += "+tags" + std::to_string(tags.size());
+                    if (!model.empty()) name += "+model";
+                    if (min_rating > 0) name += "+rating";
+                    const std::string cursor = with_cursor ? deep_cursor : "";
+                    run.time(name, [&] { db.get_generations(limit, cursor, tags, model, min_rating); });
+                }
+            }
+        }
+    }
+
+    // The /v1/history/images path: tree + dump() against the streaming writer
+    run.time("gallery_json/tree_dump", [&] { db.get_generations(limit).dump(); });
+    run.time("gallery_json/stream", [&] {
+        std::string body;
+        db.write_generations_json(body, limit, "", {}, "", 0);
+    });
+    diffusion_desk::GenerationFields grid;
+    std::string error;
+    diffusion_desk::GenerationFields::parse("id,name,timestamp,thumbnail_path", grid, error);
+    run.time("gallery_json/stream_grid_fields", [&] {
+        std::string body;
+        db.write_generations_json(body, limit, "", {}, "", 0, grid);
+    });
+    grid.thumbnail_size = 512;
+    run.time("gallery_json/stream_grid_fields_thumb_512", [&] {
+        std::string body;
+        db.write_generations_json(body, limit, "", {}, "", 0, grid);
+    });
+
+    // Ranked search: a common word matches ~1/8 of the library, a word pair ~1/64
+    run.time("search_generations/word", [&] { db.search_generations("castle ", limit); });
+    run.time("search_generations/two_words", [&] { db.search_generations("castle sunset ", limit); });
+    run.time("search_generations/typeahead", [&] { db.search_generations("castle wat", limit); });
+    run.time("search_generations/tag", [&] { db.search_generations("tag_7 ", limit); });
+    run.time("search_generations/no_match", [&] { db.search_generations("zeppelin ", limit); });
+    run.time("search_generations/hostile_input", [&] { db.search_generations("\"castle\" OR NEAR( prompt:* -", limit); });
+    std::string search_cursor;
+    {
+        json page = db.search_generations("castle sunset ", limit);
+        for (int p = 0; p < 10 && page["next_cursor"].is_string(); ++p) {
+            search_cursor = page["next_cursor"].get<std::string>();
+            page = db.search_generations("castle sunset ", limit, search_cursor);
+        }
+    }
+    run.time("search_generations/cursor_page_10", [&] { db.search_generations("castle sunset ", limit, search_cursor); });
+    run.time("get_tags", [&] { db.get_tags(); });
+}
+
+// Lookups the services issue per image; timed per 1000 calls
+void bench_point_reads(diffusion_desk::Database& db, const BenchOptions& opt, BenchRun& run) {
+    auto id_at = [&](int i) { return 1 + (i * 7919) % opt.generations; };
+    run.time("get_generation_filepath/x1000", [&] {
+        for (int i = 0; i < 1000; ++i) db.get_generation_filepath("bench-" + std::to_string(id_at(i)));
+    });
+    run.time("generation_exists/x1000", [&] {
+        for (int i = 0; i < 1000; ++i) db.generation_exists("/outputs/img-" + std::to_string(id_at(i)) + ".png");
+    });
+    run.time("get_generation_files/x1000", [&] {
+        for (int i = 0; i < 1000; ++i) db.get_generation_files(id_at(i));
+    });
+    run.time("get_generation_files/thumbnail/x1000", [&] {
+        for (int i = 0; i < 1000; ++i) db.get_generation_files(id_at(i), "thumbnail");
+    });
+    run.time("get_untagged_generations", [&] { db.get_untagged_generations(5); });
+    db.set_config("bench_key", "value");
+    run.time("get_config/x1000", [&] {
+        for (int i = 0; i < 1000; ++i) db.get_config("bench_key");
+    });
+}
+
+// Writes. Queued (group-committed) calls are followed by flush_writes() so each sample
+// includes the commit, which is what the next reader waits for.
+void bench_mutations(diffusion_desk::Database& db, const BenchOptions& opt, BenchRun& run) {
+    int n = 0;
+    auto next_id = [&] { return 1 + (n++ * 104729) % opt.generations; };
+    auto uuid = [](int id) { return "bench-" + std::to_string(id); };
+
+    run.time("set_favorite", [&] { db.set_favorite(uuid(next_id()), n % 2 == 0); });
+    run.time("set_rating", [&] { db.set_rating(uuid(next_id()), n % 6); });
+    run.time("add_tag", [&] { db.add_tag(uuid(next_id()), "bench_user_tag"); });
+    run.time("add_tag_by_id+flush", [&] {
+        db.add_tag_by_id(next_id(), "bench_vision_tag", "llm_vision");
+        db.flush_writes();
+    });
+    run.time("remove_tag", [&] { db.remove_tag(uuid(next_id()), "tag_" + std::to_string(1 + n % opt.tags)); });
+    run.time("mark_as_tagged+flush", [&] {
+        db.mark_as_tagged(next_id());
+        db.flush_writes();
+    });
+    run.time("delete_unused_tags", [&] { db.delete_unused_tags(); });
+    run.time("add_generation_file+flush", [&] {
+        int id = next_id();
+        db.add_generation_file(id, "upscale", "/outputs/upscale/bench-" + std::to_string(id) + ".png");
+        db.flush_writes();
+    });
+
+    int inserted = 0;
+    auto new_generation = [&] {
+        diffusion_desk::Generation gen;
+        gen.uuid = "bench-new-" + std::to_string(inserted);
+        gen.file_path = "/outputs/bench-new-" + std::to_string(inserted) + ".png";
+        gen.prompt = "a castle at sunset, detailed";
+        gen.model_id = "model_1.safetensors";
+        inserted++;
+        return gen;
+    };
+    run.time("insert_generation", [&] { db.insert_generation(new_generation()); });
+    run.time("insert_generation_with_tags", [&] {
+        db.insert_generation_with_tags(new_generation(), {"tag_1", "tag_2", "tag_3", "tag_4", "tag_5"});
+    });
+    run.time("save_generation", [&] {
+        diffusion_desk::Generation gen = new_generation();
+        db.save_generation({{"uuid", gen.uuid}, {"file_path", gen.file_path}, {"prompt", gen.prompt},
+                            {"model_id", gen.model_id}, {"sample_steps", 20}, {"cfg_scale", 7.0}});
+    });
+    // Deletes the rows inserted above, so the synthetic library stays intact for later cases
+    int removed = 0;
+    run.time("remove_generation", [&] {
+        if (removed < inserted) db.remove_generation("bench-new-" + std::to_string(removed++));
+    });
+}
+
+void bench_jobs(diffusion_desk::Database& db, BenchRun& run) {
+    run.time("add_job", [&] { db.add_job("generate_thumbnail", {{"generation_id", 1}}, 10); });
+    run.time("get_next_job/x1000", [&] {
+        for (int i = 0; i < 1000; ++i) db.get_next_job();
+    });
+    int claimed = 0;
+    run.time("update_job_status+flush", [&] {
+        db.update_job_status(1 + claimed++, "completed");
+        db.flush_writes();
+    });
+    // A JobService worker's round trip: atomic batch claim with lease, then finish each
+    run.time("job_claim_cycle", [&] {
+        for (const auto& job : db.claim_jobs("generate_thumbnail", 4, 300)) db.update_job_status(job.id, "completed");
+        db.flush_writes();
+    });
+    run.time("retry_job+flush", [&] {
+        db.retry_job(1 + claimed++, "bench", 0);
+        db.flush_writes();
+    });
+    run.time("recover_expired_jobs", [&] { db.recover_expired_jobs("generate_thumbnail", 3); });
+    run.time("fail_unhandled_jobs", [&] { db.fail_unhandled_jobs({"generate_thumbnail", "pack_thumbnails"}); });
+}
+
+void bench_settings(diffusion_desk::Database& db, BenchRun& run) {
+    run.time("get_image_presets", [&] { db.get_image_presets(); });
+    run.time("get_llm_presets", [&] { db.get_llm_presets(); });
+    run.time("get_styles", [&] { db.get_styles(); });
+    run.time("get_library_items", [&] { db.get_library_items(); });
+    run.time("get_library_items/category", [&] { db.get_library_items("Style"); });
+    run.time("get_model_metadata", [&] { db.get_model_metadata("model_1.safetensors"); });
+    run.time("get_model_metadata/path_fallback", [&] { db.get_model_metadata("checkpoints/model_1.safetensors"); });
+    run.time("get_all_models_metadata", [&] { db.get_all_models_metadata(); });
+
+    // Save/delete pairs keep the tables at their populated size
+    const int scratch_id = 1000000;
+    run.time("save_image_preset+delete", [&] {
+        diffusion_desk::ImagePreset preset;
+        preset.id = scratch_id;
+        preset.name = "bench_scratch";
+        preset.unet_path = "unet/scratch.safetensors";
+        db.save_image_preset(preset);
+        db.delete_image_preset(scratch_id);
+    });
+    run.time("save_llm_preset+delete", [&] {
+        diffusion_desk::LlmPreset preset;
+        preset.id = scratch_id;
+        preset.name = "bench_scratch";
+        preset.model_path = "llm/scratch.gguf";
+        db.save_llm_preset(preset);
+        db.delete_llm_preset(scratch_id);
+    });
+    run.time("save_style+delete", [&] {
+        db.save_style({"bench_scratch", "a prompt", "", ""});
+        db.delete_style("bench_scratch");
+    });
+    run.time("add_library_item", [&] { db.add_library_item({0, "bench_scratch", "content", "Style", "", 0}); });
+    run.time("increment_library_usage", [&] { db.increment_library_usage(1); });
+    run.time("delete_library_item", [&] {
+        json items = db.get_library_items("Style");
+        for (const auto& item : items) {
+            if (item.value("label", "") == "bench_scratch") {
+                db.delete_library_item(item["id"].get<int>());
+                break;
+            }
+        }
+    });
+    run.time("save_model_metadata", [&] {
+        db.save_model_metadata("model_1.safetensors", {{"type", "checkpoint"}, {"base", "sdxl"}});
+    });
+    run.time("set_config", [&] { db.set_config("bench_key", "value"); });
+}
+
+void print_usage() {
+    std::cout << "usage: diffusion_desk_db_bench [--db PATH] [--keep-db] [--output FILE] [--filter TEXT]\n"
+                 "                               [--generations N] [--tags N] [--tags-per-image N] [--models N]\n"
+                 "                               [--files-per-generation N] [--jobs N] [--presets N]\n"
+                 "                               [--page-size N] [--iterations N]\n"
+                 "                               [--readers N]   (0 = one per core, -1 = writer only)\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    BenchOptions opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next_int = [&](int& target) {
+            if (i + 1 < argc) target = std::stoi(argv[++i]);
+        };
+        if (arg == "--db" && i + 1 < argc) opt.db_path = argv[++i];
+        else if (arg == "--keep-db") opt.keep_db = true;
+        else if (arg == "--output" && i + 1 < argc) opt.output_path = argv[++i];
+        else if (arg == "--filter" && i + 1 < argc) opt.filter = argv[++i];
+        else if (arg == "--generations") next_int(opt.generations);
+        else if (arg == "--tags") next_int(opt.tags);
+        else if (arg == "--tags-per-image") next_int(opt.tags_per_image);
+        else if (arg == "--models") next_int(opt.models);
+        else if (arg == "--files-per-generation") next_int(opt.files_per_generation);
+        else if (arg == "--jobs") next_int(opt.jobs);
+        else if (arg == "--presets") next_int(opt.presets);
+        else if (arg == "--page-size") next_int(opt.page_size);
+        else if (arg == "--iterations") next_int(opt.iterations);
+        else if (arg == "--readers") next_int(opt.readers);
+        else if (arg == "-h" || arg == "--help") { print_usage(); return 0; }
+        else { print_usage(); return 2; }
+    }
+    opt.generations = std::max(1, opt.generations);
+    opt.tags = std::max(1, opt.tags);
+    opt.iterations = std::max(1, opt.iterations);
+
+    if (opt.db_path.empty()) {
+        opt.db_path = (fs::temp_directory_path() / "diffusion_desk_db_bench.db").string();
+    }
+    for (const char* suffix : {"", "-wal", "-shm"}) {
+        std::error_code ec;
+        fs::remove(opt.db_path + suffix, ec);
+    }
+
+    // Database logs migrations to stdout; keep stdout for the JSON report only
+    std::streambuf* stdout_buf = std::cout.rdbuf(std::cerr.rdbuf());
+
+    json report;
+    try {
+        diffusion_desk::Database db(opt.db_path, opt.readers);
+        db.init_schema();
+
+        auto populate_start = std::chrono::steady_clock::now();
+        diffusion_desk::LibrarySpec spec;
+        spec.generations = opt.generations;
+        spec.tags = opt.tags;
+        spec.tags_per_image = opt.tags_per_image;
+        spec.models = opt.models;
+        spec.files_per_generation = opt.files_per_generation;
+        spec.jobs = opt.jobs;
+        spec.presets = opt.presets;
+        diffusion_desk::populate_synthetic_library(db, spec);
+        double populate_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - populate_start).count();
+
+        report["library"] = {
+            {"generations", opt.generations},
+            {"tags", opt.tags},
+            {"tags_per_image", opt.tags_per_image},
+            {"models", opt.models},
+            {"files_per_generation", opt.files_per_generation},
+            {"jobs", opt.jobs},
+            {"presets", opt.presets},
+            {"populate_s", populate_s},
+        };
+        report["options"] = {{"page_size", opt.page_size}, {"iterations", opt.iterations}, {"readers", opt.readers}};
+
+        BenchRun run(opt);
+        bench_gallery(db, opt, run);
+        bench_point_reads(db, opt, run);
+        bench_settings(db, run);
+        bench_jobs(db, run);
+        bench_mutations(db, opt, run);
+
+        if (run.wants("concurrent/")) {
+            int max_threads = std::max(2, (int)std::thread::hardware_concurrency());
+            for (int threads : {1, max_threads}) {
+                run.add(concurrent_reads(db, opt, threads, 3.0));
+            }
+        }
+
+        // One transaction per write, as before group commit, then the default window
+        if (run.wants("writes/")) {
+            db.set_write_batching(std::chrono::microseconds(0), 1);
+            run.add(service_writes(db, opt, "autocommit", 3.0));
+            db.set_write_batching(std::chrono::microseconds(2000), 256);
+            run.add(service_writes(db, opt, "group_commit", 3.0));
+        }
+
+        report["results"] = run.results();
+        report["statement_cache"] = db.get_statement_cache_stats();
+    } catch (const std::exception& e) {
+        std::cout.rdbuf(stdout_buf);
+        std::cerr << "[db_bench] failed: " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout.rdbuf(stdout_buf);
+
+    if (!opt.keep_db) {
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::error_code ec;
+            fs::remove(opt.db_path + suffix, ec);
+        }
+    }
+
+    if (!opt.output_path.empty()) {
+        std::ofstream out(opt.output_path);
+        out << report.dump(2) << std::endl;
+        if (!out) {
+            std::cerr << "[db_bench] cannot write " << opt.output_path << std::endl;
+            return 1;
+        }
+    }
+    std::cout << report.dump(2) << std::endl;
+    return 0;
+}
@@ -0,0 +1,213 @@
+// Query-plan regression check for the orchestrator Database layer.
+// Builds a synthetic library, drives every public Database method (each get_generations
+// filter combination included) so the statement cache records the exact SQL they run,
+// then EXPLAINs each statement and fails if a hot table is read with a full scan or a
+// foreign key has no index for its ON DELETE CASCADE. Registered with CTest from
+// cmake/db-bench.
+
+#include "orchestrator/database.hpp"
+#include "synthetic_library.hpp"
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using diffusion_desk::json;
+
+namespace {
+
+// Tables that grow with the library. Anything else is small enough to scan.
+const std::set<std::string> LARGE_TABLES = {"generations", "image_tags", "tags", "generation_files", "jobs", "thumbnail_pack"};
+
+void exercise_every_method(diffusion_desk::Database& db) {
+    const std::string cursor = "2023-11-14 22:13:20|100";
+    for (bool with_cursor : {false, true}) {
+        for (const std::vector<std::string>& tags : {std::vector<std::string>{}, {"tag_7"}, {"tag_7", "tag_9", "tag_11"}}) {
+            for (const std::string& model : {std::string(), std::string("model_1.safetensors")}) {
+                for (int min_rating : {0, 4}) {
+                    db.get_generations(50, with_cursor ? cursor : "", tags, model, min_rating);
+                }
+            }
+        }
+    }
+    std::string page;
+    db.write_generations_json(page, 50, cursor, {"tag_7"}, "model_1.safetensors", 4);
+    db.write_generations_json(page, 50, "", {}, "", 0);
+    diffusion_desk::GenerationFields retina;
+    retina.thumbnail_size = 512;
+    db.write_generations_json(page, 50, "", {}, "", 0, retina);
+    json ranked = db.search_generations("castle sun", 50);
+    if (ranked["next_cursor"].is_string()) db.search_generations("castle sun", 50, ranked["next_cursor"].get<std::string>());
+    db.get_tags();
+    db.get_generation_filepath("bench-10");
+    db.generation_exists("/outputs/img-10.png");
+    db.get_generation_files(10);
+    db.get_generation_files(10, "thumbnail");
+    db.get_untagged_generations(5);
+
+    db.set_favorite("bench-11", true);
+    db.set_rating("bench-11", 4);
+    db.add_tag("bench-12", "plan_check_tag");
+    db.add_tag_by_id(12, "plan_check_tag_2", "llm_vision");
+    db.remove_tag("bench-12", "plan_check_tag");
+    db.mark_as_tagged(12);
+    db.remove_generation("bench-13");
+    db.delete_unused_tags();
+
+    int job_id = db.add_job("generate_thumbnail", {{"generation_id", 14}}, 10);
+    db.get_next_job();
+    db.update_job_status(job_id, "processing");
+    db.update_job_status(job_id, "completed");
+    db.update_job_status(job_id, "failed", "plan check");
+    for (const auto& job : db.claim_jobs("generate_thumbnail", 4, 60)) db.retry_job(job.id, "plan check", 0);
+    db.recover_expired_jobs("generate_thumbnail", 3);
+    db.fail_unhandled_jobs({"generate_thumbnail", "pack_thumbnails"});
+    db.add_generation_file(14, "thumbnail", "/outputs/previews/thumb_14.jpg");
+    db.get_loose_thumbnails(0, 64);
+    db.set_generation_file_path(1, "/thumbs/14_256.jpg");
+    db.put_thumbnail_location({14, 256, 1, 16, 1000});
+    db.get_thumbnail_locations({14, 15, 16}, 256);
+    db.get_segment_thumbnails(1);
+    db.get_thumbnail_segment_usage();
+    db.relocate_thumbnails({{{14, 256, 1, 16, 1000}, {14, 256, 2, 16, 1000}}});
+
+    db.save_style({"plan", "a prompt", "", ""});
+    db.get_styles();
+    db.delete_style("plan");
+    db.add_library_item({0, "label", "content", "Style", "", 0});
+    db.get_library_items();
+    db.get_library_items("Style");
+    db.get_image_presets();
+    db.get_llm_presets();
+    db.save_model_metadata("model_1.safetensors", {{"type", "checkpoint"}});
+    db.get_model_metadata("model_1.safetensors");
+    db.get_model_metadata("missing/model_1.safetensors");
+    db.get_all_models_metadata();
+    db.set_config("plan_check", "1");
+    db.get_config("plan_check");
+    db.flush_writes();
+}
+
+// "SCAN g" / "SCAN TABLE generations AS g" without USING is a full table scan
+std::string scanned_table(std::string detail, const std::string& sql) {
+    if (detail.rfind("SCAN ", 0) != 0) return "";
+    if (detail.find(" USING ") != std::string::npos) return "";
+    if (detail.find("VIRTUAL TABLE") != std::string::npos) return "";
+    if (detail.find("CONSTANT ROW") != std::string::npos) return "";
+    detail = detail.substr(5);
+    if (detail.rfind("TABLE ", 0) == 0) detail = detail.substr(6);
+    std::string name = detail.substr(0, detail.find(' '));
+    if (LARGE_TABLES.count(name)) return name;
+    // Newer SQLite reports the alias; resolve it against "FROM <table> <alias>" in the SQL
+    for (const auto& table : LARGE_TABLES) {
+        if (sql.find(table + " " + name + " ") != std::string::npos ||
+            sql.find(table + " " + name + "\n") != std::string::npos ||
+            sql.find(table + " AS " + name) != std::string::npos) {
+            return table;
+        }
+    }
+    return "";
+}
+
+int check_plans(SQLite::Database& raw, const std::map<std::string, std::string>& statements) {
+    int failures = 0;
+    std::set<std::string> notes;
+    for (const auto& [sql, caller] : statements) {
+        std::vector<std::string> details;
+        try {
+            SQLite::Statement plan(raw, "EXPLAIN QUERY PLAN " + sql);
+            while (plan.executeStep()) details.push_back(plan.getColumn(3).getText());
+        } catch (const std::exception& e) {
+            std::cerr << "[db_plan_check] FAIL " << caller << ": cannot explain: " << e.what() << std::endl;
+            failures++;
+            continue;
+        }
+        for (const auto& d : details) {
+            std::string table = scanned_table(d, sql);
+            if (!table.empty()) {
+                std::cerr << "[db_plan_check] FAIL " << caller << ": full scan of " << table << " (" << d << ")\n    " << sql << std::endl;
+                failures++;
+            } else if (d.find("USE TEMP B-TREE") != std::string::npos && notes.insert(caller + ": " + d).second) {
+                std::cout << "[db_plan_check] note " << caller << ": " << d << std::endl;
+            }
+        }
+    }
+    return failures;
+}
+
+// A cascade delete from the parent searches the child by the FK column, so it needs an
+// index whose leading column is that FK
+int check_foreign_key_indexes(SQLite::Database& raw) {
+    int failures = 0;
+    for (const auto& table : LARGE_TABLES) {
+        std::set<std::string> leading;
+        SQLite::Statement indexes(raw, "SELECT name FROM pragma_index_list(?)");
+        indexes.bind(1, table);
+        while (indexes.executeStep()) {
+            SQLite::Statement info(raw, "SELECT name FROM pragma_index_info(?) WHERE seqno = 0");
+            info.bind(1, indexes.getColumn(0).getText());
+            if (info.executeStep()) leading.insert(info.getColumn(0).getText());
+        }
+        SQLite::Statement fks(raw, "SELECT \"from\", \"table\" FROM pragma_foreign_key_list(?)");
+        fks.bind(1, table);
+        while (fks.executeStep()) {
+            std::string column = fks.getColumn(0).getText();
+            if (!leading.count(column)) {
+                std::cerr << "[db_plan_check] FAIL " << table << "." << column << " references "
+                          << fks.getColumn(1).getText() << " but has no index" << std::endl;
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    diffusion_desk::LibrarySpec spec;
+    spec.generations = 20000;
+    spec.jobs = 5000;
+    std::string db_path = (fs::temp_directory_path() / "diffusion_desk_db_plan_check.db").string();
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--generations" && i + 1 < argc) spec.generations = std::stoi(argv[++i]);
+        else if (arg == "--db" && i + 1 < argc) db_path = argv[++i];
+        else {
+            std::cout << "usage: diffusion_desk_db_plan_check [--generations N] [--db PATH]\n";
+            return 2;
+        }
+    }
+    auto remove_db = [&] {
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::error_code ec;
+            fs::remove(db_path + suffix, ec);
+        }
+    };
+    remove_db();
+
+    int failures = 0;
+    size_t checked = 0;
+    try {
+        diffusion_desk::Database db(db_path);
+        db.init_schema();
+        diffusion_desk::populate_synthetic_library(db, spec);
+        exercise_every_method(db);
+
+        auto statements = db.get_prepared_statements();
+        checked = statements.size();
+        SQLite::Database raw(db_path, SQLite::OPEN_READONLY);
+        failures += check_plans(raw, statements);
+        failures += check_foreign_key_indexes(raw);
+    } catch (const std::exception& e) {
+        std::cerr << "[db_plan_check] failed: " << e.what() << std::endl;
+        remove_db();
+        return 1;
+    }
+    remove_db();
+
+    std::cout << "[db_plan_check] " << checked << " statements checked, " << failures << " problem(s)" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,445 @@
+// Micro-benchmark for the image paths behind generation results and thumbnails.
+// Times the area resampler on synthetic 1024/2048/4096 square sources for every
+// instruction set the CPU supports, next to the nearest-neighbour loop it replaced, and
+// checks that the SIMD paths match the scalar one byte for byte. Also times PNG against
+// QOI for single results, PNG encoding of a batch sequentially and on a thread pool,
+// base64 encode/decode throughput (MB/s) of inline request images on every instruction set,
+// and reading parameters from PNG text chunks against the .txt sidecars they replaced.
+// Build it with cmake/image-bench.
+
+#include "utils/base64.hpp"
+#include "utils/image_resample.hpp"
+#include "utils/png_text.hpp"
+#include "utils/qoi.hpp"
+#include "utils/thread_pool.hpp"
+#include "stb_image_write.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json.hpp"
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+using diffusion_desk::Base64Isa;
+using diffusion_desk::ResampleIsa;
+
+namespace {
+
+struct BenchOptions {
+    std::vector<int> sizes = {1024, 2048, 4096};
+    std::vector<int> levels = {512, 256, 128};
+    int iterations = 10;
+    bool check_only = false;
+    std::string filter;
+    std::string output_path;
+};
+
+json time_it(const std::string& name, int iterations, double megapixels, const std::function<void()>& fn) {
+    fn(); // warm-up
+    std::vector<double> samples;
+    for (int i = 0; i < iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (double s : samples) total += s;
+
+    json r;
+    r["name"] = name;
+    r["iterations"] = iterations;
+    r["mean_ms"] = total / samples.size();
+    r["p50_ms"] = samples[samples.size() / 2];
+    r["max_ms"] = samples.back();
+    r["source_mpix_per_s"] = megapixels / (samples[samples.size() / 2] / 1000.0);
+    std::cerr << "[image_bench] " << name << ": p50 " << r["p50_ms"].get<double>() << " ms" << std::endl;
+    return r;
+}
+
+void append_bytes(void* context, void* data, int size) {
+    auto* out = static_cast<std::vector<uint8_t>*>(context);
+    out->insert(out->end(), static_cast<uint8_t*>(data), static_cast<uint8_t*>(data) + size);
+}
+
+std::vector<uint8_t> encode_png_bytes(const std::vector<uint8_t>& rgb, int width, int height) {
+    std::vector<uint8_t> png;
+    stbi_write_png_to_func(append_bytes, &png, width, height, 3, rgb.data(), width * 3);
+    return png;
+}
+
+size_t encode_png(const std::vector<uint8_t>& rgb, int size) {
+    return encode_png_bytes(rgb, size, size).size();
+}
+
+const char* SAMPLE_PARAMETERS = "a lighthouse on a cliff at dusk, volumetric light\n"
+                                "Negative prompt: blurry, lowres\n"
+                                "Steps: 28, Sampler: euler_a, CFG scale: 6.5, Seed: 1234, Size: 1024x1024, Model: model.safetensors, Time: 12.34s";
+
+// Smooth gradients with a fine checkerboard on top, so aliasing and rounding both show up
+std::vector<uint8_t> synthetic_rgb(int size) {
+    std::vector<uint8_t> pixels(size_t(size) * size * 3);
+    uint32_t state = 12345;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            state = state * 1664525u + 1013904223u;
+            uint8_t* px = &pixels[(size_t(y) * size + x) * 3];
+            const int checker = ((x ^ y) & 1) ? 40 : 0;
+            px[0] = uint8_t(std::min(255, x * 255 / size + checker));
+            px[1] = uint8_t(std::min(255, y * 255 / size + checker));
+            px[2] = uint8_t(state >> 24);
+        }
+    }
+    return pixels;
+}
+
+// The loop ThumbnailService used before the area resampler, kept as the baseline
+void resize_nearest(const uint8_t* src, int width, int height, uint8_t* dst, int target_w, int target_h) {
+    float scale = float(target_w) / width;
+    for (int y = 0; y < target_h; ++y) {
+        for (int x = 0; x < target_w; ++x) {
+            int sx = std::min(static_cast<int>(x / scale), width - 1);
+            int sy = std::min(static_cast<int>(y / scale), height - 1);
+            std::copy_n(src + (size_t(sy) * width + sx) * 3, 3, dst + (size_t(y) * target_w + x) * 3);
+        }
+    }
+}
+
+// The base64 decoder api_utils used before the table-driven one, kept as the baseline: a
+// std::string::find over the alphabet per character and a push_back per byte
+std::vector<uint8_t> base64_decode_find(const std::string& encoded) {
+    static const std::string chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::vector<uint8_t> ret;
+    unsigned char quad[4];
+    int i = 0;
+    for (char c : encoded) {
+        if (c == '=' || !(std::isalnum((unsigned char)c) || c == '+' || c == '/')) break;
+        quad[i++] = (unsigned char)chars.find(c);
+        if (i == 4) {
+            ret.push_back(uint8_t((quad[0] << 2) + ((quad[1] & 0x30) >> 4)));
+            ret.push_back(uint8_t(((quad[1] & 0xf) << 4) + ((quad[2] & 0x3c) >> 2)));
+            ret.push_back(uint8_t(((quad[2] & 0x3) << 6) + quad[3]));
+            i = 0;
+        }
+    }
+    if (i > 1) ret.push_back(uint8_t((quad[0] << 2) + ((quad[1] & 0x30) >> 4)));
+    if (i > 2) ret.push_back(uint8_t(((quad[1] & 0xf) << 4) + ((quad[2] & 0x3c) >> 2)));
+    return ret;
+}
+
+std::vector<Base64Isa> supported_base64_isas() {
+    std::vector<Base64Isa> isas = {Base64Isa::Scalar};
+    if (diffusion_desk::base64_best_isa() != Base64Isa::Scalar) isas.push_back(Base64Isa::SSSE3);
+    if (diffusion_desk::base64_best_isa() == Base64Isa::AVX2) isas.push_back(Base64Isa::AVX2);
+    return isas;
+}
+
+std::vector<ResampleIsa> supported_isas() {
+    std::vector<ResampleIsa> isas = {ResampleIsa::Scalar};
+    if (diffusion_desk::resample_best_isa() != ResampleIsa::Scalar) isas.push_back(ResampleIsa::SSE2);
+    if (diffusion_desk::resample_best_isa() == ResampleIsa::AVX2) isas.push_back(ResampleIsa::AVX2);
+    return isas;
+}
+
+// Odd sizes and ratios exercise the scalar tails and uneven tap counts of the SIMD paths
+int check_parity() {
+    const int cases[][4] = {{1024, 1024, 256, 256}, {1216, 832, 512, 350}, {1000, 999, 333, 77},
+                            {37, 53, 17, 5}, {640, 480, 639, 479}, {4096, 4096, 128, 128}};
+    int failures = 0;
+    for (const auto& c : cases) {
+        for (int channels : {3, 4}) {
+            std::vector<uint8_t> src(size_t(c[0]) * c[1] * channels);
+            uint32_t state = 7;
+            for (auto& b : src) { state = state * 1664525u + 1013904223u; b = uint8_t(state >> 24); }
+            std::vector<uint8_t> expected(size_t(c[2]) * c[3] * channels);
+            diffusion_desk::resize_area(src.data(), c[0], c[1], channels, expected.data(), c[2], c[3], ResampleIsa::Scalar);
+            for (ResampleIsa isa : supported_isas()) {
+                std::vector<uint8_t> got(expected.size());
+                diffusion_desk::resize_area(src.data(), c[0], c[1], channels, got.data(), c[2], c[3], isa);
+                if (got != expected) {
+                    std::cerr << "[image_bench] FAIL " << diffusion_desk::resample_isa_name(isa) << " differs from scalar for "
+                              << c[0] << "x" << c[1] << "x" << channels << " -> " << c[2] << "x" << c[3] << std::endl;
+                    failures++;
+                }
+            }
+        }
+    }
+    // A flat image must stay exactly flat through the pyramid
+    std::vector<uint8_t> flat(size_t(1216) * 832 * 3, 201);
+    for (const auto& level : diffusion_desk::build_pyramid(flat.data(), 1216, 832, 3, {512, 256, 128})) {
+        if (std::any_of(level.pixels.begin(), level.pixels.end(), [](uint8_t v) { return v != 201; })) {
+            std::cerr << "[image_bench] FAIL flat image changed at level " << level.max_dim << std::endl;
+            failures++;
+        }
+    }
+    // QOI must round-trip exactly, with and without alpha
+    for (int channels : {3, 4}) {
+        const int w = 317, h = 211;
+        std::vector<uint8_t> src(size_t(w) * h * channels);
+        for (size_t i = 0; i < src.size(); ++i) src[i] = uint8_t((i / channels % w) / 8 * 5 + (i % channels) * 40 + (i % 97 == 0 ? 3 : 0));
+        std::vector<uint8_t> encoded = diffusion_desk::qoi_encode(src.data(), w, h, channels);
+        int dw = 0, dh = 0, dc = 0;
+        uint8_t* decoded = diffusion_desk::qoi_decode(encoded.data(), encoded.size(), &dw, &dh, &dc, 0);
+        if (!decoded || dw != w || dh != h || dc != channels || !std::equal(src.begin(), src.end(), decoded)) {
+            std::cerr << "[image_bench] FAIL QOI round trip with " << channels << " channels" << std::endl;
+            failures++;
+        }
+        free(decoded);
+        // A truncated file is rejected rather than read past its end
+        if (uint8_t* truncated = diffusion_desk::qoi_decode(encoded.data(), encoded.size() / 2, &dw, &dh, &dc, 0)) {
+            std::cerr << "[image_bench] FAIL truncated QOI decoded" << std::endl;
+            free(truncated);
+            failures++;
+        }
+    }
+    // base64: every length around the SIMD block sizes, encoded and decoded on every path,
+    // must match the scalar code and the decoder it replaced, also when the text is cut
+    // short by padding or a stray character
+    uint32_t state = 99;
+    for (size_t n = 0; n < 400; ++n) {
+        std::vector<uint8_t> bytes(n);
+        for (auto& b : bytes) { state = state * 1664525u + 1013904223u; b = uint8_t(state >> 24); }
+        std::string expected_text;
+        diffusion_desk::base64_encode(bytes.data(), n, expected_text, Base64Isa::Scalar);
+        for (int variant = 0; variant < 3; ++variant) {
+            std::string text = expected_text;
+            if (variant == 1 && !text.empty()) text[n * 7 % text.size()] = '=';
+            if (variant == 2 && !text.empty()) text[n * 13 % text.size()] = '\n';
+            const std::vector<uint8_t> expected = base64_decode_find(text);
+            if (variant == 0 && expected != bytes) {
+                std::cerr << "[image_bench] FAIL base64 round trip of " << n << " bytes" << std::endl;
+                failures++;
+            }
+            for (Base64Isa isa : supported_base64_isas()) {
+                std::string encoded;
+                diffusion_desk::base64_encode(bytes.data(), n, encoded, isa);
+                std::vector<uint8_t> decoded(diffusion_desk::base64_decoded_size(text.size()));
+                decoded.resize(diffusion_desk::base64_decode(text.data(), text.size(), decoded.data(), isa));
+                if (encoded != expected_text || decoded != expected) {
+                    std::cerr << "[image_bench] FAIL base64 " << diffusion_desk::base64_isa_name(isa) << " differs for "
+                              << n << " bytes (variant " << variant << ")" << std::endl;
+                    failures++;
+                }
+            }
+        }
+    }
+    // PNG text chunks: what png_add_text writes must come back from memory and from the
+    // file, in ASCII (tEXt) and UTF-8 (iTXt), and the image must still be a valid PNG
+    {
+        std::vector<uint8_t> rgb(size_t(64) * 48 * 3, 90);
+        std::vector<uint8_t> png = encode_png_bytes(rgb, 64, 48);
+        const size_t plain_size = png.size();
+        const std::string utf8_json = "{\"prompt\":\"caf\xc3\xa9 \xe2\x98\x95\",\"seed\":1234}";
+        const bool added = diffusion_desk::png_add_text(png, {{diffusion_desk::PNG_PARAMETERS_KEY, SAMPLE_PARAMETERS},
+                                                              {diffusion_desk::PNG_PARAMS_JSON_KEY, utf8_json}});
+        const fs::path path = fs::temp_directory_path() / "diffusion_desk_image_bench_text.png";
+        std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(png.data()), (std::streamsize)png.size());
+        for (const auto& text : {diffusion_desk::png_read_text(png.data(), png.size()), diffusion_desk::png_read_text_file(path)}) {
+            if (!added || png.size() <= plain_size || text.size() != 2 ||
+                text.count(diffusion_desk::PNG_PARAMETERS_KEY) == 0 || text.at(diffusion_desk::PNG_PARAMETERS_KEY) != SAMPLE_PARAMETERS ||
+                text.count(diffusion_desk::PNG_PARAMS_JSON_KEY) == 0 || text.at(diffusion_desk::PNG_PARAMS_JSON_KEY) != utf8_json) {
+                std::cerr << "[image_bench] FAIL PNG text chunk round trip" << std::endl;
+                failures++;
+            }
+        }
+        std::error_code ec;
+        fs::remove(path, ec);
+        // A flipped byte fails the CRC and the chunk is ignored, not returned damaged
+        const char* word = "lighthouse";
+        auto at = std::search(png.begin(), png.end(), word, word + std::strlen(word));
+        if (at != png.end()) *at ^= 0x20;
+        if (diffusion_desk::png_read_text(png.data(), png.size()).count(diffusion_desk::PNG_PARAMETERS_KEY) != 0) {
+            std::cerr << "[image_bench] FAIL PNG text chunk with a bad CRC was read" << std::endl;
+            failures++;
+        }
+        const auto params = diffusion_desk::parse_image_params(SAMPLE_PARAMETERS);
+        if (params.value("Seed", "") != "1234" || params.value("CFG scale", "") != "6.5" ||
+            params.value("prompt", "") != "a lighthouse on a cliff at dusk, volumetric light") {
+            std::cerr << "[image_bench] FAIL parse_image_params" << std::endl;
+            failures++;
+        }
+    }
+    std::cerr << "[image_bench] parity: " << failures << " problem(s)" << std::endl;
+    return failures;
+}
+
+void print_usage() {
+    std::cout << "usage: diffusion_desk_image_bench [--iterations N] [--filter TEXT] [--output FILE] [--check]\n"
+                 "  --check   only verify SIMD/scalar parity and the QOI, base64 and PNG text round trips (exit code 1 on mismatch)\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    BenchOptions opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc) opt.iterations = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--filter" && i + 1 < argc) opt.filter = argv[++i];
+        else if (arg == "--output" && i + 1 < argc) opt.output_path = argv[++i];
+        else if (arg == "--check") opt.check_only = true;
+        else if (arg == "-h" || arg == "--help") { print_usage(); return 0; }
+        else { print_usage(); return 2; }
+    }
+
+    if (check_parity() != 0) return 1;
+    if (opt.check_only) return 0;
+
+    json results = json::array();
+    auto wants = [&](const std::string& name) { return opt.filter.empty() || name.find(opt.filter) != std::string::npos; };
+    for (int size : opt.sizes) {
+        const std::vector<uint8_t> src = synthetic_rgb(size);
+        const double mpix = double(size) * size / 1e6;
+        const std::string prefix = std::to_string(size) + "x" + std::to_string(size);
+
+        std::vector<uint8_t> thumb(256 * 256 * 3);
+        std::string name = "resize/" + prefix + "/nearest_256";
+        if (wants(name)) {
+            results.push_back(time_it(name, opt.iterations, mpix, [&] { resize_nearest(src.data(), size, size, thumb.data(), 256, 256); }));
+        }
+        for (ResampleIsa isa : supported_isas()) {
+            const std::string isa_name = diffusion_desk::resample_isa_name(isa);
+            name = "resize/" + prefix + "/area_256/" + isa_name;
+            if (wants(name)) {
+                results.push_back(time_it(name, opt.iterations, mpix, [&] {
+                    diffusion_desk::resize_area(src.data(), size, size, 3, thumb.data(), 256, 256, isa);
+                }));
+            }
+        }
+        // One result as a kept (PNG) and as a temporary (QOI) output
+        name = "encode/" + prefix + "/png";
+        if (wants(name)) {
+            json r = time_it(name, std::min(opt.iterations, 3), mpix, [&] { encode_png(src, size); });
+            r["bytes"] = encode_png(src, size);
+            results.push_back(r);
+        }
+        name = "encode/" + prefix + "/qoi";
+        if (wants(name)) {
+            json r = time_it(name, opt.iterations, mpix, [&] { diffusion_desk::qoi_encode(src.data(), size, size, 3); });
+            r["bytes"] = diffusion_desk::qoi_encode(src.data(), size, size, 3).size();
+            results.push_back(r);
+        }
+        name = "decode/" + prefix + "/qoi";
+        if (wants(name)) {
+            const std::vector<uint8_t> encoded = diffusion_desk::qoi_encode(src.data(), size, size, 3);
+            results.push_back(time_it(name, opt.iterations, mpix, [&] {
+                int w, h, c;
+                free(diffusion_desk::qoi_decode(encoded.data(), encoded.size(), &w, &h, &c, 3));
+            }));
+        }
+
+        // A batch of 8 results: one after another as handle_generate_image used to, then on
+        // a pool as it does now. The pool time approaches one encode when there are 8 cores.
+        name = "encode/" + prefix + "/png_x8/sequential";
+        if (size <= 2048 && wants(name)) {
+            results.push_back(time_it(name, std::min(opt.iterations, 3), mpix * 8, [&] {
+                for (int i = 0; i < 8; ++i) encode_png(src, size);
+            }));
+        }
+        name = "encode/" + prefix + "/png_x8/pool";
+        if (size <= 2048 && wants(name)) {
+            diffusion_desk::ThreadPool pool(std::min<size_t>(8, std::max(1u, std::thread::hardware_concurrency())));
+            json r = time_it(name, std::min(opt.iterations, 3), mpix * 8, [&] {
+                std::vector<std::future<size_t>> pending;
+                for (int i = 0; i < 8; ++i) pending.push_back(pool.submit([&] { return encode_png(src, size); }));
+                for (auto& p : pending) p.get();
+            });
+            r["threads"] = pool.size();
+            results.push_back(r);
+        }
+
+        // An init image of this size sent inline as base64, one way and back
+        if (size <= 2048) {
+            const double mb = double(src.size()) / 1e6;
+            std::string text;
+            diffusion_desk::base64_encode(src.data(), src.size(), text);
+            auto add_throughput = [&](json r) {
+                r["mb_per_s"] = mb / (r["p50_ms"].get<double>() / 1000.0);
+                results.push_back(r);
+            };
+            name = "base64/" + prefix + "/decode/find";
+            if (wants(name)) add_throughput(time_it(name, std::min(opt.iterations, 3), mpix, [&] { base64_decode_find(text); }));
+            for (Base64Isa isa : supported_base64_isas()) {
+                const std::string isa_name = diffusion_desk::base64_isa_name(isa);
+                name = "base64/" + prefix + "/encode/" + isa_name;
+                if (wants(name)) {
+                    add_throughput(time_it(name, opt.iterations, mpix, [&] {
+                        std::string out;
+                        diffusion_desk::base64_encode(src.data(), src.size(), out, isa);
+                    }));
+                }
+                name = "base64/" + prefix + "/decode/" + isa_name;
+                if (wants(name)) {
+                    std::vector<uint8_t> out(diffusion_desk::base64_decoded_size(text.size()));
+                    add_throughput(time_it(name, opt.iterations, mpix, [&] {
+                        diffusion_desk::base64_decode(text.data(), text.size(), out.data(), isa);
+                    }));
+                }
+            }
+        }
+
+        // Re-indexing the library: parameters of one kept result from its PNG text chunks,
+        // against opening and parsing the .txt sidecar written next to it before
+        if (size <= 2048) {
+            const fs::path dir = fs::temp_directory_path();
+            const fs::path png_path = dir / ("diffusion_desk_image_bench_" + prefix + ".png");
+            const fs::path txt_path = dir / ("diffusion_desk_image_bench_" + prefix + ".txt");
+            std::vector<uint8_t> png = encode_png_bytes(src, size, size);
+            diffusion_desk::png_add_text(png, {{diffusion_desk::PNG_PARAMETERS_KEY, SAMPLE_PARAMETERS}});
+            std::ofstream(png_path, std::ios::binary).write(reinterpret_cast<const char*>(png.data()), (std::streamsize)png.size());
+            std::ofstream(txt_path, std::ios::binary) << SAMPLE_PARAMETERS;
+            name = "metadata/" + prefix + "/png_chunks";
+            if (wants(name)) {
+                results.push_back(time_it(name, opt.iterations, mpix, [&] {
+                    auto text = diffusion_desk::png_read_text_file(png_path);
+                    diffusion_desk::parse_image_params(text[diffusion_desk::PNG_PARAMETERS_KEY]);
+                }));
+            }
+            name = "metadata/" + prefix + "/txt_sidecar";
+            if (wants(name)) {
+                results.push_back(time_it(name, opt.iterations, mpix, [&] {
+                    std::ifstream f(txt_path);
+                    std::string content((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+                    diffusion_desk::parse_image_params(content);
+                }));
+            }
+            std::error_code ec;
+            fs::remove(png_path, ec);
+            fs::remove(txt_path, ec);
+        }
+
+        // What ThumbnailService runs per image: all levels from one decoded source
+        name = "pyramid/" + prefix + "/512_256_128/" + diffusion_desk::resample_isa_name(diffusion_desk::resample_best_isa());
+        if (wants(name)) {
+            results.push_back(time_it(name, opt.iterations, mpix, [&] {
+                diffusion_desk::build_pyramid(src.data(), size, size, 3, opt.levels);
+            }));
+        }
+    }
+
+    json report;
+    report["best_isa"] = diffusion_desk::resample_isa_name(diffusion_desk::resample_best_isa());
+    report["base64_best_isa"] = diffusion_desk::base64_isa_name(diffusion_desk::base64_best_isa());
+    report["results"] = results;
+    if (!opt.output_path.empty()) {
+        std::ofstream out(opt.output_path);
+        out << report.dump(2) << std::endl;
+        if (!out) {
+            std::cerr << "[image_bench] cannot write " << opt.output_path << std::endl;
+            return 1;
+        }
+    }
+    std::cout << report.dump(2) << std::endl;
+    return 0;
+}
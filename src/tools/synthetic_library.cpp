@@ -0,0 +1,142 @@
+#include "synthetic_library.hpp"
+#include <algorithm>
+#include <ctime>
+#include <random>
+#include <vector>
+
+namespace diffusion_desk {
+
+static std::string sql_timestamp(std::time_t t) {
+    std::tm tm_utc{};
+#if defined(_WIN32)
+    gmtime_s(&tm_utc, &t);
+#else
+    gmtime_r(&t, &tm_utc);
+#endif
+    char buf[32];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm_utc);
+    return buf;
+}
+
+void populate_synthetic_library(Database& db, const LibrarySpec& spec) {
+    SQLite::Database& raw = db.get_db();
+    std::mt19937 rng(spec.seed);
+    std::uniform_int_distribution<int> tag_dist(1, std::max(1, spec.tags));
+    std::uniform_int_distribution<int> rating_dist(0, 5);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    const std::vector<std::string> words = {
+        "cat", "dog", "castle", "forest", "neon", "portrait", "city", "ocean",
+        "mountain", "robot", "sunset", "watercolor", "studio", "cinematic", "macro", "snow"};
+
+    SQLite::Transaction transaction(raw);
+
+    SQLite::Statement ins_tag(raw, "INSERT OR IGNORE INTO tags (name) VALUES (?)");
+    for (int i = 1; i <= spec.tags; ++i) {
+        ins_tag.bind(1, "tag_" + std::to_string(i));
+        ins_tag.exec();
+        ins_tag.reset();
+    }
+
+    SQLite::Statement ins_gen(raw, R"(
+        INSERT INTO generations (uuid, file_path, timestamp, prompt, negative_prompt, seed, width, height,
+                                 steps, cfg_scale, model_id, rating, auto_tagged, params_json)
+        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+    )");
+    SQLite::Statement ins_link(raw, "INSERT OR IGNORE INTO image_tags (generation_id, tag_id, source) VALUES (?, ?, 'llm_vision')");
+    SQLite::Statement ins_file(raw, "INSERT INTO generation_files (generation_id, file_type, file_path) VALUES (?, ?, ?)");
+    // The rest of the thumbnail pyramid first, then other derived files
+    const std::vector<std::string> extra_file_types = {"thumbnail_512", "thumbnail_128", "upscale", "mask", "preview"};
+
+    const std::time_t base = 1700000000;
+    for (int i = 1; i <= spec.generations; ++i) {
+        std::string prompt = "a " + words[i % words.size()] + " and a " + words[(i / 7) % words.size()] +
+                             ", " + words[(i / 3) % words.size()] + " style, detailed #" + std::to_string(i);
+        json params = {{"prompt", prompt}, {"sample_steps", 20}, {"width", 1024}, {"height", 1024},
+                       {"sampler", "euler_a"}, {"cfg_scale", 7.0}, {"n", 1}};
+        bool tagged = unit(rng) >= spec.untagged_ratio;
+
+        ins_gen.bind(1, "bench-" + std::to_string(i));
+        ins_gen.bind(2, "/outputs/img-" + std::to_string(i) + ".png");
+        ins_gen.bind(3, sql_timestamp(base + i));
+        ins_gen.bind(4, prompt);
+        ins_gen.bind(5, "blurry, lowres");
+        ins_gen.bind(6, (int64_t)i);
+        ins_gen.bind(7, 1024);
+        ins_gen.bind(8, 1024);
+        ins_gen.bind(9, 20);
+        ins_gen.bind(10, 7.0);
+        ins_gen.bind(11, "model_" + std::to_string(i % std::max(1, spec.models)) + ".safetensors");
+        ins_gen.bind(12, rating_dist(rng));
+        ins_gen.bind(13, tagged ? 1 : 0);
+        ins_gen.bind(14, params.dump());
+        ins_gen.exec();
+        ins_gen.reset();
+
+        for (int t = 0; tagged && t < spec.tags_per_image; ++t) {
+            ins_link.bind(1, i);
+            ins_link.bind(2, tag_dist(rng));
+            ins_link.exec();
+            ins_link.reset();
+        }
+
+        for (int f = 0; f < spec.files_per_generation; ++f) {
+            const std::string& type = f == 0 ? std::string("thumbnail") : extra_file_types[(f - 1) % extra_file_types.size()];
+            ins_file.bind(1, i);
+            ins_file.bind(2, type);
+            std::string path;
+            if (f == 0) path = "/outputs/previews/thumb_" + std::to_string(i) + ".jpg";
+            else if (type.rfind("thumbnail_", 0) == 0) path = "/outputs/previews/thumb_" + std::to_string(i) + "_" + type.substr(10) + ".jpg";
+            else path = "/outputs/" + type + "/img-" + std::to_string(i) + "-" + std::to_string(f) + ".png";
+            ins_file.bind(3, path);
+            ins_file.exec();
+            ins_file.reset();
+        }
+    }
+
+    SQLite::Statement ins_job(raw, "INSERT INTO jobs (type, payload, status, priority, created_at) VALUES (?, ?, ?, ?, ?)");
+    for (int i = 1; i <= spec.jobs; ++i) {
+        bool pending = i > spec.jobs - spec.jobs / 100; // Newest 1% still queued
+        ins_job.bind(1, i % 3 == 0 ? "auto_tag" : "generate_thumbnail");
+        ins_job.bind(2, json({{"generation_id", 1 + i % std::max(1, spec.generations)}}).dump());
+        ins_job.bind(3, pending ? "pending" : "completed");
+        ins_job.bind(4, i % 3 == 0 ? 0 : 10);
+        ins_job.bind(5, sql_timestamp(base + i));
+        ins_job.exec();
+        ins_job.reset();
+    }
+
+    transaction.commit();
+
+    // Settings-sized tables go through the public API; they stay in the tens of rows
+    for (int i = 1; i <= spec.presets; ++i) {
+        const std::string n = std::to_string(i);
+        ImagePreset image;
+        image.name = "preset_" + n;
+        image.unet_path = "unet/model_" + std::to_string(i % std::max(1, spec.models)) + ".safetensors";
+        image.vae_path = "vae/ae.safetensors";
+        image.clip_l_path = "clip/clip_l.safetensors";
+        image.vram_weights_mb_estimate = 4096 + i;
+        image.default_params = {{"sample_steps", 20}, {"cfg_scale", 7.0}, {"width", 1024}, {"height", 1024}};
+        db.save_image_preset(image);
+
+        LlmPreset llm;
+        llm.name = "preset_" + n;
+        llm.model_path = "llm/model_" + n + ".gguf";
+        llm.n_ctx = 4096;
+        llm.capabilities = {"chat", i % 2 ? "vision" : "completion"};
+        llm.system_prompt_assistant = "You are a helpful assistant.";
+        llm.system_prompt_tagging = "List the tags for this image.";
+        db.save_llm_preset(llm);
+
+        db.save_style({"style_" + n, "a " + words[i % words.size()] + " style", "blurry", ""});
+        db.add_library_item({0, "item_" + n, words[i % words.size()] + " lighting", i % 2 ? "Style" : "Subject", "", 0});
+    }
+    for (int m = 0; m < spec.models; ++m) {
+        db.save_model_metadata("model_" + std::to_string(m) + ".safetensors",
+                               {{"type", "checkpoint"}, {"base", "sdxl"}, {"trigger_words", json::array({"bench"})}});
+    }
+
+    raw.exec("ANALYZE");
+}
+
+} // namespace diffusion_desk
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "orchestrator/database.hpp"
+#include <string>
+
+namespace diffusion_desk {
+
+// Shape of a generated library. Defaults approximate a heavy long-term user.
+struct LibrarySpec {
+    int generations = 100000;
+    int tags = 2000;
+    int tags_per_image = 10;
+    int models = 5;
+    int files_per_generation = 3; // The thumbnail pyramid, then extra "upscale"/"mask"/"preview" rows
+    int jobs = 20000;           // Mostly completed thumbnail/tagging jobs, a few pending
+    int presets = 20;           // Each of image presets, LLM presets, styles and library items
+    double untagged_ratio = 0.1; // Share of generations still waiting for auto-tagging
+    unsigned seed = 1234;
+};
+
+// Fills an initialized Database with deterministic synthetic rows through its writer
+// connection, in a single transaction, then runs ANALYZE so plans match a real library.
+// Generations are named "bench-<n>" with files "/outputs/img-<n>.png", tags "tag_<n>",
+// models "model_<n>.safetensors" (each with metadata), presets and styles "preset_<n>" /
+// "style_<n>".
+void populate_synthetic_library(Database& db, const LibrarySpec& spec);
+
+} // namespace diffusion_desk
@@ -0,0 +1,309 @@
+#include "base64.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DD_BASE64_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define DD_TARGET_SSSE3
+#define DD_TARGET_AVX2
+#else
+#define DD_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define DD_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace diffusion_desk {
+
+namespace {
+
+constexpr char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+constexpr uint8_t INVALID = 0xff;
+
+struct DecodeTable {
+    uint8_t value[256];
+    constexpr DecodeTable() : value() {
+        for (int i = 0; i < 256; ++i) value[i] = INVALID;
+        for (int i = 0; i < 64; ++i) value[(unsigned char)ALPHABET[i]] = uint8_t(i);
+    }
+};
+constexpr DecodeTable DECODE;
+
+// Both scalar loops return where they stopped so the SIMD paths can hand over their tail
+size_t encode_scalar(const uint8_t* in, size_t size, char* out) {
+    char* const start = out;
+    size_t i = 0;
+    for (; i + 3 <= size; i += 3) {
+        const uint32_t v = (uint32_t(in[i]) << 16) | (uint32_t(in[i + 1]) << 8) | in[i + 2];
+        *out++ = ALPHABET[v >> 18];
+        *out++ = ALPHABET[(v >> 12) & 0x3f];
+        *out++ = ALPHABET[(v >> 6) & 0x3f];
+        *out++ = ALPHABET[v & 0x3f];
+    }
+    if (i < size) {
+        const uint32_t v = (uint32_t(in[i]) << 16) | (i + 1 < size ? uint32_t(in[i + 1]) << 8 : 0);
+        *out++ = ALPHABET[v >> 18];
+        *out++ = ALPHABET[(v >> 12) & 0x3f];
+        *out++ = i + 1 < size ? ALPHABET[(v >> 6) & 0x3f] : '=';
+        *out++ = '=';
+    }
+    return size_t(out - start);
+}
+
+size_t decode_scalar(const char* text, size_t length, uint8_t* out) {
+    const auto* in = reinterpret_cast<const unsigned char*>(text);
+    uint8_t* const start = out;
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        const uint8_t a = DECODE.value[in[i]], b = DECODE.value[in[i + 1]];
+        const uint8_t c = DECODE.value[in[i + 2]], d = DECODE.value[in[i + 3]];
+        if ((a | b | c | d) & 0x80) break;
+        const uint32_t v = (uint32_t(a) << 18) | (uint32_t(b) << 12) | (uint32_t(c) << 6) | d;
+        *out++ = uint8_t(v >> 16);
+        *out++ = uint8_t(v >> 8);
+        *out++ = uint8_t(v);
+    }
+    // Up to three characters before the end or the first invalid one
+    uint32_t v = 0;
+    int count = 0;
+    for (; i < length && count < 4; ++i, ++count) {
+        const uint8_t d = DECODE.value[in[i]];
+        if (d == INVALID) break;
+        v = (v << 6) | d;
+    }
+    if (count >= 2) {
+        v <<= 6 * (4 - count);
+        *out++ = uint8_t(v >> 16);
+        if (count >= 3) *out++ = uint8_t(v >> 8);
+    }
+    return size_t(out - start);
+}
+
+#ifdef DD_BASE64_X86
+
+// Wojciech Muła and Daniel Lemire's vector base64 ("Faster Base64 Encoding and Decoding
+// using AVX2 Instructions", 2018): reshuffle 12 bytes into 16 sextets, then map each sextet
+// to its character with one pshufb of per-range offsets. Decoding runs the same in reverse
+// and validates with a nibble bitmask lookup.
+
+DD_TARGET_SSSE3 inline __m128i encode_block_ssse3(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    const __m128i sextets = _mm_or_si128(t1, t3);
+
+    // 0..25 -> 13 ('A' offset), 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+    __m128i range = _mm_subs_epu8(sextets, _mm_set1_epi8(51));
+    range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), sextets), _mm_set1_epi8(13)));
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(sextets, _mm_shuffle_epi8(offsets, range));
+}
+
+DD_TARGET_SSSE3 size_t encode_ssse3(const uint8_t* in, size_t size, char* out) {
+    size_t i = 0, o = 0;
+    // Each step reads 16 bytes and uses 12
+    for (; i + 16 <= size; i += 12, o += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + o), encode_block_ssse3(block));
+    }
+    return o + encode_scalar(in + i, size - i, out + o);
+}
+
+// Translates 16 characters to sextets. False if any is outside the alphabet.
+DD_TARGET_SSSE3 inline bool decode_lookup_ssse3(__m128i& str) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+
+    const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(str, mask_2f));
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff) return false;
+    const __m128i eq_2f = _mm_cmpeq_epi8(str, mask_2f);
+    str = _mm_add_epi8(str, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles)));
+    return true;
+}
+
+// 16 sextets -> 12 bytes in the low three quarters
+DD_TARGET_SSSE3 inline __m128i decode_pack_ssse3(__m128i sextets) {
+    const __m128i pairs = _mm_maddubs_epi16(sextets, _mm_set1_epi32(0x01400140));
+    const __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+DD_TARGET_SSSE3 size_t decode_ssse3(const char* text, size_t length, uint8_t* out) {
+    size_t i = 0, o = 0;
+    // Each step stores 16 bytes of which 12 are real; the 24 characters still ahead decode
+    // to more than the 4 spare bytes, so the store stays inside base64_decoded_size
+    for (; i + 40 <= length; i += 16, o += 12) {
+        __m128i str = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        if (!decode_lookup_ssse3(str)) break;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + o), decode_pack_ssse3(str));
+    }
+    return o + decode_scalar(text + i, length - i, out + o);
+}
+
+DD_TARGET_AVX2 size_t encode_avx2(const uint8_t* in, size_t size, char* out) {
+    size_t i = 0, o = 0;
+    // Two 12-byte groups per step, one per 128-bit lane; the upper load ends 4 bytes past
+    // its group
+    for (; i + 28 <= size; i += 24, o += 32) {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12));
+        __m256i block = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        block = _mm256_shuffle_epi8(block, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                           10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        const __m256i t0 = _mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i sextets = _mm256_or_si256(t1, t3);
+
+        __m256i range = _mm256_subs_epu8(sextets, _mm256_set1_epi8(51));
+        range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), sextets), _mm256_set1_epi8(13)));
+        const __m256i offsets = _mm256_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+        const __m256i chars = _mm256_add_epi8(sextets, _mm256_shuffle_epi8(offsets, range));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + o), chars);
+    }
+    return o + encode_scalar(in + i, size - i, out + o);
+}
+
+DD_TARGET_AVX2 size_t decode_avx2(const char* text, size_t length, uint8_t* out) {
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+
+    size_t i = 0, o = 0;
+    // 24 real bytes per 32-byte store; as in decode_ssse3, enough characters must follow to
+    // cover the 8 spare bytes
+    for (; i + 48 <= length; i += 32, o += 24) {
+        __m256i str = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+        const __m256i lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(str, mask_2f));
+        const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        if (!_mm256_testz_si256(lo, hi)) break;
+        const __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+        str = _mm256_add_epi8(str, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles)));
+
+        const __m256i pairs = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+        words = _mm256_shuffle_epi8(words, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        // Close the gap between the lanes' 12-byte results
+        words = _mm256_permutevar8x32_epi32(words, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + o), words);
+    }
+    return o + decode_scalar(text + i, length - i, out + o);
+}
+
+bool cpu_supports(bool want_avx2) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+    __cpuid(info, 1);
+    const bool ssse3 = (info[2] & (1 << 9)) != 0;
+    if (!want_avx2) return ssse3;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (max_leaf < 7 || !osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return want_avx2 ? __builtin_cpu_supports("avx2") : __builtin_cpu_supports("ssse3");
+#endif
+}
+
+#endif // DD_BASE64_X86
+
+} // namespace
+
+Base64Isa base64_best_isa() {
+#ifdef DD_BASE64_X86
+    static const Base64Isa best = cpu_supports(true) ? Base64Isa::AVX2 : cpu_supports(false) ? Base64Isa::SSSE3 : Base64Isa::Scalar;
+    return best;
+#else
+    return Base64Isa::Scalar;
+#endif
+}
+
+const char* base64_isa_name(Base64Isa isa) {
+    switch (isa) {
+        case Base64Isa::AVX2: return "avx2";
+        case Base64Isa::SSSE3: return "ssse3";
+        default: return "scalar";
+    }
+}
+
+void base64_encode(const uint8_t* data, size_t size, std::string& out) {
+    base64_encode(data, size, out, base64_best_isa());
+}
+
+void base64_encode(const uint8_t* data, size_t size, std::string& out, Base64Isa isa) {
+    const size_t start = out.size();
+    out.resize(start + base64_encoded_size(size));
+    char* dst = &out[start];
+#ifdef DD_BASE64_X86
+    if (isa == Base64Isa::AVX2) {
+        encode_avx2(data, size, dst);
+        return;
+    }
+    if (isa == Base64Isa::SSSE3) {
+        encode_ssse3(data, size, dst);
+        return;
+    }
+#else
+    (void)isa;
+#endif
+    encode_scalar(data, size, dst);
+}
+
+std::string base64_encode(const uint8_t* data, size_t size) {
+    std::string out;
+    base64_encode(data, size, out);
+    return out;
+}
+
+size_t base64_decode(const char* text, size_t length, uint8_t* out) {
+    return base64_decode(text, length, out, base64_best_isa());
+}
+
+size_t base64_decode(const char* text, size_t length, uint8_t* out, Base64Isa isa) {
+#ifdef DD_BASE64_X86
+    if (isa == Base64Isa::AVX2) return decode_avx2(text, length, out);
+    if (isa == Base64Isa::SSSE3) return decode_ssse3(text, length, out);
+#else
+    (void)isa;
+#endif
+    return decode_scalar(text, length, out);
+}
+
+std::vector<uint8_t> base64_decode(const char* text, size_t length) {
+    std::vector<uint8_t> out(base64_decoded_size(length));
+    out.resize(base64_decode(text, length, out.data()));
+    return out;
+}
+
+size_t base64_payload_offset(const std::string& value) {
+    // The marker sits within the first few dozen characters ("data:image/png;base64,")
+    const size_t marker = value.compare(0, 5, "data:") == 0 ? value.find("base64,") : std::string::npos;
+    return marker == std::string::npos ? 0 : marker + 7;
+}
+
+} // namespace diffusion_desk
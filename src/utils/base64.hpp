@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace diffusion_desk {
+
+// Standard base64 (RFC 4648 alphabet, '=' padding) for images passed inline in JSON. The
+// scalar path is table driven; the SIMD paths translate 16 or 32 characters per step and
+// produce the same output byte for byte.
+enum class Base64Isa {
+    Scalar,
+    SSSE3,
+    AVX2
+};
+
+// Fastest path this CPU and build support (detected once)
+Base64Isa base64_best_isa();
+const char* base64_isa_name(Base64Isa isa);
+
+inline size_t base64_encoded_size(size_t size) { return (size + 2) / 3 * 4; }
+// Upper bound on the bytes decoded from length characters
+inline size_t base64_decoded_size(size_t length) { return length / 4 * 3 + 3; }
+
+// Appends the padded encoding of data to out, growing it once
+void base64_encode(const uint8_t* data, size_t size, std::string& out);
+void base64_encode(const uint8_t* data, size_t size, std::string& out, Base64Isa isa);
+std::string base64_encode(const uint8_t* data, size_t size);
+
+// Decodes text up to its end or the first character outside the alphabet ('=' padding,
+// whitespace, a closing quote), whichever comes first, into out, which must have room for
+// base64_decoded_size(length) bytes. A trailing partial group yields the whole bytes it
+// holds. Returns the number of bytes written.
+size_t base64_decode(const char* text, size_t length, uint8_t* out);
+size_t base64_decode(const char* text, size_t length, uint8_t* out, Base64Isa isa);
+std::vector<uint8_t> base64_decode(const char* text, size_t length);
+
+// Where the base64 payload of an inline image starts: after the "base64," of a data URI, or
+// at 0 for bare base64
+size_t base64_payload_offset(const std::string& value);
+
+} // namespace diffusion_desk
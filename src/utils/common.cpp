@@ -1,10 +1,12 @@
 #include "common.hpp"
+#include "qoi.hpp"
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <vector>
 #include <map>
+#include <algorithm>
 #include <regex>
 #include <random>
 #include <filesystem>
@@ -602,10 +604,18 @@ uint8_t* load_image_common(bool from_memory,
     uint8_t* image_buffer = nullptr;
     if (from_memory) {
         image_path   = "memory";
-        image_buffer = (uint8_t*)stbi_load_from_memory((const stbi_uc*)image_path_or_bytes, len, &width, &height, &c, expected_channel);
+        if (diffusion_desk::is_qoi((const uint8_t*)image_path_or_bytes, len)) {
+            image_buffer = diffusion_desk::qoi_decode((const uint8_t*)image_path_or_bytes, len, &width, &height, &c, expected_channel);
+        } else {
+            image_buffer = (uint8_t*)stbi_load_from_memory((const stbi_uc*)image_path_or_bytes, len, &width, &height, &c, expected_channel);
+        }
     } else {
         image_path   = image_path_or_bytes;
-        image_buffer = (uint8_t*)stbi_load(image_path_or_bytes, &width, &height, &c, expected_channel);
+        if (diffusion_desk::is_qoi_file(image_path_or_bytes)) {
+            image_buffer = diffusion_desk::qoi_load(image_path_or_bytes, &width, &height, &c, expected_channel);
+        } else {
+            image_buffer = (uint8_t*)stbi_load(image_path_or_bytes, &width, &height, &c, expected_channel);
+        }
     }
     if (image_buffer == nullptr) {
         DD_LOG_ERROR("load image from '%s' failed", image_path);
@@ -752,7 +762,12 @@ ArgOptions SDSvrParams::get_options() {
             "",
             "--internal-token",
             "transient API token for internal communication",
-            &internal_token}};
+            &internal_token},
+        {
+            "",
+            "--fsync",
+            "flush written images to disk: none, async, always (default: none)",
+            &fsync_policy}};
 
     options.int_options = {
         {
@@ -780,6 +795,51 @@ ArgOptions SDSvrParams::get_options() {
             "--safe-mode-crashes",
             "number of crashes before enabling safe mode (default: 2)",
             &safe_mode_crashes},
+        {
+            "",
+            "--encode-threads",
+            "threads encoding generated images, 0 for one per core (default: 0)",
+            &encode_threads},
+        {
+            "",
+            "--image-cache-mb",
+            "memory for decoded init, mask and reference images reused across requests, 0 to disable (default: 256)",
+            &image_cache_mb},
+        {
+            "",
+            "--context-cache-host-mb",
+            "RAM for SD context variants kept loaded across placement changes, 0 to disable (default: 8192)",
+            &context_cache_host_mb},
+        {
+            "",
+            "--context-cache-vram-mb",
+            "VRAM for SD context variants kept loaded across placement changes (default: 0)",
+            &context_cache_vram_mb},
+        {
+            "",
+            "--generation-batch-images",
+            "most images queued generation jobs that differ only in seed may combine into one pass, 1 to disable, at most 8 (default: 4)",
+            &generation_batch_images},
+        {
+            "",
+            "--generation-batch-window-ms",
+            "how long a queued generation job waits for compatible jobs to batch with (default: 0)",
+            &generation_batch_window_ms},
+        {
+            "",
+            "--generation-aging-s",
+            "seconds a queued generation job waits before it moves up one priority class, 0 to disable (default: 60)",
+            &generation_aging_s},
+        {
+            "",
+            "--generation-job-retention",
+            "finished generation jobs kept for status and event lookups (default: 256)",
+            &generation_job_retention_count},
+        {
+            "",
+            "--generation-job-retention-s",
+            "seconds a finished generation job is kept at most, 0 for no limit (default: 3600)",
+            &generation_job_retention_s},
     };
 
     options.bool_options = {
@@ -818,6 +878,16 @@ bool SDSvrParams::process_and_check() {
         DD_LOG_ERROR("error: listen_port should be in the range [0, 65535]");
         return false;
     }
+
+    if (fsync_policy != "none" && fsync_policy != "async" && fsync_policy != "always") {
+        DD_LOG_ERROR("error: fsync should be one of none, async, always");
+        return false;
+    }
+
+    if (generation_batch_images < 1 || generation_batch_images > MAX_GENERATION_IMAGES) {
+        DD_LOG_ERROR("error: generation_batch_images should be in the range [1, %d]", MAX_GENERATION_IMAGES);
+        return false;
+    }
     return true;
 }
 
@@ -871,6 +941,30 @@ bool SDSvrParams::load_from_file(const std::string& path) {
         if (j.contains("sd")) {
             auto& sd = j["sd"];
             if (sd.contains("safe_mode_crashes")) safe_mode_crashes = sd["safe_mode_crashes"];
+            if (sd.contains("encode_threads")) encode_threads = sd["encode_threads"];
+            if (sd.contains("image_cache_mb")) image_cache_mb = sd["image_cache_mb"];
+            if (sd.contains("context_cache_host_mb")) context_cache_host_mb = sd["context_cache_host_mb"];
+            if (sd.contains("context_cache_vram_mb")) context_cache_vram_mb = sd["context_cache_vram_mb"];
+            if (sd.contains("generation_batch_images")) {
+                // Loaded after the command line was checked; an out of range value would stop the SD worker
+                generation_batch_images = sd["generation_batch_images"];
+                if (generation_batch_images < 1 || generation_batch_images > MAX_GENERATION_IMAGES) {
+                    DD_LOG_WARN("sd.generation_batch_images %d is outside [1, %d], clamping",
+                                generation_batch_images, MAX_GENERATION_IMAGES);
+                    generation_batch_images = std::clamp(generation_batch_images, 1, MAX_GENERATION_IMAGES);
+                }
+            }
+            if (sd.contains("generation_batch_window_ms")) generation_batch_window_ms = sd["generation_batch_window_ms"];
+            if (sd.contains("generation_aging_s")) generation_aging_s = sd["generation_aging_s"];
+            if (sd.contains("generation_job_retention")) generation_job_retention_count = sd["generation_job_retention"];
+            if (sd.contains("generation_job_retention_s")) generation_job_retention_s = sd["generation_job_retention_s"];
+            if (sd.contains("fsync")) fsync_policy = sd["fsync"];
+        }
+
+        if (j.contains("jobs") && j["jobs"].contains("workers") && j["jobs"]["workers"].is_object()) {
+            for (auto& [type, count] : j["jobs"]["workers"].items()) {
+                if (count.is_number_integer()) job_workers[type] = count.get<int>();
+            }
         }
 
         if (j.contains("setup_completed")) setup_completed = j["setup_completed"];
@@ -914,6 +1008,16 @@ bool SDSvrParams::save_to_file(const std::string& path) {
     j["llm"]["style_extractor_system_prompt"] = style_extractor_system_prompt;
 
     j["sd"]["safe_mode_crashes"] = safe_mode_crashes;
+    j["sd"]["encode_threads"] = encode_threads;
+    j["sd"]["image_cache_mb"] = image_cache_mb;
+    j["sd"]["context_cache_host_mb"] = context_cache_host_mb;
+    j["sd"]["context_cache_vram_mb"] = context_cache_vram_mb;
+    j["sd"]["generation_batch_images"] = generation_batch_images;
+    j["sd"]["generation_batch_window_ms"] = generation_batch_window_ms;
+    j["sd"]["generation_aging_s"] = generation_aging_s;
+    j["sd"]["generation_job_retention"] = generation_job_retention_count;
+    j["sd"]["generation_job_retention_s"] = generation_job_retention_s;
+    j["sd"]["fsync"] = fsync_policy;
     j["setup_completed"] = setup_completed;
 
     // 3. Write back
@@ -950,36 +1054,6 @@ std::vector<std::string> split(const std::string& s, char delimiter) {
     return tokens;
 }
 
-std::string base64_encode(const unsigned char* buf, unsigned int bufLen) {
-    static const char* base64_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-
-    while (bufLen--) {
-        char_array_3[i++] = *(buf++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-            for (i = 0; i < 4; i++) ret += base64_chars[char_array_4[i]];
-            i = 0;
-        }
-    }
-    if (i) {
-        for (j = i; j < 3; j++) char_array_3[j] = '\0';
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-        char_array_4[3] = char_array_3[2] & 0x3f;
-        for (j = 0; j < i + 1; j++) ret += base64_chars[char_array_4[j]];
-        while (i++ < 3) ret += '=';
-    }
-    return ret;
-}
 void dd_log_printf(DDLogLevel level, const char* format, ...) {
     va_list args;
     va_start(args, format);
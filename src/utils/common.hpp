@@ -87,7 +87,6 @@ std::string make_error_json(const std::string& error, const std::string& message
 std::string generate_random_token(size_t length = 32);
 std::string extract_json_block(const std::string& content);
 std::vector<std::string> split(const std::string& s, char delimiter);
-std::string base64_encode(const unsigned char* buf, unsigned int bufLen);
 
 struct StringOption {
     std::string short_name;
@@ -139,6 +138,9 @@ struct ArgOptions {
 
 bool parse_options(int argc, const char** argv, const std::vector<ArgOptions>& options_list);
 
+// Most images one generation request (n) makes, and so one auto-batched pass of queued jobs
+constexpr int MAX_GENERATION_IMAGES = 8;
+
 struct SDSvrParams {
     std::string listen_ip = "127.0.0.1";
     int listen_port       = 1234;
@@ -152,6 +154,17 @@ struct SDSvrParams {
     int llm_idle_timeout = 300; 
     int sd_idle_timeout = 600; 
     int safe_mode_crashes = 2;
+    int encode_threads = 0;             // SD worker threads encoding batch results (0: one per core, up to 8)
+    int image_cache_mb = 256;           // SD worker cache of decoded init/mask/reference images (0: off)
+    int context_cache_host_mb = 8192;   // Parked SD context variants whose weights live in RAM
+    int context_cache_vram_mb = 0;      // Parked SD context variants holding VRAM (0: never park those)
+    int generation_batch_images = 4;    // Most images one auto-batched pass of queued generation jobs may have (1: off, at most MAX_GENERATION_IMAGES)
+    int generation_batch_window_ms = 0; // How long a queued generation job waits for jobs to batch with
+    int generation_aging_s = 60;        // Queue wait that raises a generation job one priority class (0: no aging)
+    int generation_job_retention_count = 256; // Finished generation jobs kept for status and event lookups
+    int generation_job_retention_s = 3600;    // ...and how long at most (0: no time limit)
+    std::string fsync_policy = "none";  // Flushing of written images: none, async (after the response), always
+    std::map<std::string, int> job_workers; // Worker threads per background job type ("jobs.workers")
     std::string internal_token;
     std::string tagger_system_prompt = "Extract the following fields from the image:\n\n"
         "tags: A JSON array of 8 to 12 concise lowercase gallery search keywords covering the main subject, specific visible objects, medium or style, composition, lighting, background, mood, and any readable text. Prefer visually specific tags over generic category labels.\n\n"
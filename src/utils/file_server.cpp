@@ -0,0 +1,302 @@
+#include "file_server.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace diffusion_desk {
+
+namespace {
+
+std::string http_date(int64_t unix_seconds) {
+    std::time_t t = (std::time_t)unix_seconds;
+    std::tm tm{};
+#if defined(_WIN32)
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+    char buf[64];
+    std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buf;
+}
+
+// IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT"), the only form current browsers send.
+// Returns -1 if the value does not parse.
+int64_t parse_http_date(const std::string& value) {
+    static const char* months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    char month[4] = {};
+    std::tm tm{};
+    if (std::sscanf(value.c_str(), "%*3s, %d %3s %d %d:%d:%d GMT", &tm.tm_mday, month, &tm.tm_year,
+                    &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+        return -1;
+    }
+    auto it = std::find_if(std::begin(months), std::end(months), [&](const char* m) { return std::string(m) == month; });
+    if (it == std::end(months)) return -1;
+    tm.tm_mon = int(it - std::begin(months));
+    tm.tm_year -= 1900;
+#if defined(_WIN32)
+    return (int64_t)_mkgmtime(&tm);
+#else
+    return (int64_t)timegm(&tm);
+#endif
+}
+
+// If-None-Match holds "*" or a comma-separated list of entity tags; weak comparison
+bool etag_matches(const std::string& header, const std::string& etag) {
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t end = header.find(',', pos);
+        if (end == std::string::npos) end = header.size();
+        std::string tag = header.substr(pos, end - pos);
+        tag.erase(0, tag.find_first_not_of(" \t"));
+        tag.erase(tag.find_last_not_of(" \t") + 1);
+        if (tag.rfind("W/", 0) == 0) tag = tag.substr(2);
+        if (tag == "*" || tag == etag) return true;
+        pos = end + 1;
+    }
+    return false;
+}
+
+// Validators, 304 handling and the zero-copy body shared by serve_file and serve_mapped
+void respond(const httplib::Request& req, httplib::Response& res, std::shared_ptr<const MappedFile> file,
+             size_t offset, size_t length, const std::string& mime, const std::string& etag,
+             int64_t last_modified, const char* cache_control) {
+    res.set_header("ETag", etag);
+    if (last_modified >= 0) res.set_header("Last-Modified", http_date(last_modified));
+    res.set_header("Cache-Control", cache_control);
+    res.set_header("Accept-Ranges", "bytes");
+
+    // If-None-Match takes precedence; If-Modified-Since only applies without it (RFC 9110)
+    bool not_modified = false;
+    if (req.has_header("If-None-Match")) {
+        not_modified = etag_matches(req.get_header_value("If-None-Match"), etag);
+    } else if (last_modified >= 0 && req.has_header("If-Modified-Since")) {
+        int64_t since = parse_http_date(req.get_header_value("If-Modified-Since"));
+        not_modified = since >= 0 && last_modified <= since;
+    }
+    if (not_modified) {
+        res.status = 304;
+        return;
+    }
+
+    if (length == 0) {
+        res.set_content("", mime);
+        return;
+    }
+    const char* base = file->data() + offset;
+    res.set_content_provider(length, mime,
+        [file, base, length](size_t pos, size_t count, httplib::DataSink& sink) {
+            if (pos >= length) return false;
+            return sink.write(base + pos, std::min(count, length - pos));
+        });
+}
+
+} // namespace
+
+MappedFile::~MappedFile() {
+    if (!m_data || !m_copy.empty()) return;
+#if defined(_WIN32)
+    UnmapViewOfFile(m_data);
+#else
+    munmap(const_cast<char*>(m_data), m_size);
+#endif
+}
+
+std::shared_ptr<MappedFile> MappedFile::open(const fs::path& path) {
+    auto file = std::shared_ptr<MappedFile>(new MappedFile());
+    return file->map(path, false) ? file : nullptr;
+}
+
+std::shared_ptr<MappedFile> MappedFile::load(const fs::path& path) {
+    auto file = std::shared_ptr<MappedFile>(new MappedFile());
+    return file->map(path, true) ? file : nullptr;
+}
+
+bool MappedFile::map(const fs::path& path, bool copy) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    FILETIME written;
+    bool ok = GetFileSizeEx(file, &size) && GetFileTime(file, nullptr, nullptr, &written);
+    if (ok) {
+        m_size = (size_t)size.QuadPart;
+        // FILETIME counts 100 ns intervals since 1601
+        m_mtime_ticks = (int64_t)(((uint64_t)written.dwHighDateTime << 32) | written.dwLowDateTime);
+        m_mtime = (m_mtime_ticks - 116444736000000000LL) / 10000000LL;
+    }
+    if (ok && m_size > 0 && copy) {
+        m_copy.resize(m_size);
+        size_t done = 0;
+        DWORD n = 0;
+        while (done < m_size &&
+               ReadFile(file, m_copy.data() + done, (DWORD)std::min<size_t>(m_size - done, 1 << 30), &n, nullptr) && n > 0) {
+            done += n;
+        }
+        m_size = done; // Shorter if it was truncated meanwhile
+        m_copy.resize(std::max<size_t>(done, 1));
+        m_data = m_copy.data();
+    } else if (ok && m_size > 0) {
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            m_data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping); // The view keeps the mapping alive
+        }
+        ok = m_data != nullptr;
+    }
+    CloseHandle(file);
+    return ok;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (ok) {
+        m_size = (size_t)st.st_size;
+        m_mtime = (int64_t)st.st_mtime;
+#if defined(__APPLE__)
+        m_mtime_ticks = (int64_t)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+        m_mtime_ticks = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    }
+    if (ok && m_size > 0 && copy) {
+        m_copy.resize(m_size);
+        size_t done = 0;
+        ssize_t n = 0;
+        while (done < m_size && (n = ::read(fd, m_copy.data() + done, m_size - done)) > 0) done += (size_t)n;
+        m_size = done; // Shorter if it was truncated meanwhile
+        m_copy.resize(std::max<size_t>(done, 1));
+        m_data = m_copy.data();
+    } else if (ok && m_size > 0) {
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            m_data = (const char*)data;
+            // Responses are read front to back, usually in full
+            madvise(data, m_size, MADV_SEQUENTIAL);
+        }
+        ok = m_data != nullptr;
+    }
+    ::close(fd);
+    return ok;
+#endif
+}
+
+std::string mime_type_for(const fs::path& path) {
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    if (ext == ".png") return "image/png";
+    if (ext == ".jpg" || ext == ".jpeg") return "image/jpeg";
+    if (ext == ".webp") return "image/webp";
+    if (ext == ".json") return "application/json";
+    if (ext == ".txt") return "text/plain; charset=utf-8";
+    return "application/octet-stream";
+}
+
+std::optional<fs::path> resolve_served_path(const fs::path& root, const std::string& relative) {
+    if (relative.empty() || relative.find('\0') != std::string::npos) return std::nullopt;
+    // Backslashes are separators on Windows; treat them as such everywhere so a request
+    // cannot hide a ".." from the component check on one platform only
+    std::string normalized = relative;
+    std::replace(normalized.begin(), normalized.end(), '\\', '/');
+    fs::path rel = fs::path(normalized).lexically_normal();
+    if (rel.is_absolute() || rel.has_root_name() || rel.has_root_directory()) return std::nullopt;
+    for (const auto& part : rel) {
+        if (part == "..") return std::nullopt;
+    }
+
+    // Symlinks inside root could still point out of it
+    std::error_code ec;
+    const fs::path base = fs::weakly_canonical(root, ec);
+    if (ec) return std::nullopt;
+    const fs::path resolved = fs::weakly_canonical(base / rel, ec);
+    if (ec) return std::nullopt;
+    auto mismatch = std::mismatch(base.begin(), base.end(), resolved.begin(), resolved.end());
+    if (mismatch.first != base.end()) return std::nullopt;
+    return resolved;
+}
+
+bool serve_file(const httplib::Request& req, httplib::Response& res, const fs::path& path, const char* cache_control) {
+    // Only names that are never reused are safe to map; see MappedFile
+    const bool immutable = std::strcmp(cache_control, CACHE_IMMUTABLE) == 0;
+    auto file = immutable ? MappedFile::open(path) : MappedFile::load(path);
+    if (!file) return false;
+
+    char etag[64];
+    std::snprintf(etag, sizeof(etag), "\"%llx-%llx\"", (unsigned long long)file->mtime_ticks(), (unsigned long long)file->size());
+    respond(req, res, file, 0, file->size(), mime_type_for(path), etag, file->mtime(), cache_control);
+    return true;
+}
+
+void serve_mapped(const httplib::Request& req, httplib::Response& res, std::shared_ptr<const MappedFile> file,
+                  size_t offset, size_t length, const std::string& mime, const std::string& etag,
+                  const char* cache_control) {
+    respond(req, res, std::move(file), offset, length, mime, etag, -1, cache_control);
+}
+
+namespace {
+
+// Unique per process and call; the worker and the orchestrator never write the same target
+fs::path partial_path(const fs::path& target) {
+    static std::atomic<unsigned> counter{0};
+    fs::path partial = target;
+    partial += ".part" + std::to_string(counter++);
+    return partial;
+}
+
+bool rename_into_place(const fs::path& partial, const fs::path& target) {
+    std::error_code ec;
+    fs::rename(partial, target, ec);
+    if (ec) fs::remove(partial, ec);
+    return !ec;
+}
+
+} // namespace
+
+bool replace_file(const fs::path& target, const void* data, size_t size) {
+    const fs::path partial = partial_path(target);
+    {
+        std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(static_cast<const char*>(data), (std::streamsize)size);
+        if (!out.flush()) {
+            out.close();
+            std::error_code ec;
+            fs::remove(partial, ec);
+            return false;
+        }
+    }
+    return rename_into_place(partial, target);
+}
+
+bool copy_file_replacing(const fs::path& source, const fs::path& target) {
+    const fs::path partial = partial_path(target);
+    std::error_code ec;
+    if (!fs::copy_file(source, partial, fs::copy_options::overwrite_existing, ec)) {
+        fs::remove(partial, ec);
+        return false;
+    }
+    return rename_into_place(partial, target);
+}
+
+} // namespace diffusion_desk
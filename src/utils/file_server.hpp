@@ -0,0 +1,84 @@
+#pragma once
+
+#include "httplib.h"
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace diffusion_desk {
+
+// Cache-Control for files whose name is never reused for other content, such as generated
+// images (img-<timestamp>-<seed>.png)
+inline constexpr const char* CACHE_IMMUTABLE = "public, max-age=31536000, immutable";
+// For files regenerated under the same name (thumbnails, style and model previews): the
+// browser keeps them but revalidates, which costs a 304 instead of the image
+inline constexpr const char* CACHE_REVALIDATE = "no-cache";
+
+// Read-only view of a whole file. The mapping stays valid after the file is deleted or
+// replaced by rename, so a response already in flight is never cut short. It does not
+// survive the file being truncated or rewritten in place: reading past the new end faults
+// (SIGBUS) on POSIX, and on Windows the writer fails instead. Such files are either only
+// ever replaced through replace_file/copy_file_replacing or read with load(). Bytes
+// appended after mapping are not visible; map the file again to see them.
+class MappedFile {
+public:
+    // nullptr if the file cannot be opened or mapped, or is not a regular file
+    static std::shared_ptr<MappedFile> open(const std::filesystem::path& path);
+    // Same, but reads the file into memory and closes it right away; for small files that
+    // another process may rewrite while a response is in flight
+    static std::shared_ptr<MappedFile> load(const std::filesystem::path& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    int64_t mtime() const { return m_mtime; }             // Unix seconds
+    int64_t mtime_ticks() const { return m_mtime_ticks; } // Finest resolution available, for ETags
+
+private:
+    MappedFile() = default;
+    bool map(const std::filesystem::path& path, bool copy);
+
+    const char* m_data = nullptr;
+    std::vector<char> m_copy; // Owns m_data for load(); empty for a mapping
+    size_t m_size = 0;
+    int64_t m_mtime = 0;
+    int64_t m_mtime_ticks = 0;
+};
+
+std::string mime_type_for(const std::filesystem::path& path);
+
+// Joins a request path onto root, refusing anything that could resolve outside it: empty
+// or absolute paths, drive letters, ".." components and symlinks that lead elsewhere.
+std::optional<std::filesystem::path> resolve_served_path(const std::filesystem::path& root, const std::string& relative);
+
+// Serves a regular file through a sized content provider, so the bytes are never copied
+// into the response. Files sent with CACHE_IMMUTABLE come straight from a memory mapping;
+// anything else may be regenerated under its name and is read with MappedFile::load.
+// Sets ETag, Last-Modified and Cache-Control, answers If-None-Match / If-Modified-Since
+// with 304, and leaves Range requests to httplib, which asks the provider for just the
+// requested window. Returns false, leaving res untouched, if path is not a readable
+// regular file.
+bool serve_file(const httplib::Request& req, httplib::Response& res, const std::filesystem::path& path,
+                const char* cache_control = CACHE_REVALIDATE);
+
+// Like serve_file for length bytes at offset of an already mapped file, e.g. one record of
+// a pack file. The caller supplies the ETag (quoted) since the file's own says nothing
+// about one record; the mapping is kept alive until the response is sent.
+void serve_mapped(const httplib::Request& req, httplib::Response& res, std::shared_ptr<const MappedFile> file,
+                  size_t offset, size_t length, const std::string& mime, const std::string& etag,
+                  const char* cache_control = CACHE_REVALIDATE);
+
+// Write a file under a temporary name next to target and rename it over target, so a
+// reader (or a mapping of the old file) never sees it half written or truncated. Every
+// writer of a served path that may already exist goes through these. Return false on
+// failure, leaving target as it was.
+bool replace_file(const std::filesystem::path& target, const void* data, size_t size);
+bool copy_file_replacing(const std::filesystem::path& source, const std::filesystem::path& target);
+
+} // namespace diffusion_desk
@@ -0,0 +1,302 @@
+#include "image_resample.hpp"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <tuple>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DD_RESAMPLE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define DD_TARGET_AVX2
+#else
+#define DD_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace diffusion_desk {
+
+namespace {
+
+// Filter weights are 14-bit fixed point: small enough for _mm_madd_epi16's signed 16-bit
+// operands, and each tap list sums to exactly WEIGHT_ONE so a flat area stays flat
+constexpr int WEIGHT_BITS = 14;
+constexpr int WEIGHT_ONE = 1 << WEIGHT_BITS;
+constexpr int WEIGHT_ROUND = WEIGHT_ONE / 2;
+
+// The source pixels covering each destination pixel along one axis
+struct AreaTaps {
+    std::vector<int> first;    // First source index per destination index
+    std::vector<int> count;
+    std::vector<int> offset;   // Into weights
+    std::vector<int16_t> weights;
+};
+
+AreaTaps area_taps(int src, int dst) {
+    // Exact integer coverage: source pixel j spans [j*dst, (j+1)*dst) and destination
+    // pixel i spans [i*src, (i+1)*src) on a common grid
+    AreaTaps taps;
+    taps.first.resize(dst);
+    taps.count.resize(dst);
+    taps.offset.resize(dst);
+    for (int i = 0; i < dst; ++i) {
+        const int64_t begin = int64_t(i) * src;
+        const int64_t end = int64_t(i + 1) * src;
+        const int first = int(begin / dst);
+        const int last = std::min<int>(src, int((end + dst - 1) / dst));
+        taps.first[i] = first;
+        taps.count[i] = last - first;
+        taps.offset[i] = int(taps.weights.size());
+
+        int sum = 0;
+        for (int j = first; j < last; ++j) {
+            const int64_t cover = std::min<int64_t>(int64_t(j + 1) * dst, end) - std::max<int64_t>(int64_t(j) * dst, begin);
+            const int w = int((cover * WEIGHT_ONE + src / 2) / src);
+            taps.weights.push_back(int16_t(w));
+            sum += w;
+        }
+        // Rounding residue goes to the biggest tap, where it matters least
+        auto largest = std::max_element(taps.weights.begin() + taps.offset[i], taps.weights.end());
+        *largest = int16_t(*largest + (WEIGHT_ONE - sum));
+    }
+    return taps;
+}
+
+// Vertical pass: out[x] = sum_k rows[k][x] * weights[k], for one destination row
+void vertical_scalar(const uint8_t* const* rows, const int16_t* weights, int count, uint8_t* out, int begin, int bytes) {
+    for (int x = begin; x < bytes; ++x) {
+        int acc = WEIGHT_ROUND;
+        for (int k = 0; k < count; ++k) acc += rows[k][x] * weights[k];
+        out[x] = uint8_t(acc >> WEIGHT_BITS);
+    }
+}
+
+#ifdef DD_RESAMPLE_X86
+
+// Pairs of source rows are interleaved so one madd applies both weights:
+// (a0,b0,a1,b1,...) . (wa,wb,wa,wb,...) -> a0*wa + b0*wb per 32-bit lane
+inline int32_t weight_pair(const int16_t* weights, int k, int count) {
+    const int wb = k + 1 < count ? weights[k + 1] : 0;
+    return int32_t(uint16_t(weights[k])) | int32_t(uint32_t(uint16_t(wb)) << 16);
+}
+
+void vertical_sse2(const uint8_t* const* rows, const int16_t* weights, int count, uint8_t* out, int bytes) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(WEIGHT_ROUND);
+    int x = 0;
+    for (; x + 16 <= bytes; x += 16) {
+        __m128i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+        for (int k = 0; k < count; k += 2) {
+            const uint8_t* row_b = k + 1 < count ? rows[k + 1] : rows[k];
+            const __m128i w = _mm_set1_epi32(weight_pair(weights, k, count));
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + x));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row_b + x));
+            const __m128i ab_lo = _mm_unpacklo_epi8(a, b);
+            const __m128i ab_hi = _mm_unpackhi_epi8(a, b);
+            acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi8(ab_lo, zero), w));
+            acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(ab_lo, zero), w));
+            acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi8(ab_hi, zero), w));
+            acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi8(ab_hi, zero), w));
+        }
+        const __m128i lo = _mm_packs_epi32(_mm_srai_epi32(acc0, WEIGHT_BITS), _mm_srai_epi32(acc1, WEIGHT_BITS));
+        const __m128i hi = _mm_packs_epi32(_mm_srai_epi32(acc2, WEIGHT_BITS), _mm_srai_epi32(acc3, WEIGHT_BITS));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(lo, hi));
+    }
+    vertical_scalar(rows, weights, count, out, x, bytes);
+}
+
+// 16 source bytes of one row pair: cvtepu8 widens, and unpack lo/hi leave pixels
+// [0-3|8-11] and [4-7|12-15] per lane, which packs_epi32 puts back in order
+DD_TARGET_AVX2 inline void madd_pair_avx2(const uint8_t* a, const uint8_t* b, __m256i w, __m256i& acc_lo, __m256i& acc_hi) {
+    const __m256i wa = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)));
+    const __m256i wb = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b)));
+    acc_lo = _mm256_add_epi32(acc_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(wa, wb), w));
+    acc_hi = _mm256_add_epi32(acc_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(wa, wb), w));
+}
+
+DD_TARGET_AVX2 inline void store16_avx2(uint8_t* out, __m256i acc_lo, __m256i acc_hi) {
+    const __m256i packed = _mm256_packs_epi32(_mm256_srai_epi32(acc_lo, WEIGHT_BITS), _mm256_srai_epi32(acc_hi, WEIGHT_BITS));
+    const __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), bytes);
+}
+
+DD_TARGET_AVX2 void vertical_avx2(const uint8_t* const* rows, const int16_t* weights, int count, uint8_t* out, int bytes) {
+    const __m256i round = _mm256_set1_epi32(WEIGHT_ROUND);
+    int x = 0;
+    // Two independent 16-byte halves per step keep four accumulators in flight
+    for (; x + 32 <= bytes; x += 32) {
+        __m256i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+        for (int k = 0; k < count; k += 2) {
+            const uint8_t* row_b = k + 1 < count ? rows[k + 1] : rows[k];
+            const __m256i w = _mm256_set1_epi32(weight_pair(weights, k, count));
+            madd_pair_avx2(rows[k] + x, row_b + x, w, acc0, acc1);
+            madd_pair_avx2(rows[k] + x + 16, row_b + x + 16, w, acc2, acc3);
+        }
+        store16_avx2(out + x, acc0, acc1);
+        store16_avx2(out + x + 16, acc2, acc3);
+    }
+    for (; x + 16 <= bytes; x += 16) {
+        __m256i acc0 = round, acc1 = round;
+        for (int k = 0; k < count; k += 2) {
+            const uint8_t* row_b = k + 1 < count ? rows[k + 1] : rows[k];
+            madd_pair_avx2(rows[k] + x, row_b + x, _mm256_set1_epi32(weight_pair(weights, k, count)), acc0, acc1);
+        }
+        store16_avx2(out + x, acc0, acc1);
+    }
+    vertical_scalar(rows, weights, count, out, x, bytes);
+}
+
+bool cpu_has_avx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // DD_RESAMPLE_X86
+
+// Horizontal pass over one vertically reduced row
+template <int Channels>
+void horizontal_fixed(const uint8_t* row, const AreaTaps& taps, uint8_t* out, int dst_w) {
+    for (int i = 0; i < dst_w; ++i) {
+        const uint8_t* px = row + size_t(taps.first[i]) * Channels;
+        const int16_t* w = taps.weights.data() + taps.offset[i];
+        int acc[Channels];
+        for (int c = 0; c < Channels; ++c) acc[c] = WEIGHT_ROUND;
+        for (int k = 0; k < taps.count[i]; ++k, px += Channels) {
+            for (int c = 0; c < Channels; ++c) acc[c] += px[c] * w[k];
+        }
+        for (int c = 0; c < Channels; ++c) out[size_t(i) * Channels + c] = uint8_t(acc[c] >> WEIGHT_BITS);
+    }
+}
+
+void horizontal(const uint8_t* row, const AreaTaps& taps, int channels, uint8_t* out, int dst_w) {
+    switch (channels) {
+        case 1: horizontal_fixed<1>(row, taps, out, dst_w); return;
+        case 3: horizontal_fixed<3>(row, taps, out, dst_w); return;
+        case 4: horizontal_fixed<4>(row, taps, out, dst_w); return;
+    }
+    for (int i = 0; i < dst_w; ++i) {
+        const int16_t* w = taps.weights.data() + taps.offset[i];
+        for (int c = 0; c < channels; ++c) {
+            int acc = WEIGHT_ROUND;
+            for (int k = 0; k < taps.count[i]; ++k) acc += row[size_t(taps.first[i] + k) * channels + c] * w[k];
+            out[size_t(i) * channels + c] = uint8_t(acc >> WEIGHT_BITS);
+        }
+    }
+}
+
+} // namespace
+
+ResampleIsa resample_best_isa() {
+#ifdef DD_RESAMPLE_X86
+    static const ResampleIsa best = cpu_has_avx2() ? ResampleIsa::AVX2 : ResampleIsa::SSE2;
+    return best;
+#else
+    return ResampleIsa::Scalar;
+#endif
+}
+
+const char* resample_isa_name(ResampleIsa isa) {
+    switch (isa) {
+        case ResampleIsa::AVX2: return "avx2";
+        case ResampleIsa::SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+std::pair<int, int> fit_within(int width, int height, int max_dim) {
+    if (width <= max_dim && height <= max_dim) return {width, height};
+    if (width >= height) {
+        return {max_dim, std::max(1, int((int64_t(height) * max_dim + width / 2) / width))};
+    }
+    return {std::max(1, int((int64_t(width) * max_dim + height / 2) / height)), max_dim};
+}
+
+void resize_area(const uint8_t* src, int src_w, int src_h, int channels,
+                 uint8_t* dst, int dst_w, int dst_h) {
+    resize_area(src, src_w, src_h, channels, dst, dst_w, dst_h, resample_best_isa());
+}
+
+void resize_area(const uint8_t* src, int src_w, int src_h, int channels,
+                 uint8_t* dst, int dst_w, int dst_h, ResampleIsa isa) {
+    const size_t src_stride = size_t(src_w) * channels;
+    const size_t dst_stride = size_t(dst_w) * channels;
+    if (src_w == dst_w && src_h == dst_h) {
+        std::memcpy(dst, src, src_stride * src_h);
+        return;
+    }
+#ifndef DD_RESAMPLE_X86
+    isa = ResampleIsa::Scalar;
+#endif
+
+    // Rows first: that pass touches every source byte and vectorizes over whole rows
+    // regardless of channel count. The horizontal pass then only sees dst_h rows.
+    const AreaTaps rows_taps = area_taps(src_h, dst_h);
+    const AreaTaps cols_taps = area_taps(src_w, dst_w);
+    std::vector<uint8_t> reduced(src_stride);
+    std::vector<const uint8_t*> rows;
+    for (int y = 0; y < dst_h; ++y) {
+        const int count = rows_taps.count[y];
+        const int16_t* weights = rows_taps.weights.data() + rows_taps.offset[y];
+        rows.resize(count);
+        for (int k = 0; k < count; ++k) rows[k] = src + size_t(rows_taps.first[y] + k) * src_stride;
+
+        uint8_t* out_row = dst_h == src_h ? nullptr : reduced.data();
+        if (!out_row) {
+            // Width-only resize: the horizontal pass reads the source row directly
+            horizontal(rows[0], cols_taps, channels, dst + y * dst_stride, dst_w);
+            continue;
+        }
+        switch (isa) {
+#ifdef DD_RESAMPLE_X86
+            case ResampleIsa::AVX2: vertical_avx2(rows.data(), weights, count, out_row, int(src_stride)); break;
+            case ResampleIsa::SSE2: vertical_sse2(rows.data(), weights, count, out_row, int(src_stride)); break;
+#endif
+            default: vertical_scalar(rows.data(), weights, count, out_row, 0, int(src_stride)); break;
+        }
+        if (dst_w == src_w) {
+            std::memcpy(dst + y * dst_stride, out_row, dst_stride);
+        } else {
+            horizontal(out_row, cols_taps, channels, dst + y * dst_stride, dst_w);
+        }
+    }
+}
+
+std::vector<ImageLevel> build_pyramid(const uint8_t* src, int width, int height, int channels,
+                                      const std::vector<int>& max_dims) {
+    std::vector<ImageLevel> levels(max_dims.size());
+    std::vector<size_t> order(max_dims.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return max_dims[a] > max_dims[b]; });
+
+    const uint8_t* from = src;
+    int from_w = width, from_h = height;
+    for (size_t index : order) {
+        ImageLevel& level = levels[index];
+        level.max_dim = max_dims[index];
+        std::tie(level.width, level.height) = fit_within(width, height, level.max_dim);
+        // A level sized from the source can round a pixel wider than the one above it
+        level.width = std::min(level.width, from_w);
+        level.height = std::min(level.height, from_h);
+        level.pixels.resize(size_t(level.width) * level.height * channels);
+        resize_area(from, from_w, from_h, channels, level.pixels.data(), level.width, level.height);
+        from = level.pixels.data();
+        from_w = level.width;
+        from_h = level.height;
+    }
+    return levels;
+}
+
+} // namespace diffusion_desk
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace diffusion_desk {
+
+// Thumbnail pyramid levels (max dimension in px) written per generated image, by the SD
+// worker from the decoded result or by ThumbnailService from the file
+inline constexpr int THUMBNAIL_SIZES[] = {128, 256, 512};
+inline constexpr int DEFAULT_THUMBNAIL_SIZE = 256;
+
+// Instruction set the area resampler runs on. All paths use the same fixed-point
+// arithmetic, so their output is bit-identical.
+enum class ResampleIsa {
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+// Fastest path this CPU and build support (detected once)
+ResampleIsa resample_best_isa();
+const char* resample_isa_name(ResampleIsa isa);
+
+// Size of a width x height image fitted into a max_dim square, keeping the aspect ratio.
+// Never upscales.
+std::pair<int, int> fit_within(int width, int height, int max_dim);
+
+// Area-averaging (box filter) downscale of packed 8-bit pixels: each destination pixel is
+// the coverage-weighted mean of the source pixels under it, so detail is averaged instead
+// of aliased as with point sampling. dst_w/dst_h must not exceed src_w/src_h.
+void resize_area(const uint8_t* src, int src_w, int src_h, int channels,
+                 uint8_t* dst, int dst_w, int dst_h);
+void resize_area(const uint8_t* src, int src_w, int src_h, int channels,
+                 uint8_t* dst, int dst_w, int dst_h, ResampleIsa isa);
+
+struct ImageLevel {
+    int max_dim = 0;
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+// Downscales one decoded image to every size in max_dims, returned in the same order.
+// Only the largest level reads the source; each smaller one is averaged from the level
+// above it, so a pyramid costs little more than its biggest thumbnail.
+std::vector<ImageLevel> build_pyramid(const uint8_t* src, int width, int height, int channels,
+                                      const std::vector<int>& max_dims);
+
+} // namespace diffusion_desk
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace diffusion_desk {
+
+// Thread-safe LRU map with a budget in bytes (or any other cost unit the caller assigns per
+// entry). Values are shared, so an entry evicted while a caller still uses it stays valid
+// until that caller lets go.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t cost = 0;
+        size_t budget = 0;
+    };
+
+    explicit LruCache(size_t budget) : m_budget(budget) {}
+
+    // The entry for key, now the most recently used one, or nullptr. Counts a hit or a miss.
+    std::shared_ptr<Value> get(const Key& key) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(key);
+        if (it == m_index.end()) {
+            m_stats.misses++;
+            return nullptr;
+        }
+        m_stats.hits++;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return it->second->value;
+    }
+
+    // Stores value under key, replacing an earlier entry, and evicts least recently used
+    // entries until the total cost fits the budget. A value costing more than the whole
+    // budget is not stored. Returns whether it was.
+    bool put(const Key& key, std::shared_ptr<Value> value, size_t cost) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        erase_locked(key);
+        if (cost > m_budget) return false;
+        m_entries.push_front(Entry{key, std::move(value), cost});
+        m_index[key] = m_entries.begin();
+        m_stats.cost += cost;
+        trim_locked();
+        return true;
+    }
+
+    void erase(const Key& key) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        erase_locked(key);
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_index.clear();
+        m_entries.clear();
+        m_stats.cost = 0;
+    }
+
+    void set_budget(size_t budget) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_budget = budget;
+        trim_locked();
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Stats stats = m_stats;
+        stats.entries = m_entries.size();
+        stats.budget = m_budget;
+        return stats;
+    }
+
+private:
+    struct Entry {
+        Key key;
+        std::shared_ptr<Value> value;
+        size_t cost;
+    };
+
+    void erase_locked(const Key& key) {
+        auto it = m_index.find(key);
+        if (it == m_index.end()) return;
+        m_stats.cost -= it->second->cost;
+        m_entries.erase(it->second);
+        m_index.erase(it);
+    }
+
+    void trim_locked() {
+        while (m_stats.cost > m_budget && !m_entries.empty()) {
+            const Entry& oldest = m_entries.back();
+            m_stats.cost -= oldest.cost;
+            m_index.erase(oldest.key);
+            m_entries.pop_back();
+            m_stats.evictions++;
+        }
+    }
+
+    mutable std::mutex m_mutex;
+    size_t m_budget;
+    std::list<Entry> m_entries; // Most recently used first
+    std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> m_index;
+    Stats m_stats;
+};
+
+} // namespace diffusion_desk
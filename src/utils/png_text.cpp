@@ -0,0 +1,192 @@
+#include "png_text.hpp"
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <regex>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace diffusion_desk {
+
+namespace {
+
+constexpr uint8_t PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+constexpr size_t IHDR_END = 8 + 8 + 13 + 4; // Signature, then IHDR's length, type, data and CRC
+// Parameters are a few KB at most; a larger text chunk is not ours and is skipped unread
+constexpr uint32_t MAX_TEXT_CHUNK = 1u << 20;
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t size) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+uint32_t get_u32_be(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+void put_u32_be(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back(uint8_t(v >> 24));
+    out.push_back(uint8_t(v >> 16));
+    out.push_back(uint8_t(v >> 8));
+    out.push_back(uint8_t(v));
+}
+
+bool is_type(const uint8_t* type, const char* name) {
+    return std::memcmp(type, name, 4) == 0;
+}
+
+bool is_ascii(const std::string& s) {
+    for (unsigned char c : s) {
+        if (c >= 0x80) return false;
+    }
+    return true;
+}
+
+void append_chunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+    put_u32_be(out, (uint32_t)data.size());
+    const size_t type_pos = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put_u32_be(out, crc32_update(0xffffffffu, out.data() + type_pos, 4 + data.size()) ^ 0xffffffffu);
+}
+
+// type points at the 4 type bytes, followed by length data bytes and the CRC
+void read_text_chunk(const uint8_t* type, uint32_t length, std::map<std::string, std::string>& out) {
+    const uint8_t* data = type + 4;
+    if ((crc32_update(0xffffffffu, type, 4 + (size_t)length) ^ 0xffffffffu) != get_u32_be(data + length)) return;
+
+    const uint8_t* end = data + length;
+    const uint8_t* key_end = static_cast<const uint8_t*>(std::memchr(data, 0, length));
+    if (!key_end || key_end == data) return;
+    std::string key(reinterpret_cast<const char*>(data), key_end - data);
+    const uint8_t* text = key_end + 1;
+
+    if (is_type(type, "iTXt")) {
+        // Compression flag and method, then NUL-terminated language tag and translated keyword
+        if (end - text < 2 || text[0] != 0) return; // Compressed iTXt is not ours
+        text += 2;
+        for (int field = 0; field < 2; ++field) {
+            const uint8_t* nul = static_cast<const uint8_t*>(std::memchr(text, 0, end - text));
+            if (!nul) return;
+            text = nul + 1;
+        }
+    }
+    out.emplace(std::move(key), std::string(reinterpret_cast<const char*>(text), end - text));
+}
+
+} // namespace
+
+bool png_add_text(std::vector<uint8_t>& png, const std::vector<PngText>& texts) {
+    if (png.size() < IHDR_END || std::memcmp(png.data(), PNG_SIGNATURE, 8) != 0 ||
+        get_u32_be(png.data() + 8) != 13 || !is_type(png.data() + 12, "IHDR")) {
+        return false;
+    }
+
+    std::vector<uint8_t> chunks;
+    for (const auto& t : texts) {
+        if (t.key.empty() || t.key.size() > 79 || t.key.find('\0') != std::string::npos) return false;
+        std::vector<uint8_t> data(t.key.begin(), t.key.end());
+        data.push_back(0);
+        const bool ascii = is_ascii(t.text);
+        if (!ascii) {
+            // Uncompressed, no language tag, no translated keyword
+            data.insert(data.end(), {0, 0, 0, 0});
+        }
+        data.insert(data.end(), t.text.begin(), t.text.end());
+        append_chunk(chunks, ascii ? "tEXt" : "iTXt", data);
+    }
+    // One move of the image data, however many chunks
+    png.insert(png.begin() + IHDR_END, chunks.begin(), chunks.end());
+    return true;
+}
+
+std::map<std::string, std::string> png_read_text(const uint8_t* data, size_t size) {
+    std::map<std::string, std::string> out;
+    if (size < 8 || std::memcmp(data, PNG_SIGNATURE, 8) != 0) return out;
+    size_t pos = 8;
+    while (size - pos >= 12) {
+        const uint32_t length = get_u32_be(data + pos);
+        const uint8_t* type = data + pos + 4;
+        if (is_type(type, "IDAT") || is_type(type, "IEND") || length > size - pos - 12) break;
+        if (is_type(type, "tEXt") || is_type(type, "iTXt")) read_text_chunk(type, length, out);
+        pos += 12 + (size_t)length;
+    }
+    return out;
+}
+
+std::map<std::string, std::string> png_read_text_file(const fs::path& path) {
+    std::map<std::string, std::string> out;
+    std::ifstream file(path, std::ios::binary);
+    uint8_t signature[8];
+    if (!file.read(reinterpret_cast<char*>(signature), 8) || std::memcmp(signature, PNG_SIGNATURE, 8) != 0) return out;
+
+    std::vector<uint8_t> chunk;
+    uint8_t header[8];
+    while (file.read(reinterpret_cast<char*>(header), 8)) {
+        const uint32_t length = get_u32_be(header);
+        const uint8_t* type = header + 4;
+        if (is_type(type, "IDAT") || is_type(type, "IEND")) break;
+        if ((is_type(type, "tEXt") || is_type(type, "iTXt")) && length <= MAX_TEXT_CHUNK) {
+            chunk.assign(type, type + 4);
+            chunk.resize(4 + (size_t)length + 4);
+            if (!file.read(reinterpret_cast<char*>(chunk.data() + 4), (std::streamsize)length + 4)) break;
+            read_text_chunk(chunk.data(), length, out);
+        } else if (!file.seekg((std::streamoff)length + 4, std::ios::cur)) {
+            break;
+        }
+    }
+    return out;
+}
+
+nlohmann::json parse_image_params(const std::string& text) {
+    static const std::regex kv_re(R"(([^:,]+):\s*([^,]+))");
+    static const std::regex trim_re("^\\s+|\\s+$");
+    nlohmann::json j;
+    std::stringstream ss(text);
+    std::string line;
+    bool in_params = false;
+    std::string prompt = "";
+    std::string neg_prompt = "";
+
+    while (std::getline(ss, line)) {
+        if (line.find("Negative prompt:") == 0) {
+            neg_prompt = line.substr(16);
+            in_params = false;
+            continue;
+        }
+        if (line.find("Steps:") == 0) {
+            in_params = true;
+            std::sregex_iterator begin(line.begin(), line.end(), kv_re);
+            std::sregex_iterator end;
+            for (std::sregex_iterator i = begin; i != end; ++i) {
+                std::smatch match = *i;
+                std::string key = match[1];
+                std::string val = match[2];
+                // Trim leading/trailing whitespace
+                key = std::regex_replace(key, trim_re, "");
+                val = std::regex_replace(val, trim_re, "");
+                j[key] = val;
+            }
+            continue;
+        }
+        if (!in_params) {
+            if (!prompt.empty()) prompt += "\n";
+            prompt += line;
+        }
+    }
+    j["prompt"] = prompt;
+    j["negative_prompt"] = neg_prompt;
+    return j;
+}
+
+} // namespace diffusion_desk
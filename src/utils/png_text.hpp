@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+#include <json.hpp>
+
+namespace diffusion_desk {
+
+// Generation parameters travel inside the PNG as text chunks instead of a .txt sidecar:
+//   "parameters"      A1111-style text (prompt, "Negative prompt: ...", "Steps: ..., Seed: ...")
+//                     that other tools and image viewers already understand
+//   "diffusion-desk"  the full request as JSON, read back by the library import
+// Both are written right after IHDR, so a reader finds them in the first few hundred bytes.
+constexpr const char* PNG_PARAMETERS_KEY = "parameters";
+constexpr const char* PNG_PARAMS_JSON_KEY = "diffusion-desk";
+
+// Text is stored uncompressed: as tEXt when it is plain ASCII, otherwise as UTF-8 iTXt
+struct PngText {
+    std::string key; // 1-79 Latin-1 characters, no NUL
+    std::string text;
+};
+
+// Inserts the chunks after the IHDR of an encoded PNG. Returns false, leaving png
+// untouched, if it does not start with a PNG signature and IHDR or a key is invalid.
+bool png_add_text(std::vector<uint8_t>& png, const std::vector<PngText>& texts);
+
+// tEXt and iTXt chunks (uncompressed ones only) in front of the first IDAT, by key. Chunks
+// with a bad CRC are skipped. Pixel data is never read: the file variant reads the chunk
+// headers and seeks past everything else, stopping at IDAT.
+std::map<std::string, std::string> png_read_text(const uint8_t* data, size_t size);
+std::map<std::string, std::string> png_read_text_file(const std::filesystem::path& path);
+
+// Parses A1111-style "parameters" text into {"prompt", "negative_prompt", "Steps", "Seed", ...}
+nlohmann::json parse_image_params(const std::string& text);
+
+} // namespace diffusion_desk
@@ -0,0 +1,235 @@
+#include "qoi.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace diffusion_desk {
+
+namespace {
+
+constexpr uint8_t OP_INDEX = 0x00;
+constexpr uint8_t OP_DIFF = 0x40;
+constexpr uint8_t OP_LUMA = 0x80;
+constexpr uint8_t OP_RUN = 0xc0;
+constexpr uint8_t OP_RGB = 0xfe;
+constexpr uint8_t OP_RGBA = 0xff;
+constexpr uint8_t OP_MASK = 0xc0;
+
+constexpr uint8_t MAGIC[4] = {'q', 'o', 'i', 'f'};
+constexpr uint8_t PADDING[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+// Limit from the reference implementation; keeps width * height * 5 well inside size_t
+constexpr size_t MAX_PIXELS = 400000000;
+
+struct Rgba {
+    uint8_t r, g, b, a;
+    bool operator==(const Rgba& o) const { return r == o.r && g == o.g && b == o.b && a == o.a; }
+};
+
+inline int color_hash(const Rgba& c) {
+    return (c.r * 3 + c.g * 5 + c.b * 7 + c.a * 11) % 64;
+}
+
+inline void write_u32(uint8_t*& p, uint32_t v) {
+    *p++ = uint8_t(v >> 24);
+    *p++ = uint8_t(v >> 16);
+    *p++ = uint8_t(v >> 8);
+    *p++ = uint8_t(v);
+}
+
+inline uint32_t read_u32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+// Templated on the channel count so the per-pixel load has no branch
+template <int C>
+uint8_t* encode_pixels(const uint8_t* px, size_t count, uint8_t* p) {
+    Rgba index[64] = {};
+    Rgba prev = {0, 0, 0, 255};
+    int run = 0;
+    for (size_t i = 0; i < count; ++i, px += C) {
+        const Rgba cur = {px[0], px[1], px[2], C == 4 ? px[3] : uint8_t(255)};
+        if (cur == prev) {
+            if (++run == 62 || i + 1 == count) {
+                *p++ = uint8_t(OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            *p++ = uint8_t(OP_RUN | (run - 1));
+            run = 0;
+        }
+
+        const int hash = color_hash(cur);
+        if (index[hash] == cur) {
+            *p++ = uint8_t(OP_INDEX | hash);
+        } else {
+            index[hash] = cur;
+            if (cur.a == prev.a) {
+                // Channel differences wrap around, as the format specifies
+                const int vr = int8_t(cur.r - prev.r);
+                const int vg = int8_t(cur.g - prev.g);
+                const int vb = int8_t(cur.b - prev.b);
+                const int vg_r = int8_t(vr - vg);
+                const int vg_b = int8_t(vb - vg);
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                    *p++ = uint8_t(OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                    *p++ = uint8_t(OP_LUMA | (vg + 32));
+                    *p++ = uint8_t((vg_r + 8) << 4 | (vg_b + 8));
+                } else {
+                    *p++ = OP_RGB;
+                    *p++ = cur.r;
+                    *p++ = cur.g;
+                    *p++ = cur.b;
+                }
+            } else {
+                *p++ = OP_RGBA;
+                *p++ = cur.r;
+                *p++ = cur.g;
+                *p++ = cur.b;
+                *p++ = cur.a;
+            }
+        }
+        prev = cur;
+    }
+    return p;
+}
+
+template <int C>
+inline void store_pixel(uint8_t* out, const Rgba& px) {
+    if constexpr (C >= 3) {
+        out[0] = px.r;
+        out[1] = px.g;
+        out[2] = px.b;
+        if constexpr (C == 4) out[3] = px.a;
+    } else {
+        // Same luma weights as stb_image, so a QOI mask loads like a PNG one
+        out[0] = uint8_t((px.r * 77 + px.g * 150 + px.b * 29) >> 8);
+        if constexpr (C == 2) out[1] = px.a;
+    }
+}
+
+template <int C>
+bool decode_pixels(const uint8_t* data, size_t size, size_t count, uint8_t* out) {
+    Rgba index[64] = {};
+    Rgba px = {0, 0, 0, 255};
+    size_t p = QOI_HEADER_SIZE;
+    // Every op is at most 5 bytes and the 8-byte end marker follows the last one, so
+    // reading an op that starts before chunks_end never runs past the buffer
+    const size_t chunks_end = size - sizeof(PADDING);
+    int run = 0;
+    for (size_t i = 0; i < count; ++i, out += C) {
+        if (run > 0) {
+            run--;
+        } else {
+            if (p >= chunks_end) return false;
+            const uint8_t b1 = data[p++];
+            if (b1 == OP_RGB) {
+                px.r = data[p++];
+                px.g = data[p++];
+                px.b = data[p++];
+            } else if (b1 == OP_RGBA) {
+                px.r = data[p++];
+                px.g = data[p++];
+                px.b = data[p++];
+                px.a = data[p++];
+            } else if ((b1 & OP_MASK) == OP_INDEX) {
+                px = index[b1];
+            } else if ((b1 & OP_MASK) == OP_DIFF) {
+                px.r += ((b1 >> 4) & 0x03) - 2;
+                px.g += ((b1 >> 2) & 0x03) - 2;
+                px.b += (b1 & 0x03) - 2;
+            } else if ((b1 & OP_MASK) == OP_LUMA) {
+                const uint8_t b2 = data[p++];
+                const int vg = (b1 & 0x3f) - 32;
+                px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                px.g += vg;
+                px.b += vg - 8 + (b2 & 0x0f);
+            } else {
+                run = b1 & 0x3f;
+            }
+            index[color_hash(px)] = px;
+        }
+        store_pixel<C>(out, px);
+    }
+    return true;
+}
+
+} // namespace
+
+bool is_qoi(const uint8_t* data, size_t size) {
+    return data && size >= QOI_HEADER_SIZE && std::memcmp(data, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+std::vector<uint8_t> qoi_encode(const uint8_t* pixels, int width, int height, int channels) {
+    if (!pixels || width <= 0 || height <= 0 || (channels != 3 && channels != 4)) return {};
+    const size_t count = size_t(width) * size_t(height);
+    if (count >= MAX_PIXELS) return {};
+
+    // Worst case is one RGBA op per pixel; trimmed to the real size at the end
+    std::vector<uint8_t> out(QOI_HEADER_SIZE + count * (channels + 1) + sizeof(PADDING));
+    uint8_t* p = out.data();
+    std::memcpy(p, MAGIC, sizeof(MAGIC));
+    p += sizeof(MAGIC);
+    write_u32(p, uint32_t(width));
+    write_u32(p, uint32_t(height));
+    *p++ = uint8_t(channels);
+    *p++ = 0; // sRGB with linear alpha
+
+    p = channels == 4 ? encode_pixels<4>(pixels, count, p) : encode_pixels<3>(pixels, count, p);
+    std::memcpy(p, PADDING, sizeof(PADDING));
+    p += sizeof(PADDING);
+    out.resize(size_t(p - out.data()));
+    return out;
+}
+
+uint8_t* qoi_decode(const uint8_t* data, size_t size, int* width, int* height, int* channels, int desired_channels) {
+    if (!is_qoi(data, size) || size < QOI_HEADER_SIZE + sizeof(PADDING)) return nullptr;
+    const uint32_t w = read_u32(data + 4);
+    const uint32_t h = read_u32(data + 8);
+    const int stored_channels = data[12];
+    const int colorspace = data[13];
+    if (w == 0 || h == 0 || stored_channels < 3 || stored_channels > 4 || colorspace > 1 || h >= MAX_PIXELS / w) {
+        return nullptr;
+    }
+    const int out_channels = desired_channels == 0 ? stored_channels : desired_channels;
+    if (out_channels < 1 || out_channels > 4) return nullptr;
+
+    const size_t count = size_t(w) * h;
+    uint8_t* out = static_cast<uint8_t*>(std::malloc(count * out_channels));
+    if (!out) return nullptr;
+
+    bool ok = false;
+    switch (out_channels) {
+        case 1: ok = decode_pixels<1>(data, size, count, out); break;
+        case 2: ok = decode_pixels<2>(data, size, count, out); break;
+        case 3: ok = decode_pixels<3>(data, size, count, out); break;
+        default: ok = decode_pixels<4>(data, size, count, out); break;
+    }
+    if (!ok) {
+        std::free(out);
+        return nullptr;
+    }
+    if (width) *width = int(w);
+    if (height) *height = int(h);
+    if (channels) *channels = stored_channels;
+    return out;
+}
+
+uint8_t* qoi_load(const char* path, int* width, int* height, int* channels, int desired_channels) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return nullptr;
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return qoi_decode(bytes.data(), bytes.size(), width, height, channels, desired_channels);
+}
+
+bool is_qoi_file(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    uint8_t header[QOI_HEADER_SIZE];
+    if (!file.read(reinterpret_cast<char*>(header), sizeof(header))) return false;
+    return is_qoi(header, sizeof(header));
+}
+
+} // namespace diffusion_desk
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace diffusion_desk {
+
+// "Quite OK Image" lossless format (qoiformat.org). Encoding is a single pass over the
+// pixels with no entropy coder, so it runs many times faster than PNG's deflate at a
+// somewhat larger size. Used for temporary outputs that are usually thrown away; images
+// that are kept get converted to PNG/JPEG.
+
+constexpr size_t QOI_HEADER_SIZE = 14;
+
+// True if the buffer starts with a QOI header
+bool is_qoi(const uint8_t* data, size_t size);
+
+// Encodes packed 8-bit RGB (channels = 3) or RGBA (channels = 4) pixels. Returns an empty
+// vector for other channel counts or empty images.
+std::vector<uint8_t> qoi_encode(const uint8_t* pixels, int width, int height, int channels);
+
+// Decodes a QOI buffer into a malloc'd pixel buffer the caller frees with free(), like
+// stbi_load. channels receives the count stored in the file; desired_channels (1-4, or 0
+// for the stored count) picks the output layout, 1 and 2 being luma (+ alpha) computed as
+// stb_image does. Returns nullptr on malformed or truncated input.
+uint8_t* qoi_decode(const uint8_t* data, size_t size, int* width, int* height, int* channels, int desired_channels);
+
+// qoi_decode on a file; nullptr if it cannot be read or is not QOI
+uint8_t* qoi_load(const char* path, int* width, int* height, int* channels, int desired_channels);
+
+// True if the file starts with a QOI header
+bool is_qoi_file(const char* path);
+
+} // namespace diffusion_desk
@@ -21,14 +21,23 @@ int run_sd_worker(SDSvrParams& svr_params, SDContextParams& ctx_params, SDGenera
     //     load_model_config(ctx_params, ctx_params.diffusion_model_path, svr_params.model_dir);
     // }
 
-    sd_ctx_params_t sd_ctx_params_raw = ctx_params.to_sd_ctx_params_t(true, false, false);
     SdCtxPtr sd_ctx;
     UpscalerCtxPtr upscaler_ctx;
     std::string current_upscale_model_path;
-    
+    auto context_cache = std::make_shared<SdContextCache>(
+        (uint64_t)std::max(0, svr_params.context_cache_host_mb) * 1024 * 1024,
+        (uint64_t)std::max(0, svr_params.context_cache_vram_mb) * 1024 * 1024);
+
     if (!ctx_params.model_path.empty() || !ctx_params.diffusion_model_path.empty()) {
-        sd_ctx.reset(new_sd_ctx(&sd_ctx_params_raw));
-        if (!sd_ctx) {
+        const bool loaded = context_cache->activate(
+            sd_ctx,
+            SdContextCache::signature(ctx_params, true, false),
+            SdContextCache::estimate_cost(ctx_params),
+            [&]() {
+                sd_ctx_params_t sd_ctx_params_raw = ctx_params.to_sd_ctx_params_t(true, false, false);
+                return SdCtxPtr(new_sd_ctx(&sd_ctx_params_raw));
+            });
+        if (!loaded) {
             DD_LOG_ERROR("new_sd_ctx failed for initial model - starting with empty context");
             // Do not exit, allow loading another model later
         }
@@ -47,6 +56,7 @@ int run_sd_worker(SDSvrParams& svr_params, SDContextParams& ctx_params, SDGenera
         "",    // active_llm_model_path
         false  // active_llm_model_loaded
     };
+    ctx.context_cache = context_cache;
 
     httplib::Server svr;
 
@@ -62,7 +72,8 @@ int run_sd_worker(SDSvrParams& svr_params, SDContextParams& ctx_params, SDGenera
                     auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - ctx.last_access).count();
                     if (duration > ctx.svr_params.sd_idle_timeout) {
                         DD_LOG_INFO("SD idle timeout reached (%d seconds). Unloading...", ctx.svr_params.sd_idle_timeout);
-                        ctx.sd_ctx.reset();
+                        ctx.context_cache->release_active(ctx.sd_ctx);
+                        ctx.context_cache->clear();
                     }
                 }
             }
@@ -184,10 +195,12 @@ int run_sd_worker(SDSvrParams& svr_params, SDContextParams& ctx_params, SDGenera
     });
 
     svr.Post("/v1/images/generations", [&](const httplib::Request& req, httplib::Response& res) {
+        InteractiveGenerationScope interactive;
         handle_generate_image(req, res, ctx);
     });
 
     svr.Post("/v1/images/edits", [&](const httplib::Request& req, httplib::Response& res) {
+        InteractiveGenerationScope interactive;
         handle_edit_image(req, res, ctx);
     });
 